@@ -58,6 +58,7 @@ extern "C"
 #include "mlt_log.h"
 #include "mlt_cache.h"
 #include "mlt_version.h"
+#include "mlt_trace.h"
 
 #ifdef __cplusplus
 }
@@ -520,20 +520,10 @@ static mlt_frame* shuffle_get_frame( mlt_cache cache, mlt_position position )
 	return hit;
 }
 
-/** Put a frame in the cache.
- *
- * Unlike mlt_cache_put() this version is more suitable for caching frames
- * and their data - like images. However, this version does not use reference
- * counting and garbage collection. Rather, frames are cloned with deep copy
- * to avoid those things.
- *
- * \public \memberof mlt_cache_s
- * \param cache a cache object
- * \param frame the frame to cache
- * \see mlt_frame_get_frame
+/** Store a frame at the position of another in the cache.
  */
 
-void mlt_cache_put_frame( mlt_cache cache, mlt_frame frame )
+static void put_frame( mlt_cache cache, mlt_frame frame, mlt_frame stored )
 {
 	pthread_mutex_lock( &cache->mutex );
 	mlt_frame *hit = shuffle_get_frame( cache, mlt_frame_original_position( frame ) );
@@ -560,7 +550,7 @@ void mlt_cache_put_frame( mlt_cache cache, mlt_frame frame )
 		// The MRU end gets the new item
 		hit = &alt[ cache->count - 1 ];
 	}
-	*hit = mlt_frame_clone( frame, 1 );
+	*hit = stored;
 	mlt_log( NULL, MLT_LOG_DEBUG, "%s: put %d = %p\n", __FUNCTION__, cache->count - 1, frame );
 
 	// swap the current array
@@ -569,18 +559,45 @@ void mlt_cache_put_frame( mlt_cache cache, mlt_frame frame )
 	pthread_mutex_unlock( &cache->mutex );
 }
 
-/** Get a frame from the cache.
+/** Put a frame in the cache.
  *
- * You must call mlt_frame_close() on the frame you receive from this.
+ * Unlike mlt_cache_put() this version is more suitable for caching frames
+ * and their data - like images. However, this version does not use reference
+ * counting and garbage collection. Rather, frames are cloned with deep copy
+ * to avoid those things.
  *
  * \public \memberof mlt_cache_s
  * \param cache a cache object
- * \param position the position of the frame that you want
- * \return a frame if found or NULL if not found or has been flushed from the cache
- * \see mlt_frame_put_frame
+ * \param frame the frame to cache
+ * \see mlt_frame_get_frame
  */
 
-mlt_frame mlt_cache_get_frame( mlt_cache cache, mlt_position position )
+void mlt_cache_put_frame( mlt_cache cache, mlt_frame frame )
+{
+	put_frame( cache, frame, mlt_frame_clone( frame, 1 ) );
+}
+
+/** Put a frame in the cache without copying it.
+ *
+ * The cache takes a reference on the frame instead of a deep copy, so the
+ * caller must not change the frame or its data afterwards.
+ *
+ * \public \memberof mlt_cache_s
+ * \param cache a cache object
+ * \param frame the frame to cache
+ * \see mlt_cache_get_frame_ref
+ */
+
+void mlt_cache_put_frame_ref( mlt_cache cache, mlt_frame frame )
+{
+	mlt_properties_inc_ref( MLT_FRAME_PROPERTIES( frame ) );
+	put_frame( cache, frame, frame );
+}
+
+/** Find the frame at a position in the cache, copying it unless \p is_ref.
+ */
+
+static mlt_frame get_frame( mlt_cache cache, mlt_position position, int is_ref )
 {
 	mlt_frame result = NULL;
 	pthread_mutex_lock( &cache->mutex );
@@ -593,7 +610,15 @@ mlt_frame mlt_cache_get_frame( mlt_cache cache, mlt_position position )
 		alt[ cache->count - 1 ] = *hit;
 		hit = &alt[ cache->count - 1 ];
 
-		result = mlt_frame_clone( *hit, 1 );
+		if ( is_ref )
+		{
+			result = *hit;
+			mlt_properties_inc_ref( MLT_FRAME_PROPERTIES( result ) );
+		}
+		else
+		{
+			result = mlt_frame_clone( *hit, 1 );
+		}
 		mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p\n", __FUNCTION__, cache->count - 1, *hit );
 
 		// swap the current array
@@ -603,3 +628,36 @@ mlt_frame mlt_cache_get_frame( mlt_cache cache, mlt_position position )
 
 	return result;
 }
+
+/** Get a frame from the cache.
+ *
+ * You must call mlt_frame_close() on the frame you receive from this.
+ *
+ * \public \memberof mlt_cache_s
+ * \param cache a cache object
+ * \param position the position of the frame that you want
+ * \return a frame if found or NULL if not found or has been flushed from the cache
+ * \see mlt_frame_put_frame
+ */
+
+mlt_frame mlt_cache_get_frame( mlt_cache cache, mlt_position position )
+{
+	return get_frame( cache, position, 0 );
+}
+
+/** Get a frame from the cache without copying it.
+ *
+ * The frame is shared with the cache and must not be changed. You must call
+ * mlt_frame_close() on the frame you receive from this.
+ *
+ * \public \memberof mlt_cache_s
+ * \param cache a cache object
+ * \param position the position of the frame that you want
+ * \return a frame if found or NULL if not found or has been flushed from the cache
+ * \see mlt_cache_put_frame_ref
+ */
+
+mlt_frame mlt_cache_get_frame_ref( mlt_cache cache, mlt_position position )
+{
+	return get_frame( cache, position, 1 );
+}
@@ -38,5 +38,7 @@ extern void mlt_cache_put( mlt_cache cache, void *object, void* data, int size,
 extern mlt_cache_item mlt_cache_get( mlt_cache cache, void *object );
 extern void mlt_cache_put_frame( mlt_cache cache, mlt_frame frame );
 extern mlt_frame mlt_cache_get_frame( mlt_cache cache, mlt_position position );
+extern void mlt_cache_put_frame_ref( mlt_cache cache, mlt_frame frame );
+extern mlt_frame mlt_cache_get_frame_ref( mlt_cache cache, mlt_position position );
 
 #endif
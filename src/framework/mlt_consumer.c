@@ -28,10 +28,12 @@
 #include "mlt_frame.h"
 #include "mlt_profile.h"
 #include "mlt_log.h"
+#include "mlt_trace.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <sys/time.h>
 
 /** Define this if you want an automatic deinterlace (if necessary) when the
@@ -73,6 +75,16 @@ typedef struct
 	int process_head;
 	int started;
 	pthread_t *threads; /**< used to deallocate all threads */
+
+	/* adaptive scheduling of the parallel work queue */
+	double render_cost;   /**< smoothed time to render one frame in microseconds */
+	double render_jitter; /**< smoothed deviation of render_cost in microseconds */
+	int render_count;     /**< the number of render times sampled */
+	int threads_active;   /**< the maximum number of frames rendering at once */
+	int in_flight;        /**< the number of frames rendering now */
+	int frames_rendered;
+	int frames_dropped;
+	int frames_late;      /**< dropped frames that were still rendering at playout */
 }
 consumer_private;
 
@@ -805,14 +817,18 @@ static void *consumer_read_ahead_thread( void *arg )
 		// Get the image of the first frame
 		if ( !video_off )
 		{
+			mlt_trace_scope scope = mlt_trace_begin( MLT_CONSUMER_SERVICE( self ), "render" );
 			mlt_events_fire( MLT_CONSUMER_PROPERTIES( self ), "consumer-frame-render", frame, NULL );
 			mlt_frame_get_image( frame, &image, &priv->image_format, &width, &height, 0 );
+			mlt_trace_end( scope, frame );
 		}
 
 		if ( !audio_off )
 		{
+			mlt_trace_scope scope = mlt_trace_begin( MLT_CONSUMER_SERVICE( self ), "render" );
 			samples = mlt_sample_calculator( fps, frequency, counter++ );
 			mlt_frame_get_audio( frame, &audio, &priv->audio_format, &frequency, &channels, &samples );
+			mlt_trace_end( scope, frame );
 		}
 
 		// Mark as rendered
@@ -876,8 +892,10 @@ static void *consumer_read_ahead_thread( void *arg )
 				height = mlt_properties_get_int( properties, "height" );
 
 				// Get the image
+				mlt_trace_scope scope = mlt_trace_begin( MLT_CONSUMER_SERVICE( self ), "render" );
 				mlt_events_fire( MLT_CONSUMER_PROPERTIES( self ), "consumer-frame-render", frame, NULL );
 				mlt_frame_get_image( frame, &image, &priv->image_format, &width, &height, 0 );
+				mlt_trace_end( scope, frame );
 			}
 
 			// Indicate the rendered image is available.
@@ -904,8 +922,10 @@ static void *consumer_read_ahead_thread( void *arg )
 		// Always process audio
 		if ( !audio_off )
 		{
+			mlt_trace_scope scope = mlt_trace_begin( MLT_CONSUMER_SERVICE( self ), "render" );
 			samples = mlt_sample_calculator( fps, frequency, counter++ );
 			mlt_frame_get_audio( frame, &audio, &priv->audio_format, &frequency, &channels, &samples );
+			mlt_trace_end( scope, frame );
 		}
 
 		// Get the time to process this frame
@@ -974,13 +994,16 @@ static void *consumer_read_ahead_thread( void *arg )
 /** Locate the first unprocessed frame in the queue.
  *
  * When playing with realtime behavior, we do not use the true head, but
- * rather an adjusted process_head. The process_head is adjusted based on
- * the rate of frame-dropping or recovery from frame-dropping. The idea is
- * that as the level of frame-dropping increases to move the process_head
- * closer to the tail because the frames are not completing processing prior
- * to their playout! Then, as frames are not dropped the process_head moves
- * back closer to the head of the queue so that worker threads can work 
- * ahead of the playout point (queue head).
+ * rather an adjusted process_head. Once enough render times are known, the
+ * process_head is the first frame whose playout is later than the predicted
+ * time to render it (see worker_schedule), so frames that would miss their
+ * deadline are dropped before any work is spent on them. Until then, the
+ * process_head is adjusted based on the rate of frame-dropping or recovery
+ * from frame-dropping. The idea is that as the level of frame-dropping
+ * increases to move the process_head closer to the tail because the frames
+ * are not completing processing prior to their playout! Then, as frames are
+ * not dropped the process_head moves back closer to the head of the queue so
+ * that worker threads can work ahead of the playout point (queue head).
  *
  * \private \memberof mlt_consumer_s
  * \param self a consumer
@@ -996,6 +1019,33 @@ static inline int first_unprocessed_frame( mlt_consumer self )
 	return index;
 }
 
+/** Fold the time to render one frame into the running estimate.
+ *
+ * This keeps a smoothed mean and mean deviation the same way TCP estimates
+ * round trip times, so a sudden rise in cost raises the estimate quickly
+ * while a single cheap frame barely lowers it. The caller must hold the
+ * done_mutex.
+ *
+ * \private \memberof mlt_consumer_s
+ * \param priv the private data of a consumer
+ * \param sample the time to render a frame in microseconds
+ */
+
+static void update_render_cost( consumer_private *priv, double sample )
+{
+	if ( priv->render_count++ == 0 )
+	{
+		priv->render_cost = sample;
+		priv->render_jitter = sample / 2;
+	}
+	else
+	{
+		double error = sample - priv->render_cost;
+		priv->render_cost += error / 8;
+		priv->render_jitter += ( fabs( error ) - priv->render_jitter ) / 4;
+	}
+}
+
 /** The worker thread procedure for parallel processing frames.
  *
  * \private \memberof mlt_consumer_s
@@ -1036,7 +1086,7 @@ static void *consumer_worker_thread( void *arg )
 		// Get the next unprocessed frame from the work queue
 		pthread_mutex_lock( &priv->queue_mutex );
 		int index = first_unprocessed_frame( self );
-		while ( priv->ahead && index >= mlt_deque_count( priv->queue ) )
+		while ( priv->ahead && ( index >= mlt_deque_count( priv->queue ) || priv->in_flight >= priv->threads_active ) )
 		{
 			mlt_log_debug( MLT_CONSUMER_SERVICE(self), "waiting in worker index = %d queue count = %d\n",
 				index, mlt_deque_count( priv->queue ) );
@@ -1052,6 +1102,7 @@ static void *consumer_worker_thread( void *arg )
 				index, mlt_frame_get_position(frame), mlt_deque_count( priv->queue ) );
 			frame->is_processing = 1;
 			mlt_properties_inc_ref( MLT_FRAME_PROPERTIES( frame ) );
+			priv->in_flight++;
 		}
 		pthread_mutex_unlock( &priv->queue_mutex );
 
@@ -1068,20 +1119,34 @@ static void *consumer_worker_thread( void *arg )
 			mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "consumer_deinterlace", 1 );
 #endif
 
+		// Measure the time to render
+		struct timeval started;
+		gettimeofday( &started, NULL );
+
 		// Get the image
 		if ( !video_off )
 		{
 			// Fetch width/height again
 			width = mlt_properties_get_int( properties, "width" );
 			height = mlt_properties_get_int( properties, "height" );
+			mlt_trace_scope scope = mlt_trace_begin( MLT_CONSUMER_SERVICE( self ), "render" );
 			mlt_events_fire( MLT_CONSUMER_PROPERTIES( self ), "consumer-frame-render", frame, NULL );
 			mlt_frame_get_image( frame, &image, &format, &width, &height, 0 );
+			mlt_trace_end( scope, frame );
 		}
+		long elapsed = time_difference( &started );
 		mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "rendered", 1 );
 		mlt_frame_close( frame );
 
+		// Let another worker take a frame.
+		pthread_mutex_lock( &priv->queue_mutex );
+		priv->in_flight--;
+		pthread_cond_signal( &priv->queue_cond );
+		pthread_mutex_unlock( &priv->queue_mutex );
+
 		// Tell a waiting thread (non-realtime main consumer thread) that we are done.
 		pthread_mutex_lock( &priv->done_mutex );
+		update_render_cost( priv, elapsed );
 		pthread_cond_broadcast( &priv->done_cond );
 		pthread_mutex_unlock( &priv->done_mutex );
 	}
@@ -1143,6 +1208,16 @@ static void consumer_work_start( mlt_consumer self )
 	// These keep track of the accelleration of frame dropping or recovery.
 	priv->consecutive_dropped = 0;
 	priv->consecutive_rendered = 0;
+
+	// These estimate the cost of rendering to schedule the workers.
+	priv->render_cost = 0;
+	priv->render_jitter = 0;
+	priv->render_count = 0;
+	priv->threads_active = n;
+	priv->in_flight = 0;
+	priv->frames_rendered = 0;
+	priv->frames_dropped = 0;
+	priv->frames_late = 0;
 	
 	// This is the position in the queue from which to look for a frame to process.
 	// If we always start from the head, then we may likely not complete processing
@@ -1361,6 +1436,81 @@ void mlt_consumer_purge( mlt_consumer self )
 	}
 }
 
+/** Plan the parallel work queue from the estimated cost of rendering.
+ *
+ * A frame at some index in the queue plays out after that many frame periods,
+ * and a worker that starts on it now finishes after the predicted cost, taken
+ * as the smoothed cost plus twice its deviation. Frames nearer to playout than
+ * that are left to be dropped, and only as many workers take frames at once
+ * as are needed to render one frame per period.
+ *
+ * \private \memberof mlt_consumer_s
+ * \param self a consumer
+ * \param threads the number of worker threads
+ * \param buffer the size of the work queue
+ * \param fps the frame rate
+ * \return the number of frames the work queue needs, or 0 if the cost is not known yet
+ */
+
+static int worker_schedule( mlt_consumer self, int threads, int buffer, double fps )
+{
+	consumer_private *priv = self->local;
+	double period = 1000000.0 / ( fps > 0 ? fps : 25 );
+	double predicted;
+	int count;
+
+	pthread_mutex_lock( &priv->done_mutex );
+	predicted = priv->render_cost + 2 * priv->render_jitter;
+	count = priv->render_count;
+	pthread_mutex_unlock( &priv->done_mutex );
+
+	// Wait until every thread has rendered once.
+	if ( count < threads )
+		return 0;
+
+	int span = ceil( predicted / period );
+	int head = span < buffer - threads ? span : buffer - threads;
+	int active = span + 1 < threads ? span + 1 : threads;
+
+	pthread_mutex_lock( &priv->queue_mutex );
+	priv->process_head = head > 0 ? head : 0;
+	if ( active > priv->threads_active )
+		pthread_cond_broadcast( &priv->queue_cond );
+	priv->threads_active = active;
+	pthread_mutex_unlock( &priv->queue_mutex );
+
+	return span + active + 1;
+}
+
+/** Publish the statistics of the work queue as consumer properties.
+ *
+ * \private \memberof mlt_consumer_s
+ * \param self a consumer
+ * \param properties the consumer's properties
+ * \param threads the number of worker threads
+ * \param fps the frame rate
+ */
+
+static void worker_stats( mlt_consumer self, mlt_properties properties, int threads, double fps )
+{
+	consumer_private *priv = self->local;
+	double cost, jitter;
+
+	pthread_mutex_lock( &priv->done_mutex );
+	cost = priv->render_cost;
+	jitter = priv->render_jitter;
+	pthread_mutex_unlock( &priv->done_mutex );
+
+	mlt_properties_set_double( properties, "render_cost", cost / 1000.0 );
+	mlt_properties_set_double( properties, "render_jitter", jitter / 1000.0 );
+	mlt_properties_set_double( properties, "render_load", fps > 0 ? cost * fps / 1000000.0 / threads : 0 );
+	mlt_properties_set_int( properties, "threads_active", priv->threads_active );
+	mlt_properties_set_int( properties, "process_head", priv->real_time > 0 ? priv->process_head : 0 );
+	mlt_properties_set_int( properties, "frames_rendered", priv->frames_rendered );
+	mlt_properties_set_int( properties, "frames_dropped", priv->frames_dropped );
+	mlt_properties_set_int( properties, "frames_late", priv->frames_late );
+}
+
 /** Use multiple worker threads and a work queue.
  */
 
@@ -1377,11 +1527,14 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 	int headroom = 2 + threads * threads;
 	buffer = buffer < headroom ? headroom : buffer;
 
+	int orig_buffer = mlt_properties_get_int( properties, "buffer" );
+	int prefill = mlt_properties_get_int( properties, "prefill" );
+	int needed;
+
 	// Start worker threads if not already started.
 	if ( ! priv->ahead )
 	{
-		int prefill = mlt_properties_get_int( properties, "prefill" );
-		prefill = prefill > 0 && prefill < buffer ? prefill : buffer;
+		int fill = prefill > 0 && prefill < buffer ? prefill : buffer;
 
 		set_audio_format( self );
 		set_image_format( self );
@@ -1401,8 +1554,24 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 			}
 		}
 
+		// Without an explicit prefill, wait only for what the first frames
+		// predict is needed to stay ahead of playout.
+		if ( priv->real_time > 0 && prefill <= 0 )
+		{
+			pthread_mutex_lock( &priv->done_mutex );
+			while ( priv->ahead && priv->render_count < threads )
+				pthread_cond_wait( &priv->done_cond, &priv->done_mutex );
+			pthread_mutex_unlock( &priv->done_mutex );
+			needed = worker_schedule( self, threads, buffer, fps ) - 1;
+			if ( needed > 0 && needed < fill )
+				fill = needed;
+			pthread_mutex_lock( &priv->queue_mutex );
+			priv->process_head = 0;
+			pthread_mutex_unlock( &priv->queue_mutex );
+		}
+
 		// Wait for prefill
-		while ( priv->ahead && first_unprocessed_frame( self ) < prefill )
+		while ( priv->ahead && first_unprocessed_frame( self ) < fill )
 		{
 			pthread_mutex_lock( &priv->done_mutex );
 			pthread_cond_wait( &priv->done_cond, &priv->done_mutex );
@@ -1411,6 +1580,16 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 		priv->process_head = threads;
 	}
 
+	// Plan the workers from the cost of rendering.
+	needed = priv->real_time > 0 ? worker_schedule( self, threads, buffer, fps ) : 0;
+	if ( needed > buffer && ( orig_buffer == 1 || prefill == 1 ) && buffer < (threads + 1) * 10 )
+	{
+		// Grow a low-latency buffer before frames start to drop.
+		buffer = needed < (threads + 1) * 10 ? needed : (threads + 1) * 10;
+		mlt_log_verbose( self, "render cost predicts drops - increasing buffer to %d\n", buffer );
+		mlt_properties_set_int( properties, "_buffer", buffer );
+	}
+
 //	mlt_log_verbose( MLT_CONSUMER_SERVICE(self), "size %d done count %d work count %d process_head %d\n",
 //		threads, first_unprocessed_frame( self ), mlt_deque_count( priv->queue ), priv->process_head );
 
@@ -1450,16 +1629,24 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 	{
 		if ( mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "rendered" ) )
 		{
+			priv->frames_rendered++;
 			priv->consecutive_dropped = 0;
-			if ( priv->process_head > threads && priv->consecutive_rendered >= priv->process_head )
+			if ( needed )
+				priv->consecutive_rendered++;
+			else if ( priv->process_head > threads && priv->consecutive_rendered >= priv->process_head )
 				priv->process_head--;
 			else
 				priv->consecutive_rendered++;
 		}
 		else
 		{
+			priv->frames_dropped++;
+			if ( frame->is_processing )
+				priv->frames_late++;
 			priv->consecutive_rendered = 0;
-			if ( priv->process_head < buffer - threads && priv->consecutive_dropped > threads )
+			if ( needed )
+				priv->consecutive_dropped++;
+			else if ( priv->process_head < buffer - threads && priv->consecutive_dropped > threads )
 				priv->process_head++;
 			else
 				priv->consecutive_dropped++;
@@ -1470,8 +1657,6 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 		// Check for too many consecutively dropped frames
 		if ( priv->consecutive_dropped > mlt_properties_get_int( properties, "drop_max" ) )
 		{
-			int orig_buffer = mlt_properties_get_int( properties, "buffer" );
-			int prefill = mlt_properties_get_int( properties, "prefill" );
 			mlt_log_verbose( self, "too many frames dropped - " );
 
 			// If using a default low-latency buffer level (SDL) and below the limit
@@ -1491,6 +1676,7 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 			}
 		}
 	}
+	worker_stats( self, properties, threads, fps );
 	if ( priv->is_purge ) {
 		priv->is_purge = 0;
 		mlt_frame_close( frame );
@@ -41,8 +41,20 @@
  * \properties \em buffer the number of frames to use in the asynchronous
  * render thread, defaults to 25
  * \properties \em prefill the number of frames to render before commencing
- * output when real_time <> 0, defaults to the size of buffer
+ * output when real_time <> 0, defaults to the size of buffer, or when real_time
+ * is greater than 1 to the number predicted from the cost of the first frames
  * \properties \em drop_max the maximum number of consecutively dropped frames, defaults to 5
+ * \properties \em render_cost the smoothed time in milliseconds to render a frame when
+ * real_time is greater than 1 or less than -1 (read only)
+ * \properties \em render_jitter the smoothed deviation of render_cost in milliseconds (read only)
+ * \properties \em render_load render_cost as a fraction of what the worker threads can
+ * render in real time; drops are likely above 1 (read only)
+ * \properties \em threads_active the number of worker threads allowed to render at once (read only)
+ * \properties \em process_head the number of frames before playout for which rendering
+ * is predicted to miss the deadline; these are dropped without being rendered (read only)
+ * \properties \em frames_rendered the number of frames rendered by worker threads before playout (read only)
+ * \properties \em frames_dropped the number of frames not rendered by worker threads before playout (read only)
+ * \properties \em frames_late the number of frames_dropped that were still rendering at playout (read only)
  * \properties \em frequency the audio sample rate to use in Hertz, defaults to 48000
  * \properties \em channels the number of audio channels to use, defaults to 2
  * \properties \em real_time the asynchronous behavior: 1 (default) for asynchronous
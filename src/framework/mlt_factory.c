@@ -170,6 +170,10 @@ mlt_repository mlt_factory_init( const char *directory )
 		// Initialise the pool
 		mlt_pool_init( );
 
+		// Record the render time of every service when asked
+		if ( getenv( "MLT_TRACE" ) && strcmp( getenv( "MLT_TRACE" ), "" ) )
+			mlt_trace_enable( 1 );
+
 		// Create and set up the events object
 		event_object = mlt_properties_new( );
 		mlt_events_init( event_object );
@@ -425,6 +429,9 @@ void mlt_factory_close( )
 		}
 		free( mlt_directory );
 		mlt_directory = NULL;
+		if ( getenv( "MLT_TRACE" ) && strcmp( getenv( "MLT_TRACE" ), "" ) )
+			mlt_trace_write( getenv( "MLT_TRACE" ) );
+		mlt_trace_close( );
 		mlt_pool_close( );
 	}
 }
@@ -24,6 +24,9 @@
 #include "mlt_filter.h"
 #include "mlt_frame.h"
 #include "mlt_producer.h"
+#include "mlt_factory.h"
+#include "mlt_log.h"
+#include "mlt_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -282,6 +285,82 @@ double mlt_filter_get_progress( mlt_filter self, mlt_frame frame )
 	return position / length;
 }
 
+/** Open a copy of the producer a filter is attached to, for analyzing it ahead of playback.
+ *
+ * Filters that measure their whole range before returning the first frame
+ * read it from copies of the source. This is only reliable when the filter
+ * is attached directly to a plain avformat producer, because then the
+ * resource is the media and its positions are the filter's positions. For
+ * anything else (a playlist, tractor, track, cut or another kind of producer)
+ * this returns NULL and the filter should analyze in-line instead.
+ *
+ * The copy is opened through the loader with the same resource and stream
+ * selection as the source.
+ *
+ * \public \memberof mlt_filter_s
+ * \param self a filter
+ * \param frame a frame that the filter is processing
+ * \param audio false to disable the audio of the copy
+ * \param video false to disable the video of the copy
+ * \param[out] origin the producer position at which the filter's position is 0
+ * \return a new producer that the caller must close, or NULL
+ */
+
+mlt_producer mlt_filter_open_source( mlt_filter self, mlt_frame frame, int audio, int video, mlt_position *origin )
+{
+	mlt_producer source = mlt_frame_get_original_producer( frame );
+	mlt_properties properties = MLT_FILTER_PROPERTIES( self );
+	mlt_properties source_properties;
+	const char *service;
+	const char *resource;
+	mlt_producer producer;
+	mlt_filter filter;
+	char *uri;
+	int i = 0;
+
+	if ( !source || mlt_producer_is_cut( source ) )
+		return NULL;
+	source_properties = MLT_PRODUCER_PROPERTIES( source );
+	service = mlt_properties_get( source_properties, "mlt_service" );
+	resource = mlt_properties_get( source_properties, "resource" );
+	if ( !service || strncmp( service, "avformat", 8 ) || !resource )
+		return NULL;
+
+	// The filter must be one of the source's own filters
+	while ( ( filter = mlt_service_filter( MLT_PRODUCER_SERVICE( source ), i++ ) ) && filter != self )
+		;
+	if ( !filter )
+		return NULL;
+
+	uri = malloc( strlen( service ) + strlen( resource ) + 2 );
+	if ( !uri )
+		return NULL;
+	sprintf( uri, "%s:%s", service, resource );
+	producer = mlt_factory_producer( mlt_service_profile( MLT_FILTER_SERVICE( self ) ), NULL, uri );
+	free( uri );
+	if ( !producer )
+	{
+		mlt_log_error( MLT_FILTER_SERVICE( self ), "unable to open %s for analysis\n", resource );
+		return NULL;
+	}
+
+	if ( audio && mlt_properties_get( source_properties, "audio_index" ) )
+		mlt_properties_set( MLT_PRODUCER_PROPERTIES( producer ), "audio_index", mlt_properties_get( source_properties, "audio_index" ) );
+	else if ( !audio )
+		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "audio_index", -1 );
+	if ( video && mlt_properties_get( source_properties, "video_index" ) )
+		mlt_properties_set( MLT_PRODUCER_PROPERTIES( producer ), "video_index", mlt_properties_get( source_properties, "video_index" ) );
+	else if ( !video )
+		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "video_index", -1 );
+
+	// An attached filter sees the producer's own positions
+	if ( origin )
+		*origin = mlt_properties_get_position( properties, "out" ) ?
+			mlt_properties_get_position( properties, "in" ) : mlt_producer_get_in( source );
+
+	return producer;
+}
+
 /** Process the frame.
  *
  * When fetching the frame position in a subclass process method, the frame's
@@ -323,7 +402,10 @@ mlt_frame mlt_filter_process( mlt_filter self, mlt_frame frame )
 		mlt_properties_set_data( MLT_FRAME_PROPERTIES(frame), name, self, 0,
 			(mlt_destructor) mlt_filter_close, NULL );
 
-		return self->process( self, frame );
+		mlt_trace_scope scope = mlt_trace_begin( MLT_FILTER_SERVICE( self ), "process" );
+		frame = self->process( self, frame );
+		mlt_trace_end( scope, frame );
+		return frame;
 	}
 }
 
@@ -69,6 +69,7 @@ extern mlt_position mlt_filter_get_length( mlt_filter self );
 extern mlt_position mlt_filter_get_length2( mlt_filter self, mlt_frame frame );
 extern mlt_position mlt_filter_get_position( mlt_filter self, mlt_frame frame );
 extern double mlt_filter_get_progress( mlt_filter self, mlt_frame frame );
+extern mlt_producer mlt_filter_open_source( mlt_filter self, mlt_frame frame, int audio, int video, mlt_position *origin );
 extern void mlt_filter_close( mlt_filter );
 
 #endif
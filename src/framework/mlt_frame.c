@@ -27,10 +27,12 @@
 #include "mlt_factory.h"
 #include "mlt_profile.h"
 #include "mlt_log.h"
+#include "mlt_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 /** Construct a frame object.
  *
@@ -190,6 +192,7 @@ int mlt_frame_set_position( mlt_frame self, mlt_position value )
 
 int mlt_frame_push_get_image( mlt_frame self, mlt_get_image get_image )
 {
+	mlt_trace_push( self, get_image );
 	return mlt_deque_push_back( self->stack_image, get_image );
 }
 
@@ -240,6 +243,7 @@ mlt_frame mlt_frame_pop_frame( mlt_frame self )
 
 int mlt_frame_push_service( mlt_frame self, void *that )
 {
+	mlt_trace_push( self, that );
 	return mlt_deque_push_back( self->stack_image, that );
 }
 
@@ -290,6 +294,7 @@ int mlt_frame_pop_service_int( mlt_frame self )
 
 int mlt_frame_push_audio( mlt_frame self, void *that )
 {
+	mlt_trace_push( self, that );
 	return mlt_deque_push_back( self->stack_audio, that );
 }
 
@@ -448,6 +453,40 @@ int mlt_image_format_size( mlt_image_format format, int width, int height, int *
 	return 0;
 }
 
+/** Convert the image format, attributing the time to the service that asked for it.
+ *
+ * \private \memberof mlt_frame_s
+ */
+
+static int frame_convert_image( mlt_frame self, uint8_t **image, mlt_image_format *format, mlt_image_format requested_format )
+{
+	mlt_trace_scope scope = NULL;
+	int error;
+
+	if ( *format != requested_format && mlt_trace_is_enabled() )
+		scope = mlt_trace_begin_convert( "convert_image", mlt_image_format_name( *format ), mlt_image_format_name( requested_format ) );
+	error = self->convert_image( self, image, format, requested_format );
+	mlt_trace_end( scope, self );
+	return error;
+}
+
+/** Convert the audio format, attributing the time to the service that asked for it.
+ *
+ * \private \memberof mlt_frame_s
+ */
+
+static int frame_convert_audio( mlt_frame self, void **audio, mlt_audio_format *format, mlt_audio_format requested_format )
+{
+	mlt_trace_scope scope = NULL;
+	int error;
+
+	if ( *format != requested_format && mlt_trace_is_enabled() )
+		scope = mlt_trace_begin_convert( "convert_audio", mlt_audio_format_name( *format ), mlt_audio_format_name( requested_format ) );
+	error = self->convert_audio( self, audio, format, requested_format );
+	mlt_trace_end( scope, self );
+	return error;
+}
+
 static int generate_test_image( mlt_properties properties, uint8_t **buffer,  mlt_image_format *format, int *width, int *height, int writable )
 {
 	mlt_producer producer = mlt_properties_get_data( properties, "test_card_producer", NULL );
@@ -577,14 +616,16 @@ int mlt_frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *for
 
 	if ( get_image )
 	{
+		mlt_trace_scope scope = mlt_trace_begin_callback( self, get_image, "get_image" );
 		mlt_properties_set_int( properties, "image_count", mlt_properties_get_int( properties, "image_count" ) - 1 );
 		error = get_image( self, buffer, format, width, height, writable );
+		mlt_trace_end( scope, self );
 		if ( !error && buffer && *buffer )
 		{
 			mlt_properties_set_int( properties, "width", *width );
 			mlt_properties_set_int( properties, "height", *height );
 			if ( self->convert_image && requested_format != mlt_image_none )
-				self->convert_image( self, buffer, format, requested_format );
+				frame_convert_image( self, buffer, format, requested_format );
 			mlt_properties_set_int( properties, "format", *format );
 		}
 		else
@@ -600,7 +641,7 @@ int mlt_frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *for
 		*height = mlt_properties_get_int( properties, "height" );
 		if ( self->convert_image && *buffer && requested_format != mlt_image_none )
 		{
-			self->convert_image( self, buffer, format, requested_format );
+			frame_convert_image( self, buffer, format, requested_format );
 			mlt_properties_set_int( properties, "format", *format );
 		}
 	}
@@ -716,13 +757,15 @@ int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format
 
 	if ( hide == 0 && get_audio != NULL )
 	{
+		mlt_trace_scope scope = mlt_trace_begin_callback( self, get_audio, "get_audio" );
 		get_audio( self, buffer, format, frequency, channels, samples );
+		mlt_trace_end( scope, self );
 		mlt_properties_set_int( properties, "audio_frequency", *frequency );
 		mlt_properties_set_int( properties, "audio_channels", *channels );
 		mlt_properties_set_int( properties, "audio_samples", *samples );
 		mlt_properties_set_int( properties, "audio_format", *format );
 		if ( self->convert_audio && *buffer && requested_format != mlt_audio_none )
-			self->convert_audio( self, buffer, format, requested_format );
+			frame_convert_audio( self, buffer, format, requested_format );
 	}
 	else if ( mlt_properties_get_data( properties, "audio", NULL ) )
 	{
@@ -732,7 +775,7 @@ int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format
 		*channels = mlt_properties_get_int( properties, "audio_channels" );
 		*samples = mlt_properties_get_int( properties, "audio_samples" );
 		if ( self->convert_audio && *buffer && requested_format != mlt_audio_none )
-			self->convert_audio( self, buffer, format, requested_format );
+			frame_convert_audio( self, buffer, format, requested_format );
 	}
 	else
 	{
@@ -757,15 +800,16 @@ int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format
 	}
 
 	// TODO: This does not belong here
-	if ( *format == mlt_audio_s16 && mlt_properties_get( properties, "meta.volume" ) && *buffer )
+	if ( ( *format == mlt_audio_s16 || *format == mlt_audio_float || *format == mlt_audio_f32le ) &&
+	     mlt_properties_get( properties, "meta.volume" ) && *buffer )
 	{
 		double value = mlt_properties_get_double( properties, "meta.volume" );
 
 		if ( value == 0.0 )
 		{
-			memset( *buffer, 0, *samples * *channels * 2 );
+			memset( *buffer, 0, mlt_audio_format_size( *format, *samples, *channels ) );
 		}
-		else if ( value != 1.0 )
+		else if ( value != 1.0 && *format == mlt_audio_s16 )
 		{
 			int total = *samples * *channels;
 			int16_t *p = *buffer;
@@ -775,6 +819,16 @@ int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format
 				p ++;
 			}
 		}
+		else if ( value != 1.0 )
+		{
+			int total = *samples * *channels;
+			float *p = *buffer;
+			while ( total -- )
+			{
+				*p = *p * value;
+				p ++;
+			}
+		}
 
 		mlt_properties_set( properties, "meta.volume", NULL );
 	}
@@ -897,6 +951,66 @@ mlt_producer mlt_frame_get_original_producer( mlt_frame self )
 	return NULL;
 }
 
+/** Get an unfiltered neighbour of a frame.
+ *
+ * A filter that needs the frames around the one it is processing sets
+ * \em _temporal_radius on itself to the largest \p offset it uses. The producer
+ * it is attached to then renders each neighbour once, keeps it while it is in
+ * range and attaches it to every frame that needs it, so several filters and
+ * consecutive frames share it. As the neighbour may be in use by other frames,
+ * possibly on other threads, hold \p mlt_frame_neighbour_lock while using its
+ * image and do not modify the image.
+ *
+ * \public \memberof mlt_frame_s
+ * \param self a frame
+ * \param offset the distance to the neighbour, negative for a preceding frame
+ * \return the neighbour, or NULL if it is not available (do not close it)
+ */
+
+mlt_frame mlt_frame_get_neighbour( mlt_frame self, int offset )
+{
+	char key[ 32 ];
+
+	if ( self == NULL || offset == 0 )
+		return self;
+	if ( offset == -1 )
+		return mlt_properties_get_data( MLT_FRAME_PROPERTIES( self ), "previous frame", NULL );
+	if ( offset == 1 )
+		return mlt_properties_get_data( MLT_FRAME_PROPERTIES( self ), "next frame", NULL );
+	sprintf( key, "neighbour frame %d", offset );
+	return mlt_properties_get_data( MLT_FRAME_PROPERTIES( self ), key, NULL );
+}
+
+/** Protect a neighbour against concurrent use by the frames sharing it.
+ *
+ * When locking several neighbours, lock them in ascending order of position.
+ * This is not the properties lock, which the producer may take while it attaches
+ * the neighbour to another frame.
+ *
+ * \public \memberof mlt_frame_s
+ * \param neighbour a frame obtained from \p mlt_frame_get_neighbour
+ */
+
+void mlt_frame_neighbour_lock( mlt_frame neighbour )
+{
+	pthread_mutex_t *mutex = neighbour ? mlt_properties_get_data( MLT_FRAME_PROPERTIES( neighbour ), "_neighbour_mutex", NULL ) : NULL;
+	if ( mutex )
+		pthread_mutex_lock( mutex );
+}
+
+/** End protecting a neighbour against concurrent use.
+ *
+ * \public \memberof mlt_frame_s
+ * \param neighbour a frame obtained from \p mlt_frame_get_neighbour
+ */
+
+void mlt_frame_neighbour_unlock( mlt_frame neighbour )
+{
+	pthread_mutex_t *mutex = neighbour ? mlt_properties_get_data( MLT_FRAME_PROPERTIES( neighbour ), "_neighbour_mutex", NULL ) : NULL;
+	if ( mutex )
+		pthread_mutex_unlock( mutex );
+}
+
 /** Destroy the frame.
  *
  * \public \memberof mlt_frame_s
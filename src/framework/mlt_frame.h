@@ -58,6 +58,8 @@ typedef int ( *mlt_get_audio )( mlt_frame self, void **buffer, mlt_audio_format
  * (no speed factor applied, only available when \em _need_previous_next is set on the producer)
  * \properties \em next \em frame a reference to the unfiltered following frame
  * (no speed factor applied, only available when \em _need_previous_next is set on the producer)
+ * \properties \em neighbour \em frame \em N a reference to the unfiltered frame N positions away,
+ * for |N| > 1 (only available when \em _temporal_radius is set, see \p mlt_frame_get_neighbour)
  * \properties \em colorspace the standard for the YUV coefficients
  * \properties \em force_full_luma luma range handling, set to -1 for pass-through, 1 for full range, 0 for scaling
  * \properties \em color_trc the color transfer characteristic (gamma)
@@ -139,6 +141,9 @@ extern int mlt_frame_push_audio( mlt_frame self, void *that );
 extern void *mlt_frame_pop_audio( mlt_frame self );
 extern mlt_deque mlt_frame_service_stack( mlt_frame self );
 extern mlt_producer mlt_frame_get_original_producer( mlt_frame self );
+extern mlt_frame mlt_frame_get_neighbour( mlt_frame self, int offset );
+extern void mlt_frame_neighbour_lock( mlt_frame neighbour );
+extern void mlt_frame_neighbour_unlock( mlt_frame neighbour );
 extern void mlt_frame_close( mlt_frame self );
 extern mlt_properties mlt_frame_unique_properties( mlt_frame self, mlt_service service );
 extern mlt_frame mlt_frame_clone( mlt_frame self, int is_deep );
@@ -715,3 +715,156 @@ void mlt_geometry_close( mlt_geometry self )
 }
 
 
+
+/** private part of a compiled geometry (deprecated)
+ * \deprecated use mlt_animation_s instead
+ *
+ * The keys are held in an array ordered by frame and never change after
+ * compiling, so one copy can be read by any number of threads.
+ */
+
+struct mlt_geometry_compiled_s
+{
+	int refcount;
+	int length;
+	int count;
+	struct mlt_geometry_item_s *keys;
+};
+
+// Make an immutable copy of the keys that can be shared between threads
+mlt_geometry_compiled mlt_geometry_compile( mlt_geometry self )
+{
+	geometry g = self->local;
+	mlt_geometry_compiled compiled = calloc( 1, sizeof( struct mlt_geometry_compiled_s ) );
+	if ( compiled != NULL )
+	{
+		geometry_item place;
+
+		compiled->refcount = 1;
+		compiled->length = g->length;
+		for ( place = g->item; place != NULL; place = place->next )
+			compiled->count ++;
+		if ( compiled->count > 0 )
+			compiled->keys = malloc( compiled->count * sizeof( struct mlt_geometry_item_s ) );
+		if ( compiled->keys != NULL )
+		{
+			int i = 0;
+			for ( place = g->item; place != NULL; place = place->next )
+				compiled->keys[ i ++ ] = place->data;
+		}
+		else
+		{
+			compiled->count = 0;
+		}
+	}
+	return compiled;
+}
+
+// Parse a geometry specification straight into its compiled form
+mlt_geometry_compiled mlt_geometry_compiled_parse( char *data, int length, int nw, int nh )
+{
+	mlt_geometry_compiled compiled = NULL;
+	mlt_geometry geometry = mlt_geometry_init( );
+	if ( geometry != NULL )
+	{
+		mlt_geometry_parse( geometry, data, length, nw, nh );
+		compiled = mlt_geometry_compile( geometry );
+		mlt_geometry_close( geometry );
+	}
+	return compiled;
+}
+
+// Fetch a geometry item for an absolute position using a binary search of the keys
+int mlt_geometry_compiled_fetch( mlt_geometry_compiled self, mlt_geometry_item item, float position )
+{
+	struct mlt_geometry_item_s *key = NULL;
+	struct mlt_geometry_item_s *next = NULL;
+
+	if ( self != NULL && self->count > 0 )
+	{
+		// Find the last key at or before the position, or the first key
+		int lo = 0;
+		int hi = self->count - 1;
+		while ( lo < hi )
+		{
+			int mid = ( lo + hi + 1 ) / 2;
+			if ( position >= self->keys[ mid ].frame )
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+		key = &self->keys[ lo ];
+		if ( lo + 1 < self->count )
+			next = &self->keys[ lo + 1 ];
+	}
+
+	// The same cases as mlt_geometry_fetch
+	if ( key != NULL )
+	{
+		if ( position < key->frame )
+		{
+			memset( item, 0, sizeof( struct mlt_geometry_item_s ) );
+			item->mix = 100;
+		}
+		else if ( position == key->frame )
+		{
+			memcpy( item, key, sizeof( struct mlt_geometry_item_s ) );
+		}
+		else if ( next == NULL )
+		{
+			memcpy( item, key, sizeof( struct mlt_geometry_item_s ) );
+			item->key = 0;
+			item->f[ 0 ] = 0;
+			item->f[ 1 ] = 0;
+			item->f[ 2 ] = 0;
+			item->f[ 3 ] = 0;
+			item->f[ 4 ] = 0;
+		}
+		else
+		{
+			item->key = 0;
+			position -= key->frame;
+			item->x = linearstep( key->x, next->x, position, next->frame - key->frame );
+			item->y = linearstep( key->y, next->y, position, next->frame - key->frame );
+			item->w = linearstep( key->w, next->w, position, next->frame - key->frame );
+			item->h = linearstep( key->h, next->h, position, next->frame - key->frame );
+			item->mix = linearstep( key->mix, next->mix, position, next->frame - key->frame );
+			item->distort = key->distort;
+			position += key->frame;
+		}
+
+		item->frame = position;
+	}
+	else
+	{
+		memset( item, 0, sizeof( struct mlt_geometry_item_s ) );
+		item->frame = position;
+		item->mix = 100;
+	}
+
+	return key == NULL;
+}
+
+// Get the length the compiled geometry was parsed with
+int mlt_geometry_compiled_get_length( mlt_geometry_compiled self )
+{
+	return self != NULL ? self->length : 0;
+}
+
+// Add a reference
+mlt_geometry_compiled mlt_geometry_compiled_inc_ref( mlt_geometry_compiled self )
+{
+	if ( self != NULL )
+		__sync_fetch_and_add( &self->refcount, 1 );
+	return self;
+}
+
+// Release a reference, destroying the compiled geometry with the last one
+void mlt_geometry_compiled_close( mlt_geometry_compiled self )
+{
+	if ( self != NULL && __sync_sub_and_fetch( &self->refcount, 1 ) == 0 )
+	{
+		free( self->keys );
+		free( self );
+	}
+}
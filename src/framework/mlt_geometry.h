@@ -82,5 +82,17 @@ extern char *mlt_geometry_serialise( mlt_geometry self );
 /* Close the geometry */
 extern void mlt_geometry_close( mlt_geometry self );
 
+/* Make an immutable copy of the keys that can be shared between threads */
+extern mlt_geometry_compiled mlt_geometry_compile( mlt_geometry self );
+/* Parse a geometry specification straight into its compiled form */
+extern mlt_geometry_compiled mlt_geometry_compiled_parse( char *data, int length, int nw, int nh );
+/* Fetch a geometry item for an absolute position using a binary search of the keys */
+extern int mlt_geometry_compiled_fetch( mlt_geometry_compiled self, mlt_geometry_item item, float position );
+/* Get the length the compiled geometry was parsed with */
+extern int mlt_geometry_compiled_get_length( mlt_geometry_compiled self );
+/* Add and release references */
+extern mlt_geometry_compiled mlt_geometry_compiled_inc_ref( mlt_geometry_compiled self );
+extern void mlt_geometry_compiled_close( mlt_geometry_compiled self );
+
 #endif
 
@@ -23,6 +23,7 @@
 
 #include "mlt_properties.h"
 #include "mlt_deque.h"
+#include "mlt_trace.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -268,6 +269,9 @@ void *mlt_pool_alloc( int size )
 	// Determines the index of the pool to use
 	int index = 8;
 
+	// Count it against the service doing the work
+	mlt_trace_alloc( size );
+
 	// Minimum size pooled is 256 bytes
 	size += sizeof( struct mlt_release_s );
 	while ( ( 1 << index ) < size )
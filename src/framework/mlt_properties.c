@@ -2425,6 +2425,24 @@ mlt_animation mlt_properties_get_animation( mlt_properties self, const char *nam
 	return value == NULL ? NULL : mlt_property_get_animation( value );
 }
 
+/** Get the compiled geometry of a property.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param name the property to get
+ * \param length the length of the geometry or -1 for the default
+ * \param nw the normalised width percentages refer to or -1 for the default
+ * \param nh the normalised height percentages refer to or -1 for the default
+ * \return a reference to release with mlt_geometry_compiled_close or NULL if the property is not set
+ * \see mlt_property_get_geometry
+ */
+
+mlt_geometry_compiled mlt_properties_get_geometry( mlt_properties self, const char *name, int length, int nw, int nh )
+{
+	mlt_property value = mlt_properties_find( self, name );
+	return value == NULL ? NULL : mlt_property_get_geometry( value, length, nw, nh );
+}
+
 /** Set a property to a rectangle value.
  *
  * \public \memberof mlt_properties_s
@@ -103,6 +103,7 @@ extern int mlt_properties_anim_set_int( mlt_properties self, const char *name, i
 extern double mlt_properties_anim_get_double( mlt_properties self, const char *name, int position, int length );
 extern int mlt_properties_anim_set_double( mlt_properties self, const char *name, double value, int position, int length, mlt_keyframe_type keyframe_type );
 extern mlt_animation mlt_properties_get_animation( mlt_properties self, const char *name );
+extern mlt_geometry_compiled mlt_properties_get_geometry( mlt_properties self, const char *name, int length, int nw, int nh );
 
 extern int mlt_properties_set_rect( mlt_properties self, const char *name, mlt_rect value );
 extern mlt_rect mlt_properties_get_rect( mlt_properties self, const char *name );
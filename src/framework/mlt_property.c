@@ -29,6 +29,7 @@
 
 #include "mlt_property.h"
 #include "mlt_animation.h"
+#include "mlt_geometry.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -83,6 +84,10 @@ struct mlt_property_s
 
 	pthread_mutex_t mutex;
 	mlt_animation animation;
+
+	/// The string compiled as a geometry and the arguments it was parsed with
+	mlt_geometry_compiled geometry;
+	int geometry_length, geometry_nw, geometry_nh;
 };
 
 /** Construct a property and initialize it
@@ -117,6 +122,9 @@ static inline void mlt_property_clear( mlt_property self )
 	if ( self->animation )
 		mlt_animation_close( self->animation );
 
+	if ( self->geometry )
+		mlt_geometry_compiled_close( self->geometry );
+
 	// Wipe stuff
 	self->types = 0;
 	self->prop_int = 0;
@@ -129,6 +137,7 @@ static inline void mlt_property_clear( mlt_property self )
 	self->destructor = NULL;
 	self->serialiser = NULL;
 	self->animation = NULL;
+	self->geometry = NULL;
 }
 
 /** Set the property to an integer value.
@@ -1431,6 +1440,47 @@ int mlt_property_anim_set_string( mlt_property self, const char *value, double f
 	return result;
 }
 
+/** Get the property string compiled as a geometry.
+ *
+ * The compiled geometry is kept on the property and handed out again for as
+ * long as the string and the parse arguments stay the same, so callers can
+ * ask for it on every frame without parsing. It is immutable and reference
+ * counted, which makes it safe to use from several threads.
+ * \public \memberof mlt_property_s
+ * \param self a property
+ * \param length the length of the geometry or -1 for the default
+ * \param nw the normalised width percentages refer to or -1 for the default
+ * \param nh the normalised height percentages refer to or -1 for the default
+ * \return a new reference the caller must release with mlt_geometry_compiled_close
+ * or NULL if the property has no string representation
+ */
+
+mlt_geometry_compiled mlt_property_get_geometry( mlt_property self, int length, int nw, int nh )
+{
+	mlt_geometry_compiled result = NULL;
+
+	// Make sure numbers have their string form
+	mlt_property_get_string( self );
+
+	pthread_mutex_lock( &self->mutex );
+	if ( ( self->types & mlt_prop_string ) && self->prop_string )
+	{
+		if ( !self->geometry || self->geometry_length != length || self->geometry_nw != nw || self->geometry_nh != nh )
+		{
+			if ( self->geometry )
+				mlt_geometry_compiled_close( self->geometry );
+			self->geometry = mlt_geometry_compiled_parse( self->prop_string, length, nw, nh );
+			self->geometry_length = length;
+			self->geometry_nw = nw;
+			self->geometry_nh = nh;
+		}
+		result = mlt_geometry_compiled_inc_ref( self->geometry );
+	}
+	pthread_mutex_unlock( &self->mutex );
+
+	return result;
+}
+
 /** Get an object's animation object.
  *
  * You might need to call another mlt_property_anim_ function to actually construct
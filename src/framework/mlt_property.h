@@ -64,6 +64,7 @@ extern int mlt_property_anim_set_double( mlt_property self, double value, double
 extern int mlt_property_anim_set_int( mlt_property self, int value, double fps, locale_t locale, int position, int length, mlt_keyframe_type keyframe_type );
 extern int mlt_property_anim_set_string( mlt_property self, const char *value, double fps, locale_t locale, int position, int length );
 extern mlt_animation mlt_property_get_animation( mlt_property self );
+extern mlt_geometry_compiled mlt_property_get_geometry( mlt_property self, int length, int nw, int nh );
 
 extern int mlt_property_set_rect( mlt_property self, mlt_rect value );
 extern mlt_rect mlt_property_get_rect( mlt_property self, locale_t locale );
@@ -28,6 +28,8 @@
 #include "mlt_factory.h"
 #include "mlt_log.h"
 #include "mlt_producer.h"
+#include "mlt_trace.h"
+#include "mlt_pool.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -427,6 +429,283 @@ void mlt_service_apply_filters( mlt_service self, mlt_frame frame, int index )
 	}
 }
 
+/** \brief The unfiltered neighbour frames of a producer
+ *
+ * The window lives on the producer, so a neighbour is rendered once and then
+ * shared by every frame (and every filter of that frame) whose radius covers
+ * it, instead of being fetched again for each of them. Position p is held in
+ * slot p modulo the size, so the 2 * radius + 1 positions around any frame
+ * never collide and frames that fall out of range are replaced as playback
+ * moves on.
+ */
+
+typedef struct
+{
+	int size;                 /**< the number of slots, 2 * radius + 1 */
+	mlt_position *positions;  /**< the position of the frame in each slot */
+	mlt_frame *frames;        /**< the frames, NULL for an empty slot */
+}
+temporal_window_s, *temporal_window;
+
+static void temporal_window_close( temporal_window window )
+{
+	if ( window )
+	{
+		int i;
+		for ( i = 0; i < window->size; i++ )
+			mlt_frame_close( window->frames[ i ] );
+		free( window->frames );
+		free( window->positions );
+		free( window );
+	}
+}
+
+static temporal_window temporal_window_init( int size )
+{
+	temporal_window window = calloc( 1, sizeof( temporal_window_s ) );
+	if ( window )
+	{
+		window->size = size;
+		window->positions = calloc( size, sizeof( mlt_position ) );
+		window->frames = calloc( size, sizeof( mlt_frame ) );
+		if ( !window->positions || !window->frames )
+		{
+			temporal_window_close( window );
+			window = NULL;
+		}
+	}
+	return window;
+}
+
+static void neighbour_mutex_close( pthread_mutex_t *mutex )
+{
+	pthread_mutex_destroy( mutex );
+	free( mutex );
+}
+
+/** Determine how many neighbours on each side the frames of a producer need.
+ *
+ * This is the largest \em _temporal_radius of the enabled filters attached to
+ * the producer or of the producer itself, and at least 1 when the producer has
+ * \em _need_previous_next set.
+ *
+ * \private \memberof mlt_service_s
+ * \param self a producer
+ * \return the radius in frames
+ */
+
+static int temporal_radius( mlt_service self )
+{
+	mlt_service_base *base = self->local;
+	mlt_properties properties = MLT_SERVICE_PROPERTIES( self );
+	int radius = mlt_properties_get_int( properties, "_temporal_radius" );
+	int i;
+
+	if ( radius < 1 && mlt_properties_get_int( properties, "_need_previous_next" ) )
+		radius = 1;
+	for ( i = 0; i < base->filter_count; i++ )
+	{
+		mlt_properties filter_properties = MLT_FILTER_PROPERTIES( base->filters[ i ] );
+		if ( !mlt_properties_get_int( filter_properties, "disable" ) &&
+		     mlt_properties_get_int( filter_properties, "_temporal_radius" ) > radius )
+			radius = mlt_properties_get_int( filter_properties, "_temporal_radius" );
+	}
+	return radius;
+}
+
+/** Get the image of a frame obtained through the producer's window.
+ *
+ * The image is rendered on the frame held in the window, once however many
+ * frames use it, and copied as the filters of this frame may change it in
+ * place while the window frame must stay unfiltered for its neighbours.
+ *
+ * \private \memberof mlt_service_s
+ * \see mlt_get_image
+ */
+
+static int temporal_get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_frame source = mlt_properties_get_data( properties, "_temporal_source", NULL );
+	mlt_properties source_properties = MLT_FRAME_PROPERTIES( source );
+	int image_count = mlt_properties_get_int( properties, "image_count" );
+	int error;
+
+	mlt_frame_neighbour_lock( source );
+
+	// Pass on the properties that steer the rendering
+	mlt_properties_pass_list( source_properties, properties, "consumer_deinterlace, deinterlace_method, rescale.interp" );
+
+	error = mlt_frame_get_image( source, image, format, width, height, 0 );
+	if ( !error && *image )
+	{
+		uint8_t *alpha = mlt_properties_get_data( source_properties, "alpha", NULL );
+		int size = mlt_image_format_size( *format, *width, *height, NULL );
+		uint8_t *copy = mlt_pool_alloc( size );
+
+		memcpy( copy, *image, size );
+		*image = copy;
+		mlt_frame_set_image( frame, copy, size, mlt_pool_release );
+		if ( alpha )
+		{
+			size = *width * *height;
+			copy = mlt_pool_alloc( size );
+			memcpy( copy, alpha, size );
+			mlt_frame_set_alpha( frame, copy, size, mlt_pool_release );
+		}
+
+		// Take on what rendering told about the image, e.g. progressive
+		mlt_properties_inherit( properties, source_properties );
+		mlt_properties_set_int( properties, "image_count", image_count );
+	}
+
+	mlt_frame_neighbour_unlock( source );
+
+	return error;
+}
+
+/** Get the audio of a frame obtained through the producer's window.
+ *
+ * \private \memberof mlt_service_s
+ * \see mlt_get_audio
+ */
+
+static int temporal_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	mlt_frame source = mlt_properties_get_data( MLT_FRAME_PROPERTIES( frame ), "_temporal_source", NULL );
+	int error;
+
+	mlt_frame_neighbour_lock( source );
+	error = mlt_frame_get_audio( source, buffer, format, frequency, channels, samples );
+	if ( !error && *buffer )
+	{
+		// Copy, as audio filters work in place
+		int size = mlt_audio_format_size( *format, *samples, *channels );
+		void *copy = mlt_pool_alloc( size );
+
+		memcpy( copy, *buffer, size );
+		*buffer = copy;
+		mlt_frame_set_audio( frame, copy, *format, size, mlt_pool_release );
+	}
+	mlt_frame_neighbour_unlock( source );
+
+	return error;
+}
+
+/** Obtain a frame of a producer through its window of unfiltered frames.
+ *
+ * The frame at \p position and the neighbours missing from the window are
+ * rendered in ascending order, so a source read sequentially only decodes the
+ * one newly entering frame, which then serves as the current frame and as a
+ * neighbour of the frames around it. The frame returned draws its image and
+ * audio from the window frame at \p position and has the others attached as
+ * its neighbours.
+ *
+ * \private \memberof mlt_service_s
+ * \param self a producer
+ * \param[out] frame a frame by reference
+ * \param position the position of the frame
+ * \param index as determined by the producer
+ * \param radius the number of neighbours needed on each side
+ * \return true if there was an error
+ */
+
+static int temporal_get_frame( mlt_service self, mlt_frame_ptr frame, mlt_position position, int index, int radius )
+{
+	mlt_properties properties = MLT_SERVICE_PROPERTIES( self );
+	mlt_producer producer = MLT_PRODUCER( self );
+	temporal_window window = mlt_properties_get_data( properties, "_temporal_window", NULL );
+	mlt_frame source = NULL;
+	mlt_position new_position;
+	int offset;
+
+	if ( !window || window->size != 2 * radius + 1 )
+	{
+		window = temporal_window_init( 2 * radius + 1 );
+		mlt_properties_set_data( properties, "_temporal_window", window, 0, ( mlt_destructor ) temporal_window_close, NULL );
+	}
+	if ( !window )
+		return self->get_frame( self, frame, index );
+
+	// Determine where the producer moves on to, as getting the frame would
+	mlt_producer_prepare_next( producer );
+	new_position = mlt_producer_position( producer );
+
+	*frame = mlt_frame_init( self );
+
+	for ( offset = -radius; offset <= radius; offset++ )
+	{
+		mlt_position neighbour_position = position + offset;
+		int slot = ( neighbour_position % window->size + window->size ) % window->size;
+		mlt_frame neighbour = window->frames[ slot ];
+
+		if ( !neighbour || window->positions[ slot ] != neighbour_position )
+		{
+			mlt_frame_close( neighbour );
+			window->frames[ slot ] = NULL;
+			mlt_producer_seek( producer, neighbour_position );
+			if ( self->get_frame( self, &neighbour, index ) )
+				neighbour = NULL;
+			if ( neighbour )
+			{
+				// The lock behind mlt_frame_neighbour_lock, recursive because
+				// several filters of the same frame may hold it
+				pthread_mutex_t *mutex = malloc( sizeof( pthread_mutex_t ) );
+				if ( mutex )
+				{
+					pthread_mutexattr_t attr;
+					pthread_mutexattr_init( &attr );
+					pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+					pthread_mutex_init( mutex, &attr );
+					pthread_mutexattr_destroy( &attr );
+					mlt_properties_set_data( MLT_FRAME_PROPERTIES( neighbour ), "_neighbour_mutex", mutex, 0, ( mlt_destructor ) neighbour_mutex_close, NULL );
+				}
+			}
+			window->frames[ slot ] = neighbour;
+			window->positions[ slot ] = neighbour_position;
+		}
+
+		if ( neighbour && offset == 0 )
+		{
+			source = neighbour;
+		}
+		else if ( neighbour )
+		{
+			char key[ 32 ];
+			if ( offset == -1 )
+				strcpy( key, "previous frame" );
+			else if ( offset == 1 )
+				strcpy( key, "next frame" );
+			else
+				sprintf( key, "neighbour frame %d", offset );
+			mlt_properties_inc_ref( MLT_FRAME_PROPERTIES( neighbour ) );
+			mlt_properties_set_data( MLT_FRAME_PROPERTIES( *frame ), key, neighbour, 0, ( mlt_destructor ) mlt_frame_close, NULL );
+		}
+	}
+
+	// Restore the new position
+	mlt_producer_seek( producer, new_position );
+
+	if ( source )
+	{
+		mlt_properties frame_properties = MLT_FRAME_PROPERTIES( *frame );
+
+		mlt_properties_inherit( frame_properties, MLT_FRAME_PROPERTIES( source ) );
+		mlt_properties_set_data( frame_properties, "_producer", mlt_frame_get_original_producer( source ), 0, NULL, NULL );
+		mlt_properties_inc_ref( MLT_FRAME_PROPERTIES( source ) );
+		mlt_properties_set_data( frame_properties, "_temporal_source", source, 0, ( mlt_destructor ) mlt_frame_close, NULL );
+		mlt_frame_push_get_image( *frame, temporal_get_image );
+		mlt_frame_push_audio( *frame, temporal_get_audio );
+	}
+	else
+	{
+		mlt_frame_close( *frame );
+		*frame = NULL;
+	}
+
+	return source == NULL;
+}
+
 /** Obtain a frame.
  *
  * \public \memberof mlt_service_s
@@ -452,9 +731,21 @@ int mlt_service_get_frame( mlt_service self, mlt_frame_ptr frame, int index )
 		mlt_properties properties = MLT_SERVICE_PROPERTIES( self );
 		mlt_position in = mlt_properties_get_position( properties, "in" );
 		mlt_position out = mlt_properties_get_position( properties, "out" );
-		mlt_position position = mlt_service_identify( self ) == producer_type ? mlt_producer_position( MLT_PRODUCER( self ) ) : -1;
+		int is_producer = mlt_service_identify( self ) == producer_type;
+		mlt_position position = is_producer ? mlt_producer_position( MLT_PRODUCER( self ) ) : -1;
+		int radius = is_producer ? temporal_radius( self ) : 0;
+		mlt_trace_scope scope = mlt_trace_begin( self, "get_frame" );
 
-		result = self->get_frame( self, frame, index );
+		if ( radius > 0 )
+		{
+			result = temporal_get_frame( self, frame, position, index, radius );
+		}
+		else
+		{
+			if ( is_producer && mlt_properties_get_data( properties, "_temporal_window", NULL ) )
+				mlt_properties_set_data( properties, "_temporal_window", NULL, 0, NULL, NULL );
+			result = self->get_frame( self, frame, index );
+		}
 
 		if ( result == 0 )
 		{
@@ -468,35 +759,8 @@ int mlt_service_get_frame( mlt_service self, mlt_frame_ptr frame, int index )
 			}
 			mlt_service_apply_filters( self, *frame, 1 );
 			mlt_deque_push_back( MLT_FRAME_SERVICE_STACK( *frame ), self );
-			
-			if ( mlt_service_identify( self ) == producer_type &&
-			     mlt_properties_get_int( MLT_SERVICE_PROPERTIES( self ), "_need_previous_next" ) )
-			{
-				// Save the new position from self->get_frame
-				mlt_position new_position = mlt_producer_position( MLT_PRODUCER( self ) );
-				
-				// Get the preceding frame, unfiltered
-				mlt_frame previous_frame;
-				mlt_producer_seek( MLT_PRODUCER(self), position - 1 );
-				result = self->get_frame( self, &previous_frame, index );
-				if ( !result )
-					mlt_properties_set_data( properties, "previous frame",
-						previous_frame, 0, ( mlt_destructor ) mlt_frame_close, NULL );
-
-				// Get the following frame, unfiltered
-				mlt_frame next_frame;
-				mlt_producer_seek( MLT_PRODUCER(self), position + 1 );
-				result = self->get_frame( self, &next_frame, index );
-				if ( !result )
-				{
-					mlt_properties_set_data( properties, "next frame",
-						next_frame, 0, ( mlt_destructor ) mlt_frame_close, NULL );
-				}
-				
-				// Restore the new position
-				mlt_producer_seek( MLT_PRODUCER(self), new_position );
-			}
 		}
+		mlt_trace_end( scope, result == 0 ? *frame : NULL );
 	}
 
 	// Make sure we return a frame
@@ -744,6 +1008,7 @@ void mlt_service_close( mlt_service self )
 			int i = 0;
 			int count = base->filter_count;
 			mlt_events_block( MLT_SERVICE_PROPERTIES( self ), self );
+			mlt_trace_forget( self );
 			while( count -- )
 				mlt_service_detach( self, base->filters[ 0 ] );
 			free( base->filters );
@@ -53,6 +53,9 @@
  * \properties \em _unique_id is a unique identifier
  * \properties \em _need_previous_next boolean that instructs producers to get
  * preceding and following frames inside of \p mlt_service_get_frame
+ * \properties \em _temporal_radius the number of unfiltered neighbours on each side
+ * that a producer attaches to its frames, see \p mlt_frame_get_neighbour; producers
+ * use the largest value set on themselves or on their enabled filters
  */
 
 struct mlt_service_s
@@ -0,0 +1,721 @@
+/**
+ * \file mlt_trace.c
+ * \brief profiling instrumentation of services
+ * \see mlt_trace_scope_s
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ * \author agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "mlt_trace.h"
+#include "mlt_frame.h"
+#include "mlt_service.h"
+#include "mlt_properties.h"
+#include "mlt_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+/** the number of buckets in the table of traced services */
+#define SERVICE_BUCKETS (256)
+
+/** the maximum number of events kept for the trace dump */
+#define MAX_EVENTS (1 << 18)
+
+/** \brief Traced service class
+ *
+ * The statistics gathered for one service. Records are never freed until
+ * the trace is closed, so frames and scopes may refer to them after the
+ * service itself is gone.
+ */
+
+typedef struct trace_service_s
+{
+	void *service;                /**< the service, or NULL once it is closed */
+	char *name;                   /**< the mlt_service of the service */
+	char *id;                     /**< the id of the service, or its address */
+	int64_t calls;                /**< the number of scopes completed */
+	int64_t wall;                 /**< the total wall time in nanoseconds, including nested services */
+	int64_t self_wall;            /**< the wall time in nanoseconds, excluding nested services */
+	int64_t cpu;                  /**< the total thread CPU time in nanoseconds */
+	int64_t self_cpu;             /**< the thread CPU time in nanoseconds, excluding nested services */
+	int64_t allocs;               /**< the number of pool allocations */
+	int64_t alloc_bytes;          /**< the number of bytes requested from the pool */
+	int64_t conversions;          /**< the number of image and audio format conversions requested */
+	int64_t conversion_wall;      /**< the wall time in nanoseconds spent in those conversions */
+	struct trace_service_s *next; /**< the next record in the same bucket */
+	struct trace_service_s *all;  /**< the next record in order of creation */
+}
+*trace_service;
+
+/** \brief Trace scope class
+ *
+ * A scope times one call into a service. Scopes nest per thread so that the
+ * time of nested services can be subtracted, and allocations made while a
+ * scope is innermost are counted against its service.
+ */
+
+struct mlt_trace_scope_s
+{
+	trace_service owner;              /**< the service doing the work */
+	const char *category;             /**< what the service is doing */
+	char detail[32];                  /**< the formats of a conversion */
+	int64_t wall;                     /**< the wall clock at the start */
+	int64_t cpu;                      /**< the thread CPU clock at the start */
+	int64_t child_wall;               /**< the wall time of nested scopes */
+	int64_t child_cpu;                /**< the thread CPU time of nested scopes */
+	int64_t allocs;                   /**< the number of pool allocations */
+	int64_t alloc_bytes;              /**< the number of bytes allocated */
+	struct mlt_trace_scope_s *parent; /**< the enclosing scope on this thread */
+};
+
+/** One completed scope, kept for the trace dump. */
+
+typedef struct
+{
+	trace_service owner;
+	const char *category;
+	char detail[32];
+	mlt_position position;
+	int tid;
+	int64_t start;
+	int64_t wall;
+	int64_t cpu;
+	int64_t allocs;
+	int64_t alloc_bytes;
+} trace_event;
+
+/** The per thread state. */
+
+typedef struct
+{
+	mlt_trace_scope top;
+	int tid;
+} trace_thread;
+
+/** The callbacks pushed onto a frame and the services that pushed them. */
+
+typedef struct
+{
+	int count;
+	int size;
+	struct
+	{
+		void *callback;
+		trace_service owner;
+	} *items;
+} trace_owners;
+
+static volatile int g_enabled = 0;
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_thread_key;
+static int g_thread_count = 0;
+static int64_t g_epoch = 0;
+static trace_service g_buckets[ SERVICE_BUCKETS ];
+static trace_service g_all = NULL;
+static trace_service g_last = NULL;
+static trace_service g_unattributed = NULL;
+static trace_event *g_events = NULL;
+static int g_event_count = 0;
+static int g_event_size = 0;
+static int64_t g_dropped = 0;
+
+static int64_t wall_time( )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t cpu_time( )
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+	if ( !clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) )
+		return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+	return 0;
+}
+
+static void create_thread_key( )
+{
+	pthread_key_create( &g_thread_key, free );
+}
+
+static trace_thread *get_thread( )
+{
+	trace_thread *thread;
+	pthread_once( &g_once, create_thread_key );
+	thread = pthread_getspecific( g_thread_key );
+	if ( !thread )
+	{
+		thread = calloc( 1, sizeof( *thread ) );
+		if ( thread )
+		{
+			pthread_mutex_lock( &g_mutex );
+			thread->tid = ++g_thread_count;
+			pthread_mutex_unlock( &g_mutex );
+			pthread_setspecific( g_thread_key, thread );
+		}
+	}
+	return thread;
+}
+
+static unsigned int bucket( void *service )
+{
+	return ( (uintptr_t) service >> 4 ) % SERVICE_BUCKETS;
+}
+
+/** Get the record of a service, creating it on first sight.
+ *
+ * The caller must hold g_mutex.
+ */
+
+static trace_service get_service( mlt_service service )
+{
+	trace_service record = NULL;
+
+	if ( service )
+	{
+		record = g_buckets[ bucket( service ) ];
+		while ( record && record->service != service )
+			record = record->next;
+	}
+	else
+	{
+		record = g_unattributed;
+	}
+
+	if ( !record )
+	{
+		record = calloc( 1, sizeof( *record ) );
+		if ( !record )
+			return NULL;
+		if ( service )
+		{
+			mlt_properties properties = MLT_SERVICE_PROPERTIES( service );
+			const char *name = mlt_properties_get( properties, "mlt_service" );
+			const char *id = mlt_properties_get( properties, "id" );
+			char address[32];
+			if ( !name )
+				name = mlt_properties_get( properties, "mlt_type" );
+			if ( !id )
+			{
+				snprintf( address, sizeof( address ), "%p", service );
+				id = address;
+			}
+			record->service = service;
+			record->name = strdup( name ? name : "service" );
+			record->id = strdup( id );
+			record->next = g_buckets[ bucket( service ) ];
+			g_buckets[ bucket( service ) ] = record;
+		}
+		else
+		{
+			record->name = strdup( "unattributed" );
+			record->id = strdup( "" );
+			g_unattributed = record;
+		}
+		if ( g_last )
+			g_last->all = record;
+		else
+			g_all = record;
+		g_last = record;
+	}
+	return record;
+}
+
+static mlt_trace_scope scope_begin( trace_service owner, const char *category )
+{
+	trace_thread *thread = get_thread( );
+	mlt_trace_scope self = thread ? calloc( 1, sizeof( struct mlt_trace_scope_s ) ) : NULL;
+	if ( self )
+	{
+		self->owner = owner;
+		self->category = category;
+		self->parent = thread->top;
+		thread->top = self;
+		self->wall = wall_time( );
+		self->cpu = cpu_time( );
+	}
+	return self;
+}
+
+/** Turn the instrumentation on or off.
+ *
+ * Tracing is also turned on by mlt_factory_init when the MLT_TRACE environment
+ * variable is set, in which case mlt_factory_close writes the trace to the
+ * file it names.
+ * \public \memberof mlt_trace_scope_s
+ * \param enable whether to record
+ */
+
+void mlt_trace_enable( int enable )
+{
+	pthread_mutex_lock( &g_mutex );
+	if ( enable && !g_epoch )
+		g_epoch = wall_time( );
+	g_enabled = enable;
+	pthread_mutex_unlock( &g_mutex );
+}
+
+/** Determine if the instrumentation is recording.
+ *
+ * \public \memberof mlt_trace_scope_s
+ * \return true if recording
+ */
+
+int mlt_trace_is_enabled( )
+{
+	return g_enabled;
+}
+
+/** Clear the statistics and the events recorded so far.
+ *
+ * \public \memberof mlt_trace_scope_s
+ */
+
+void mlt_trace_reset( )
+{
+	trace_service record;
+
+	pthread_mutex_lock( &g_mutex );
+	for ( record = g_all; record; record = record->all )
+	{
+		record->calls = record->wall = record->self_wall = record->cpu = record->self_cpu = 0;
+		record->allocs = record->alloc_bytes = record->conversions = record->conversion_wall = 0;
+	}
+	g_event_count = 0;
+	g_dropped = 0;
+	g_epoch = wall_time( );
+	pthread_mutex_unlock( &g_mutex );
+}
+
+/** Get the statistics of every service traced.
+ *
+ * The result has one nested properties per service, named by index in the
+ * order in which the services were first seen, each holding \em service,
+ * \em id, \em calls, \em allocs, \em alloc_bytes and \em conversions, and
+ * the times \em wall, \em self_wall, \em cpu, \em self_cpu and
+ * \em conversion_wall in milliseconds. The self times exclude the nested
+ * services and the conversions the service asked for.
+ * \public \memberof mlt_trace_scope_s
+ * \return a new properties list that the caller must close
+ */
+
+mlt_properties mlt_trace_stats( )
+{
+	mlt_properties result = mlt_properties_new( );
+	trace_service record;
+	int i = 0;
+
+	if ( !result )
+		return NULL;
+	pthread_mutex_lock( &g_mutex );
+	for ( record = g_all; record; record = record->all )
+	{
+		mlt_properties stats;
+		char key[20];
+
+		if ( !record->calls && !record->allocs && !record->conversions )
+			continue;
+		stats = mlt_properties_new( );
+		if ( !stats )
+			break;
+		mlt_properties_set( stats, "service", record->name );
+		mlt_properties_set( stats, "id", record->id );
+		mlt_properties_set_int64( stats, "calls", record->calls );
+		mlt_properties_set_double( stats, "wall", record->wall / 1000000.0 );
+		mlt_properties_set_double( stats, "self_wall", record->self_wall / 1000000.0 );
+		mlt_properties_set_double( stats, "cpu", record->cpu / 1000000.0 );
+		mlt_properties_set_double( stats, "self_cpu", record->self_cpu / 1000000.0 );
+		mlt_properties_set_int64( stats, "allocs", record->allocs );
+		mlt_properties_set_int64( stats, "alloc_bytes", record->alloc_bytes );
+		mlt_properties_set_int64( stats, "conversions", record->conversions );
+		mlt_properties_set_double( stats, "conversion_wall", record->conversion_wall / 1000000.0 );
+		snprintf( key, sizeof( key ), "%d", i++ );
+		mlt_properties_set_data( result, key, stats, 0, (mlt_destructor) mlt_properties_close, NULL );
+	}
+	mlt_properties_set_int64( result, "dropped_events", g_dropped );
+	pthread_mutex_unlock( &g_mutex );
+
+	return result;
+}
+
+static void write_string( FILE *file, const char *s )
+{
+	fputc( '"', file );
+	for ( ; s && *s; s++ )
+	{
+		if ( *s == '"' || *s == '\\' )
+			fprintf( file, "\\%c", *s );
+		else if ( (unsigned char) *s < 0x20 )
+			fprintf( file, "\\u%04x", *s );
+		else
+			fputc( *s, file );
+	}
+	fputc( '"', file );
+}
+
+/** Write the events recorded as a Chrome trace.
+ *
+ * The file uses the trace event format of chrome://tracing and similar
+ * viewers. Each call into a service is a complete event named after the
+ * service, with the frame position, the thread CPU time and the pool
+ * allocations in its arguments. Format conversions are named after the
+ * formats and carry the service that requested them.
+ * \public \memberof mlt_trace_scope_s
+ * \param filename the file to write
+ * \return true if error
+ */
+
+int mlt_trace_write( const char *filename )
+{
+	FILE *file = fopen( filename, "w" );
+	int i;
+
+	if ( !file )
+	{
+		mlt_log_error( NULL, "[trace] unable to write %s\n", filename );
+		return 1;
+	}
+	pthread_mutex_lock( &g_mutex );
+	fprintf( file, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%lld},\"traceEvents\":[", (long long) g_dropped );
+	for ( i = 0; i < g_event_count; i++ )
+	{
+		trace_event *event = &g_events[i];
+		fprintf( file, "%s\n{\"name\":", i ? "," : "" );
+		write_string( file, event->detail[0] ? event->detail : event->owner->name );
+		fprintf( file, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"service\":",
+			event->category, event->start / 1000.0, event->wall / 1000.0, event->tid );
+		write_string( file, event->owner->name );
+		fprintf( file, ",\"id\":" );
+		write_string( file, event->owner->id );
+		fprintf( file, ",\"position\":%d,\"cpu\":%.3f,\"allocs\":%lld,\"alloc_bytes\":%lld}}",
+			event->position, event->cpu / 1000.0, (long long) event->allocs, (long long) event->alloc_bytes );
+	}
+	fprintf( file, "\n]}\n" );
+	pthread_mutex_unlock( &g_mutex );
+
+	return fclose( file ) != 0;
+}
+
+/** Stop recording and release everything recorded.
+ *
+ * \public \memberof mlt_trace_scope_s
+ */
+
+void mlt_trace_close( )
+{
+	trace_service record;
+
+	pthread_mutex_lock( &g_mutex );
+	g_enabled = 0;
+	record = g_all;
+	while ( record )
+	{
+		trace_service next = record->all;
+		free( record->name );
+		free( record->id );
+		free( record );
+		record = next;
+	}
+	memset( g_buckets, 0, sizeof( g_buckets ) );
+	g_all = g_last = g_unattributed = NULL;
+	free( g_events );
+	g_events = NULL;
+	g_event_count = g_event_size = 0;
+	g_dropped = 0;
+	g_epoch = 0;
+	pthread_mutex_unlock( &g_mutex );
+}
+
+/** Start timing a call into a service.
+ *
+ * \public \memberof mlt_trace_scope_s
+ * \param service the service doing the work
+ * \param category a static string describing the work, for example "get_frame"
+ * \return a scope to pass to mlt_trace_end, or NULL when not recording
+ */
+
+mlt_trace_scope mlt_trace_begin( mlt_service service, const char *category )
+{
+	trace_service owner;
+
+	if ( !g_enabled )
+		return NULL;
+	pthread_mutex_lock( &g_mutex );
+	owner = get_service( service );
+	pthread_mutex_unlock( &g_mutex );
+	return owner ? scope_begin( owner, category ) : NULL;
+}
+
+/** Start timing a callback popped from a frame's image or audio stack.
+ *
+ * The time is attributed to the service whose scope was innermost when the
+ * callback was pushed with mlt_trace_push.
+ * \public \memberof mlt_trace_scope_s
+ * \param frame the frame
+ * \param callback the callback about to be called
+ * \param category a static string describing the work, for example "get_image"
+ * \return a scope to pass to mlt_trace_end, or NULL when not recording
+ */
+
+mlt_trace_scope mlt_trace_begin_callback( mlt_frame frame, void *callback, const char *category )
+{
+	trace_owners *owners;
+	trace_service owner = NULL;
+	int i;
+
+	if ( !g_enabled )
+		return NULL;
+	owners = mlt_properties_get_data( MLT_FRAME_PROPERTIES( frame ), "_trace_owners", NULL );
+	if ( owners )
+	{
+		for ( i = owners->count - 1; i >= 0; i-- )
+		{
+			if ( owners->items[i].callback == callback )
+			{
+				owner = owners->items[i].owner;
+				owners->count--;
+				memmove( &owners->items[i], &owners->items[i + 1], ( owners->count - i ) * sizeof( owners->items[0] ) );
+				break;
+			}
+		}
+	}
+	if ( !owner )
+	{
+		pthread_mutex_lock( &g_mutex );
+		owner = get_service( NULL );
+		pthread_mutex_unlock( &g_mutex );
+	}
+	return owner ? scope_begin( owner, category ) : NULL;
+}
+
+/** Start timing a format conversion.
+ *
+ * The conversion is attributed to the service whose scope is innermost,
+ * which is the one that asked for a format the frame did not have.
+ * \public \memberof mlt_trace_scope_s
+ * \param category a static string describing the work, for example "convert_image"
+ * \param from the name of the current format
+ * \param to the name of the requested format
+ * \return a scope to pass to mlt_trace_end, or NULL when not recording
+ */
+
+mlt_trace_scope mlt_trace_begin_convert( const char *category, const char *from, const char *to )
+{
+	trace_thread *thread;
+	trace_service owner;
+	mlt_trace_scope self;
+
+	if ( !g_enabled )
+		return NULL;
+	thread = get_thread( );
+	if ( thread && thread->top )
+	{
+		owner = thread->top->owner;
+	}
+	else
+	{
+		pthread_mutex_lock( &g_mutex );
+		owner = get_service( NULL );
+		pthread_mutex_unlock( &g_mutex );
+	}
+	self = owner ? scope_begin( owner, category ) : NULL;
+	if ( self )
+		snprintf( self->detail, sizeof( self->detail ), "%s>%s", from, to );
+	return self;
+}
+
+/** Stop timing and record a scope.
+ *
+ * Scopes must end in the reverse order in which they began on each thread.
+ * \public \memberof mlt_trace_scope_s
+ * \param self a scope, which may be NULL
+ * \param frame the frame worked on, or NULL
+ */
+
+void mlt_trace_end( mlt_trace_scope self, mlt_frame frame )
+{
+	trace_thread *thread;
+	trace_service owner;
+	int64_t wall, cpu;
+
+	if ( !self )
+		return;
+	wall = wall_time( ) - self->wall;
+	cpu = cpu_time( ) - self->cpu;
+	owner = self->owner;
+
+	thread = get_thread( );
+	if ( thread )
+		thread->top = self->parent;
+	if ( self->parent )
+	{
+		self->parent->child_wall += wall;
+		self->parent->child_cpu += cpu;
+	}
+
+	pthread_mutex_lock( &g_mutex );
+	if ( self->detail[0] )
+	{
+		owner->conversions++;
+		owner->conversion_wall += wall;
+	}
+	else
+	{
+		owner->calls++;
+		owner->wall += wall;
+		owner->self_wall += wall - self->child_wall;
+		owner->cpu += cpu;
+		owner->self_cpu += cpu - self->child_cpu;
+	}
+	owner->allocs += self->allocs;
+	owner->alloc_bytes += self->alloc_bytes;
+
+	if ( g_enabled && g_event_count == g_event_size && g_event_size < MAX_EVENTS )
+	{
+		int size = g_event_size ? g_event_size * 2 : 1024;
+		trace_event *events = realloc( g_events, size * sizeof( trace_event ) );
+		if ( events )
+		{
+			g_events = events;
+			g_event_size = size;
+		}
+	}
+	if ( !g_enabled )
+	{
+		// Stopped recording while this scope was open
+	}
+	else if ( g_event_count < g_event_size )
+	{
+		trace_event *event = &g_events[ g_event_count++ ];
+		event->owner = owner;
+		event->category = self->category;
+		memcpy( event->detail, self->detail, sizeof( event->detail ) );
+		event->position = frame ? mlt_frame_get_position( frame ) : -1;
+		event->tid = thread ? thread->tid : 0;
+		event->start = self->wall - g_epoch;
+		event->wall = wall;
+		event->cpu = cpu;
+		event->allocs = self->allocs;
+		event->alloc_bytes = self->alloc_bytes;
+	}
+	else
+	{
+		g_dropped++;
+	}
+	pthread_mutex_unlock( &g_mutex );
+
+	free( self );
+}
+
+static void owners_close( trace_owners *owners )
+{
+	free( owners->items );
+	free( owners );
+}
+
+/** Note which service pushed something onto a frame's image or audio stack.
+ *
+ * \public \memberof mlt_trace_scope_s
+ * \param frame the frame
+ * \param callback the callback or data pushed
+ */
+
+void mlt_trace_push( mlt_frame frame, void *callback )
+{
+	trace_thread *thread;
+	trace_owners *owners;
+
+	if ( !g_enabled )
+		return;
+	thread = get_thread( );
+	if ( !thread || !thread->top )
+		return;
+	owners = mlt_properties_get_data( MLT_FRAME_PROPERTIES( frame ), "_trace_owners", NULL );
+	if ( !owners )
+	{
+		owners = calloc( 1, sizeof( *owners ) );
+		if ( !owners )
+			return;
+		mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), "_trace_owners", owners, 0, (mlt_destructor) owners_close, NULL );
+	}
+	if ( owners->count == owners->size )
+	{
+		int size = owners->size ? owners->size * 2 : 16;
+		void *items = realloc( owners->items, size * sizeof( owners->items[0] ) );
+		if ( !items )
+			return;
+		owners->items = items;
+		owners->size = size;
+	}
+	owners->items[ owners->count ].callback = callback;
+	owners->items[ owners->count ].owner = thread->top->owner;
+	owners->count++;
+}
+
+/** Count a pool allocation against the innermost scope.
+ *
+ * \public \memberof mlt_trace_scope_s
+ * \param size the number of bytes requested
+ */
+
+void mlt_trace_alloc( int size )
+{
+	trace_thread *thread;
+
+	if ( !g_enabled )
+		return;
+	thread = get_thread( );
+	if ( thread && thread->top )
+	{
+		thread->top->allocs++;
+		thread->top->alloc_bytes += size;
+	}
+}
+
+/** Detach the record of a service that is being closed.
+ *
+ * Its statistics are kept, but a new service at the same address gets a new record.
+ * \public \memberof mlt_trace_scope_s
+ * \param service the service
+ */
+
+void mlt_trace_forget( mlt_service service )
+{
+	trace_service *record;
+
+	if ( !g_all )
+		return;
+	pthread_mutex_lock( &g_mutex );
+	record = &g_buckets[ bucket( service ) ];
+	while ( *record && (*record)->service != service )
+		record = &(*record)->next;
+	if ( *record )
+	{
+		(*record)->service = NULL;
+		*record = (*record)->next;
+	}
+	pthread_mutex_unlock( &g_mutex );
+}
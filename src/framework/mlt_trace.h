@@ -0,0 +1,44 @@
+/**
+ * \file mlt_trace.h
+ * \brief profiling instrumentation of services
+ * \see mlt_trace_scope_s
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ * \author agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _MLT_TRACE_H
+#define _MLT_TRACE_H
+
+#include "mlt_types.h"
+
+extern void mlt_trace_enable( int enable );
+extern int mlt_trace_is_enabled( );
+extern void mlt_trace_reset( );
+extern mlt_properties mlt_trace_stats( );
+extern int mlt_trace_write( const char *filename );
+extern void mlt_trace_close( );
+
+extern mlt_trace_scope mlt_trace_begin( mlt_service service, const char *category );
+extern mlt_trace_scope mlt_trace_begin_callback( mlt_frame frame, void *callback, const char *category );
+extern mlt_trace_scope mlt_trace_begin_convert( const char *category, const char *from, const char *to );
+extern void mlt_trace_end( mlt_trace_scope scope, mlt_frame frame );
+extern void mlt_trace_push( mlt_frame frame, void *callback );
+extern void mlt_trace_alloc( int size );
+extern void mlt_trace_forget( mlt_service service );
+
+#endif
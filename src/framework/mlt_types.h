@@ -160,11 +160,13 @@ typedef struct mlt_parser_s *mlt_parser;                /**< pointer to Properti
 typedef struct mlt_deque_s *mlt_deque;                  /**< pointer to Deque object */
 typedef struct mlt_geometry_s *mlt_geometry;            /**< pointer to Geometry object */
 typedef struct mlt_geometry_item_s *mlt_geometry_item;  /**< pointer to Geometry Item object */
+typedef struct mlt_geometry_compiled_s *mlt_geometry_compiled; /**< pointer to compiled, read-only Geometry object */
 typedef struct mlt_profile_s *mlt_profile;              /**< pointer to Profile object */
 typedef struct mlt_repository_s *mlt_repository;        /**< pointer to Repository object */
 typedef struct mlt_cache_s *mlt_cache;                  /**< pointer to Cache object */
 typedef struct mlt_cache_item_s *mlt_cache_item;        /**< pointer to CacheItem object */
 typedef struct mlt_animation_s *mlt_animation;          /**< pointer to Property Animation object */
+typedef struct mlt_trace_scope_s *mlt_trace_scope;      /**< pointer to Trace Scope object */
 
 typedef void ( *mlt_destructor )( void * );             /**< pointer to destructor function */
 typedef char *( *mlt_serialiser )( void *, int length );/**< pointer to serialization function */
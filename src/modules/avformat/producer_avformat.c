@@ -47,6 +47,8 @@
 #include <string.h>
 #include <pthread.h>
 #include <limits.h>
+#include <math.h>
+#include <sys/time.h>
 
 #if LIBAVCODEC_VERSION_MAJOR >= 53
 #include <libavutil/opt.h>
@@ -62,12 +64,32 @@
 #define AV_CODEC_ID_H264    CODEC_ID_H264
 #endif
 
+// Decoded pictures can be shared with frames instead of copied
+#if LIBAVCODEC_VERSION_INT >= ((55<<16)+(39<<8)+0)
+#define USE_REFCOUNTED_FRAMES
+#endif
+
 #define POSITION_INITIAL (-2)
 #define POSITION_INVALID (-1)
 
 #define MAX_AUDIO_STREAMS (32)
 #define MAX_VDPAU_SURFACES (10)
 #define MAX_AUDIO_FRAME_SIZE (192000) // 1 second of 48khz 32bit audio
+#define AUDIO_CACHE_FRAMES (50)
+
+/** A block of decoded audio, as returned for one frame, addressed by sample. */
+
+typedef struct
+{
+	int64_t start;    // first sample at frequency
+	int samples;
+	int channels;
+	int frequency;
+	int index;        // audio_index at the time of decoding
+	mlt_audio_format format;
+	uint8_t *data;
+	int size;
+} audio_cache_entry;
 
 struct producer_avformat_s
 {
@@ -78,6 +100,7 @@ struct producer_avformat_s
 	AVCodecContext *audio_codec[ MAX_AUDIO_STREAMS ];
 	AVCodecContext *video_codec;
 	AVFrame *video_frame;
+	AVFrame *decode_frame; // receives the next picture when refcounted
 	AVFrame *audio_frame;
 	AVPacket pkt;
 	mlt_position audio_expected;
@@ -114,6 +137,40 @@ struct producer_avformat_s
 	AVRational video_time_base;
 	mlt_frame last_good_frame; // for video error concealment
 	int last_good_position;    // for video error concealment
+	AVInputFormat *input_format; // retained to reopen without probing
+	// decoder context pool (see pool_acquire)
+	int is_pooled;
+	int is_suspended;
+	int is_probed; // closed after probing, to be opened on first use
+	int pool_refs;
+	int64_t last_access;
+	int64_t pool_memory;
+	int reopen_count;
+	int is_refcounted;
+	struct producer_avformat_s *pool_prev;
+	struct producer_avformat_s *pool_next;
+	// decoded audio cache (see audio_cache_fetch)
+	audio_cache_entry *audio_cache;
+	int audio_cache_size;
+	int audio_cache_next;
+	// sample accurate audio seeking
+	int sample_accurate;
+	int audio_seek_pending;
+	int64_t audio_seek_target;
+	int64_t audio_next_sample;
+	// read-ahead video decoding (see prefetch_thread)
+	pthread_t prefetch_thread;
+	pthread_mutex_t prefetch_mutex;
+	pthread_cond_t prefetch_cond;
+	int prefetch_started;
+	int prefetch_stop;
+	int prefetch_active;
+	int prefetch_count;
+	int prefetch_generation;
+	mlt_position prefetch_last;
+	mlt_position prefetch_next;
+	mlt_image_format prefetch_format;
+	char *prefetch_interp;
 #ifdef VDPAU
 	struct
 	{
@@ -147,11 +204,234 @@ static int video_codec_init( producer_avformat self, int index, mlt_properties p
 static void get_audio_streams_info( producer_avformat self );
 static mlt_audio_format pick_audio_format( int sample_fmt );
 static int pick_av_pixel_format( int *pix_fmt );
+static void close_contexts( producer_avformat self );
+static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable );
+static int image_layout_matches( producer_avformat self, AVFrame *frame, int pix_fmt, mlt_image_format format, int width, int height );
+static void copy_image( AVFrame *frame, uint8_t *buffer, mlt_image_format format, int width, int height );
 
 #ifdef VDPAU
 #include "vdpau.c"
 #endif
 
+/** Release the last decoded picture.
+*/
+
+static void free_video_frame( producer_avformat self )
+{
+#ifdef USE_REFCOUNTED_FRAMES
+	if ( self->video_frame )
+		av_frame_unref( self->video_frame );
+	if ( self->decode_frame )
+		av_frame_unref( self->decode_frame );
+	av_freep( &self->decode_frame );
+#endif
+	av_freep( &self->video_frame );
+}
+
+/** The decoder context pool.
+ *
+ * When MLT_AVFORMAT_MAX_OPEN (a number of producers) or MLT_AVFORMAT_MAX_MEMORY
+ * (in MiB) is set, producers are not kept in the "producer_avformat" service
+ * cache, which destroys the producer state when it evicts. Instead, every
+ * producer stays in a list ordered by last access, and when the limits are
+ * exceeded the least recently used idle producers are suspended: their format
+ * and codec contexts are closed, but the probed stream information is kept so
+ * that resuming does not need to probe the file again.
+ */
+
+static struct
+{
+	pthread_mutex_t mutex;
+	pthread_once_t once;
+	int max_open;
+	int64_t max_memory;
+	producer_avformat head; // least recently used
+	producer_avformat tail; // most recently used
+	int reopens;
+} avformat_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_ONCE_INIT };
+
+static void pool_init_once( void )
+{
+	if ( getenv( "MLT_AVFORMAT_MAX_OPEN" ) )
+		avformat_pool.max_open = atoi( getenv( "MLT_AVFORMAT_MAX_OPEN" ) );
+	if ( getenv( "MLT_AVFORMAT_MAX_MEMORY" ) )
+		avformat_pool.max_memory = (int64_t) atoi( getenv( "MLT_AVFORMAT_MAX_MEMORY" ) ) << 20;
+}
+
+static int pool_enabled( void )
+{
+	pthread_once( &avformat_pool.once, pool_init_once );
+	return avformat_pool.max_open > 0 || avformat_pool.max_memory > 0;
+}
+
+static int64_t pool_time( void )
+{
+	struct timeval now;
+	gettimeofday( &now, NULL );
+	return (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static int pool_is_open( producer_avformat self )
+{
+	return self->video_format || self->audio_format;
+}
+
+/** Estimate the memory held by the open decoders of a producer.
+*/
+
+static int64_t pool_estimate_memory( producer_avformat self )
+{
+	int64_t memory = 0;
+	int i;
+
+	if ( self->video_codec && self->video_codec->width > 0 && self->video_codec->height > 0 )
+	{
+		// The decoder holds reference frames and one frame per thread.
+		int frames = 2 + FFMAX( self->video_codec->thread_count, 1 ) + FFMAX( self->video_codec->has_b_frames, 0 );
+		memory += (int64_t) self->video_codec->width * self->video_codec->height * 3 / 2 * frames;
+	}
+	for ( i = 0; i < MAX_AUDIO_STREAMS; i++ )
+		if ( self->audio_buffer[ i ] )
+			memory += self->audio_buffer_size[ i ] + MAX_AUDIO_FRAME_SIZE;
+	return memory;
+}
+
+static void pool_unlink( producer_avformat self )
+{
+	if ( self->pool_prev )
+		self->pool_prev->pool_next = self->pool_next;
+	else if ( avformat_pool.head == self )
+		avformat_pool.head = self->pool_next;
+	if ( self->pool_next )
+		self->pool_next->pool_prev = self->pool_prev;
+	else if ( avformat_pool.tail == self )
+		avformat_pool.tail = self->pool_prev;
+	self->pool_prev = self->pool_next = NULL;
+}
+
+static void pool_append( producer_avformat self )
+{
+	self->pool_prev = avformat_pool.tail;
+	self->pool_next = NULL;
+	if ( avformat_pool.tail )
+		avformat_pool.tail->pool_next = self;
+	else
+		avformat_pool.head = self;
+	avformat_pool.tail = self;
+}
+
+/** Close the contexts of an idle producer, keeping its stream information.
+ *
+ * This must be called with the pool mutex held, and it never blocks on the
+ * producer's own mutexes so that it cannot deadlock with its render thread.
+ * \return true if the producer was suspended
+ */
+
+static int pool_suspend( producer_avformat self )
+{
+	// Live sources cannot be reopened where they left off.
+	if ( !self->seekable || self->pool_refs > 1 || pthread_mutex_trylock( &self->video_mutex ) )
+		return 0;
+	if ( pthread_mutex_trylock( &self->audio_mutex ) )
+	{
+		pthread_mutex_unlock( &self->video_mutex );
+		return 0;
+	}
+	pthread_mutex_lock( &self->open_mutex );
+	close_contexts( self );
+	pthread_mutex_unlock( &self->open_mutex );
+	free_video_frame( self );
+	self->is_suspended = 1;
+	self->pool_memory = 0;
+	pthread_mutex_unlock( &self->audio_mutex );
+	pthread_mutex_unlock( &self->video_mutex );
+	mlt_log_debug( MLT_PRODUCER_SERVICE( self->parent ), "suspended decoder idle for %"PRId64" ms\n",
+		( pool_time() - self->last_access ) / 1000 );
+	return 1;
+}
+
+/** Add a producer to the pool.
+*/
+
+static void pool_add( producer_avformat self )
+{
+	pthread_mutex_lock( &avformat_pool.mutex );
+	self->is_pooled = 1;
+	self->pool_refs = 1;
+	self->last_access = pool_time();
+	pool_append( self );
+	pthread_mutex_unlock( &avformat_pool.mutex );
+}
+
+/** Reference a producer for a new frame and make room for it to be open.
+ *
+ * The producer becomes the most recently used, and least recently used idle
+ * producers are suspended while the open count or memory exceed the limits.
+ */
+
+static void pool_acquire( producer_avformat self )
+{
+	producer_avformat p;
+	int open_count = 1;
+	int64_t memory;
+
+	pthread_mutex_lock( &avformat_pool.mutex );
+	self->pool_refs ++;
+	self->last_access = pool_time();
+	self->pool_memory = pool_estimate_memory( self );
+	pool_unlink( self );
+	pool_append( self );
+
+	memory = self->pool_memory;
+	for ( p = avformat_pool.head; p != self; p = p->pool_next )
+	{
+		if ( pool_is_open( p ) )
+		{
+			open_count ++;
+			memory += p->pool_memory;
+		}
+	}
+	for ( p = avformat_pool.head; p != self &&
+		  ( ( avformat_pool.max_open > 0 && open_count > avformat_pool.max_open ) ||
+		    ( avformat_pool.max_memory > 0 && memory > avformat_pool.max_memory ) );
+		  p = p->pool_next )
+	{
+		int64_t p_memory = p->pool_memory;
+		if ( pool_is_open( p ) && pool_suspend( p ) )
+		{
+			open_count --;
+			memory -= p_memory;
+		}
+	}
+	mlt_properties_set_int( mlt_global_properties(), "avformat.open_count", open_count );
+	pthread_mutex_unlock( &avformat_pool.mutex );
+}
+
+/** Release a reference, destroying the producer state with the last one.
+*/
+
+static void pool_release( producer_avformat self )
+{
+	int refs;
+
+	pthread_mutex_lock( &avformat_pool.mutex );
+	refs = -- self->pool_refs;
+	pthread_mutex_unlock( &avformat_pool.mutex );
+	if ( refs <= 0 )
+		producer_avformat_close( self );
+}
+
+/** Remove a closing producer from the pool and release its own reference.
+*/
+
+static void pool_remove( producer_avformat self )
+{
+	pthread_mutex_lock( &avformat_pool.mutex );
+	pool_unlink( self );
+	pthread_mutex_unlock( &avformat_pool.mutex );
+	pool_release( self );
+}
+
 /** Constructor for libavformat.
 */
 
@@ -213,6 +493,7 @@ mlt_producer producer_avformat_init( mlt_profile profile, const char *service, c
 #endif
 					self->audio_format = NULL;
 					self->video_format = NULL;
+					self->is_probed = pool_enabled();
 				}
 			}
 			if ( producer )
@@ -223,7 +504,10 @@ mlt_producer producer_avformat_init( mlt_profile profile, const char *service, c
 #ifdef VDPAU
 				mlt_service_cache_set_size( MLT_PRODUCER_SERVICE(producer), "producer_avformat", 5 );
 #endif
-				mlt_service_cache_put( MLT_PRODUCER_SERVICE(producer), "producer_avformat", self, 0, (mlt_destructor) producer_avformat_close );
+				if ( pool_enabled() )
+					pool_add( self );
+				else
+					mlt_service_cache_put( MLT_PRODUCER_SERVICE(producer), "producer_avformat", self, 0, (mlt_destructor) producer_avformat_close );
 			}
 		}
 	}
@@ -679,6 +963,112 @@ static int get_basic_info( producer_avformat self, mlt_profile profile, const ch
 	return error;
 }
 
+#if LIBAVFORMAT_VERSION_INT > ((53<<16)+(6<<8)+0)
+
+/** Open a format context for a file that was already probed.
+*/
+
+static int reopen_input( producer_avformat self, AVFormatContext **context, const char *filename,
+	const char *URL, AVInputFormat *format, AVDictionary **params )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	int error = avformat_open_input( context, filename, format, params ) < 0;
+	if ( error )
+		error = avformat_open_input( context, URL, format, params ) < 0;
+	if ( !error )
+	{
+		apply_properties( *context, properties, AV_OPT_FLAG_DECODING_PARAM );
+		if ( (*context)->iformat && (*context)->iformat->priv_class && (*context)->priv_data )
+			apply_properties( (*context)->priv_data, properties, AV_OPT_FLAG_DECODING_PARAM );
+		// Only formats without a header need their packets analyzed to find the streams.
+		if ( (*context)->ctx_flags & AVFMTCTX_NOHEADER )
+			error = avformat_find_stream_info( *context, NULL ) < 0;
+	}
+	return error;
+}
+
+/** Reopen a suspended file reusing the stream information found by producer_open.
+*/
+
+static int producer_resume( producer_avformat self, mlt_profile profile, const char *URL, int take_lock )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	AVInputFormat *format = NULL;
+	AVDictionary *params = NULL;
+	int error = 0;
+	int i;
+
+	if ( take_lock )
+	{
+		pthread_mutex_lock( &self->audio_mutex );
+		pthread_mutex_lock( &self->video_mutex );
+	}
+	mlt_events_block( properties, self->parent );
+
+	// The first open after probing is not a resume.
+	int was_suspended = self->is_suspended;
+
+	char *filename = parse_url( profile, URL, &format, &params );
+	if ( !format )
+		format = self->input_format;
+
+	error = reopen_input( self, &self->video_format, filename, URL, format, &params );
+	av_dict_free( &params );
+	if ( !error )
+	{
+		if ( self->audio_index != -1 && self->video_index != -1 )
+			error = reopen_input( self, &self->audio_format, filename, URL, format, NULL );
+		else if ( self->audio_index != -1 )
+		{
+			self->audio_format = self->video_format;
+			self->video_format = NULL;
+		}
+	}
+	free( filename );
+
+	if ( !error )
+	{
+		self->apackets = mlt_deque_init();
+		self->vpackets = mlt_deque_init();
+
+		// Force both audio and video to seek on the next request.
+		if ( self->last_position != POSITION_INITIAL )
+			self->last_position = POSITION_INVALID;
+		self->video_expected = self->audio_expected = INT_MAX;
+		for ( i = 0; i < MAX_AUDIO_STREAMS; i++ )
+			self->audio_used[i] = 0;
+		self->is_suspended = 0;
+		self->is_probed = 0;
+
+		if ( was_suspended )
+		{
+			pthread_mutex_lock( &avformat_pool.mutex );
+			avformat_pool.reopens ++;
+			mlt_properties_set_int( mlt_global_properties(), "avformat.reopens", avformat_pool.reopens );
+			pthread_mutex_unlock( &avformat_pool.mutex );
+			mlt_properties_set_int( properties, "reopen_count", ++self->reopen_count );
+		}
+	}
+	else
+	{
+		mlt_log_warning( MLT_PRODUCER_SERVICE( self->parent ), "failed to resume %s\n", URL );
+		if ( self->video_format )
+			avformat_close_input( &self->video_format );
+		if ( self->audio_format )
+			avformat_close_input( &self->audio_format );
+	}
+
+	if ( take_lock )
+	{
+		pthread_mutex_unlock( &self->audio_mutex );
+		pthread_mutex_unlock( &self->video_mutex );
+	}
+	mlt_events_unblock( properties, self->parent );
+
+	return error;
+}
+#endif
+
 /** Open the file.
 */
 
@@ -694,9 +1084,19 @@ static int producer_open( producer_avformat self, mlt_profile profile, const cha
 		pthread_mutex_init( &self->video_mutex, NULL );
 		pthread_mutex_init( &self->packets_mutex, NULL );
 		pthread_mutex_init( &self->open_mutex, NULL );
+		pthread_mutex_init( &self->prefetch_mutex, NULL );
+		pthread_cond_init( &self->prefetch_cond, NULL );
+		self->prefetch_last = POSITION_INVALID;
 		self->is_mutex_init = 1;
 	}
 
+#if LIBAVFORMAT_VERSION_INT > ((53<<16)+(6<<8)+0)
+	if ( ( self->is_suspended || self->is_probed ) && self->input_format )
+		return producer_resume( self, profile, URL, take_lock );
+#endif
+	self->is_suspended = 0;
+	self->is_probed = 0;
+
 	// Lock the service
 	if ( take_lock )
 	{
@@ -757,6 +1157,8 @@ static int producer_open( producer_avformat self, mlt_profile profile, const cha
 		// Continue if no error
 		if ( !error && self->video_format )
 		{
+			self->input_format = self->video_format->iformat;
+
 			// Find default audio and video streams
 			find_default_streams( self );
 			error = get_basic_info( self, profile, filename );
@@ -843,12 +1245,13 @@ static int producer_open( producer_avformat self, mlt_profile profile, const cha
 	return error;
 }
 
-static void prepare_reopen( producer_avformat self )
-{
-	mlt_service_lock( MLT_PRODUCER_SERVICE( self->parent ) );
-	pthread_mutex_lock( &self->audio_mutex );
-	pthread_mutex_lock( &self->open_mutex );
+/** Close the codecs and format contexts and drop queued packets.
+ *
+ * The caller must hold the audio and open mutexes.
+ */
 
+static void close_contexts( producer_avformat self )
+{
 	int i;
 	for ( i = 0; i < MAX_AUDIO_STREAMS; i++ )
 	{
@@ -877,7 +1280,6 @@ static void prepare_reopen( producer_avformat self )
 #endif
 	self->audio_format = NULL;
 	self->video_format = NULL;
-	pthread_mutex_unlock( &self->open_mutex );
 
 	// Cleanup the packet queues
 	AVPacket *pkt;
@@ -901,6 +1303,15 @@ static void prepare_reopen( producer_avformat self )
 		mlt_deque_close( self->vpackets );
 		self->vpackets = NULL;
 	}
+}
+
+static void prepare_reopen( producer_avformat self )
+{
+	mlt_service_lock( MLT_PRODUCER_SERVICE( self->parent ) );
+	pthread_mutex_lock( &self->audio_mutex );
+	pthread_mutex_lock( &self->open_mutex );
+	close_contexts( self );
+	pthread_mutex_unlock( &self->open_mutex );
 	pthread_mutex_unlock( &self->audio_mutex );
 	mlt_service_unlock( MLT_PRODUCER_SERVICE( self->parent ) );
 }
@@ -999,7 +1410,7 @@ static int seek_video( producer_avformat self, mlt_position position,
 			// Remove the cached info relating to the previous position
 			self->current_position = POSITION_INVALID;
 			self->last_position = POSITION_INVALID;
-			av_freep( &self->video_frame );
+			free_video_frame( self );
 		}
 	}
 	return paused;
@@ -1230,6 +1641,13 @@ static int convert_image( producer_avformat self, AVFrame *frame, uint8_t *buffe
 			memcpy( dst, src, FFMIN( width, frame->linesize[3] ) );
 	}
 
+	// Skip swscale when only the padding differs
+	if ( image_layout_matches( self, frame, pix_fmt, *format, width, height ) )
+	{
+		copy_image( frame, buffer, *format, width, height );
+		return result;
+	}
+
 	int src_pix_fmt = pix_fmt;
 	pick_av_pixel_format( &src_pix_fmt );
 	if ( *format == mlt_image_yuv420p )
@@ -1303,6 +1721,143 @@ static int convert_image( producer_avformat self, AVFrame *frame, uint8_t *buffe
 	return result;
 }
 
+/** Determine whether a decoded picture is already in the requested image format.
+ *
+ * \return 0 if it must be converted, 1 if only the plane padding differs,
+ * or 2 if the picture has exactly the layout of an MLT image
+*/
+
+static int image_layout_matches( producer_avformat self, AVFrame *frame, int pix_fmt, mlt_image_format format, int width, int height )
+{
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( self->parent ) );
+	int same_yuv = !self->full_luma && self->yuv_colorspace == profile->colorspace;
+
+	if ( !frame->data[0] )
+		return 0;
+	switch ( format )
+	{
+	case mlt_image_yuv420p:
+		if ( pix_fmt != PIX_FMT_YUV420P || !same_yuv || ( width & 1 ) || ( height & 1 ) )
+			return 0;
+		return ( frame->linesize[0] == width && frame->linesize[1] == width / 2 && frame->linesize[2] == width / 2 &&
+		         frame->data[1] == frame->data[0] + width * height &&
+		         frame->data[2] == frame->data[1] + width * height / 4 ) ? 2 : 1;
+	case mlt_image_yuv422:
+		if ( pix_fmt != PIX_FMT_YUYV422 || !same_yuv )
+			return 0;
+		return frame->linesize[0] == width * 2 ? 2 : 1;
+	case mlt_image_rgb24:
+		if ( pix_fmt != PIX_FMT_RGB24 )
+			return 0;
+		return frame->linesize[0] == width * 3 ? 2 : 1;
+	case mlt_image_rgb24a:
+		if ( pix_fmt != PIX_FMT_RGBA )
+			return 0;
+		return frame->linesize[0] == width * 4 ? 2 : 1;
+	default:
+		return 0;
+	}
+}
+
+/** Copy a picture that only differs from the MLT image by its plane padding.
+*/
+
+static void copy_image( AVFrame *frame, uint8_t *buffer, mlt_image_format format, int width, int height )
+{
+	int planes = format == mlt_image_yuv420p ? 3 : 1;
+	int bytes = format == mlt_image_yuv420p ? 1 : format == mlt_image_yuv422 ? 2 : format == mlt_image_rgb24 ? 3 : 4;
+	int p, y;
+
+	for ( p = 0; p < planes; p++ )
+	{
+		int plane_width = p ? width / 2 : width;
+		int plane_height = p ? height / 2 : height;
+		uint8_t *src = frame->data[p];
+		for ( y = 0; y < plane_height; y++ )
+		{
+			memcpy( buffer, src, plane_width * bytes );
+			buffer += plane_width * bytes;
+			src += frame->linesize[p];
+		}
+	}
+}
+
+#ifdef USE_REFCOUNTED_FRAMES
+static void release_frame_reference( AVFrame *frame )
+{
+	av_frame_free( &frame );
+}
+#endif
+
+/** Hand the decoded picture to the frame without copying it.
+ *
+ * This is only possible when the picture is reference counted, the caller
+ * does not need to write to the image, and the picture already has the
+ * layout of the requested MLT image.
+ * \return the image size, or 0 if the picture must be copied or converted
+*/
+
+static int reference_image( producer_avformat self, mlt_frame frame, AVCodecContext *codec_context, uint8_t **buffer,
+	mlt_image_format *format, int *width, int *height, int writable )
+{
+	int size = 0;
+#ifdef USE_REFCOUNTED_FRAMES
+	AVFrame *picture = self->video_frame;
+
+	if ( writable || !self->is_refcounted || !picture || !picture->buf[0] ||
+	     codec_context->width == 0 || codec_context->height == 0 ||
+	     image_layout_matches( self, picture, codec_context->pix_fmt, *format, codec_context->width, codec_context->height ) != 2 )
+		return 0;
+
+	AVFrame *reference = av_frame_clone( picture );
+	if ( !reference )
+		return 0;
+
+	*width = codec_context->width;
+	*height = codec_context->height;
+	size = mlt_image_format_size( *format, *width, *height, NULL );
+	*buffer = reference->data[0];
+	mlt_frame_set_image( frame, *buffer, size, NULL );
+	mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), "avformat.frame_reference", reference, 0,
+		(mlt_destructor) release_frame_reference, NULL );
+	mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "colorspace", self->yuv_colorspace );
+#endif
+	return size;
+}
+
+/** Copy a frame for the image cache or for error concealment.
+ *
+ * A frame that shares the decoder's picture gets another reference to the
+ * picture rather than a copy of the image.
+*/
+
+static mlt_frame clone_image_frame( mlt_frame frame )
+{
+#ifdef USE_REFCOUNTED_FRAMES
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	AVFrame *picture = mlt_properties_get_data( properties, "avformat.frame_reference", NULL );
+	int size = 0;
+	uint8_t *image = mlt_properties_get_data( properties, "image", &size );
+
+	if ( picture && image == picture->data[0] && !mlt_properties_get_data( properties, "alpha", NULL ) )
+	{
+		AVFrame *reference = av_frame_clone( picture );
+		if ( reference )
+		{
+			mlt_frame clone = mlt_frame_init( NULL );
+			mlt_properties clone_props = MLT_FRAME_PROPERTIES( clone );
+
+			mlt_properties_inherit( clone_props, properties );
+			mlt_properties_set_data( clone_props, "avformat.frame_reference", reference, 0,
+				(mlt_destructor) release_frame_reference, NULL );
+			mlt_properties_set_data( clone_props, "image", reference->data[0], size, NULL, NULL );
+			return clone;
+		}
+	}
+#endif
+	return mlt_frame_clone( frame, 1 );
+}
+
 /** Allocate the image buffer and set it on the frame.
 */
 
@@ -1325,6 +1880,136 @@ static int allocate_buffer( mlt_frame frame, AVCodecContext *codec_context, uint
 	return size;
 }
 
+/** The read-ahead thread.
+ *
+ * When the consumer requests consecutive frames, this decodes the frames
+ * that follow into the image cache so that the decoding of several
+ * producers overlaps instead of adding up on the consumer's thread.
+ * A non-consecutive request (a seek or a change of speed) restarts it.
+*/
+
+static void *prefetch_thread( void *arg )
+{
+	producer_avformat self = arg;
+	mlt_service service = MLT_PRODUCER_SERVICE( self->parent );
+
+	pthread_mutex_lock( &self->prefetch_mutex );
+	while ( !self->prefetch_stop )
+	{
+		if ( self->prefetch_active && self->prefetch_next <= self->prefetch_last + self->prefetch_count )
+		{
+			mlt_position position = self->prefetch_next;
+			int generation = self->prefetch_generation;
+			mlt_image_format format = self->prefetch_format;
+			mlt_frame frame = mlt_frame_init( service );
+			pthread_mutex_unlock( &self->prefetch_mutex );
+
+			// Decode the frame as the consumer would; producer_get_image() caches it
+			int error = 1;
+			if ( frame )
+			{
+				mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+				uint8_t *buffer = NULL;
+				int width = 0;
+				int height = 0;
+
+				mlt_properties_set_position( properties, "original_position", position );
+				mlt_properties_set_int( properties, "avformat.prefetch", 1 );
+				pthread_mutex_lock( &self->prefetch_mutex );
+				mlt_properties_set( properties, "rescale.interp", self->prefetch_interp );
+				pthread_mutex_unlock( &self->prefetch_mutex );
+				mlt_frame_push_service( frame, self );
+				mlt_frame_push_get_image( frame, producer_get_image );
+				error = mlt_frame_get_image( frame, &buffer, &format, &width, &height, 0 );
+				mlt_frame_close( frame );
+			}
+
+			pthread_mutex_lock( &self->prefetch_mutex );
+			if ( generation == self->prefetch_generation && self->prefetch_next == position )
+			{
+				if ( error )
+					// Stop at the end or on failure until the next seek
+					self->prefetch_active = 0;
+				else
+					self->prefetch_next = position + 1;
+			}
+		}
+		else
+		{
+			pthread_cond_wait( &self->prefetch_cond, &self->prefetch_mutex );
+		}
+	}
+	pthread_mutex_unlock( &self->prefetch_mutex );
+
+	return NULL;
+}
+
+/** Tell the read-ahead thread which frame the consumer requested.
+*/
+
+static void prefetch_request( producer_avformat self, mlt_frame frame, mlt_position position, mlt_image_format format )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	int count = 0;
+
+	// The frames read ahead are handed over through the image cache
+	if ( !self->seekable || self->is_pooled || !self->image_cache )
+		return;
+	if ( getenv( "MLT_AVFORMAT_PREFETCH" ) )
+		count = atoi( getenv( "MLT_AVFORMAT_PREFETCH" ) );
+	if ( mlt_properties_get( properties, "prefetch" ) )
+		count = mlt_properties_get_int( properties, "prefetch" );
+	if ( count <= 0 )
+		return;
+
+	pthread_mutex_lock( &self->prefetch_mutex );
+	self->prefetch_count = count;
+	if ( position != self->prefetch_last + 1 || format != self->prefetch_format )
+	{
+		// Seek or speed change: abandon the frames ahead until playback
+		// is consecutive again
+		self->prefetch_generation++;
+		self->prefetch_active = 0;
+		self->prefetch_next = position + 1;
+	}
+	else
+	{
+		self->prefetch_active = 1;
+		if ( self->prefetch_next <= position )
+			self->prefetch_next = position + 1;
+	}
+	self->prefetch_last = position;
+	self->prefetch_format = format;
+	free( self->prefetch_interp );
+	self->prefetch_interp = mlt_properties_get( MLT_FRAME_PROPERTIES( frame ), "rescale.interp" ) ?
+		strdup( mlt_properties_get( MLT_FRAME_PROPERTIES( frame ), "rescale.interp" ) ) : NULL;
+	if ( !self->prefetch_started )
+	{
+		self->prefetch_stop = 0;
+		self->prefetch_started = !pthread_create( &self->prefetch_thread, NULL, prefetch_thread, self );
+	}
+	pthread_cond_signal( &self->prefetch_cond );
+	pthread_mutex_unlock( &self->prefetch_mutex );
+}
+
+/** Stop the read-ahead thread.
+*/
+
+static void prefetch_close( producer_avformat self )
+{
+	if ( self->prefetch_started )
+	{
+		pthread_mutex_lock( &self->prefetch_mutex );
+		self->prefetch_stop = 1;
+		pthread_cond_signal( &self->prefetch_cond );
+		pthread_mutex_unlock( &self->prefetch_mutex );
+		pthread_join( self->prefetch_thread, NULL );
+		self->prefetch_started = 0;
+	}
+	free( self->prefetch_interp );
+	self->prefetch_interp = NULL;
+}
+
 /** Get an image from a frame.
 */
 
@@ -1382,9 +2067,18 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 		if ( self->image_cache && cache_supplied )
 			mlt_cache_set_size( self->image_cache, cache_size );
 	}
+	// Let the read-ahead thread continue past this frame
+	if ( !mlt_properties_get_int( frame_properties, "avformat.prefetch" ) )
+		prefetch_request( self, frame, position, *format );
+	// The read-ahead frames are delivered through the image cache
+	if ( self->image_cache && self->prefetch_count > 0 &&
+	     mlt_cache_get_size( self->image_cache ) < self->prefetch_count + 2 )
+		mlt_cache_set_size( self->image_cache, self->prefetch_count + 2 );
 	if ( self->image_cache )
 	{
-		mlt_frame original = mlt_cache_get_frame( self->image_cache, position );
+		// A cached frame is shared unless the caller is going to write to it
+		mlt_frame original = writable ? mlt_cache_get_frame( self->image_cache, position )
+			: mlt_cache_get_frame_ref( self->image_cache, position );
 		if ( original )
 		{
 			mlt_properties orig_props = MLT_FRAME_PROPERTIES( original );
@@ -1462,8 +2156,15 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	if ( self->video_frame && self->video_frame->linesize[0]
 		 && ( paused || self->current_position >= req_position ) )
 	{
-		// Duplicate it
-		if ( ( image_size = allocate_buffer( frame, codec_context, buffer, format, width, height ) ) )
+		// Share or duplicate it
+		if ( ( image_size = reference_image( self, frame, codec_context, buffer, format, width, height, writable ) ) )
+		{
+			// Workaround 1088 encodings missing cropping info.
+			if ( *height == 1088 && mlt_profile_dar( mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) ) ) == 16.0/9.0 )
+				*height = 1080;
+			got_picture = 1;
+		}
+		else if ( ( image_size = allocate_buffer( frame, codec_context, buffer, format, width, height ) ) )
 		{
 			int yuv_colorspace;
 			// Workaround 1088 encodings missing cropping info.
@@ -1592,7 +2293,26 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 					codec_context->reordered_opaque = int_position;
 					if ( int_position >= req_position )
 						codec_context->skip_loop_filter = AVDISCARD_NONE;
-#if (LIBAVCODEC_VERSION_INT >= ((52<<16)+(26<<8)+0))
+#ifdef USE_REFCOUNTED_FRAMES
+					if ( self->is_refcounted )
+					{
+						// Keep the previous picture until a new one is complete
+						if ( !self->decode_frame )
+							self->decode_frame = av_frame_alloc();
+						ret = avcodec_decode_video2( codec_context, self->decode_frame, &got_picture, &self->pkt );
+						if ( got_picture )
+						{
+							av_frame_unref( self->video_frame );
+							av_frame_move_ref( self->video_frame, self->decode_frame );
+						}
+						else
+						{
+							av_frame_unref( self->decode_frame );
+						}
+					}
+					else
+					ret = avcodec_decode_video2( codec_context, self->video_frame, &got_picture, &self->pkt );
+#elif (LIBAVCODEC_VERSION_INT >= ((52<<16)+(26<<8)+0))
 					ret = avcodec_decode_video2( codec_context, self->video_frame, &got_picture, &self->pkt );
 #else
 					ret = avcodec_decode_video( codec_context, self->video_frame, &got_picture, self->pkt.data, self->pkt.size );
@@ -1645,7 +2365,15 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 			// Now handle the picture if we have one
 			if ( got_picture )
 			{
-				if ( ( image_size = allocate_buffer( frame, codec_context, buffer, format, width, height ) ) )
+				if ( ( image_size = reference_image( self, frame, codec_context, buffer, format, width, height, writable ) ) )
+				{
+					// Workaround 1088 encodings missing cropping info.
+					if ( *height == 1088 && mlt_profile_dar( mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) ) ) == 16.0/9.0 )
+						*height = 1080;
+					self->top_field_first |= self->video_frame->top_field_first;
+					self->current_position = int_position;
+				}
+				else if ( ( image_size = allocate_buffer( frame, codec_context, buffer, format, width, height ) ) )
 				{
 					int yuv_colorspace;
 					// Workaround 1088 encodings missing cropping info.
@@ -1718,22 +2446,33 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	if ( image_size > 0 )
 	{
 		mlt_properties_set_int( frame_properties, "format", *format );
+		// Copy the frame once for both the cache and error concealment
+		mlt_frame copy = NULL;
 		// Cache the image for rapid repeated access.
 		if ( self->image_cache ) {
-			mlt_cache_put_frame( self->image_cache, frame );
+			copy = clone_image_frame( frame );
+			mlt_cache_put_frame_ref( self->image_cache, copy );
 		}
 		// Clone frame for error concealment.
 		if ( self->current_position >= self->last_good_position ) {
 			self->last_good_position = self->current_position;
 			if ( self->last_good_frame )
 				mlt_frame_close( self->last_good_frame );
-			self->last_good_frame = mlt_frame_clone( frame, 1 );
+			self->last_good_frame = copy ? copy : clone_image_frame( frame );
+		}
+		else
+		{
+			mlt_frame_close( copy );
 		}
 	}
 	else if ( self->last_good_frame )
 	{
 		// Use last known good frame if there was a decoding failure.
-		mlt_frame original = mlt_frame_clone( self->last_good_frame, 1 );
+		mlt_frame original = self->last_good_frame;
+		if ( writable )
+			original = mlt_frame_clone( original, 1 );
+		else
+			mlt_properties_inc_ref( MLT_FRAME_PROPERTIES( original ) );
 		mlt_properties orig_props = MLT_FRAME_PROPERTIES( original );
 		int size = 0;
 
@@ -1855,6 +2594,18 @@ static int video_codec_init( producer_avformat self, int index, mlt_properties p
 		if ( thread_count > 1 )
 			codec_context->thread_count = thread_count;
 
+#ifdef USE_REFCOUNTED_FRAMES
+		// Let decoded pictures outlive the next decode so frames can reference them
+		self->is_refcounted = 0;
+#ifdef VDPAU
+		if ( !self->vdpau )
+#endif
+		{
+			codec_context->refcounted_frames = 1;
+			self->is_refcounted = 1;
+		}
+#endif
+
 		// If we don't have a codec and we can't initialise it, we can't do much more...
 		pthread_mutex_lock( &self->open_mutex );
 #if LIBAVCODEC_VERSION_INT >= ((53<<16)+(8<<8)+0)
@@ -2136,6 +2887,14 @@ static int seek_audio( producer_avformat self, mlt_position position, double tim
 			if ( av_seek_frame( context, -1, timestamp, AVSEEK_FLAG_BACKWARD ) != 0 )
 				paused = 1;
 
+			// Remember the exact sample wanted so decode_audio() can trim to it
+			self->audio_seek_pending = 0;
+			if ( self->sample_accurate && self->audio_index != INT_MAX && self->audio_codec[ self->audio_index ] )
+			{
+				self->audio_seek_target = llrint( timecode * self->audio_codec[ self->audio_index ]->sample_rate );
+				self->audio_seek_pending = 1;
+			}
+
 			// Clear the usage in the audio buffer
 			int i = MAX_AUDIO_STREAMS + 1;
 			while ( --i )
@@ -2184,6 +2943,207 @@ static void planar_to_interleaved( uint8_t *dest, uint8_t *src, int samples, int
 }
 #endif
 
+/** Release the decoded audio cache.
+*/
+
+static void audio_cache_close( producer_avformat self )
+{
+	int i;
+	for ( i = 0; i < self->audio_cache_size; i++ )
+		mlt_pool_release( self->audio_cache[i].data );
+	free( self->audio_cache );
+	self->audio_cache = NULL;
+	self->audio_cache_size = 0;
+	self->audio_cache_next = 0;
+}
+
+/** Apply the audio_cache property, which is the number of frames to keep.
+*/
+
+static void audio_cache_configure( producer_avformat self )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	int size = AUDIO_CACHE_FRAMES;
+	if ( mlt_properties_get( properties, "audio_cache" ) )
+		size = mlt_properties_get_int( properties, "audio_cache" );
+	if ( !self->seekable || size < 0 )
+		size = 0;
+	if ( size != self->audio_cache_size )
+	{
+		audio_cache_close( self );
+		if ( size > 0 )
+		{
+			self->audio_cache = calloc( size, sizeof( audio_cache_entry ) );
+			if ( self->audio_cache )
+				self->audio_cache_size = size;
+		}
+	}
+}
+
+/** Determine the audio parameters that decoding would return for the current audio_index.
+*/
+
+static int audio_output_params( producer_avformat self, mlt_audio_format *format, int *frequency, int *channels )
+{
+	if ( self->audio_index == INT_MAX )
+	{
+		int index;
+		for ( index = 0; index < MAX_AUDIO_STREAMS; index++ )
+			if ( self->audio_codec[ index ] )
+			{
+				*format = pick_audio_format( self->audio_codec[ index ]->sample_fmt );
+				*frequency = self->max_frequency;
+				*channels = self->total_channels;
+				return *frequency > 0;
+			}
+	}
+	else if ( self->audio_index >= 0 && self->audio_index < MAX_AUDIO_STREAMS && self->audio_codec[ self->audio_index ] )
+	{
+		AVCodecContext *codec_context = self->audio_codec[ self->audio_index ];
+		*format = pick_audio_format( codec_context->sample_fmt );
+		*frequency = codec_context->sample_rate;
+		*channels = codec_context->channels;
+		return *frequency > 0;
+	}
+	return 0;
+}
+
+/** Store the audio returned for a frame in the decoded audio cache.
+*/
+
+static void audio_cache_store( producer_avformat self, int64_t start, uint8_t *buffer, mlt_audio_format format, int frequency, int channels, int samples )
+{
+	int size = mlt_audio_format_size( format, samples, channels );
+	int i;
+
+	if ( !self->audio_cache_size || !buffer || size <= 0 )
+		return;
+
+	// Do not store the same block twice
+	for ( i = 0; i < self->audio_cache_size; i++ )
+	{
+		audio_cache_entry *entry = &self->audio_cache[i];
+		if ( entry->data && entry->start == start && entry->samples == samples && entry->index == self->audio_index &&
+		     entry->frequency == frequency && entry->channels == channels && entry->format == format )
+			return;
+	}
+
+	// Replace the oldest entry
+	audio_cache_entry *entry = &self->audio_cache[ self->audio_cache_next ];
+	self->audio_cache_next = ( self->audio_cache_next + 1 ) % self->audio_cache_size;
+	if ( !entry->data || entry->size < size )
+	{
+		mlt_pool_release( entry->data );
+		entry->data = mlt_pool_alloc( size );
+		entry->size = entry->data ? size : 0;
+		if ( !entry->data )
+			return;
+	}
+	memcpy( entry->data, buffer, size );
+	entry->start = start;
+	entry->samples = samples;
+	entry->channels = channels;
+	entry->frequency = frequency;
+	entry->index = self->audio_index;
+	entry->format = format;
+}
+
+/** Assemble the audio for a frame from the decoded audio cache.
+ *
+ * Blocks are addressed by sample rather than by frame, so a request is
+ * satisfied when the cached blocks cover its sample range without a gap.
+ * \return true if the frame's audio was set from the cache
+*/
+
+static int audio_cache_fetch( producer_avformat self, mlt_frame frame, mlt_position position, double fps,
+	void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	mlt_audio_format want_format;
+	int want_frequency, want_channels;
+
+	if ( !self->audio_cache_size || !audio_output_params( self, &want_format, &want_frequency, &want_channels ) )
+		return 0;
+
+	int64_t start = mlt_sample_calculator_to_now( fps, want_frequency, position );
+	int want_samples = mlt_sample_calculator( fps, want_frequency, position );
+	int sample_size = mlt_audio_format_size( want_format, 1, want_channels );
+	int64_t next = start;
+	int found = 1;
+
+	if ( want_samples <= 0 || sample_size <= 0 )
+		return 0;
+
+	// Check that the range is covered
+	while ( found && next < start + want_samples )
+	{
+		int i;
+		found = 0;
+		for ( i = 0; i < self->audio_cache_size; i++ )
+		{
+			audio_cache_entry *entry = &self->audio_cache[i];
+			if ( entry->data && entry->index == self->audio_index && entry->frequency == want_frequency &&
+			     entry->channels == want_channels && entry->format == want_format &&
+			     entry->start <= next && next < entry->start + entry->samples )
+			{
+				next = entry->start + entry->samples;
+				found = 1;
+				break;
+			}
+		}
+	}
+	if ( !found )
+		return 0;
+
+	int size = mlt_audio_format_size( want_format, want_samples, want_channels );
+	uint8_t *dest = mlt_pool_alloc( size );
+	if ( !dest )
+		return 0;
+
+	// Copy the covering blocks
+	next = start;
+	while ( next < start + want_samples )
+	{
+		int i;
+		for ( i = 0; i < self->audio_cache_size; i++ )
+		{
+			audio_cache_entry *entry = &self->audio_cache[i];
+			if ( entry->data && entry->index == self->audio_index && entry->frequency == want_frequency &&
+			     entry->channels == want_channels && entry->format == want_format &&
+			     entry->start <= next && next < entry->start + entry->samples )
+			{
+				int64_t count = FFMIN( entry->start + entry->samples, start + want_samples ) - next;
+				memcpy( dest + ( next - start ) * sample_size, entry->data + ( next - entry->start ) * sample_size, count * sample_size );
+				next += count;
+				break;
+			}
+		}
+	}
+
+	*buffer = dest;
+	*format = want_format;
+	*frequency = want_frequency;
+	*channels = want_channels;
+	*samples = want_samples;
+	mlt_frame_set_audio( frame, *buffer, *format, size, mlt_pool_release );
+
+	return 1;
+}
+
+/** Compute the number of the first sample in a packet relative to the start of the file.
+*/
+
+static int64_t packet_sample( producer_avformat self, AVPacket *pkt )
+{
+	AVFormatContext *context = self->audio_format;
+	AVStream *stream = context->streams[ pkt->stream_index ];
+	double seconds = av_q2d( stream->time_base ) * pkt->pts;
+
+	// The same origin that seek_audio() uses for its timestamp
+	if ( context->start_time != AV_NOPTS_VALUE )
+		seconds -= (double) context->start_time / AV_TIME_BASE;
+	return llrint( seconds * self->audio_codec[ pkt->stream_index ]->sample_rate );
+}
+
 static int decode_audio( producer_avformat self, int *ignore, AVPacket pkt, int channels, int samples, double timecode, double fps )
 {
 	// Fetch the audio_format
@@ -2202,6 +3162,21 @@ static int decode_audio( producer_avformat self, int *ignore, AVPacket pkt, int
 	int audio_used = self->audio_used[ index ];
 	int ret = 0;
 
+	// Locate the first packet after a sample accurate seek
+	if ( self->audio_seek_pending == 1 && index == self->audio_index )
+	{
+		if ( pkt.pts != AV_NOPTS_VALUE )
+		{
+			self->audio_next_sample = packet_sample( self, &pkt );
+			self->audio_seek_pending = 2;
+		}
+		else
+		{
+			// Fall back to trimming by frame below
+			self->audio_seek_pending = 0;
+		}
+	}
+
 	while ( pkt.data && pkt.size > 0 )
 	{
 		int sizeof_sample = sample_bytes( codec_context );
@@ -2265,6 +3240,21 @@ static int decode_audio( producer_avformat self, int *ignore, AVPacket pkt, int
 			}
 			audio_used += convert_samples;
 
+			// Drop the samples that precede a sample accurate seek target
+			if ( self->audio_seek_pending == 2 && index == self->audio_index )
+			{
+				int64_t drop = FFMIN( self->audio_seek_target - self->audio_next_sample, convert_samples );
+				self->audio_next_sample += convert_samples;
+				if ( drop > 0 )
+				{
+					audio_used -= drop;
+					memmove( dest, dest + drop * codec_context->channels * sizeof_sample,
+							 ( convert_samples - drop ) * codec_context->channels * sizeof_sample );
+				}
+				if ( self->audio_next_sample >= self->audio_seek_target )
+					self->audio_seek_pending = 0;
+			}
+
 			// Handle ignore
 			while ( *ignore && audio_used )
 			{
@@ -2293,7 +3283,7 @@ static int decode_audio( producer_avformat self, int *ignore, AVPacket pkt, int
 			"A pkt.pts %"PRId64" pkt.dts %"PRId64" req_pos %"PRId64" cur_pos %"PRId64" pkt_pos %"PRId64"\n",
 			pkt.pts, pkt.dts, req_position, self->current_position, int_position );
 
-		if ( int_position > 0 )
+		if ( int_position > 0 && !( self->sample_accurate && self->audio_index != INT_MAX ) )
 		{
 			if ( int_position < req_position )
 				// We are behind, so skip some
@@ -2333,6 +3323,19 @@ static int producer_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 	// Number of frames to ignore (for ffwd)
 	int ignore[ MAX_AUDIO_STREAMS ] = { 0 };
 
+	// Serve repeated and backward requests from the decoded audio cache
+	// without seeking; audio_expected is untouched so that decoding resumes
+	// where it left off.
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	self->sample_accurate = mlt_properties_get_int( properties, "sample_accurate" );
+	audio_cache_configure( self );
+	if ( position + 1 != self->audio_expected &&
+	     audio_cache_fetch( self, frame, position, fps, buffer, format, frequency, channels, samples ) )
+	{
+		pthread_mutex_unlock( &self->audio_mutex );
+		return 0;
+	}
+
 	// Flag for paused (silence)
 	int paused = seek_audio( self, position, real_timecode );
 
@@ -2497,6 +3500,9 @@ static int producer_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 		*buffer = mlt_pool_alloc( size );
 		mlt_frame_set_audio( frame, *buffer, *format, size, mlt_pool_release );
 
+		// Only cache audio that was decoded in full, not silence or padding
+		int complete = 1;
+
 		// Interleave tracks if audio_index=all
 		if ( self->audio_index == INT_MAX )
 		{
@@ -2514,6 +3520,9 @@ static int producer_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 				}
 			}
 			for ( index = 0; index < index_max; index++ )
+			if ( self->audio_codec[ index ] && self->audio_used[ index ] < *samples )
+				complete = 0;
+			for ( index = 0; index < index_max; index++ )
 			if ( self->audio_codec[ index ] && self->audio_used[ index ] >= *samples )
 			{
 				int current_channels = self->audio_codec[ index ]->channels;
@@ -2526,6 +3535,7 @@ static int producer_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 		else
 		{
 			index = self->audio_index;
+			complete = self->audio_used[ index ] >= *samples;
 
 			// Now handle the audio if we have enough
 			if ( self->audio_used[ index ] > 0 )
@@ -2547,6 +3557,10 @@ static int producer_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 				memset( *buffer, 0, *samples * *channels * sizeof_sample );
 			}
 		}
+
+		if ( complete )
+			audio_cache_store( self, mlt_sample_calculator_to_now( fps, *frequency, position ),
+				*buffer, *format, *frequency, *channels, *samples );
 	}
 	else
 	{
@@ -2706,29 +3720,48 @@ static int producer_get_frame( mlt_producer producer, mlt_frame_ptr frame, int i
 {
 	// Access the private data
 	mlt_service service = MLT_PRODUCER_SERVICE( producer );
-	mlt_cache_item cache_item = mlt_service_cache_get( service, "producer_avformat" );
-	producer_avformat self = mlt_cache_item_data( cache_item, NULL );
+	mlt_cache_item cache_item = NULL;
+	producer_avformat self = NULL;
 
-	// If cache miss
-	if ( !self )
+	if ( pool_enabled() )
+	{
+		// Pooled producers are never evicted, only suspended
+		self = producer->child;
+		pool_acquire( self );
+	}
+	else
 	{
-		self = calloc( 1, sizeof( struct producer_avformat_s ) );
-		producer->child = self;
-		self->parent = producer;
-		mlt_service_cache_put( service, "producer_avformat", self, 0, (mlt_destructor) producer_avformat_close );
 		cache_item = mlt_service_cache_get( service, "producer_avformat" );
+		self = mlt_cache_item_data( cache_item, NULL );
+
+		// If cache miss
+		if ( !self )
+		{
+			self = calloc( 1, sizeof( struct producer_avformat_s ) );
+			producer->child = self;
+			self->parent = producer;
+			mlt_service_cache_put( service, "producer_avformat", self, 0, (mlt_destructor) producer_avformat_close );
+			cache_item = mlt_service_cache_get( service, "producer_avformat" );
+		}
 	}
 
 	// Create an empty frame
 	*frame = mlt_frame_init( service);
 	
-	if ( *frame )
+	if ( *frame && self->is_pooled )
+	{
+		mlt_properties_set_data( MLT_FRAME_PROPERTIES(*frame), "avformat_pool", self, 0, (mlt_destructor) pool_release, NULL );
+	}
+	else if ( *frame )
 	{
 		mlt_properties_set_data( MLT_FRAME_PROPERTIES(*frame), "avformat_cache", cache_item, 0, (mlt_destructor) mlt_cache_item_close, NULL );
 	}
 	else
 	{
-		mlt_cache_item_close( cache_item );
+		if ( self->is_pooled )
+			pool_release( self );
+		else
+			mlt_cache_item_close( cache_item );
 		return 1;
 	}
 
@@ -2755,9 +3788,12 @@ static void producer_avformat_close( producer_avformat self )
 {
 	mlt_log_debug( NULL, "producer_avformat_close\n" );
 
+	// Stop decoding ahead before anything is released
+	prefetch_close( self );
+
 	// Cleanup av contexts
 	av_free_packet( &self->pkt );
-	av_free( self->video_frame );
+	free_video_frame( self );
 	av_free( self->audio_frame );
 	if ( self->is_mutex_init )
 		pthread_mutex_lock( &self->open_mutex );
@@ -2796,6 +3832,7 @@ static void producer_avformat_close( producer_avformat self )
 #endif
 	if ( self->image_cache )
 		mlt_cache_close( self->image_cache );
+	audio_cache_close( self );
 	if ( self->last_good_frame )
 		mlt_frame_close( self->last_good_frame );
 
@@ -2806,6 +3843,8 @@ static void producer_avformat_close( producer_avformat self )
 		pthread_mutex_destroy( &self->video_mutex );
 		pthread_mutex_destroy( &self->packets_mutex );
 		pthread_mutex_destroy( &self->open_mutex );
+		pthread_mutex_destroy( &self->prefetch_mutex );
+		pthread_cond_destroy( &self->prefetch_cond );
 	}
 
 	// Cleanup the packet queues
@@ -2836,7 +3875,10 @@ static void producer_avformat_close( producer_avformat self )
 
 static void producer_close( mlt_producer parent )
 {
-	// Remove this instance from the cache
+	// Remove this instance from the pool or cache
+	producer_avformat self = parent->child;
+	if ( pool_enabled() && self && self->is_pooled )
+		pool_remove( self );
 	mlt_service_cache_purge( MLT_PRODUCER_SERVICE(parent) );
 
 	// Close the parent
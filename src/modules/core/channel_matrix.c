@@ -0,0 +1,477 @@
+/*
+ * channel_matrix.c -- route, copy, pan and downmix audio channels in one pass
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "channel_matrix.h"
+#include <framework/mlt_pool.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+/** a row that is not a plain copy of one input channel */
+#define ROW_MIX (-2)
+
+/** a row that is silent */
+#define ROW_SILENT (-1)
+
+/** Create a matrix with all gains set to zero.
+*/
+
+channel_matrix channel_matrix_new( int channels_in, int channels_out )
+{
+	channel_matrix self = NULL;
+	if ( channels_in > 0 && channels_out > 0 )
+	{
+		self = calloc( 1, sizeof( struct channel_matrix_s ) );
+		if ( self )
+		{
+			self->channels_in = channels_in;
+			self->channels_out = channels_out;
+			self->gains = calloc( channels_in * channels_out, sizeof( float ) );
+			if ( !self->gains )
+			{
+				free( self );
+				self = NULL;
+			}
+		}
+	}
+	return self;
+}
+
+/** Pass each channel through to the output channel of the same index.
+ *
+ * Output channels without a matching input are left silent.
+ */
+
+void channel_matrix_identity( channel_matrix self )
+{
+	int i;
+	memset( self->gains, 0, self->channels_in * self->channels_out * sizeof( float ) );
+	for ( i = 0; i < self->channels_in && i < self->channels_out; i++ )
+		channel_matrix_gain( self, i, i ) = 1.0f;
+}
+
+/** Get the gains at the end of the buffer, creating them as a copy of the start gains.
+*/
+
+float *channel_matrix_ramp( channel_matrix self )
+{
+	if ( !self->ramp )
+	{
+		size_t size = self->channels_in * self->channels_out * sizeof( float );
+		self->ramp = malloc( size );
+		if ( self->ramp )
+			memcpy( self->ramp, self->gains, size );
+	}
+	return self->ramp;
+}
+
+/** Set the gains from a string.
+ *
+ * Rows are separated by semicolons, one per output channel, and each row
+ * lists the gains of the input channels separated by spaces or commas.
+ * Rows or columns beyond the size of the matrix are ignored, and rows not
+ * given are left as they are.
+ * \return the number of rows parsed
+ */
+
+int channel_matrix_parse( channel_matrix self, const char *spec )
+{
+	int out = 0;
+	while ( spec && *spec && out < self->channels_out )
+	{
+		int in = 0;
+		memset( &channel_matrix_gain( self, out, 0 ), 0, self->channels_in * sizeof( float ) );
+		while ( *spec && *spec != ';' )
+		{
+			char *end = NULL;
+			double gain = strtod( spec, &end );
+			if ( end == spec )
+			{
+				// Skip separators and anything else unparseable
+				spec++;
+				continue;
+			}
+			if ( in < self->channels_in )
+				channel_matrix_gain( self, out, in ) = gain;
+			in++;
+			spec = end;
+		}
+		if ( *spec == ';' )
+			spec++;
+		out++;
+	}
+	return out;
+}
+
+/** Find the input channel copied by a row, or ROW_SILENT or ROW_MIX.
+*/
+
+static int row_source( channel_matrix self, int out )
+{
+	const float *row = &channel_matrix_gain( self, out, 0 );
+	int i, source = ROW_SILENT;
+
+	if ( self->ramp && memcmp( row, self->ramp + out * self->channels_in, self->channels_in * sizeof( float ) ) )
+		return ROW_MIX;
+	for ( i = 0; i < self->channels_in; i++ )
+	{
+		if ( row[i] == 0.0f )
+			continue;
+		if ( row[i] != 1.0f || source != ROW_SILENT )
+			return ROW_MIX;
+		source = i;
+	}
+	return source;
+}
+
+/** Copy whole planes of non-interleaved audio.
+*/
+
+static int route_planar( const int *sources, int channels_in, int channels_out, uint8_t *src, uint8_t *dest, int samples, int bytes )
+{
+	size_t plane = (size_t) samples * bytes;
+	uint8_t *stash = NULL;
+	int i, o;
+
+	// In place, save the planes that are copied elsewhere but also overwritten
+	if ( src == dest )
+	{
+		for ( i = 0; i < channels_in && i < channels_out; i++ )
+		{
+			if ( sources[i] == i )
+				continue;
+			for ( o = 0; o < channels_out; o++ )
+			{
+				if ( o != i && sources[o] == i )
+				{
+					if ( !stash )
+						stash = mlt_pool_alloc( channels_in * plane );
+					if ( !stash )
+						return 1;
+					memcpy( stash + i * plane, src + i * plane, plane );
+					break;
+				}
+			}
+		}
+	}
+
+	for ( o = 0; o < channels_out; o++ )
+	{
+		int source = sources[o];
+		if ( source == ROW_SILENT )
+			memset( dest + o * plane, 0, plane );
+		else if ( src != dest || source != o )
+		{
+			int stashed = stash && source < channels_out && sources[source] != source;
+			memcpy( dest + o * plane, ( stashed ? stash : src ) + source * plane, plane );
+		}
+	}
+	mlt_pool_release( stash );
+	return 0;
+}
+
+#define ROUTE_INTERLEAVED( type, silence ) \
+{ \
+	type *s = (type*) src; \
+	type *d = (type*) dest; \
+	type *in = (type*) frame; \
+	for ( n = 0; n < samples; n++, s += channels_in, d += channels_out ) \
+	{ \
+		if ( src != dest ) \
+			in = s; \
+		else \
+			memcpy( in, s, channels_in * sizeof( type ) ); \
+		for ( o = 0; o < channels_out; o++ ) \
+			d[o] = sources[o] == ROW_SILENT ? (silence) : in[ sources[o] ]; \
+	} \
+}
+
+/** Copy samples of interleaved audio.
+ *
+ * Writing sample n in place never reaches beyond input sample n while the
+ * output has no more channels than the input, so one sample of scratch
+ * space is enough.
+ */
+
+static int route_interleaved( const int *sources, int channels_in, int channels_out, uint8_t *src, uint8_t *dest, int samples, mlt_audio_format format )
+{
+	int32_t *frame = malloc( channels_in * sizeof( int32_t ) );
+	int n, o;
+
+	if ( !frame )
+		return 1;
+	switch ( format )
+	{
+	case mlt_audio_u8:
+		ROUTE_INTERLEAVED( uint8_t, 128 )
+		break;
+	case mlt_audio_s16:
+		ROUTE_INTERLEAVED( int16_t, 0 )
+		break;
+	default:
+		ROUTE_INTERLEAVED( int32_t, 0 )
+		break;
+	}
+	free( frame );
+	return 0;
+}
+
+/** Read one channel of audio as floats in the range [-1, 1).
+*/
+
+static void read_plane( float *dest, const void *audio, mlt_audio_format format, int channel, int channels, int samples )
+{
+	int n;
+	switch ( format )
+	{
+	case mlt_audio_u8:
+	{
+		const uint8_t *p = (const uint8_t*) audio + channel;
+		for ( n = 0; n < samples; n++ )
+			dest[n] = ( (float) p[ n * channels ] - 128.0f ) / 128.0f;
+		break;
+	}
+	case mlt_audio_s16:
+	{
+		const int16_t *p = (const int16_t*) audio + channel;
+		for ( n = 0; n < samples; n++ )
+			dest[n] = (float) p[ n * channels ] / 32768.0f;
+		break;
+	}
+	case mlt_audio_s32:
+	{
+		const int32_t *p = (const int32_t*) audio + channel * samples;
+		for ( n = 0; n < samples; n++ )
+			dest[n] = (float) p[n] / 2147483648.0f;
+		break;
+	}
+	case mlt_audio_s32le:
+	{
+		const int32_t *p = (const int32_t*) audio + channel;
+		for ( n = 0; n < samples; n++ )
+			dest[n] = (float) p[ n * channels ] / 2147483648.0f;
+		break;
+	}
+	case mlt_audio_float:
+		memcpy( dest, (const float*) audio + channel * samples, samples * sizeof( float ) );
+		break;
+	case mlt_audio_f32le:
+	{
+		const float *p = (const float*) audio + channel;
+		for ( n = 0; n < samples; n++ )
+			dest[n] = p[ n * channels ];
+		break;
+	}
+	default:
+		memset( dest, 0, samples * sizeof( float ) );
+		break;
+	}
+}
+
+/** Write one channel of audio from floats, clipping the integer formats.
+*/
+
+static void write_plane( void *audio, mlt_audio_format format, int channel, int channels, int samples, const float *src )
+{
+	int n;
+	switch ( format )
+	{
+	case mlt_audio_u8:
+	{
+		uint8_t *p = (uint8_t*) audio + channel;
+		for ( n = 0; n < samples; n++ )
+		{
+			float v = src[n] * 128.0f + 128.0f;
+			p[ n * channels ] = v <= 0.0f ? 0 : v >= 255.0f ? 255 : lrintf( v );
+		}
+		break;
+	}
+	case mlt_audio_s16:
+	{
+		int16_t *p = (int16_t*) audio + channel;
+		for ( n = 0; n < samples; n++ )
+		{
+			float v = src[n] * 32768.0f;
+			p[ n * channels ] = v <= -32768.0f ? -32768 : v >= 32767.0f ? 32767 : lrintf( v );
+		}
+		break;
+	}
+	case mlt_audio_s32:
+	case mlt_audio_s32le:
+	{
+		int32_t *p = (int32_t*) audio;
+		int stride = format == mlt_audio_s32 ? 1 : channels;
+		p += format == mlt_audio_s32 ? channel * samples : channel;
+		for ( n = 0; n < samples; n++ )
+		{
+			double v = src[n] * 2147483648.0;
+			p[ n * stride ] = v <= -2147483648.0 ? INT32_MIN : v >= 2147483647.0 ? INT32_MAX : lrint( v );
+		}
+		break;
+	}
+	case mlt_audio_float:
+		memcpy( (float*) audio + channel * samples, src, samples * sizeof( float ) );
+		break;
+	case mlt_audio_f32le:
+	{
+		float *p = (float*) audio + channel;
+		for ( n = 0; n < samples; n++ )
+			p[ n * channels ] = src[n];
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/** Mix every output channel as a weighted sum of float planes.
+*/
+
+static int mix_audio( channel_matrix self, void *src, void *dest, mlt_audio_format format, int samples )
+{
+	int channels_in = self->channels_in;
+	int channels_out = self->channels_out;
+	float *planes = mlt_pool_alloc( channels_in * samples * sizeof( float ) );
+	float *acc = format == mlt_audio_float ? NULL : mlt_pool_alloc( samples * sizeof( float ) );
+	int i, o, n;
+
+	if ( !planes || ( format != mlt_audio_float && !acc ) )
+	{
+		mlt_pool_release( planes );
+		mlt_pool_release( acc );
+		return 1;
+	}
+
+	// The inputs are read in full first so the outputs may overwrite them
+	for ( i = 0; i < channels_in; i++ )
+		read_plane( planes + i * samples, src, format, i, channels_in, samples );
+
+	for ( o = 0; o < channels_out; o++ )
+	{
+		float *out = acc ? acc : (float*) dest + o * samples;
+		memset( out, 0, samples * sizeof( float ) );
+		for ( i = 0; i < channels_in; i++ )
+		{
+			const float *in = planes + i * samples;
+			float start = channel_matrix_gain( self, o, i );
+			float end = self->ramp ? self->ramp[ o * channels_in + i ] : start;
+			if ( start == end )
+			{
+				if ( start != 0.0f )
+					for ( n = 0; n < samples; n++ )
+						out[n] += start * in[n];
+			}
+			else
+			{
+				float step = ( end - start ) / samples;
+				for ( n = 0; n < samples; n++ )
+					out[n] += ( start + step * n ) * in[n];
+			}
+		}
+		if ( acc )
+			write_plane( dest, format, o, channels_out, samples, acc );
+	}
+	mlt_pool_release( planes );
+	mlt_pool_release( acc );
+	return 0;
+}
+
+/** Apply the matrix to the audio of a frame.
+ *
+ * The frame's audio must have channels_in channels on entry and has
+ * channels_out channels on return. It is processed in place unless the
+ * output has more channels than the input, in which case a new buffer is
+ * given to the frame and returned in \p buffer. Rows that are plain copies
+ * of one input are moved without conversion, so routing is lossless in any
+ * format; anything else is mixed as float.
+ * \return true on error
+ */
+
+int channel_matrix_apply( channel_matrix self, mlt_frame frame, void **buffer, mlt_audio_format format, int samples )
+{
+	int channels_in = self->channels_in;
+	int channels_out = self->channels_out;
+	int bytes = mlt_audio_format_size( format, 1, 1 );
+	int *sources;
+	int o, route = 1, identity = channels_in == channels_out;
+	int error;
+	void *dest = *buffer;
+	int size = 0;
+
+	if ( !*buffer || samples <= 0 || bytes <= 0 )
+		return 1;
+
+	sources = malloc( channels_out * sizeof( int ) );
+	if ( !sources )
+		return 1;
+	for ( o = 0; o < channels_out; o++ )
+	{
+		sources[o] = row_source( self, o );
+		route = route && sources[o] != ROW_MIX;
+		identity = identity && sources[o] == o;
+	}
+	if ( identity )
+	{
+		free( sources );
+		return 0;
+	}
+
+	if ( channels_out > channels_in )
+	{
+		size = mlt_audio_format_size( format, samples, channels_out );
+		dest = mlt_pool_alloc( size );
+		if ( !dest )
+		{
+			free( sources );
+			return 1;
+		}
+	}
+
+	if ( !route )
+		error = mix_audio( self, *buffer, dest, format, samples );
+	else if ( format == mlt_audio_s32 || format == mlt_audio_float )
+		error = route_planar( sources, channels_in, channels_out, *buffer, dest, samples, bytes );
+	else
+		error = route_interleaved( sources, channels_in, channels_out, *buffer, dest, samples, format );
+	free( sources );
+
+	if ( dest != *buffer )
+	{
+		if ( error )
+		{
+			mlt_pool_release( dest );
+			return error;
+		}
+		mlt_frame_set_audio( frame, dest, format, size, mlt_pool_release );
+		*buffer = dest;
+	}
+	return error;
+}
+
+void channel_matrix_close( channel_matrix self )
+{
+	if ( self )
+	{
+		free( self->gains );
+		free( self->ramp );
+		free( self );
+	}
+}
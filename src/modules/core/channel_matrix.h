@@ -0,0 +1,51 @@
+/*
+ * channel_matrix.h -- route, copy, pan and downmix audio channels in one pass
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _CHANNEL_MATRIX_H_
+#define _CHANNEL_MATRIX_H_
+
+#include <framework/mlt_frame.h>
+
+/** A matrix of gains from input channels to output channels.
+ *
+ * Output channel o is the sum over i of gains[o * channels_in + i] times
+ * input channel i. When ramp is not NULL it holds a second set of gains
+ * of the same shape, and the gains move linearly from gains to ramp over
+ * the length of the buffer.
+ */
+
+typedef struct channel_matrix_s
+{
+	int channels_in;
+	int channels_out;
+	float *gains;
+	float *ramp;
+}
+*channel_matrix;
+
+#define channel_matrix_gain( m, out, in ) ( (m)->gains[ (out) * (m)->channels_in + (in) ] )
+
+extern channel_matrix channel_matrix_new( int channels_in, int channels_out );
+extern void channel_matrix_identity( channel_matrix self );
+extern float *channel_matrix_ramp( channel_matrix self );
+extern int channel_matrix_parse( channel_matrix self, const char *spec );
+extern int channel_matrix_apply( channel_matrix self, mlt_frame frame, void **buffer, mlt_audio_format format, int samples );
+extern void channel_matrix_close( channel_matrix self );
+
+#endif
@@ -18,14 +18,16 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include "channel_matrix.h"
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
 
-#include <string.h>
-
 static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
 {
+	mlt_filter filter = mlt_frame_pop_audio( frame );
+	char *spec = mlt_properties_get( MLT_FILTER_PROPERTIES( filter ), "matrix" );
+
 	// Used to return number of channels in the source
 	int channels_avail = *channels;
 
@@ -33,93 +35,23 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	int error = mlt_frame_get_audio( frame, buffer, format, frequency, &channels_avail, samples );
 	if ( error ) return error;
 
-	if ( channels_avail < *channels )
+	if ( ( channels_avail != *channels || spec ) && channels_avail > 0 && *channels > 0 )
 	{
-		int size = mlt_audio_format_size( *format, *samples, *channels );
-		int16_t *new_buffer = mlt_pool_alloc( size );
+		channel_matrix matrix = channel_matrix_new( channels_avail, *channels );
+		if ( !matrix )
+			return 1;
 
-		// Duplicate the existing channels
-		if ( *format == mlt_audio_s16 )
-		{
-			int i, j, k = 0;
-			for ( i = 0; i < *samples; i++ )
-			{
-				for ( j = 0; j < *channels; j++ )
-				{
-					new_buffer[ ( i * *channels ) + j ] = ((int16_t*)(*buffer))[ ( i * channels_avail ) + k ];
-					k = ( k + 1 ) % channels_avail;
-				}
-			}
-		}
-		else if ( *format == mlt_audio_s32le || *format == mlt_audio_f32le )
-		{
-			int32_t *p = (int32_t*) new_buffer;
-			int i, j, k = 0;
-			for ( i = 0; i < *samples; i++ )
-			{
-				for ( j = 0; j < *channels; j++ )
-				{
-					p[ ( i * *channels ) + j ] = ((int32_t*)(*buffer))[ ( i * channels_avail ) + k ];
-					k = ( k + 1 ) % channels_avail;
-				}
-			}
-		}
-		else if ( *format == mlt_audio_u8 )
-		{
-			uint8_t *p = (uint8_t*) new_buffer;
-			int i, j, k = 0;
-			for ( i = 0; i < *samples; i++ )
-			{
-				for ( j = 0; j < *channels; j++ )
-				{
-					p[ ( i * *channels ) + j ] = ((uint8_t*)(*buffer))[ ( i * channels_avail ) + k ];
-					k = ( k + 1 ) % channels_avail;
-				}
-			}
-		}
-		else
-		{
-			// non-interleaved - s32 or float
-			int size_avail = mlt_audio_format_size( *format, *samples, channels_avail );
-			int32_t *p = (int32_t*) new_buffer;
-			int i = *channels / channels_avail;
-			while ( i-- )
-			{
-				memcpy( p, *buffer, size_avail );
-				p += size_avail / sizeof(*p);
-			}
-			i = *channels % channels_avail;
-			if ( i )
-			{
-				size_avail = mlt_audio_format_size( *format, *samples, i );
-				memcpy( p, *buffer, size_avail );
-			}
-		}
-		// Update the audio buffer now - destroys the old
-		mlt_frame_set_audio( frame, new_buffer, *format, size, mlt_pool_release );
-		*buffer = new_buffer;
-	}
-	else if ( channels_avail > *channels )
-	{
-		int size = mlt_audio_format_size( *format, *samples, *channels );
-		int16_t *new_buffer = mlt_pool_alloc( size );
+		// Duplicate the existing channels or drop all but the first *channels
+		int i;
+		for ( i = 0; i < *channels; i++ )
+			channel_matrix_gain( matrix, i, i % channels_avail ) = 1.0f;
+
+		// A full matrix remixes, downmixes and routes in the same pass
+		if ( spec )
+			channel_matrix_parse( matrix, spec );
 
-		// Drop all but the first *channels
-		if ( *format == mlt_audio_s16 )
-		{
-			int i, j;
-			for ( i = 0; i < *samples; i++ )
-				for ( j = 0; j < *channels; j++ )
-					new_buffer[ ( i * *channels ) + j ]	= ((int16_t*)(*buffer))[ ( i * channels_avail ) + j ];
-		}
-		else
-		{
-			// non-interleaved
-			memcpy( new_buffer, *buffer, size );
-		}
-		// Update the audio buffer now - destroys the old
-		mlt_frame_set_audio( frame, new_buffer, *format, size, mlt_pool_release );
-		*buffer = new_buffer;
+		error = channel_matrix_apply( matrix, frame, buffer, *format, *samples );
+		channel_matrix_close( matrix );
 	}
 	return error;
 }
@@ -129,6 +61,7 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 
 static mlt_frame filter_process( mlt_filter filter, mlt_frame frame )
 {
+	mlt_frame_push_audio( frame, filter );
 	mlt_frame_push_audio( frame, filter_get_audio );
 	return frame;
 }
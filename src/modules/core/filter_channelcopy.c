@@ -18,6 +18,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include "channel_matrix.h"
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
@@ -45,108 +46,23 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	mlt_frame_get_audio( frame, buffer, format, frequency, channels, samples );
 
 	// Copy channels as necessary
-	if ( from != to)
-	switch ( *format )
+	if ( from != to && from >= 0 && to >= 0 && from < *channels && to < *channels )
 	{
-		case mlt_audio_u8:
+		channel_matrix matrix = channel_matrix_new( *channels, *channels );
+		if ( matrix )
 		{
-			uint8_t *f = (uint8_t*) *buffer + from;
-			uint8_t *t = (uint8_t*) *buffer + to;
-			uint8_t x;
-			int i;
-
-			if ( swap )
-				for ( i = 0; i < *samples; i++, f += *channels, t += *channels )
-				{
-					x = *t;
-					*t = *f;
-					*f = x;
-				}
-			else
-				for ( i = 0; i < *samples; i++, f += *channels, t += *channels )
-					*t = *f;
-			break;
-		}
-		case mlt_audio_s16:
-		{
-			int16_t *f = (int16_t*) *buffer + from;
-			int16_t *t = (int16_t*) *buffer + to;
-			int16_t x;
-			int i;
-
-			if ( swap )
-				for ( i = 0; i < *samples; i++, f += *channels, t += *channels )
-				{
-					x = *t;
-					*t = *f;
-					*f = x;
-				}
-			else
-				for ( i = 0; i < *samples; i++, f += *channels, t += *channels )
-					*t = *f;
-			break;
-		}
-		case mlt_audio_s32:
-		{
-			int32_t *f = (int32_t*) *buffer + from * *samples;
-			int32_t *t = (int32_t*) *buffer + to * *samples;
-
+			channel_matrix_identity( matrix );
+			channel_matrix_gain( matrix, to, to ) = 0.0f;
+			channel_matrix_gain( matrix, to, from ) = 1.0f;
 			if ( swap )
 			{
-				int32_t *x = malloc( *samples * sizeof(int32_t) );
-				memcpy( x, t, *samples * sizeof(int32_t) );
-				memcpy( t, f, *samples * sizeof(int32_t) );
-				memcpy( f, x, *samples * sizeof(int32_t) );
-				free( x );
-			}
-			else
-			{
-				memcpy( t, f, *samples * sizeof(int32_t) );
-			}
-			break;
-		}
-		case mlt_audio_s32le:
-		case mlt_audio_f32le:
-		{
-			int32_t *f = (int32_t*) *buffer + from;
-			int32_t *t = (int32_t*) *buffer + to;
-			int32_t x;
-			int i;
-
-			if ( swap )
-				for ( i = 0; i < *samples; i++, f += *channels, t += *channels )
-				{
-					x = *t;
-					*t = *f;
-					*f = x;
-				}
-			else
-				for ( i = 0; i < *samples; i++, f += *channels, t += *channels )
-					*t = *f;
-			break;
-		}
-		case mlt_audio_float:
-		{
-			float *f = (float*) *buffer + from * *samples;
-			float *t = (float*) *buffer + to * *samples;
-
-			if ( swap )
-			{
-				float *x = malloc( *samples * sizeof(float) );
-				memcpy( x, t, *samples * sizeof(float) );
-				memcpy( t, f, *samples * sizeof(float) );
-				memcpy( f, x, *samples * sizeof(float) );
-				free( x );
-			}
-			else
-			{
-				memcpy( t, f, *samples * sizeof(float) );
+				channel_matrix_gain( matrix, from, from ) = 0.0f;
+				channel_matrix_gain( matrix, from, to ) = 1.0f;
 			}
-			break;
+			if ( channel_matrix_apply( matrix, frame, buffer, *format, *samples ) )
+				mlt_log_error( MLT_FILTER_SERVICE( filter ), "Invalid audio format\n" );
+			channel_matrix_close( matrix );
 		}
-		default:
-			mlt_log_error( MLT_FILTER_SERVICE( filter ), "Invalid audio format\n" );
-			break;
 	}
 
 	return 0;
@@ -18,6 +18,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include "channel_matrix.h"
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
@@ -33,109 +34,27 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	// Get the properties of the a frame
 	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
 	int channels_out = mlt_properties_get_int( properties, "mono.channels" );
-	int i, j, size;
+	channel_matrix matrix;
+	int i, j;
 
 	// Get the producer's audio
 	mlt_frame_get_audio( frame, buffer, format, frequency, channels, samples );
 
 	if ( channels_out == -1 )
 		channels_out = *channels;
-	size = mlt_audio_format_size( *format, *samples, channels_out );
 
-	switch ( *format )
+	// Every output is the average of all inputs
+	matrix = channel_matrix_new( *channels, channels_out );
+	if ( matrix )
 	{
-		case mlt_audio_u8:
-		{
-			uint8_t *new_buffer = mlt_pool_alloc( size );
-			for ( i = 0; i < *samples; i++ )
-			{
-				uint8_t mixdown = 0;
-				for ( j = 0; j < *channels; j++ )
-					mixdown += ((uint8_t*) *buffer)[ ( i * *channels ) + j ] / *channels;
-				for ( j = 0; j < channels_out; j++ )
-					new_buffer[ ( i * channels_out ) + j ] = mixdown;
-			}
-			*buffer = new_buffer;
-			break;
-		}
-		case mlt_audio_s16:
-		{
-			int16_t *new_buffer = mlt_pool_alloc( size );
-			for ( i = 0; i < *samples; i++ )
-			{
-				int16_t mixdown = 0;
-				for ( j = 0; j < *channels; j++ )
-					mixdown += ((int16_t*) *buffer)[ ( i * *channels ) + j ] / *channels;
-				for ( j = 0; j < channels_out; j++ )
-					new_buffer[ ( i * channels_out ) + j ] = mixdown;
-			}
-			*buffer = new_buffer;
-			break;
-		}
-		case mlt_audio_s32le:
-		{
-			int32_t *new_buffer = mlt_pool_alloc( size );
-			for ( i = 0; i < *samples; i++ )
-			{
-				int32_t mixdown = 0;
-				for ( j = 0; j < *channels; j++ )
-					mixdown += ((int32_t*) *buffer)[ ( i * *channels ) + j ] / *channels;
-				for ( j = 0; j < channels_out; j++ )
-					new_buffer[ ( i * channels_out ) + j ] = mixdown;
-			}
-			*buffer = new_buffer;
-			break;
-		}
-		case mlt_audio_f32le:
-		{
-			float *new_buffer = mlt_pool_alloc( size );
-			for ( i = 0; i < *samples; i++ )
-			{
-				float mixdown = 0;
-				for ( j = 0; j < *channels; j++ )
-					mixdown += ((float*) *buffer)[ ( i * *channels ) + j ] / *channels;
-				for ( j = 0; j < channels_out; j++ )
-					new_buffer[ ( i * channels_out ) + j ] = mixdown;
-			}
-			*buffer = new_buffer;
-			break;
-		}
-		case mlt_audio_s32:
-		{
-			int32_t *new_buffer = mlt_pool_alloc( size );
-			for ( i = 0; i < *samples; i++ )
-			{
-				int32_t mixdown = 0;
-				for ( j = 0; j < *channels; j++ )
-					mixdown += ((int32_t*) *buffer)[ ( j * *channels ) + i ] / *channels;
-				for ( j = 0; j < channels_out; j++ )
-					new_buffer[ ( j * *samples ) + i ] = mixdown;
-			}
-			*buffer = new_buffer;
-			break;
-		}
-		case mlt_audio_float:
-		{
-			float *new_buffer = mlt_pool_alloc( size );
-			for ( i = 0; i < *samples; i++ )
-			{
-				float mixdown = 0;
-				for ( j = 0; j < *channels; j++ )
-					mixdown += ((float*) *buffer)[ ( j * *channels ) + i ] / *channels;
-				for ( j = 0; j < channels_out; j++ )
-					new_buffer[ ( j * *samples ) + i ] = mixdown;
-			}
-			*buffer = new_buffer;
-			break;
-		}
-		default:
+		for ( i = 0; i < channels_out; i++ )
+			for ( j = 0; j < *channels; j++ )
+				channel_matrix_gain( matrix, i, j ) = 1.0f / *channels;
+		if ( channel_matrix_apply( matrix, frame, buffer, *format, *samples ) )
 			mlt_log_error( NULL, "[filter mono] Invalid audio format\n" );
-			break;
-	}
-	if ( size > *samples * channels_out )
-	{
-		mlt_frame_set_audio( frame, *buffer, *format, size, mlt_pool_release );
-		*channels = channels_out;
+		else
+			*channels = channels_out;
+		channel_matrix_close( matrix );
 	}
 
 	return 0;
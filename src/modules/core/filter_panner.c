@@ -18,6 +18,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include "channel_matrix.h"
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
@@ -25,9 +26,107 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 
 
+/** Set one mixing weight if both channels exist.
+*/
+
+static void set_factor( float *gains, int channels, int in, int out, double factor )
+{
+	if ( in < channels && out < channels )
+		gains[ out * channels + in ] = factor;
+}
+
+/** Compute the mixing weights for a position, leaving other channels untouched.
+*/
+
+static void pan_factors( float *gains, int channels, int active_channel, int gang, double weight )
+{
+	switch ( active_channel )
+	{
+		case -1: // Front L/R balance
+		case -2: // Rear L/R balance
+		{
+			// Gang front/rear balance if requested
+			int g, active = active_channel;
+			for ( g = 0; g < gang; g++, active-- )
+			{
+				int left = active == -1 ? 0 : 2;
+				int right = left + 1;
+				if ( weight < 0.0 )
+				{
+					set_factor( gains, channels, left, left, 1.0 );
+					set_factor( gains, channels, right, right, weight + 1.0 < 0.0 ? 0.0 : weight + 1.0 );
+				}
+				else
+				{
+					set_factor( gains, channels, left, left, 1.0 - weight < 0.0 ? 0.0 : 1.0 - weight );
+					set_factor( gains, channels, right, right, 1.0 );
+				}
+			}
+			break;
+		}
+		case -3: // Left fade
+		case -4: // right fade
+		{
+			// Gang left/right fade if requested
+			int g, active = active_channel;
+			for ( g = 0; g < gang; g++, active-- )
+			{
+				int front = active == -3 ? 0 : 1;
+				int rear = front + 2;
+				if ( weight < 0.0 )
+				{
+					set_factor( gains, channels, front, front, 1.0 );
+					set_factor( gains, channels, rear, rear, weight + 1.0 < 0.0 ? 0.0 : weight + 1.0 );
+				}
+				else
+				{
+					set_factor( gains, channels, front, front, 1.0 - weight < 0.0 ? 0.0 : 1.0 - weight );
+					set_factor( gains, channels, rear, rear, 1.0 );
+				}
+			}
+			break;
+		}
+		case 0: // left
+		case 2:
+		{
+			int left = active_channel;
+			int right = left + 1;
+			set_factor( gains, channels, right, right, 1.0 );
+			if ( weight < 0.0 ) // output left toward left
+			{
+				set_factor( gains, channels, left, left, 0.5 - weight * 0.5 );
+				set_factor( gains, channels, left, right, ( 1.0 + weight ) * 0.5 );
+			}
+			else // output left toward right
+			{
+				set_factor( gains, channels, left, left, ( 1.0 - weight ) * 0.5 );
+				set_factor( gains, channels, left, right, 0.5 + weight * 0.5 );
+			}
+			break;
+		}
+		case 1: // right
+		case 3:
+		{
+			int right = active_channel;
+			int left = right - 1;
+			set_factor( gains, channels, left, left, 1.0 );
+			if ( weight < 0.0 ) // output right toward left
+			{
+				set_factor( gains, channels, right, left, 0.5 - weight * 0.5 );
+				set_factor( gains, channels, right, right, ( 1.0 + weight ) * 0.5 );
+			}
+			else // output right toward right
+			{
+				set_factor( gains, channels, right, left, ( 1.0 - weight ) * 0.5 );
+				set_factor( gains, channels, right, right, 0.5 + weight * 0.5 );
+			}
+			break;
+		}
+	}
+}
+
 /** Get the audio.
 */
 
@@ -35,161 +134,41 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 {
 	mlt_properties properties = mlt_frame_pop_audio( frame );
 	mlt_filter filter = mlt_frame_pop_audio( frame );
-	mlt_properties filter_props = MLT_FILTER_PROPERTIES( filter );
 	mlt_properties frame_props = MLT_FRAME_PROPERTIES( frame );
 
-	// We can only mix s16
-	*format = mlt_audio_s16;
 	mlt_frame_get_audio( frame, (void**) buffer, format, frequency, channels, samples );
 
 	// Apply silence
 	int silent = mlt_properties_get_int( frame_props, "silent_audio" );
 	mlt_properties_set_int( frame_props, "silent_audio", 0 );
 	if ( silent )
-		memset( *buffer, 0, *samples * *channels * sizeof( int16_t ) );
+	{
+		memset( *buffer, *format == mlt_audio_u8 ? 128 : 0, mlt_audio_format_size( *format, *samples, *channels ) );
+		return 0;
+	}
 
-	int src_size = 0;
-	int16_t *src = mlt_properties_get_data( filter_props, "scratch_buffer", &src_size );
-	int16_t *dest = *buffer;
-	double v; // sample accumulator
-	int i, out, in;
-	double factors[6][6]; // mixing weights [in][out]
 	double mix_start = 0.5, mix_end = 0.5;
 	if ( mlt_properties_get( properties, "previous_mix" ) != NULL )
 		mix_start = mlt_properties_get_double( properties, "previous_mix" );
 	if ( mlt_properties_get( properties, "mix" ) != NULL )
 		mix_end = mlt_properties_get_double( properties, "mix" );
-	double weight = mix_start;
-	double weight_step = ( mix_end - mix_start ) / *samples;
 	int active_channel = mlt_properties_get_int( properties, "channel" );
 	int gang = mlt_properties_get_int( properties, "gang" ) ? 2 : 1;
-	// Use an inline low-pass filter to help avoid clipping
-	double Fc = 0.5;
-	double B = exp(-2.0 * M_PI * Fc);
-	double A = 1.0 - B;
-	double vp[6];
 
-	// Setup or resize a scratch buffer
-	if ( !src || src_size < *samples * *channels * sizeof(int16_t) )
+	// The weights ramp from the previous mix to this one across the frame
+	channel_matrix matrix = channel_matrix_new( *channels, *channels );
+	if ( !matrix )
+		return 0;
+	channel_matrix_identity( matrix );
+	float *ramp = channel_matrix_ramp( matrix );
+	if ( ramp )
 	{
-		// We allocate 4 more samples than we need to deal with jitter in the sample count per frame.
-		src_size = ( *samples + 4 ) * *channels * sizeof(int16_t);
-		src = mlt_pool_alloc( src_size );
-		if ( !src )
-			return 0;
-		mlt_properties_set_data( filter_props, "scratch_buffer", src, src_size, mlt_pool_release, NULL );
-	}
-
-	// We must use a pristine copy as the source
-	memcpy( src, *buffer, *samples * *channels * sizeof(int16_t) );
-
-	// Initialize the mix factors
-	for ( i = 0; i < 6; i++ )
-		for ( out = 0; out < 6; out++ )
-			factors[i][out] = 0.0;
-
-	for ( out = 0; out < *channels; out++ )
-		vp[out] = (double) dest[out];
-
-	for ( i = 0; i < *samples; i++ )
-	{
-		// Recompute the mix factors
-		switch ( active_channel )
-		{
-			case -1: // Front L/R balance
-			case -2: // Rear L/R balance
-			{
-				// Gang front/rear balance if requested
-				int g, active = active_channel;
-				for ( g = 0; g < gang; g++, active-- )
-				{
-					int left = active == -1 ? 0 : 2;
-					int right = left + 1;
-					if ( weight < 0.0 )
-					{
-						factors[left][left] = 1.0;
-						factors[right][right] = weight + 1.0 < 0.0 ? 0.0 : weight + 1.0;
-					}
-					else
-					{
-						factors[left][left] = 1.0 - weight < 0.0 ? 0.0 : 1.0 - weight;
-						factors[right][right] = 1.0;
-					}
-				}
-				break;
-			}
-			case -3: // Left fade
-			case -4: // right fade
-			{
-				// Gang left/right fade if requested
-				int g, active = active_channel;
-				for ( g = 0; g < gang; g++, active-- )
-				{
-					int front = active == -3 ? 0 : 1;
-					int rear = front + 2;
-					if ( weight < 0.0 )
-					{
-						factors[front][front] = 1.0;
-						factors[rear][rear] = weight + 1.0 < 0.0 ? 0.0 : weight + 1.0;
-					}
-					else
-					{
-						factors[front][front] = 1.0 - weight < 0.0 ? 0.0 : 1.0 - weight;
-						factors[rear][rear] = 1.0;
-					}
-				}
-				break;
-			}
-			case 0: // left
-			case 2:
-			{
-				int left = active_channel;
-				int right = left + 1;
-				factors[right][right] = 1.0;
-				if ( weight < 0.0 ) // output left toward left
-				{
-					factors[left][left] = 0.5 - weight * 0.5;
-					factors[left][right] = ( 1.0 + weight ) * 0.5;
-				}
-				else // output left toward right
-				{
-					factors[left][left] = ( 1.0 - weight ) * 0.5;
-					factors[left][right] = 0.5 + weight * 0.5;
-				}
-				break;
-			}
-			case 1: // right
-			case 3:
-			{
-				int right = active_channel;
-				int left = right - 1;
-				factors[left][left] = 1.0;
-				if ( weight < 0.0 ) // output right toward left
-				{
-					factors[right][left] = 0.5 - weight * 0.5;
-					factors[right][right] = ( 1.0 + weight ) * 0.5;
-				}
-				else // output right toward right
-				{
-					factors[right][left] = ( 1.0 - weight ) * 0.5;
-					factors[right][right] = 0.5 + weight * 0.5;
-				}
-				break;
-			}
-		}
-
-		// Do the mixing
-		for ( out = 0; out < *channels && out < 6; out++ )
-		{
-			v = 0;
-			for ( in = 0; in < *channels && in < 6; in++ )
-				v += factors[in][out] * src[ i * *channels + in ];
-
-			v = v < -32767 ? -32767 : v > 32768 ? 32768 : v;
-			vp[out] = dest[ i * *channels + out ] = (int16_t) ( v * A + vp[ out ] * B );
-		}
-		weight += weight_step;
+		pan_factors( matrix->gains, *channels, active_channel, gang, mix_start );
+		pan_factors( ramp, *channels, active_channel, gang, mix_end );
+		if ( channel_matrix_apply( matrix, frame, buffer, *format, *samples ) )
+			mlt_log_error( MLT_FILTER_SERVICE( filter ), "Invalid audio format\n" );
 	}
+	channel_matrix_close( matrix );
 
 	return 0;
 }
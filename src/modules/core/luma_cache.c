@@ -0,0 +1,697 @@
+/*
+ * luma_cache.c -- process-wide cache of luma maps shared by transitions
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "luma_cache.h"
+#include <framework/mlt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <pthread.h>
+
+/** the default number of luma maps kept in the cache */
+#define DEFAULT_CACHE_SIZE (16)
+
+/** the number of key tokens kept before unused ones are dropped */
+#define MIN_KEY_LIMIT (64)
+
+/** The cache is indexed by object address, so every distinct key gets a token.
+ *
+ * A token is dropped once no thread uses it and no map made for it exists,
+ * so its address cannot be mistaken for that of a later key.
+*/
+
+typedef struct luma_key_s
+{
+	char *name;     /**< the cache key */
+	int loading;    /**< a thread is producing the map for this key */
+	int preloading; /**< a background preload has been queued for this key */
+	int waiting;    /**< the number of threads waiting for the map */
+	int maps;       /**< the number of maps of this key still alive, guarded by g_maps_mutex */
+	struct luma_key_s *next;
+}
+*luma_key;
+
+/** Guards the key table and serialises the check-then-load of a map. */
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static luma_key g_keys = NULL;
+static int g_key_count = 0;
+static int g_key_limit = MIN_KEY_LIMIT;
+
+/** Guards the map count of the tokens, as maps are closed by the cache. */
+static pthread_mutex_t g_maps_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Everything needed to produce a map, copied so it can outlive the transition.
+*/
+
+typedef struct luma_job_s
+{
+	char *key;                   /**< the cache key of the unscaled map */
+	char *scaled_key;            /**< the cache key of the scaled map or NULL */
+	char *resource;              /**< the resolved file name */
+	char *factory;               /**< the producer factory for non-PGM files */
+	char *interp;                /**< the rescale.interp for non-PGM files */
+	mlt_properties properties;   /**< the properties passed to the producer */
+	mlt_profile profile;
+	int width, height;           /**< the size requested from the producer */
+	int scale_width, scale_height;
+	int invert;
+}
+*luma_job;
+
+/** Load the luma map from PGM stream.
+*/
+
+static void luma_read_pgm( FILE *f, uint16_t **map, int *width, int *height )
+{
+	uint8_t *data = NULL;
+	while (1)
+	{
+		char line[128];
+		char comment[128];
+		int i = 2;
+		int maxval;
+		int bpp;
+		uint16_t *p;
+
+		line[127] = '\0';
+
+		// get the magic code
+		if ( fgets( line, 127, f ) == NULL )
+			break;
+
+		// skip comments
+		while ( sscanf( line, " #%s", comment ) > 0 )
+			if ( fgets( line, 127, f ) == NULL )
+				break;
+
+		if ( line[0] != 'P' || line[1] != '5' )
+			break;
+
+		// skip white space and see if a new line must be fetched
+		for ( i = 2; i < 127 && line[i] != '\0' && isspace( line[i] ); i++ );
+		if ( ( line[i] == '\0' || line[i] == '#' ) && fgets( line, 127, f ) == NULL )
+			break;
+
+		// skip comments
+		while ( sscanf( line, " #%s", comment ) > 0 )
+			if ( fgets( line, 127, f ) == NULL )
+				break;
+
+		// get the dimensions
+		if ( line[0] == 'P' )
+			i = sscanf( line, "P5 %d %d %d", width, height, &maxval );
+		else
+			i = sscanf( line, "%d %d %d", width, height, &maxval );
+
+		// get the height value, if not yet
+		if ( i < 2 )
+		{
+			if ( fgets( line, 127, f ) == NULL )
+				break;
+
+			// skip comments
+			while ( sscanf( line, " #%s", comment ) > 0 )
+				if ( fgets( line, 127, f ) == NULL )
+					break;
+
+			i = sscanf( line, "%d", height );
+			if ( i == 0 )
+				break;
+			else
+				i = 2;
+		}
+
+		// get the maximum gray value, if not yet
+		if ( i < 3 )
+		{
+			if ( fgets( line, 127, f ) == NULL )
+				break;
+
+			// skip comments
+			while ( sscanf( line, " #%s", comment ) > 0 )
+				if ( fgets( line, 127, f ) == NULL )
+					break;
+
+			i = sscanf( line, "%d", &maxval );
+			if ( i == 0 )
+				break;
+		}
+
+		// determine if this is one or two bytes per pixel
+		bpp = maxval > 255 ? 2 : 1;
+
+		// allocate temporary storage for the raw data
+		data = mlt_pool_alloc( *width * *height * bpp );
+		if ( data == NULL )
+			break;
+
+		// read the raw data
+		if ( fread( data, *width * *height * bpp, 1, f ) != 1 )
+			break;
+
+		// allocate the luma bitmap
+		*map = p = (uint16_t*)mlt_pool_alloc( *width * *height * sizeof( uint16_t ) );
+		if ( *map == NULL )
+			break;
+
+		// proces the raw data into the luma bitmap
+		for ( i = 0; i < *width * *height * bpp; i += bpp )
+		{
+			if ( bpp == 1 )
+				*p++ = data[ i ] << 8;
+			else
+				*p++ = ( data[ i ] << 8 ) + data[ i + 1 ];
+		}
+
+		break;
+	}
+
+	if ( data != NULL )
+		mlt_pool_release( data );
+}
+
+/** Generate a luma map from any YUV image.
+*/
+
+static void luma_read_yuv422( uint8_t *image, uint16_t **map, int width, int height )
+{
+	int i;
+
+	// allocate the luma bitmap
+	uint16_t *p = *map = ( uint16_t* )mlt_pool_alloc( width * height * sizeof( uint16_t ) );
+	if ( *map == NULL )
+		return;
+
+	// proces the image data into the luma bitmap
+	for ( i = 0; i < width * height * 2; i += 2 )
+		*p++ = ( image[ i ] - 16 ) * 299; // 299 = 65535 / 219
+}
+
+/** Scale a luma map using nearest neighbour, optionally inverting it.
+*/
+
+static void scale_luma( uint16_t *dest_buf, int dest_width, int dest_height, const uint16_t *src_buf, int src_width, int src_height, int invert )
+{
+	int i, j;
+	int x_step = ( src_width << 16 ) / dest_width;
+	int y_step = ( src_height << 16 ) / dest_height;
+	int x, y = 0;
+
+	for ( i = 0; i < dest_height; i++ )
+	{
+		const uint16_t *src = src_buf + ( y >> 16 ) * src_width;
+		x = 0;
+
+		for ( j = 0; j < dest_width; j++ )
+		{
+			*dest_buf++ = src[ x >> 16 ] ^ invert;
+			x += x_step;
+		}
+		y += y_step;
+	}
+}
+
+static void luma_map_close( luma_map map )
+{
+	if ( map->key )
+	{
+		pthread_mutex_lock( &g_maps_mutex );
+		map->key->maps--;
+		pthread_mutex_unlock( &g_maps_mutex );
+	}
+	mlt_pool_release( map->bitmap );
+	free( map );
+}
+
+static luma_map luma_map_new( uint16_t *bitmap, int width, int height )
+{
+	luma_map map = NULL;
+	if ( bitmap )
+	{
+		map = calloc( 1, sizeof( *map ) );
+		map->bitmap = bitmap;
+		map->width = width;
+		map->height = height;
+	}
+	return map;
+}
+
+/** Append a string to a key allocated on the heap.
+*/
+
+static char *key_append( char *key, const char *s )
+{
+	size_t length = key ? strlen( key ) : 0;
+	char *result = realloc( key, length + strlen( s ) + 1 );
+	strcpy( result + length, s );
+	return result;
+}
+
+static void job_close( luma_job job )
+{
+	if ( job )
+	{
+		free( job->key );
+		free( job->scaled_key );
+		free( job->resource );
+		free( job->factory );
+		free( job->interp );
+		mlt_properties_close( job->properties );
+		mlt_profile_close( job->profile );
+		free( job );
+	}
+}
+
+/** Describe the map wanted by a transition.
+ *
+ * Resources of the form "%name" are looked up in the lumas directory of the
+ * current normalisation. Properties on the transition starting with \p prefix
+ * are passed to the producer of a non-PGM map and so become part of the key.
+ */
+
+static luma_job job_init( mlt_transition transition, mlt_profile profile, const char *resource, const char *prefix,
+	const char *interp, int width, int height, int scale_width, int scale_height, int invert )
+{
+	mlt_properties properties = MLT_TRANSITION_PROPERTIES( transition );
+	luma_job job = NULL;
+	char temp[ 512 ];
+	char *extension;
+
+	if ( !resource || !resource[0] )
+		return NULL;
+
+	if ( strchr( resource, '%' ) )
+	{
+		FILE *test;
+		snprintf( temp, sizeof( temp ), "%s/lumas/%s/%s", mlt_environment( "MLT_DATA" ), mlt_environment( "MLT_NORMALISATION" ), strchr( resource, '%' ) + 1 );
+		test = fopen( temp, "r" );
+		if ( test == NULL )
+			strcat( temp, ".png" );
+		else
+			fclose( test );
+		resource = temp;
+	}
+
+	job = calloc( 1, sizeof( *job ) );
+	job->resource = strdup( resource );
+	job->scale_width = scale_width;
+	job->scale_height = scale_height;
+	job->invert = invert;
+
+	extension = strrchr( resource, '.' );
+	if ( extension != NULL && strcmp( extension, ".pgm" ) == 0 )
+	{
+		// A PGM is read at its own size without any help
+		job->key = key_append( NULL, resource );
+	}
+	else
+	{
+		int i;
+
+		job->factory = strdup( mlt_properties_get( properties, "factory" ) ? mlt_properties_get( properties, "factory" ) : "" );
+		job->interp = strdup( interp );
+		job->width = width;
+		job->height = height;
+		job->properties = mlt_properties_new( );
+		mlt_properties_pass( job->properties, properties, prefix );
+
+		// Producer maps are rendered at a size so a private copy of the profile is needed
+		if ( profile )
+		{
+			job->profile = calloc( 1, sizeof( *job->profile ) );
+			memcpy( job->profile, profile, sizeof( *profile ) );
+			job->profile->description = NULL;
+		}
+
+		snprintf( temp, sizeof( temp ), "%s:", job->factory );
+		job->key = key_append( NULL, temp );
+		job->key = key_append( job->key, resource );
+		snprintf( temp, sizeof( temp ), "@%dx%d/%s", width, height, interp );
+		job->key = key_append( job->key, temp );
+		for ( i = 0; i < mlt_properties_count( job->properties ); i++ )
+		{
+			char *value = mlt_properties_get_value( job->properties, i );
+			job->key = key_append( job->key, ";" );
+			job->key = key_append( job->key, mlt_properties_get_name( job->properties, i ) );
+			job->key = key_append( job->key, "=" );
+			job->key = key_append( job->key, value ? value : "" );
+		}
+	}
+
+	if ( scale_width > 0 && scale_height > 0 )
+	{
+		snprintf( temp, sizeof( temp ), "|%dx%d|%d", scale_width, scale_height, invert );
+		job->scaled_key = key_append( key_append( NULL, job->key ), temp );
+	}
+
+	return job;
+}
+
+/** Get a shared cache, creating it on first use.
+ *
+ * Unscaled and scaled maps are kept in separate caches so that a transition
+ * whose size keeps changing cannot push the decoded files out. The caches
+ * live on the global properties so they are released by mlt_factory_close.
+ * Their size is taken from MLT_LUMA_CACHE_SIZE. The caller must hold g_mutex.
+ */
+
+static mlt_cache get_cache( const char *name )
+{
+	mlt_cache cache = mlt_properties_get_data( mlt_global_properties(), name, NULL );
+	if ( !cache )
+	{
+		int size = getenv( "MLT_LUMA_CACHE_SIZE" ) ? atoi( getenv( "MLT_LUMA_CACHE_SIZE" ) ) : DEFAULT_CACHE_SIZE;
+		cache = mlt_cache_init();
+		mlt_cache_set_size( cache, size > 0 ? size : DEFAULT_CACHE_SIZE );
+		mlt_properties_set_data( mlt_global_properties(), name, cache, 0, ( mlt_destructor )mlt_cache_close, NULL );
+	}
+	return cache;
+}
+
+/** Drop the tokens that no thread uses and that have no map.
+ *
+ * The caller must hold g_mutex.
+ */
+
+static void prune_keys( )
+{
+	luma_key *link = &g_keys;
+
+	pthread_mutex_lock( &g_maps_mutex );
+	while ( *link )
+	{
+		luma_key key = *link;
+		if ( !key->loading && !key->preloading && !key->waiting && !key->maps )
+		{
+			*link = key->next;
+			free( key->name );
+			free( key );
+			g_key_count--;
+		}
+		else
+		{
+			link = &key->next;
+		}
+	}
+	pthread_mutex_unlock( &g_maps_mutex );
+}
+
+/** Get the token standing for a key in the cache.
+ *
+ * The table is pruned whenever it has doubled since the last time, so a
+ * session that keeps changing luma files or sizes does not grow it without
+ * bound. The caller must hold g_mutex.
+ */
+
+static luma_key get_key( const char *name )
+{
+	luma_key *link = &g_keys;
+	luma_key result;
+
+	while ( *link && strcmp( ( *link )->name, name ) )
+		link = &( *link )->next;
+	result = *link;
+
+	if ( result )
+	{
+		// Move it to the front, where the keys in use gather
+		*link = result->next;
+	}
+	else
+	{
+		if ( g_key_count >= g_key_limit )
+		{
+			prune_keys( );
+			g_key_limit = g_key_count * 2 > MIN_KEY_LIMIT ? g_key_count * 2 : MIN_KEY_LIMIT;
+		}
+		result = calloc( 1, sizeof( *result ) );
+		result->name = strdup( name );
+		g_key_count++;
+	}
+	result->next = g_keys;
+	g_keys = result;
+
+	return result;
+}
+
+/** Produce the unscaled map from the file.
+*/
+
+static luma_map load_map( luma_job job )
+{
+	uint16_t *bitmap = NULL;
+	int width = job->width;
+	int height = job->height;
+
+	if ( !job->factory )
+	{
+		mlt_properties temp = mlt_properties_new( );
+		FILE *f;
+
+		// Convert file name string encoding.
+		mlt_properties_set( temp, "utf8", job->resource );
+		mlt_properties_from_utf8( temp, "utf8", "local8" );
+
+		// Open PGM
+		f = fopen( mlt_properties_get( temp, "local8" ), "rb" );
+		if ( f != NULL )
+		{
+			luma_read_pgm( f, &bitmap, &width, &height );
+			fclose( f );
+		}
+		mlt_properties_close( temp );
+	}
+	else
+	{
+		mlt_producer producer = mlt_factory_producer( job->profile, job->factory, job->resource );
+
+		if ( producer != NULL )
+		{
+			mlt_properties producer_properties = MLT_PRODUCER_PROPERTIES( producer );
+			mlt_frame luma_frame = NULL;
+
+			// Ensure that we loop
+			mlt_properties_set( producer_properties, "eof", "loop" );
+
+			// Now pass all producer. properties on the transition down
+			mlt_properties_inherit( producer_properties, job->properties );
+
+			// Get the luma frame
+			if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), &luma_frame, 0 ) == 0 )
+			{
+				uint8_t *luma_image = NULL;
+				mlt_image_format luma_format = mlt_image_yuv422;
+
+				// Get image from the luma producer
+				mlt_properties_set( MLT_FRAME_PROPERTIES( luma_frame ), "rescale.interp", job->interp );
+				mlt_frame_get_image( luma_frame, &luma_image, &luma_format, &width, &height, 0 );
+
+				// Generate the luma map
+				if ( luma_image != NULL && luma_format == mlt_image_yuv422 )
+					luma_read_yuv422( luma_image, &bitmap, width, height );
+
+				mlt_frame_close( luma_frame );
+			}
+			mlt_producer_close( producer );
+		}
+	}
+
+	return luma_map_new( bitmap, width, height );
+}
+
+static mlt_cache_item fetch( luma_job job, int scaled );
+
+/** Produce the scaled map from the shared unscaled one.
+*/
+
+static luma_map scale_map( luma_job job )
+{
+	luma_map result = NULL;
+	mlt_cache_item item = fetch( job, 0 );
+	luma_map source = mlt_cache_item_data( item, NULL );
+
+	if ( source )
+	{
+		uint16_t *bitmap = mlt_pool_alloc( job->scale_width * job->scale_height * sizeof( uint16_t ) );
+		scale_luma( bitmap, job->scale_width, job->scale_height, source->bitmap, source->width, source->height,
+			job->invert * ( ( 1 << 16 ) - 1 ) );
+		result = luma_map_new( bitmap, job->scale_width, job->scale_height );
+	}
+	mlt_cache_item_close( item );
+
+	return result;
+}
+
+/** Look up a map, producing it if no other thread is already doing so.
+ *
+ * Only one thread produces a given map while others wait for it, so a
+ * playlist full of identical wipes reads and scales the file only once.
+ */
+
+static mlt_cache_item fetch( luma_job job, int scaled )
+{
+	mlt_cache_item item;
+	mlt_cache cache;
+	luma_key key;
+
+	pthread_mutex_lock( &g_mutex );
+	cache = get_cache( scaled ? "luma_cache.scaled" : "luma_cache" );
+	key = get_key( scaled ? job->scaled_key : job->key );
+	item = mlt_cache_get( cache, key );
+	key->waiting++;
+	while ( !item && key->loading )
+	{
+		pthread_cond_wait( &g_cond, &g_mutex );
+		item = mlt_cache_get( cache, key );
+	}
+	key->waiting--;
+	if ( !item )
+	{
+		luma_map map;
+
+		key->loading = 1;
+		pthread_mutex_unlock( &g_mutex );
+		map = scaled ? scale_map( job ) : load_map( job );
+		pthread_mutex_lock( &g_mutex );
+		if ( map )
+		{
+			pthread_mutex_lock( &g_maps_mutex );
+			map->key = key;
+			key->maps++;
+			pthread_mutex_unlock( &g_maps_mutex );
+			mlt_cache_put( cache, key, map, map->width * map->height * sizeof( uint16_t ), ( mlt_destructor )luma_map_close );
+			item = mlt_cache_get( cache, key );
+		}
+		key->loading = 0;
+		pthread_cond_broadcast( &g_cond );
+	}
+	pthread_mutex_unlock( &g_mutex );
+
+	return item;
+}
+
+/** Get a luma map from the shared cache.
+ *
+ * Non-PGM files are rendered through the transition's "factory" producer at
+ * \p width x \p height using \p interp, receiving the transition's properties
+ * that start with \p prefix. When \p scale_width and \p scale_height are
+ * given the map is scaled to that size and optionally inverted.
+ *
+ * \param transition the transition wanting the map
+ * \param resource the file name or "%name" of a map shipped with MLT
+ * \return a cache item holding a luma_map, or NULL if it could not be loaded;
+ * the caller must close the item when done with the map
+ */
+
+mlt_cache_item luma_cache_get( mlt_transition transition, const char *resource, const char *prefix, const char *interp,
+	int width, int height, int scale_width, int scale_height, int invert )
+{
+	mlt_profile profile = mlt_service_profile( MLT_TRANSITION_SERVICE( transition ) );
+	luma_job job = job_init( transition, profile, resource, prefix, interp, width, height, scale_width, scale_height, invert );
+	mlt_cache_item item = NULL;
+
+	if ( job )
+	{
+		item = fetch( job, job->scaled_key != NULL );
+		job_close( job );
+	}
+	return item;
+}
+
+static void *preload_thread( void *arg )
+{
+	luma_job job = arg;
+	int scaled = job->scaled_key != NULL;
+	luma_key key;
+
+	mlt_cache_item_close( fetch( job, scaled ) );
+
+	pthread_mutex_lock( &g_mutex );
+	key = get_key( scaled ? job->scaled_key : job->key );
+	key->preloading = 0;
+	pthread_mutex_unlock( &g_mutex );
+	job_close( job );
+
+	return NULL;
+}
+
+static void preload_join( pthread_t *thread )
+{
+	pthread_join( *thread, NULL );
+	free( thread );
+}
+
+/** Start producing a map in the background.
+ *
+ * This is meant to be called when a transition gets a new map so that the
+ * file is already decoded and scaled by the time the first frame needs it.
+ * Nothing is started if the map is cached or already on its way. The thread
+ * is joined when the transition is closed.
+ *
+ * \param profile the profile to use, since the transition might not have one yet
+ */
+
+void luma_cache_preload( mlt_transition transition, mlt_profile profile, const char *resource, const char *prefix,
+	const char *interp, int width, int height, int scale_width, int scale_height, int invert )
+{
+	luma_job job;
+	luma_key key;
+	mlt_cache_item item;
+	pthread_t *thread;
+
+	if ( !profile )
+		profile = mlt_service_profile( MLT_TRANSITION_SERVICE( transition ) );
+	job = job_init( transition, profile, resource, prefix, interp, width, height, scale_width, scale_height, invert );
+	if ( !job || ( job->factory && !job->profile ) )
+	{
+		job_close( job );
+		return;
+	}
+
+	pthread_mutex_lock( &g_mutex );
+	key = get_key( job->scaled_key ? job->scaled_key : job->key );
+	item = key->loading || key->preloading ? NULL : mlt_cache_get( get_cache( job->scaled_key ? "luma_cache.scaled" : "luma_cache" ), key );
+	if ( item || key->loading || key->preloading )
+	{
+		pthread_mutex_unlock( &g_mutex );
+		mlt_cache_item_close( item );
+		job_close( job );
+		return;
+	}
+	key->preloading = 1;
+	pthread_mutex_unlock( &g_mutex );
+
+	thread = malloc( sizeof( *thread ) );
+	if ( pthread_create( thread, NULL, preload_thread, job ) == 0 )
+	{
+		// Replacing a previous preload waits for it to finish
+		mlt_properties_set_data( MLT_TRANSITION_PROPERTIES( transition ), "_luma_preload", thread, 0, ( mlt_destructor )preload_join, NULL );
+	}
+	else
+	{
+		free( thread );
+		pthread_mutex_lock( &g_mutex );
+		key->preloading = 0;
+		pthread_mutex_unlock( &g_mutex );
+		job_close( job );
+	}
+}
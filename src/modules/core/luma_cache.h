@@ -0,0 +1,47 @@
+/*
+ * luma_cache.h -- process-wide cache of luma maps shared by transitions
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _LUMA_CACHE_H_
+#define _LUMA_CACHE_H_
+
+#include <framework/mlt_transition.h>
+#include <framework/mlt_cache.h>
+#include <stdint.h>
+
+/** A luma map as held by the cache.
+ *
+ * The map is shared between all transitions using the same file, so it
+ * must be treated as read only.
+ */
+
+typedef struct luma_map_s
+{
+	uint16_t *bitmap;
+	int width;
+	int height;
+	struct luma_key_s *key; /**< private to the cache */
+}
+*luma_map;
+
+extern mlt_cache_item luma_cache_get( mlt_transition transition, const char *resource, const char *prefix, const char *interp,
+                                      int width, int height, int scale_width, int scale_height, int invert );
+extern void luma_cache_preload( mlt_transition transition, mlt_profile profile, const char *resource, const char *prefix,
+                                const char *interp, int width, int height, int scale_width, int scale_height, int invert );
+
+#endif
@@ -19,6 +19,7 @@
  */
 
 #include "transition_composite.h"
+#include "luma_cache.h"
 #include <framework/mlt.h>
 
 #include <stdio.h>
@@ -63,16 +64,32 @@ static int alignment_parse( char* align )
 	return ret;
 }
 
+/** Get the length the keys of the transition are spread over.
+*/
+
+static int keys_length( mlt_transition self )
+{
+	mlt_properties properties = MLT_TRANSITION_PROPERTIES( self );
+	mlt_position length = mlt_transition_get_length( self );
+	double cycle = mlt_properties_get_double( properties, "cycle" );
+
+	// Allow a geometry repeat cycle
+	if ( cycle >= 1 )
+		length = cycle;
+	else if ( cycle > 0 )
+		length *= cycle;
+	return length;
+}
+
 /** Calculate real geometry.
 */
 
-static void geometry_calculate( mlt_transition self, struct geometry_s *output, double position )
+static void geometry_calculate( mlt_transition self, mlt_geometry_compiled geometry, struct geometry_s *output, double position )
 {
 	mlt_properties properties = MLT_TRANSITION_PROPERTIES( self );
-	mlt_geometry geometry = mlt_properties_get_data( properties, "geometries", NULL );
 	int mirror_off = mlt_properties_get_int( properties, "mirror_off" );
 	int repeat_off = mlt_properties_get_int( properties, "repeat_off" );
-	int length = mlt_geometry_get_length( geometry );
+	int length = mlt_geometry_compiled_get_length( geometry );
 
 	// Allow wrapping
 	if ( !repeat_off && position >= length && length != 0 )
@@ -84,10 +101,18 @@ static void geometry_calculate( mlt_transition self, struct geometry_s *output,
 	}
 
 	// Fetch the key for the position
-	mlt_geometry_fetch( geometry, &output->item, position );
+	mlt_geometry_compiled_fetch( geometry, &output->item, position );
 }
 
-static mlt_geometry transition_parse_keys( mlt_transition self, int normalised_width, int normalised_height )
+/** Get the compiled keys of the transition.
+
+    The geometry property is compiled and kept by the property itself. The
+    deprecated start, key[n] and end properties are compiled here and kept
+    until the length or normalisation changes. The caller must release the
+    result with mlt_geometry_compiled_close.
+*/
+
+static mlt_geometry_compiled transition_parse_keys( mlt_transition self, int normalised_width, int normalised_height )
 {
 	// Loop variable for property interrogation
 	int i = 0;
@@ -95,71 +120,73 @@ static mlt_geometry transition_parse_keys( mlt_transition self, int normalised_w
 	// Get the properties of the transition
 	mlt_properties properties = MLT_TRANSITION_PROPERTIES( self );
 
+	// Get the duration
+	int length = keys_length( self );
+
+	// Use the new style geometry string if we have one
+	if ( mlt_properties_get( properties, "geometry" ) )
+		return mlt_properties_get_geometry( properties, "geometry", length, normalised_width, normalised_height );
+
+	// Reuse the old style keys if they are still valid
+	mlt_geometry_compiled compiled = mlt_properties_get_data( properties, "geometries", NULL );
+	if ( compiled && mlt_geometry_compiled_get_length( compiled ) == length &&
+	     mlt_properties_get_int( properties, "_geometries.nw" ) == normalised_width &&
+	     mlt_properties_get_int( properties, "_geometries.nh" ) == normalised_height )
+		return mlt_geometry_compiled_inc_ref( compiled );
+
 	// Create an empty geometries object
 	mlt_geometry geometry = mlt_geometry_init( );
+	mlt_geometry_parse( geometry, NULL, length, normalised_width, normalised_height );
 
-	// Get the duration
-	mlt_position length = mlt_transition_get_length( self );
-	double cycle = mlt_properties_get_double( properties, "cycle" );
-
-	// Get the new style geometry string
-	char *property = mlt_properties_get( properties, "geometry" );
+	// DEPRECATED: Multiple keys for geometry information is inefficient and too rigid for 
+	// practical use - while deprecated, it has been slightly extended too - keys can now
+	// be specified out of order, and can be blanked or NULL to simulate removal
 
-	// Allow a geometry repeat cycle
-	if ( cycle >= 1 )
-		length = cycle;
-	else if ( cycle > 0 )
-		length *= cycle;
+	// Structure to use for parsing and inserting
+	struct mlt_geometry_item_s item;
 
-	// Parse the geometry if we have one
-	mlt_geometry_parse( geometry, property, length, normalised_width, normalised_height );
+	// Parse the start property
+	item.frame = 0;
+	if ( mlt_geometry_parse_item( geometry, &item, mlt_properties_get( properties, "start" ) ) == 0 )
+		mlt_geometry_insert( geometry, &item );
 
-	// Check if we're using the old style geometry
-	if ( property == NULL )
+	// Parse the keys in between
+	for ( i = 0; i < mlt_properties_count( properties ); i ++ )
 	{
-		// DEPRECATED: Multiple keys for geometry information is inefficient and too rigid for 
-		// practical use - while deprecated, it has been slightly extended too - keys can now
-		// be specified out of order, and can be blanked or NULL to simulate removal
+		// Get the name of the property
+		char *name = mlt_properties_get_name( properties, i );
 
-		// Structure to use for parsing and inserting
-		struct mlt_geometry_item_s item;
+		// Check that it's valid
+		if ( !strncmp( name, "key[", 4 ) )
+		{
+			// Get the value of the property
+			char *value = mlt_properties_get_value( properties, i );
 
-		// Parse the start property
-		item.frame = 0;
-		if ( mlt_geometry_parse_item( geometry, &item, mlt_properties_get( properties, "start" ) ) == 0 )
-			mlt_geometry_insert( geometry, &item );
+			// Determine the frame number
+			item.frame = atoi( name + 4 );
 
-		// Parse the keys in between
-		for ( i = 0; i < mlt_properties_count( properties ); i ++ )
-		{
-			// Get the name of the property
-			char *name = mlt_properties_get_name( properties, i );
-	
-			// Check that it's valid
-			if ( !strncmp( name, "key[", 4 ) )
-			{
-				// Get the value of the property
-				char *value = mlt_properties_get_value( properties, i );
-	
-				// Determine the frame number
-				item.frame = atoi( name + 4 );
-	
-				// Parse and add to the list
-				if ( mlt_geometry_parse_item( geometry, &item, value ) == 0 )
-					mlt_geometry_insert( geometry, &item );
-				else
-					fprintf( stderr, "Invalid Key - skipping %s = %s\n", name, value );
-			}
+			// Parse and add to the list
+			if ( mlt_geometry_parse_item( geometry, &item, value ) == 0 )
+				mlt_geometry_insert( geometry, &item );
+			else
+				fprintf( stderr, "Invalid Key - skipping %s = %s\n", name, value );
 		}
-
-		// Parse the end
-		item.frame = -1;
-		if ( mlt_geometry_parse_item( geometry, &item, mlt_properties_get( properties, "end" ) ) == 0 )
-			mlt_geometry_insert( geometry, &item );
-		mlt_geometry_interpolate( geometry );
 	}
-	
-	return geometry;
+
+	// Parse the end
+	item.frame = -1;
+	if ( mlt_geometry_parse_item( geometry, &item, mlt_properties_get( properties, "end" ) ) == 0 )
+		mlt_geometry_insert( geometry, &item );
+	mlt_geometry_interpolate( geometry );
+
+	// Compile and assign to properties to ensure we get destroyed
+	compiled = mlt_geometry_compile( geometry );
+	mlt_geometry_close( geometry );
+	mlt_properties_set_data( properties, "geometries", compiled, 0, ( mlt_destructor )mlt_geometry_compiled_close, NULL );
+	mlt_properties_set_int( properties, "_geometries.nw", normalised_width );
+	mlt_properties_set_int( properties, "_geometries.nh", normalised_height );
+
+	return mlt_geometry_compiled_inc_ref( compiled );
 }
 
 /** Adjust position according to scaled size and alignment properties.
@@ -224,135 +251,6 @@ static inline int32_t smoothstep( int32_t edge1, int32_t edge2, uint32_t a )
 	return ( ( ( a * a ) >> 16 )  * ( ( 3 << 16 ) - ( 2 * a ) ) ) >> 16;
 }
 
-/** Load the luma map from PGM stream.
-*/
-
-static void luma_read_pgm( FILE *f, uint16_t **map, int *width, int *height )
-{
-	uint8_t *data = NULL;
-	while (1)
-	{
-		char line[128];
-		char comment[128];
-		int i = 2;
-		int maxval;
-		int bpp;
-		uint16_t *p;
-
-		line[127] = '\0';
-
-		// get the magic code
-		if ( fgets( line, 127, f ) == NULL )
-			break;
-
-		// skip comments
-		while ( sscanf( line, " #%s", comment ) > 0 )
-			if ( fgets( line, 127, f ) == NULL )
-				break;
-
-		if ( line[0] != 'P' || line[1] != '5' )
-			break;
-
-		// skip white space and see if a new line must be fetched
-		for ( i = 2; i < 127 && line[i] != '\0' && isspace( line[i] ); i++ );
-		if ( ( line[i] == '\0' || line[i] == '#' ) && fgets( line, 127, f ) == NULL )
-			break;
-
-		// skip comments
-		while ( sscanf( line, " #%s", comment ) > 0 )
-			if ( fgets( line, 127, f ) == NULL )
-				break;
-
-		// get the dimensions
-		if ( line[0] == 'P' )
-			i = sscanf( line, "P5 %d %d %d", width, height, &maxval );
-		else
-			i = sscanf( line, "%d %d %d", width, height, &maxval );
-
-		// get the height value, if not yet
-		if ( i < 2 )
-		{
-			if ( fgets( line, 127, f ) == NULL )
-				break;
-
-			// skip comments
-			while ( sscanf( line, " #%s", comment ) > 0 )
-				if ( fgets( line, 127, f ) == NULL )
-					break;
-
-			i = sscanf( line, "%d", height );
-			if ( i == 0 )
-				break;
-			else
-				i = 2;
-		}
-
-		// get the maximum gray value, if not yet
-		if ( i < 3 )
-		{
-			if ( fgets( line, 127, f ) == NULL )
-				break;
-
-			// skip comments
-			while ( sscanf( line, " #%s", comment ) > 0 )
-				if ( fgets( line, 127, f ) == NULL )
-					break;
-
-			i = sscanf( line, "%d", &maxval );
-			if ( i == 0 )
-				break;
-		}
-
-		// determine if this is one or two bytes per pixel
-		bpp = maxval > 255 ? 2 : 1;
-
-		// allocate temporary storage for the raw data
-		data = mlt_pool_alloc( *width * *height * bpp );
-		if ( data == NULL )
-			break;
-
-		// read the raw data
-		if ( fread( data, *width * *height * bpp, 1, f ) != 1 )
-			break;
-
-		// allocate the luma bitmap
-		*map = p = (uint16_t*)mlt_pool_alloc( *width * *height * sizeof( uint16_t ) );
-		if ( *map == NULL )
-			break;
-
-		// proces the raw data into the luma bitmap
-		for ( i = 0; i < *width * *height * bpp; i += bpp )
-		{
-			if ( bpp == 1 )
-				*p++ = data[ i ] << 8;
-			else
-				*p++ = ( data[ i ] << 8 ) + data[ i + 1 ];
-		}
-
-		break;
-	}
-
-	if ( data != NULL )
-		mlt_pool_release( data );
-}
-
-/** Generate a luma map from any YUV image.
-*/
-
-static void luma_read_yuv422( uint8_t *image, uint16_t **map, int width, int height )
-{
-	int i;
-	
-	// allocate the luma bitmap
-	uint16_t *p = *map = ( uint16_t* )mlt_pool_alloc( width * height * sizeof( uint16_t ) );
-	if ( *map == NULL )
-		return;
-
-	// proces the image data into the luma bitmap
-	for ( i = 0; i < width * height * 2; i += 2 )
-		*p++ = ( image[ i ] - 16 ) * 299; // 299 = 65535 / 219
-}
-
 static inline int calculate_mix( uint16_t *luma, int j, int softness, int weight, int alpha, uint32_t step )
 {
 	return ( ( luma ? smoothstep( luma[ j ], luma[ j ] + softness, step ) : weight ) * ( alpha + 1 ) ) >> 8;
@@ -581,31 +479,9 @@ static int composite_yuv( uint8_t *p_dest, int width_dest, int height_dest, uint
 }
 
 
-/** Scale 16bit greyscale luma map using nearest neighbor.
+/** Get the luma map scaled to the frame size from the shared cache.
 */
 
-static inline void
-scale_luma ( uint16_t *dest_buf, int dest_width, int dest_height, const uint16_t *src_buf, int src_width, int src_height, int invert )
-{
-	register int i, j;
-	register int x_step = ( src_width << 16 ) / dest_width;
-	register int y_step = ( src_height << 16 ) / dest_height;
-	register int x, y = 0;
-
-	for ( i = 0; i < dest_height; i++ )
-	{
-		const uint16_t *src = src_buf + ( y >> 16 ) * src_width;
-		x = 0;
-		
-		for ( j = 0; j < dest_width; j++ )
-		{
-			*dest_buf++ = src[ x >> 16 ] ^ invert;
-			x += x_step;
-		}
-		y += y_step;
-	}
-}
-
 static uint16_t* get_luma( mlt_transition self, mlt_properties properties, int width, int height )
 {
 	// The cached luma map information
@@ -613,146 +489,41 @@ static uint16_t* get_luma( mlt_transition self, mlt_properties properties, int w
 	int luma_height = mlt_properties_get_int( properties, "_luma.height" );
 	uint16_t *luma_bitmap = mlt_properties_get_data( properties, "_luma.bitmap", NULL );
 	int invert = mlt_properties_get_int( properties, "luma_invert" );
-	
+	char *old_luma = mlt_properties_get( properties, "_luma" );
+
 	// If the filename property changed, reload the map
 	char *resource = mlt_properties_get( properties, "luma" );
 
-	char temp[ 512 ];
-
-	if ( luma_width == 0 || luma_height == 0 )
-	{
-		luma_width = width;
-		luma_height = height;
-	}
-
-	if ( resource && resource[0] && strchr( resource, '%' ) )
-	{
-		// TODO: Clean up quick and dirty compressed/existence check
-		FILE *test;
-		sprintf( temp, "%s/lumas/%s/%s", mlt_environment( "MLT_DATA" ), mlt_environment( "MLT_NORMALISATION" ), strchr( resource, '%' ) + 1 );
-		test = fopen( temp, "r" );
-		if ( test == NULL )
-			strcat( temp, ".png" );
-		else
-			fclose( test );
-		resource = temp;
-	}
-
 	if ( resource && resource[0] )
 	{
-		char *old_luma = mlt_properties_get( properties, "_luma" );
 		int old_invert = mlt_properties_get_int( properties, "_luma_invert" );
 
-		if ( invert != old_invert || ( old_luma && old_luma[0] && strcmp( resource, old_luma ) ) )
-		{
-			mlt_properties_set_data( properties, "_luma.orig_bitmap", NULL, 0, NULL, NULL );
-			luma_bitmap = NULL;
-		}
-	}
-	else {
-		char *old_luma = mlt_properties_get( properties, "_luma" );
-		if ( old_luma && old_luma[0] )
+		if ( luma_bitmap == NULL || luma_width != width || luma_height != height || invert != old_invert ||
+			!old_luma || strcmp( resource, old_luma ) )
 		{
-			mlt_properties_set_data( properties, "_luma.orig_bitmap", NULL, 0, NULL, NULL );
-			luma_bitmap = NULL;
-			mlt_properties_set( properties, "_luma", NULL);
-		}
-	}
+			// Maps are shared with every other transition using the same file and size
+			mlt_cache_item item = luma_cache_get( self, resource, "luma.", "none", 0, 0, width, height, invert );
+			luma_map map = mlt_cache_item_data( item, NULL );
 
-	if ( resource && resource[0] && ( luma_bitmap == NULL || luma_width != width || luma_height != height ) )
-	{
-		uint16_t *orig_bitmap = mlt_properties_get_data( properties, "_luma.orig_bitmap", NULL );
-		luma_width = mlt_properties_get_int( properties, "_luma.orig_width" );
-		luma_height = mlt_properties_get_int( properties, "_luma.orig_height" );
-
-		// Load the original luma once
-		if ( orig_bitmap == NULL )
-		{
-			char *extension = strrchr( resource, '.' );
-			
-			// See if it is a PGM
-			if ( extension != NULL && strcmp( extension, ".pgm" ) == 0 )
+			luma_bitmap = map ? map->bitmap : NULL;
+			if ( map )
 			{
-				// Convert file name string encoding.
-				mlt_properties_set( properties, "_luma_utf8", resource );
-				mlt_properties_from_utf8( properties, "_luma_utf8", "_luma_local8" );
-
-				// Open PGM
-				FILE *f = fopen( mlt_properties_get( properties, "_luma_local8" ), "rb" );
-				if ( f != NULL )
-				{
-					// Load from PGM
-					luma_read_pgm( f, &orig_bitmap, &luma_width, &luma_height );
-					fclose( f );
-					
-					// Remember the original size for subsequent scaling
-					mlt_properties_set_data( properties, "_luma.orig_bitmap", orig_bitmap, luma_width * luma_height * 2, mlt_pool_release, NULL );
-					mlt_properties_set_int( properties, "_luma.orig_width", luma_width );
-					mlt_properties_set_int( properties, "_luma.orig_height", luma_height );
-				}
-			}
-			else
-			{
-				// Get the factory producer service
-				char *factory = mlt_properties_get( properties, "factory" );
-	
-				// Create the producer
-				mlt_profile profile = mlt_service_profile( MLT_TRANSITION_SERVICE( self ) );
-				mlt_producer producer = mlt_factory_producer( profile, factory, resource );
-	
-				// If we have one
-				if ( producer != NULL )
-				{
-					// Get the producer properties
-					mlt_properties producer_properties = MLT_PRODUCER_PROPERTIES( producer );
-	
-					// Ensure that we loop
-					mlt_properties_set( producer_properties, "eof", "loop" );
-	
-					// Now pass all producer. properties on the transition down
-					mlt_properties_pass( producer_properties, properties, "luma." );
-	
-					// We will get the alpha frame from the producer
-					mlt_frame luma_frame = NULL;
-	
-					// Get the luma frame
-					if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), &luma_frame, 0 ) == 0 )
-					{
-						uint8_t *luma_image;
-						mlt_image_format luma_format = mlt_image_yuv422;
-	
-						// Get image from the luma producer
-						mlt_properties_set( MLT_FRAME_PROPERTIES( luma_frame ), "rescale.interp", "none" );
-						mlt_frame_get_image( luma_frame, &luma_image, &luma_format, &luma_width, &luma_height, 0 );
-	
-						// Generate the luma map
-						if ( luma_image != NULL && luma_format == mlt_image_yuv422 )
-							luma_read_yuv422( luma_image, &orig_bitmap, luma_width, luma_height );
-	
-						// Remember the original size for subsequent scaling
-						mlt_properties_set_data( properties, "_luma.orig_bitmap", orig_bitmap, luma_width * luma_height * 2, mlt_pool_release, NULL );
-						mlt_properties_set_int( properties, "_luma.orig_width", luma_width );
-						mlt_properties_set_int( properties, "_luma.orig_height", luma_height );
-						
-						// Cleanup the luma frame
-						mlt_frame_close( luma_frame );
-					}
-	
-					// Cleanup the luma producer
-					mlt_producer_close( producer );
-				}
+				// Remember the scaled luma size to prevent unnecessary scaling
+				mlt_properties_set_int( properties, "_luma.width", width );
+				mlt_properties_set_int( properties, "_luma.height", height );
+				mlt_properties_set_data( properties, "_luma.map", item, 0, ( mlt_destructor )mlt_cache_item_close, NULL );
+				mlt_properties_set_data( properties, "_luma.bitmap", luma_bitmap, width * height * 2, NULL, NULL );
+				mlt_properties_set( properties, "_luma", resource );
+				mlt_properties_set_int( properties, "_luma_invert", invert );
 			}
 		}
-		// Scale luma map
-		luma_bitmap = mlt_pool_alloc( width * height * sizeof( uint16_t ) );
-		scale_luma( luma_bitmap, width, height, orig_bitmap, luma_width, luma_height, invert * ( ( 1 << 16 ) - 1 ) );
-
-		// Remember the scaled luma size to prevent unnecessary scaling
-		mlt_properties_set_int( properties, "_luma.width", width );
-		mlt_properties_set_int( properties, "_luma.height", height );
-		mlt_properties_set_data( properties, "_luma.bitmap", luma_bitmap, width * height * 2, mlt_pool_release, NULL );
-		mlt_properties_set( properties, "_luma", resource );
-		mlt_properties_set_int( properties, "_luma_invert", invert );
+	}
+	else if ( old_luma && old_luma[0] )
+	{
+		luma_bitmap = NULL;
+		mlt_properties_set_data( properties, "_luma.bitmap", NULL, 0, NULL, NULL );
+		mlt_properties_set_data( properties, "_luma.map", NULL, 0, NULL, NULL );
+		mlt_properties_set( properties, "_luma", NULL );
 	}
 	return luma_bitmap;
 }
@@ -876,24 +647,10 @@ static void crop_calculate( mlt_transition self, mlt_properties properties, stru
 	result->y_src = 0;
 	if ( mlt_properties_get( properties, "crop" ) )
 	{
-		mlt_geometry crop = mlt_properties_get_data( properties, "crop_geometry", NULL );
-		if ( !crop )
-		{
-			crop = mlt_geometry_init();
-			mlt_position length = mlt_transition_get_length( self );
-			double cycle = mlt_properties_get_double( properties, "cycle" );
-
-			// Allow a geometry repeat cycle
-			if ( cycle >= 1 )
-				length = cycle;
-			else if ( cycle > 0 )
-				length *= cycle;
-			mlt_geometry_parse( crop, mlt_properties_get( properties, "crop" ), length, result->sw, result->sh );
-			mlt_properties_set_data( properties, "crop_geometry", crop, 0, (mlt_destructor)mlt_geometry_close, NULL );
-		}
+		mlt_geometry_compiled crop = mlt_properties_get_geometry( properties, "crop", keys_length( self ), result->sw, result->sh );
 
 		// Repeat processing
-		int length = mlt_geometry_get_length( crop );
+		int length = mlt_geometry_compiled_get_length( crop );
 		int mirror_off = mlt_properties_get_int( properties, "mirror_off" );
 		int repeat_off = mlt_properties_get_int( properties, "repeat_off" );
 		if ( !repeat_off && position >= length && length != 0 )
@@ -906,22 +663,20 @@ static void crop_calculate( mlt_transition self, mlt_properties properties, stru
 
 		// Compute the pan
 		struct mlt_geometry_item_s crop_item;
-		mlt_geometry_fetch( crop, &crop_item, position );
+		mlt_geometry_compiled_fetch( crop, &crop_item, position );
+		mlt_geometry_compiled_close( crop );
 		result->x_src = rint( crop_item.x );
 		result->y_src = rint( crop_item.y );
 	}
 }
 
-static mlt_geometry composite_calculate( mlt_transition self, struct geometry_s *result, mlt_frame a_frame, double position )
+static void composite_calculate( mlt_transition self, struct geometry_s *result, mlt_frame a_frame, double position )
 {
 	// Get the properties from the transition
 	mlt_properties properties = MLT_TRANSITION_PROPERTIES( self );
 
 	// Get the properties from the frame
 	mlt_properties a_props = MLT_FRAME_PROPERTIES( a_frame );
-	
-	// Structures for geometry
-	mlt_geometry start = mlt_properties_get_data( properties, "geometries", NULL );
 
 	// Obtain the normalised width and height from the a_frame
 	mlt_profile profile = mlt_service_profile( MLT_TRANSITION_SERVICE( self ) );
@@ -938,28 +693,12 @@ static mlt_geometry composite_calculate( mlt_transition self, struct geometry_s
 	}
 	else
 	{
-		// Now parse the geometries
-		if ( start == NULL )
-		{
-			// Parse the transitions properties
-			start = transition_parse_keys( self, normalised_width, normalised_height );
-
-			// Assign to properties to ensure we get destroyed
-			mlt_properties_set_data( properties, "geometries", start, 0, ( mlt_destructor )mlt_geometry_close, NULL );
-		}
-		else
-		{
-			mlt_position length = mlt_transition_get_length( self );
-			double cycle = mlt_properties_get_double( properties, "cycle" );
-			if ( cycle > 1 )
-				length = cycle;
-			else if ( cycle > 0 )
-				length *= cycle;
-			mlt_geometry_refresh( start, mlt_properties_get( properties, "geometry" ), length, normalised_width, normalised_height );
-		}
+		// Get the compiled keys of the transition
+		mlt_geometry_compiled geometry = transition_parse_keys( self, normalised_width, normalised_height );
 
 		// Do the calculation
-		geometry_calculate( self, result, position );
+		geometry_calculate( self, geometry, result, position );
+		mlt_geometry_compiled_close( geometry );
 
 		// Assign normalised info
 		result->nw = normalised_width;
@@ -971,8 +710,6 @@ static mlt_geometry composite_calculate( mlt_transition self, struct geometry_s
 	result->valign = alignment_parse( mlt_properties_get( properties, "valign" ) );
 
 	crop_calculate( self, properties, result, position );
-
-	return start;
 }
 
 mlt_frame composite_copy_region( mlt_transition self, mlt_frame a_frame, mlt_position frame_position )
@@ -1325,6 +1062,21 @@ static mlt_frame composite_process( mlt_transition self, mlt_frame a_frame, mlt_
 	return a_frame;
 }
 
+/** Start loading and scaling a new luma map before the first frame needs it.
+*/
+
+static void property_changed( mlt_properties owner, mlt_transition self, char *name )
+{
+	if ( !strcmp( name, "luma" ) || !strcmp( name, "luma_invert" ) )
+	{
+		mlt_properties properties = MLT_TRANSITION_PROPERTIES( self );
+		mlt_profile profile = mlt_service_profile( MLT_TRANSITION_SERVICE( self ) );
+		if ( profile )
+			luma_cache_preload( self, profile, mlt_properties_get( properties, "luma" ), "luma.", "none", 0, 0,
+				profile->width, profile->height, mlt_properties_get_int( properties, "luma_invert" ) );
+	}
+}
+
 /** Constructor for the filter.
 */
 
@@ -1351,6 +1103,9 @@ mlt_transition transition_composite_init( mlt_profile profile, mlt_service_type
 		
 		// Inform apps and framework that this is a video only transition
 		mlt_properties_set_int( properties, "_transition_type", 1 );
+
+		// Decode and scale a luma map in the background as soon as it is set
+		mlt_events_listen( properties, self, "property-changed", ( mlt_listener )property_changed );
 	}
 	return self;
 }
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <math.h>
 #include "transition_composite.h"
+#include "luma_cache.h"
 
 static inline int dissolve_yuv( mlt_frame frame, mlt_frame that, float weight, int width, int height )
 {
@@ -173,136 +174,6 @@ static void luma_composite( mlt_frame a_frame, mlt_frame b_frame, int luma_width
 	}
 }
 
-/** Load the luma map from PGM stream.
-*/
-
-static void luma_read_pgm( FILE *f, uint16_t **map, int *width, int *height )
-{
-	uint8_t *data = NULL;
-	while (1)
-	{
-		char line[128];
-		char comment[128];
-		int i = 2;
-		int maxval;
-		int bpp;
-		uint16_t *p;
-
-		line[127] = '\0';
-
-		// get the magic code
-		if ( fgets( line, 127, f ) == NULL )
-			break;
-
-		// skip comments
-		while ( sscanf( line, " #%s", comment ) > 0 )
-			if ( fgets( line, 127, f ) == NULL )
-				break;
-
-		if ( line[0] != 'P' || line[1] != '5' )
-			break;
-
-		// skip white space and see if a new line must be fetched
-		for ( i = 2; i < 127 && line[i] != '\0' && isspace( line[i] ); i++ );
-		if ( ( line[i] == '\0' || line[i] == '#' ) && fgets( line, 127, f ) == NULL )
-			break;
-
-		// skip comments
-		while ( sscanf( line, " #%s", comment ) > 0 )
-			if ( fgets( line, 127, f ) == NULL )
-				break;
-
-		// get the dimensions
-		if ( line[0] == 'P' )
-			i = sscanf( line, "P5 %d %d %d", width, height, &maxval );
-		else
-			i = sscanf( line, "%d %d %d", width, height, &maxval );
-
-		// get the height value, if not yet
-		if ( i < 2 )
-		{
-			if ( fgets( line, 127, f ) == NULL )
-				break;
-
-			// skip comments
-			while ( sscanf( line, " #%s", comment ) > 0 )
-				if ( fgets( line, 127, f ) == NULL )
-					break;
-
-			i = sscanf( line, "%d", height );
-			if ( i == 0 )
-				break;
-			else
-				i = 2;
-		}
-
-		// get the maximum gray value, if not yet
-		if ( i < 3 )
-		{
-			if ( fgets( line, 127, f ) == NULL )
-				break;
-
-			// skip comments
-			while ( sscanf( line, " #%s", comment ) > 0 )
-				if ( fgets( line, 127, f ) == NULL )
-					break;
-
-			i = sscanf( line, "%d", &maxval );
-			if ( i == 0 )
-				break;
-		}
-
-		// determine if this is one or two bytes per pixel
-		bpp = maxval > 255 ? 2 : 1;
-
-		// allocate temporary storage for the raw data
-		data = mlt_pool_alloc( *width * *height * bpp );
-		if ( data == NULL )
-			break;
-
-		// read the raw data
-		if ( fread( data, *width * *height * bpp, 1, f ) != 1 )
-			break;
-
-		// allocate the luma bitmap
-		*map = p = (uint16_t*)mlt_pool_alloc( *width * *height * sizeof( uint16_t ) );
-		if ( *map == NULL )
-			break;
-
-		// proces the raw data into the luma bitmap
-		for ( i = 0; i < *width * *height * bpp; i += bpp )
-		{
-			if ( bpp == 1 )
-				*p++ = data[ i ] << 8;
-			else
-				*p++ = ( data[ i ] << 8 ) + data[ i+1 ];
-		}
-
-		break;
-	}
-
-	if ( data != NULL )
-		mlt_pool_release( data );
-}
-
-/** Generate a luma map from an RGB image.
-*/
-
-static void luma_read_yuv422( uint8_t *image, uint16_t **map, int width, int height )
-{
-	int i;
-	int size = width * height * 2;
-	
-	// allocate the luma bitmap
-	uint16_t *p = *map = ( uint16_t* )mlt_pool_alloc( width * height * sizeof( uint16_t ) );
-	if ( *map == NULL )
-		return;
-
-	// proces the image data into the luma bitmap
-	for ( i = 0; i < size; i += 2 )
-		*p++ = ( image[ i ] - 16 ) * 299; // 299 = 65535 / 219
-}
-
 /** Get the image.
 */
 
@@ -346,101 +217,31 @@ static int transition_get_image( mlt_frame a_frame, uint8_t **image, mlt_image_f
 		
 	if ( resource && ( !current_resource || strcmp( resource, current_resource ) ) )
 	{
-		char temp[ 512 ];
-		char *extension = strrchr( resource, '.' );
-		char *orig_resource = resource;
-
-		if ( strchr( resource, '%' ) )
+		if ( !*resource )
 		{
-			FILE *test;
-			sprintf( temp, "%s/lumas/%s/%s", mlt_environment( "MLT_DATA" ), mlt_environment( "MLT_NORMALISATION" ), strchr( resource, '%' ) + 1 );
-			test = fopen( temp, "r" );
-			if ( test == NULL )
-				strcat( temp, ".png" );
-			else
-				fclose( test ); 
-			resource = temp;
-			extension = strrchr( resource, '.' );
+			luma_bitmap = NULL;
+			mlt_properties_set( properties, "_resource", NULL );
+			mlt_properties_set_data( properties, "bitmap", NULL, 0, NULL, NULL );
+			mlt_properties_set_data( properties, "_luma_map", NULL, 0, NULL, NULL );
 		}
-
-		// See if it is a PGM
-		if ( extension != NULL && strcmp( extension, ".pgm" ) == 0 )
+		else
 		{
-			// Convert file name string encoding.
-			mlt_properties_set( properties, "_resource_utf8", resource );
-			mlt_properties_from_utf8( properties, "_resource_utf8", "_resource_local8" );
+			// Maps are shared with every other transition using the same file
+			mlt_cache_item item = luma_cache_get( transition, resource, "producer.", "nearest", luma_width, luma_height, 0, 0, 0 );
+			luma_map map = mlt_cache_item_data( item, NULL );
 
-			// Open PGM
-			FILE *f = fopen( mlt_properties_get( properties, "_resource_local8" ), "rb" );
-			if ( f != NULL )
+			if ( map )
 			{
-				// Load from PGM
-				luma_read_pgm( f, &luma_bitmap, &luma_width, &luma_height );
-				fclose( f );
+				luma_bitmap = map->bitmap;
+				luma_width = map->width;
+				luma_height = map->height;
 
 				// Set the transition properties
 				mlt_properties_set_int( properties, "width", luma_width );
 				mlt_properties_set_int( properties, "height", luma_height );
-				mlt_properties_set( properties, "_resource", orig_resource );
-				mlt_properties_set_data( properties, "bitmap", luma_bitmap, luma_width * luma_height * 2, mlt_pool_release, NULL );
-			}
-		}
-		else if (!*resource) 
-		{
-		    luma_bitmap = NULL;
-		    mlt_properties_set( properties, "_resource", NULL );
-		    mlt_properties_set_data( properties, "bitmap", luma_bitmap, 0, mlt_pool_release, NULL );
-		}
-		else
-		{
-			// Get the factory producer service
-			char *factory = mlt_properties_get( properties, "factory" );
-
-			// Create the producer
-			mlt_profile profile = mlt_service_profile( MLT_TRANSITION_SERVICE( transition ) );
-			mlt_producer producer = mlt_factory_producer( profile, factory, resource );
-
-			// If we have one
-			if ( producer != NULL )
-			{
-				// Get the producer properties
-				mlt_properties producer_properties = MLT_PRODUCER_PROPERTIES( producer );
-
-				// Ensure that we loop
-				mlt_properties_set( producer_properties, "eof", "loop" );
-
-				// Now pass all producer. properties on the transition down
-				mlt_properties_pass( producer_properties, properties, "producer." );
-
-				// We will get the alpha frame from the producer
-				mlt_frame luma_frame = NULL;
-
-				// Get the luma frame
-				if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), &luma_frame, 0 ) == 0 )
-				{
-					uint8_t *luma_image = NULL;
-					mlt_image_format luma_format = mlt_image_yuv422;
-
-					// Get image from the luma producer
-					mlt_properties_set( MLT_FRAME_PROPERTIES( luma_frame ), "rescale.interp", "nearest" );
-					mlt_frame_get_image( luma_frame, &luma_image, &luma_format, &luma_width, &luma_height, 0 );
-
-					// Generate the luma map
-					if ( luma_image != NULL )
-						luma_read_yuv422( luma_image, &luma_bitmap, luma_width, luma_height );
-					
-					// Set the transition properties
-					mlt_properties_set_int( properties, "width", luma_width );
-					mlt_properties_set_int( properties, "height", luma_height );
-					mlt_properties_set( properties, "_resource", orig_resource);
-					mlt_properties_set_data( properties, "bitmap", luma_bitmap, luma_width * luma_height * 2, mlt_pool_release, NULL );
-
-					// Cleanup the luma frame
-					mlt_frame_close( luma_frame );
-				}
-
-				// Cleanup the luma producer
-				mlt_producer_close( producer );
+				mlt_properties_set( properties, "_resource", resource );
+				mlt_properties_set_data( properties, "_luma_map", item, 0, ( mlt_destructor )mlt_cache_item_close, NULL );
+				mlt_properties_set_data( properties, "bitmap", luma_bitmap, luma_width * luma_height * 2, NULL, NULL );
 			}
 		}
 	}
@@ -509,6 +310,31 @@ static mlt_frame transition_process( mlt_transition transition, mlt_frame a_fram
 	return a_frame;
 }
 
+/** Start loading a new luma map before the first frame needs it.
+*/
+
+static void preload_luma( mlt_transition transition, mlt_profile profile )
+{
+	mlt_properties properties = MLT_TRANSITION_PROPERTIES( transition );
+	int width = mlt_properties_get_int( properties, "width" );
+	int height = mlt_properties_get_int( properties, "height" );
+
+	if ( !profile )
+		profile = mlt_service_profile( MLT_TRANSITION_SERVICE( transition ) );
+	if ( ( width == 0 || height == 0 ) && profile )
+	{
+		width = profile->width;
+		height = profile->height;
+	}
+	luma_cache_preload( transition, profile, mlt_properties_get( properties, "resource" ), "producer.", "nearest", width, height, 0, 0, 0 );
+}
+
+static void property_changed( mlt_properties owner, mlt_transition transition, char *name )
+{
+	if ( !strcmp( name, "resource" ) )
+		preload_luma( transition, NULL );
+}
+
 /** Constructor for the filter.
 */
 
@@ -529,6 +355,10 @@ mlt_transition transition_luma_init( mlt_profile profile, mlt_service_type type,
 		// Inform apps and framework that this is a video only transition
 		mlt_properties_set_int( MLT_TRANSITION_PROPERTIES( transition ), "_transition_type", 1 );
 
+		// Decode the map in the background, also when the resource is set later
+		preload_luma( transition, profile );
+		mlt_events_listen( MLT_TRANSITION_PROPERTIES( transition ), transition, "property-changed", ( mlt_listener )property_changed );
+
 		return transition;
 	}
 	return NULL;
@@ -27,137 +27,78 @@
 #include <math.h>
 
 
-static int mix_audio( mlt_frame frame, mlt_frame that, float weight_start, float weight_end, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
-{
-	int ret = 0;
-	int16_t *src, *dest;
-	int frequency_src = *frequency, frequency_dest = *frequency;
-	int channels_src = *channels, channels_dest = *channels;
-	int samples_src = *samples, samples_dest = *samples;
-	int i, j;
-	double d = 0, s = 0;
-
-	mlt_frame_get_audio( that, (void**) &src, format, &frequency_src, &channels_src, &samples_src );
-	mlt_frame_get_audio( frame, (void**) &dest, format, &frequency_dest, &channels_dest, &samples_dest );
-
-	int silent = mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "silent_audio" );
-	mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "silent_audio", 0 );
-	if ( silent )
-		memset( dest, 0, samples_dest * channels_dest * sizeof( int16_t ) );
-
-	silent = mlt_properties_get_int( MLT_FRAME_PROPERTIES( that ), "silent_audio" );
-	mlt_properties_set_int( MLT_FRAME_PROPERTIES( that ), "silent_audio", 0 );
-	if ( silent )
-		memset( src, 0, samples_src * channels_src * sizeof( int16_t ) );
-
-	if ( channels_src > 6 )
-		channels_src = 0;
-	if ( channels_dest > 6 )
-		channels_dest = 0;
-	if ( samples_src > 4000 )
-		samples_src = 0;
-	if ( samples_dest > 4000 )
-		samples_dest = 0;
+/** Get the audio of a frame as 32-bit floating point planes.
 
-	// determine number of samples to process
-	*samples = samples_src < samples_dest ? samples_src : samples_dest;
-	*channels = channels_src < channels_dest ? channels_src : channels_dest;
-	*buffer = dest;
-	*frequency = frequency_dest;
+    A frame without an audio converter may still give s16, which is converted
+    here. Returns NULL if the audio is in any other format.
+*/
 
-	// Compute a smooth ramp over start to end
-	float weight = weight_start;
-	float weight_step = ( weight_end - weight_start ) / *samples;
+static float *get_float_audio( mlt_frame frame, int *frequency, int *channels, int *samples )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_audio_format format = mlt_audio_float;
+	void *audio = NULL;
 
-	if ( src == dest )
-	{
-		*samples = samples_src;
-		*channels = channels_src;
-		*buffer = src;
-		*frequency = frequency_src;
-		return ret;
-	}
+	mlt_frame_get_audio( frame, &audio, &format, frequency, channels, samples );
 
-	// Mixdown
-	for ( i = 0; i < *samples; i++ )
+	if ( audio && format == mlt_audio_s16 )
 	{
-		for ( j = 0; j < *channels; j++ )
+		int size = mlt_audio_format_size( mlt_audio_float, *samples, *channels );
+		float *buffer = mlt_pool_alloc( size );
+		float *p = buffer;
+		int c, i;
+		for ( c = 0; c < *channels; c++ )
 		{
-			if ( j < channels_dest )
-				d = (double) dest[ i * channels_dest + j ];
-			if ( j < channels_src )
-				s = (double) src[ i * channels_src + j ];
-			dest[ i * channels_dest + j ] = s * weight + d * ( 1.0 - weight );
+			int16_t *q = (int16_t*) audio + c;
+			for ( i = 0; i < *samples; i++, q += *channels )
+				*p++ = (float)( *q ) / 32768.0;
 		}
-		weight += weight_step;
+		mlt_frame_set_audio( frame, buffer, mlt_audio_float, size, mlt_pool_release );
+		audio = buffer;
+	}
+	else if ( format != mlt_audio_float )
+	{
+		audio = NULL;
 	}
 
-	return ret;
-}
-
-// Replacement for broken mlt_frame_audio_mix - this filter uses an inline low pass filter
-// to allow mixing without volume hacking
-static int combine_audio( mlt_frame frame, mlt_frame that, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
-{
-	int ret = 0;
-	int16_t *src, *dest;
-	int frequency_src = *frequency, frequency_dest = *frequency;
-	int channels_src = *channels, channels_dest = *channels;
-	int samples_src = *samples, samples_dest = *samples;
-	int i, j;
-	double vp[ 6 ];
-	double b_weight = 1.0;
-
-	if ( mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "meta.mixdown" ) )
-		b_weight = 1.0 - mlt_properties_get_double( MLT_FRAME_PROPERTIES( frame ), "meta.volume" );
-
-	mlt_frame_get_audio( that, (void**) &src, format, &frequency_src, &channels_src, &samples_src );
-	mlt_frame_get_audio( frame, (void**) &dest, format, &frequency_dest, &channels_dest, &samples_dest );
-
-	int silent = mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "silent_audio" );
-	mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "silent_audio", 0 );
-	if ( silent )
-		memset( dest, 0, samples_dest * channels_dest * sizeof( int16_t ) );
+	int silent = mlt_properties_get_int( properties, "silent_audio" );
+	mlt_properties_set_int( properties, "silent_audio", 0 );
+	if ( silent && audio )
+		memset( audio, 0, *samples * *channels * sizeof( float ) );
 
-	silent = mlt_properties_get_int( MLT_FRAME_PROPERTIES( that ), "silent_audio" );
-	mlt_properties_set_int( MLT_FRAME_PROPERTIES( that ), "silent_audio", 0 );
-	if ( silent )
-		memset( src, 0, samples_src * channels_src * sizeof( int16_t ) );
+	return audio;
+}
 
-	if ( src == dest )
-	{
-		*samples = samples_src;
-		*channels = channels_src;
-		*buffer = src;
-		*frequency = frequency_src;
-		return ret;
-	}
+/** Crossfade a plane of samples from a to b along a linear gain ramp.
 
-	// determine number of samples to process
-	*samples = samples_src < samples_dest ? samples_src : samples_dest;
-	*channels = channels_src < channels_dest ? channels_src : channels_dest;
-	*buffer = dest;
-	*frequency = frequency_dest;
+    The output may be a itself or overlap it from below.
+*/
 
-	for ( j = 0; j < *channels; j++ )
-		vp[ j ] = ( double )dest[ j ];
+static void mix_plane( float *out, const float *a, const float *b, int samples, float weight, float weight_step )
+{
+	int i;
+	for ( i = 0; i < samples; i++ )
+		out[ i ] = a[ i ] + ( b[ i ] - a[ i ] ) * ( weight + weight_step * i );
+}
 
-	double Fc = 0.5;
-	double B = exp(-2.0 * M_PI * Fc);
-	double A = 1.0 - B;
-	double v;
+/** Sum a plane of samples into a with an inline low pass filter.
 
-	for ( i = 0; i < *samples; i++ )
-	{
-		for ( j = 0; j < *channels; j++ )
-		{
-			v = ( double )( b_weight * dest[ i * channels_dest + j ] + src[ i * channels_src + j ] );
-			v = v < -32767 ? -32767 : v > 32768 ? 32768 : v;
-			vp[ j ] = dest[ i * channels_dest + j ] = ( int16_t )( v * A + vp[ j ] * B );
-		}
-	}
+    The sum is not clamped: float samples keep the headroom beyond full scale
+    so that mixing many tracks does not clip before the final conversion.
+*/
 
-	return ret;
+static void combine_plane( float *out, const float *a, const float *b, int samples, float a_weight )
+{
+	static const float Fc = 0.5;
+	float B = exp( -2.0 * M_PI * Fc );
+	float A = 1.0 - B;
+	float vp = a[ 0 ];
+	int i;
+
+	for ( i = 0; i < samples; i++ )
+		out[ i ] = a_weight * a[ i ] + b[ i ];
+	for ( i = 0; i < samples; i++ )
+		vp = out[ i ] = out[ i ] * A + vp * B;
 }
 
 /** Get the audio.
@@ -174,9 +115,37 @@ static int transition_get_audio( mlt_frame frame, void **buffer, mlt_audio_forma
 	// Get the properties of the b frame
 	mlt_properties b_props = MLT_FRAME_PROPERTIES( b_frame );
 
-	// We can only mix s16
-	*format = mlt_audio_s16;
+	int frequency_src = *frequency, frequency_dest = *frequency;
+	int channels_src = *channels, channels_dest = *channels;
+	int samples_src = *samples, samples_dest = *samples;
+	int j;
 
+	// The volume of a mixdown is consumed by getting the audio
+	float b_weight = 1.0;
+	if ( mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "meta.mixdown" ) )
+		b_weight = 1.0 - mlt_properties_get_double( MLT_FRAME_PROPERTIES( frame ), "meta.volume" );
+
+	// We mix 32-bit float planes
+	float *src = get_float_audio( b_frame, &frequency_src, &channels_src, &samples_src );
+	float *dest = get_float_audio( frame, &frequency_dest, &channels_dest, &samples_dest );
+
+	*format = mlt_audio_float;
+	if ( dest == NULL || src == NULL || src == dest )
+	{
+		*samples = dest ? samples_dest : samples_src;
+		*channels = dest ? channels_dest : channels_src;
+		*buffer = dest ? dest : src;
+		*frequency = dest ? frequency_dest : frequency_src;
+		return *buffer == NULL;
+	}
+
+	// determine number of samples to process
+	*samples = samples_src < samples_dest ? samples_src : samples_dest;
+	*channels = channels_src < channels_dest ? channels_src : channels_dest;
+	*buffer = dest;
+	*frequency = frequency_dest;
+
+	// Each output plane is written at the new sample count, below its input
 	if ( mlt_properties_get_int( MLT_TRANSITION_PROPERTIES( effect ), "combine" ) == 0 )
 	{
 		double mix_start = 0.5, mix_end = 0.5;
@@ -190,11 +159,17 @@ static int transition_get_audio( mlt_frame frame, void **buffer, mlt_audio_forma
 			mix_end = 1 - mix_end;
 		}
 
-		mix_audio( frame, b_frame, mix_start, mix_end, buffer, format, frequency, channels, samples );
+		// Compute a smooth ramp over start to end
+		float weight_step = ( mix_end - mix_start ) / *samples;
+		for ( j = 0; j < *channels; j++ )
+			mix_plane( dest + j * *samples, dest + j * samples_dest, src + j * samples_src, *samples, mix_start, weight_step );
 	}
 	else
 	{
-		combine_audio( frame, b_frame, buffer, format, frequency, channels, samples );
+		// Replacement for broken mlt_frame_audio_mix - this uses an inline low pass filter
+		// to allow mixing without volume hacking
+		for ( j = 0; j < *channels; j++ )
+			combine_plane( dest + j * *samples, dest + j * samples_dest, src + j * samples_src, *samples, b_weight );
 	}
 
 	return 0;
@@ -90,6 +90,31 @@ static void check_thread_safe( mlt_properties properties, const char *name )
 	mlt_properties_close( not_thread_safe );
 }
 
+/** Flag a filter whose output rows depend only on the input rows around them.
+
+    slice_safe.txt lists such plugins, optionally followed by =N for the
+    number of rows above and below a band that each output row reads.
+*/
+
+static void check_slice_safe( mlt_properties properties, const char *name )
+{
+	char dirname[PATH_MAX];
+	snprintf( dirname, PATH_MAX, "%s/frei0r/slice_safe.txt", mlt_environment( "MLT_DATA" ) );
+	mlt_properties slice_safe = mlt_properties_load( dirname );
+	int i;
+
+	for ( i = 0; i < mlt_properties_count( slice_safe ); i++ )
+	{
+		if ( strcmp( name, mlt_properties_get_name( slice_safe, i ) ) == 0 )
+		{
+			mlt_properties_set_int( properties, "_slice_safe", 1 );
+			mlt_properties_set_int( properties, "_slice_overlap", mlt_properties_get_int( slice_safe, name ) );
+			break;
+		}
+	}
+	mlt_properties_close( slice_safe );
+}
+
 static mlt_properties fill_param_info ( mlt_service_type type, const char *service_name, char *name )
 {
 	char file[ PATH_MAX ];
@@ -313,6 +338,7 @@ static void * load_lib( mlt_profile profile, mlt_service_type type , void* handl
 			}
 		}
 		check_thread_safe( properties, name );
+		check_slice_safe( properties, name );
 		mlt_properties_set_data(properties, "_dlclose_handle", handle , sizeof ( handle ) , NULL , NULL );
 		mlt_properties_set_data(properties, "_dlclose", dlclose , sizeof (void*) , NULL , NULL );
 		mlt_properties_set_data(properties, "f0r_construct", f0r_construct , sizeof( f0r_construct ),NULL,NULL);
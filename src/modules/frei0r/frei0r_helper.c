@@ -20,6 +20,10 @@
 #include <frei0r.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+
+// The fewest rows in a band when filtering a frame in bands
+#define MIN_SLICE_ROWS (16)
 
 static void parse_color( int color, f0r_param_color_t *fcolor )
 {
@@ -31,6 +35,46 @@ static void parse_color( int color, f0r_param_color_t *fcolor )
 	fcolor->b /= 255;
 }
 
+/** Idle instances of a plugin for one frame size.
+
+    Each render thread takes an instance for the duration of a frame, so a
+    thread-safe plugin runs concurrently without sharing an instance and
+    without holding the service lock during f0r_update. A pool only grows to
+    the number of frames rendered at once. A plugin in not_thread_safe.txt
+    keeps the lock until its instance is back, so it only ever has one.
+*/
+
+typedef struct
+{
+	void ( *f0r_destruct )( f0r_instance_t instance );
+	mlt_deque idle;
+} instance_pool;
+
+static void pool_close( instance_pool *pool )
+{
+	f0r_instance_t inst;
+	while ( ( inst = mlt_deque_pop_back( pool->idle ) ) )
+		pool->f0r_destruct( inst );
+	mlt_deque_close( pool->idle );
+	free( pool );
+}
+
+/** Get the value of an animatable parameter at a position.
+
+    The keyframes are compiled once and kept on the property until its
+    string changes, instead of being parsed again on every frame.
+*/
+
+static double param_value( mlt_properties prop, const char *name, double position )
+{
+	struct mlt_geometry_item_s item;
+	mlt_geometry_compiled geom = mlt_properties_get_geometry( prop, name, -1, -1, -1 );
+
+	mlt_geometry_compiled_fetch( geom, &item, position );
+	mlt_geometry_compiled_close( geom );
+	return item.x;
+}
+
 static void rgba_bgra( uint8_t *src, uint8_t* dst, int width, int height )
 {
 	int n = width * height + 1;
@@ -45,99 +89,219 @@ static void rgba_bgra( uint8_t *src, uint8_t* dst, int width, int height )
 	}	
 }
 
+/** Take an idle instance for a frame size from its pool or construct one.
+    Call with the service locked.
+*/
+
+static f0r_instance_t pool_get( mlt_properties prop, int width, int height )
+{
+	f0r_instance_t ( *f0r_construct ) ( unsigned int , unsigned int ) =  mlt_properties_get_data(  prop , "f0r_construct" ,NULL);
+	char ctorname[1024]="";
+	sprintf(ctorname,"ctor-%dx%d",width,height);
+
+	instance_pool *pool = mlt_properties_get_data( prop, ctorname, NULL );
+	if ( !pool ){
+		pool = calloc( 1, sizeof( *pool ) );
+		pool->f0r_destruct = mlt_properties_get_data( prop, "f0r_destruct", NULL );
+		pool->idle = mlt_deque_init();
+		mlt_properties_set_data( prop, ctorname, pool, 0, ( mlt_destructor )pool_close, NULL );
+	}
+	f0r_instance_t inst = mlt_deque_pop_back( pool->idle );
+	if ( !inst )
+		inst = f0r_construct(width,height);
+	return inst;
+}
+
+/** Return an instance to its pool. Call with the service locked.
+*/
+
+static void pool_put( mlt_properties prop, f0r_instance_t inst, int width, int height )
+{
+	char ctorname[1024]="";
+	sprintf(ctorname,"ctor-%dx%d",width,height);
+	instance_pool *pool = mlt_properties_get_data( prop, ctorname, NULL );
+	mlt_deque_push_back( pool->idle, inst );
+}
+
+/** Set the parameters of an instance for a position. Call with the service locked.
+*/
+
+static void set_params( mlt_properties prop, f0r_instance_t inst, double position, f0r_plugin_info_t *info )
+{
+	void (*f0r_get_param_info)(f0r_param_info_t* info, int param_index)=mlt_properties_get_data( prop ,  "f0r_get_param_info" ,NULL);
+	void (*f0r_set_param_value)(f0r_instance_t instance, f0r_param_t param, int param_index)=mlt_properties_get_data(  prop , "f0r_set_param_value" ,NULL);
+	int i=0;
+
+	for (i=0;i<info->num_params;i++){
+		f0r_param_info_t pinfo;
+		f0r_get_param_info(&pinfo,i);
+		char index[20];
+		snprintf( index, sizeof(index), "%d", i );
+		const char *name = index;
+		char *val = mlt_properties_get( prop , name );
+		if ( !val )
+			val = mlt_properties_get( prop , name = pinfo.name );
+		if ( !val ) {
+			// Use the backwards-compatibility param name map.
+			mlt_properties map = mlt_properties_get_data( prop, "_param_name_map", NULL );
+			if ( map ) {
+				int j;
+				for ( j = 0; !val && j < mlt_properties_count(map); j++ ) {
+					if ( !strcmp(mlt_properties_get_value(map, j), index) )
+						val = mlt_properties_get( prop , name = mlt_properties_get_name(map, j) );
+				}
+			}
+		}
+		if ( val ) {
+			switch (pinfo.type) {
+				case F0R_PARAM_DOUBLE:
+				case F0R_PARAM_BOOL:
+				{
+					double t = param_value( prop, name, position );
+					f0r_set_param_value(inst,&t,i);
+					break;
+				}
+				case F0R_PARAM_COLOR:
+				{
+					f0r_param_color_t color;
+					int int_color = mlt_properties_get(prop, index) ?
+						mlt_properties_get_int(prop, index) : mlt_properties_get_int(prop, pinfo.name);
+					parse_color(int_color, &color);
+					f0r_set_param_value(inst, &color, i);
+					break;
+				}
+				case F0R_PARAM_STRING:
+				{
+					f0r_set_param_value(inst, &val, i);
+					break;
+				}
+			}
+		}
+	}
+}
+
+/** A horizontal band of a frame filtered by an instance of its own size.
+*/
+
+typedef struct
+{
+	void (*f0r_update)(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe);
+	f0r_instance_t inst;
+	double time;
+	int width;
+	int top;     // first row given to the instance, including overlap
+	int rows;    // rows given to the instance
+	int skip;    // overlap rows above the band
+	int height;  // rows of the band itself
+	const uint32_t *source;
+	uint32_t *dest;
+	pthread_t thread;
+	int started;
+} frei0r_slice;
+
+static void *slice_run( void *arg )
+{
+	frei0r_slice *slice = arg;
+	const uint32_t *source = slice->source + slice->top * slice->width;
+	uint32_t *dest = slice->dest + ( slice->top + slice->skip ) * slice->width;
+
+	if ( slice->rows == slice->height )
+	{
+		slice->f0r_update( slice->inst, slice->time, source, dest );
+	}
+	else
+	{
+		// The overlap rows of the output belong to the neighbouring bands
+		uint32_t *output = mlt_pool_alloc( slice->width * slice->rows * sizeof(uint32_t) );
+		slice->f0r_update( slice->inst, slice->time, source, output );
+		memcpy( dest, output + slice->skip * slice->width, slice->width * slice->height * sizeof(uint32_t) );
+		mlt_pool_release( output );
+	}
+	return NULL;
+}
+
+/** Determine how many bands to filter a frame in.
+
+    Only filters listed in slice_safe.txt compute each output pixel from the
+    input rows around it alone, so only they can run as several instances on
+    bands of the frame. The band count comes from the threads property or
+    MLT_FREI0R_THREADS.
+*/
+
+static int slice_count( mlt_properties prop, mlt_service_type type, int height )
+{
+	int threads = mlt_properties_get_int( prop, "threads" );
+
+	if ( type != filter_type || !mlt_properties_get_int( prop, "_slice_safe" ) ||
+	     mlt_properties_get_int( prop, "_not_thread_safe" ) )
+		return 1;
+	if ( !mlt_properties_get( prop, "threads" ) && getenv( "MLT_FREI0R_THREADS" ) )
+		threads = atoi( getenv( "MLT_FREI0R_THREADS" ) );
+	if ( threads > height / MIN_SLICE_ROWS )
+		threads = height / MIN_SLICE_ROWS;
+	return threads < 1 ? 1 : threads;
+}
+
 int process_frei0r_item( mlt_service service, double position, double time, mlt_properties prop, mlt_frame this, uint8_t **image, int *width, int *height )
 {
 	int i=0;
 	f0r_instance_t ( *f0r_construct ) ( unsigned int , unsigned int ) =  mlt_properties_get_data(  prop , "f0r_construct" ,NULL);
 	void (*f0r_update)(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe)=mlt_properties_get_data(  prop , "f0r_update" ,NULL);
-	void (*f0r_destruct)(f0r_instance_t instance)=mlt_properties_get_data(  prop , "f0r_destruct" ,NULL);
 
 	void (*f0r_get_plugin_info)(f0r_plugin_info_t*)=mlt_properties_get_data( prop, "f0r_get_plugin_info" ,NULL);
-	void (*f0r_get_param_info)(f0r_param_info_t* info, int param_index)=mlt_properties_get_data( prop ,  "f0r_get_param_info" ,NULL);
-	void (*f0r_set_param_value)(f0r_instance_t instance, f0r_param_t param, int param_index)=mlt_properties_get_data(  prop , "f0r_set_param_value" ,NULL);
 	void (*f0r_update2) (f0r_instance_t instance, double time,
 			 const uint32_t* inframe1,const uint32_t* inframe2,const uint32_t* inframe3,
 	uint32_t* outframe)=mlt_properties_get_data(  prop , "f0r_update2" ,NULL);
 	mlt_service_type type = mlt_service_identify( service );
 	int not_thread_safe = mlt_properties_get_int( prop, "_not_thread_safe" );
+	int overlap = mlt_properties_get_int( prop, "_slice_overlap" );
+	int count = slice_count( prop, type, *height );
 
-	//use as name the width and height
-	f0r_instance_t inst;
 	f0r_plugin_info_t info;
-	char ctorname[1024]="";
 	memset( &info, 0, sizeof(info) );
-	sprintf(ctorname,"ctor-%dx%d",*width,*height);
-
-	mlt_service_lock( service );
 
-	void* neu=mlt_properties_get_data( prop , ctorname ,NULL );
 	if (!f0r_construct){
 		//printf("no ctor\n");
 		return -1;
 	}
-	if ( neu == 0 ){
-		inst= f0r_construct(*width,*height);
-		mlt_properties_set_data(  prop  ,  ctorname , inst, sizeof( inst ) , f0r_destruct , NULL );;
-	}else{
-		inst=mlt_properties_get_data( prop ,  ctorname , NULL );
+	frei0r_slice *slices = calloc( count, sizeof( *slices ) );
+	if ( !slices )
+		return -1;
+
+	mlt_service_lock( service );
+
+	if (f0r_get_plugin_info)
+		f0r_get_plugin_info(&info);
+
+	// Each band gets an instance of its size, with the overlap rows around it
+	for ( i = 0; i < count; i++ ){
+		frei0r_slice *slice = &slices[i];
+		int start = *height * i / count;
+		int end = *height * ( i + 1 ) / count;
+		slice->f0r_update = f0r_update;
+		slice->time = time;
+		slice->width = *width;
+		slice->top = count > 1 && start > overlap ? start - overlap : 0;
+		slice->skip = start - slice->top;
+		slice->height = end - start;
+		slice->rows = ( count > 1 && end + overlap < *height ? end + overlap : *height ) - slice->top;
+		slice->inst = pool_get( prop, *width, slice->rows );
+		if ( !slice->inst )
+			break;
+		if (f0r_get_plugin_info)
+			set_params( prop, slice->inst, position, &info );
+	}
+	if ( i < count ){
+		while ( i-- )
+			pool_put( prop, slices[i].inst, *width, slices[i].rows );
+		mlt_service_unlock( service );
+		free( slices );
+		return -1;
 	}
 
+	// The instances are private to this thread now that their parameters are set
 	if ( !not_thread_safe )
 		mlt_service_unlock( service );
-	
-	if (f0r_get_plugin_info){
-		f0r_get_plugin_info(&info);
-		for (i=0;i<info.num_params;i++){
-			f0r_param_info_t pinfo;
-			f0r_get_param_info(&pinfo,i);
-			char index[20];
-			snprintf( index, sizeof(index), "%d", i );
-			char *val = mlt_properties_get( prop , index );
-			if ( !val )
-				val = mlt_properties_get( prop , pinfo.name );
-			if ( !val ) {
-				// Use the backwards-compatibility param name map.
-				mlt_properties map = mlt_properties_get_data( prop, "_param_name_map", NULL );
-				if ( map ) {
-					int j;
-					for ( j = 0; !val && j < mlt_properties_count(map); j++ ) {
-						if ( !strcmp(mlt_properties_get_value(map, j), index) )
-							val = mlt_properties_get( prop , mlt_properties_get_name(map, j) );
-					}
-				}
-			}
-			if ( val ) {
-				switch (pinfo.type) {
-					case F0R_PARAM_DOUBLE:
-					case F0R_PARAM_BOOL:
-					{
-						mlt_geometry geom=mlt_geometry_init();
-						struct mlt_geometry_item_s item;
-						mlt_geometry_parse(geom,val,-1,-1,-1);
-						mlt_geometry_fetch(geom,&item,position);
-						double t=item.x;
-						f0r_set_param_value(inst,&t,i);
-						mlt_geometry_close(geom);
-						break;
-					}
-					case F0R_PARAM_COLOR:
-					{
-						f0r_param_color_t color;
-						int int_color = mlt_properties_get(prop, index) ?
-							mlt_properties_get_int(prop, index) : mlt_properties_get_int(prop, pinfo.name);
-						parse_color(int_color, &color);
-						f0r_set_param_value(inst, &color, i);
-						break;
-					}
-					case F0R_PARAM_STRING:
-					{
-						f0r_set_param_value(inst, &val, i);
-						break;
-					}
-				}
-			}
-		}
-	}
 
 	int video_area = *width * *height;
 	uint32_t *result = mlt_pool_alloc( video_area * sizeof(uint32_t) );
@@ -160,14 +324,30 @@ int process_frei0r_item( mlt_service service, double position, double time, mlt_
 		}
 	}
 	if (type==producer_type) {
-		f0r_update (inst, time, NULL, dest );
+		f0r_update (slices[0].inst, time, NULL, dest );
 	} else if (type==filter_type) {
-		f0r_update ( inst, time, source[0], dest );
+		for ( i = 0; i < count; i++ ){
+			slices[i].source = source[0];
+			slices[i].dest = dest;
+		}
+		for ( i = 1; i < count; i++ )
+			slices[i].started = !pthread_create( &slices[i].thread, NULL, slice_run, &slices[i] );
+		slice_run( &slices[0] );
+		for ( i = 1; i < count; i++ ){
+			if ( slices[i].started )
+				pthread_join( slices[i].thread, NULL );
+			else
+				slice_run( &slices[i] );
+		}
 	} else if (type==transition_type && f0r_update2 ){
-		f0r_update2 ( inst, time, source[0], source[1], NULL, dest );
+		f0r_update2 ( slices[0].inst, time, source[0], source[1], NULL, dest );
 	}
-	if ( not_thread_safe )
-		mlt_service_unlock( service );
+	if ( !not_thread_safe )
+		mlt_service_lock( service );
+	for ( i = 0; i < count; i++ )
+		pool_put( prop, slices[i].inst, *width, slices[i].rows );
+	mlt_service_unlock( service );
+	free( slices );
 	if (info.color_model == F0R_COLOR_MODEL_BGRA8888) {
 		rgba_bgra((uint8_t*) dest, (uint8_t*) result, *width, *height);
 	}
@@ -181,21 +361,18 @@ int process_frei0r_item( mlt_service service, double position, double time, mlt_
 
 void destruct (mlt_properties prop ) {
 
-	void (*f0r_destruct)(f0r_instance_t instance)=mlt_properties_get_data(  prop , "f0r_destruct" , NULL );
 	void (*f0r_deinit)(void)=mlt_properties_get_data ( prop , "f0r_deinit" , NULL);
 	int i=0;
 
-	if ( f0r_deinit != NULL )
-		f0r_deinit();
-
+	// Replacing the instance pools destroys their instances
 	for ( i=0 ; i < mlt_properties_count ( prop ) ; i++ ){
 		if ( strstr ( mlt_properties_get_name ( prop , i ) , "ctor-" ) != NULL ){
-			void * inst=mlt_properties_get_data( prop , mlt_properties_get_name ( prop , i ) , NULL );
-			if ( inst != NULL ){
-				f0r_destruct( (f0r_instance_t) inst);
-			}
+			mlt_properties_set_data( prop, mlt_properties_get_name ( prop , i ), NULL, 0, NULL, NULL );
 		}
 	}
+
+	if ( f0r_deinit != NULL )
+		f0r_deinit();
 	void (*dlclose)(void*)=mlt_properties_get_data ( prop , "_dlclose" , NULL);
 	void *handle=mlt_properties_get_data ( prop , "_dlclose_handle" , NULL);
 
@@ -110,28 +110,18 @@ static int ladspa_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	
 	// Initialise LADSPA if needed
 	jack_rack_t *jackrack = mlt_properties_get_data( filter_properties, "jackrack", NULL );
-	if ( jackrack == NULL )
+	if ( jackrack == NULL || jackrack->channels != *channels )
 	{
 		sample_rate = *frequency; // global inside jack_rack
 		jackrack = initialise_jack_rack( filter_properties, *channels );
 	}
-		
-	// Get the filter-specific properties
-	LADSPA_Data **input_buffers  = mlt_pool_alloc( sizeof( LADSPA_Data* ) * *channels );
-	LADSPA_Data **output_buffers = mlt_pool_alloc( sizeof( LADSPA_Data* ) * *channels );
 
-	int i;
-	for ( i = 0; i < *channels; i++ )
-	{
-		input_buffers[i]  = (LADSPA_Data*) *buffer + i * *samples;
-		output_buffers[i] = (LADSPA_Data*) *buffer + i * *samples;
-	}
-
-	// Do LADSPA processing
-	int error = jackrack && process_ladspa( jackrack->procinfo, *samples, input_buffers, output_buffers );
+	// Do LADSPA processing on the planes in place
+	int error = jackrack && process_ladspa_planar( jackrack->procinfo, *samples, (LADSPA_Data*) *buffer );
 
-	mlt_pool_release( input_buffers );
-	mlt_pool_release( output_buffers );
+	// Report the delay the plugins add
+	if ( jackrack )
+		mlt_properties_set_int( filter_properties, "latency", process_get_latency( jackrack->procinfo ) );
 
 	return error;
 }
@@ -428,6 +428,7 @@ plugin_init_holder (plugin_t * plugin,
   holder = plugin->holders + copy;
   
   holder->instance = instance;
+  holder->latency = 0.0;
   
   if (desc->control_port_count > 0)
     {
@@ -455,8 +456,10 @@ plugin_init_holder (plugin_t * plugin,
       if (!LADSPA_IS_PORT_CONTROL (desc->port_descriptors[i]))
         continue;
       
+      /* by convention a plugin reports its latency on an output named "latency" */
       if (LADSPA_IS_PORT_OUTPUT (desc->port_descriptors[i]))
-        plugin->descriptor-> connect_port (instance, i, &unused_control_port_output);
+        plugin->descriptor-> connect_port (instance, i,
+          g_ascii_strcasecmp (desc->port_names[i], "latency") ? &unused_control_port_output : &holder->latency);
     }
   
   if (jack_rack->procinfo->jack_client && plugin->desc->aux_channels > 0)
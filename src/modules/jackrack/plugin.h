@@ -42,6 +42,8 @@ struct _ladspa_holder
   LADSPA_Handle instance;
   lff_t * ui_control_fifos;
   LADSPA_Data * control_memory;
+  /** the value of the plugin's latency output port, if it has one */
+  LADSPA_Data latency;
 
   jack_port_t **             aux_ports;
 };
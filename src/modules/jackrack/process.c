@@ -300,6 +300,7 @@ process_chain (process_info_t * procinfo, jack_nframes_t frames)
 int process_ladspa (process_info_t * procinfo, jack_nframes_t frames,
                     LADSPA_Data ** inputs, LADSPA_Data ** outputs) {
   unsigned long channel;
+  plugin_t * first_enabled;
   
   if (!procinfo)
     {
@@ -312,9 +313,10 @@ int process_ladspa (process_info_t * procinfo, jack_nframes_t frames,
   
   process_control_port_messages (procinfo);
   
+  first_enabled = get_first_enabled_plugin (procinfo);
   for (channel = 0; channel < procinfo->channels; channel++)
     {
-      if(get_first_enabled_plugin (procinfo)->desc->has_input)
+      if (!first_enabled || first_enabled->desc->has_input)
         {
           procinfo->jack_input_buffers[channel] = inputs[channel];
           if (!procinfo->jack_input_buffers[channel])
@@ -338,6 +340,43 @@ int process_ladspa (process_info_t * procinfo, jack_nframes_t frames,
   return 0;
 }
 
+/** process planar audio in place, in blocks that fit the plugins' buffers
+    so that no memory is needed per call */
+int process_ladspa_planar (process_info_t * procinfo, jack_nframes_t frames,
+                           LADSPA_Data * audio) {
+  jack_nframes_t offset, block;
+  unsigned long channel;
+  int err = 0;
+
+  if (!procinfo)
+    {
+      mlt_log_error( NULL, "%s: no process_info from jack!\n", __FUNCTION__);
+      return 1;
+    }
+
+  for (offset = 0; offset < frames && !err; offset += block)
+    {
+      block = frames - offset < buffer_size ? frames - offset : buffer_size;
+      for (channel = 0; channel < procinfo->channels; channel++)
+        procinfo->planar_buffers[channel] = audio + channel * frames + offset;
+      err = process_ladspa (procinfo, block, procinfo->planar_buffers, procinfo->planar_buffers);
+    }
+
+  return err;
+}
+
+/** get the total latency in samples of the enabled plugins that report one */
+jack_nframes_t process_get_latency (process_info_t * procinfo) {
+  plugin_t * plugin;
+  jack_nframes_t latency = 0;
+
+  for (plugin = procinfo->chain; plugin; plugin = plugin->next)
+    if (plugin->enabled && plugin->copies > 0 && plugin->holders[0].latency > 0)
+      latency += plugin->holders[0].latency;
+
+  return latency;
+}
+
 int process_jack (jack_nframes_t frames, void * data) {
   int err;
   process_info_t * procinfo;
@@ -534,6 +573,8 @@ process_info_new (const char * client_name, unsigned long rack_channels,
   procinfo->port_count = 0;
   procinfo->jack_input_ports = NULL;
   procinfo->jack_output_ports = NULL;
+  procinfo->silent_buffer = NULL;
+  procinfo->planar_buffers = NULL;
   procinfo->channels = rack_channels;
   procinfo->quit = FALSE;
 	
@@ -544,6 +585,7 @@ process_info_new (const char * client_name, unsigned long rack_channels,
       procinfo->silent_buffer = g_malloc (sizeof (LADSPA_Data) * buffer_size );
       procinfo->jack_input_buffers = g_malloc (sizeof (LADSPA_Data *) * rack_channels);
       procinfo->jack_output_buffers = g_malloc (sizeof (LADSPA_Data *) * rack_channels);
+      procinfo->planar_buffers = g_malloc (sizeof (LADSPA_Data *) * rack_channels);
 
       return procinfo;
     }
@@ -601,6 +643,7 @@ process_info_destroy (process_info_t * procinfo) {
   g_free (procinfo->jack_output_ports);
   g_free (procinfo->jack_input_buffers);
   g_free (procinfo->jack_output_buffers);
+  g_free (procinfo->planar_buffers);
   g_free (procinfo);
 }
 
@@ -51,6 +51,8 @@ struct _process_info {
   LADSPA_Data ** jack_input_buffers;
   LADSPA_Data ** jack_output_buffers;
   LADSPA_Data *  silent_buffer;
+  /** the channel pointers into planar audio given to process_ladspa_planar */
+  LADSPA_Data ** planar_buffers;
   
   char * jack_client_name;
   int quit;
@@ -69,6 +71,11 @@ void process_info_set_channels (process_info_t * procinfo,
 int process_ladspa (process_info_t * procinfo, jack_nframes_t frames,
                     LADSPA_Data ** inputs, LADSPA_Data ** outputs);
 
+int process_ladspa_planar (process_info_t * procinfo, jack_nframes_t frames,
+                           LADSPA_Data * audio);
+
+jack_nframes_t process_get_latency (process_info_t * procinfo);
+
 int process_jack (jack_nframes_t frames, void * data);
 
 void process_quit (process_info_t * procinfo);
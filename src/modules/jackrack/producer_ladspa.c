@@ -88,8 +88,6 @@ static int producer_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 	mlt_producer producer = mlt_properties_get_data( MLT_FRAME_PROPERTIES( frame ), "_producer_ladspa", NULL );
 	mlt_properties producer_properties = MLT_PRODUCER_PROPERTIES( producer );
 	int size = 0;
-	LADSPA_Data** output_buffers = NULL;
-	int i = 0;
 
 	// Initialize LADSPA if needed
 	jack_rack_t *jackrack = mlt_properties_get_data( producer_properties, "_jackrack", NULL );
@@ -113,16 +111,11 @@ static int producer_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 		// Allocate the buffer
 		*buffer = mlt_pool_alloc( size );
 
-		// Initialize the LADSPA output buffer.
-		output_buffers = mlt_pool_alloc( sizeof( LADSPA_Data* ) * *channels );
-		for ( i = 0; i < *channels; i++ )
-		{
-			output_buffers[i] = (LADSPA_Data*) *buffer + i * *samples;
-		}
+		// Start from silence, since the planes are also the plugin input
+		memset( *buffer, 0, size );
 
-		// Do LADSPA processing
-		process_ladspa( jackrack->procinfo, *samples, NULL, output_buffers );
-		mlt_pool_release( output_buffers );
+		// Do LADSPA processing into the planes
+		process_ladspa_planar( jackrack->procinfo, *samples, (LADSPA_Data*) *buffer );
 
 		// Set the buffer for destruction
 		mlt_frame_set_audio( frame, *buffer, *format, size, mlt_pool_release );
@@ -27,9 +27,100 @@
 #include <sys/time.h>
 #include <assert.h>
 
+// The most frames decoded in one forward pass, which the frame store must hold
+#define MAX_GOP (198)
+
 // Forward references.
 static int producer_get_frame( mlt_producer producer, mlt_frame_ptr frame, int index );
 
+/** Decode a frame of the wrapped producer and keep it in the frame store.
+*/
+
+static mlt_frame decode_source( mlt_producer producer, mlt_position position, int index, const char *interp, mlt_image_format format, int width, int height, int store )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	mlt_producer real_producer = mlt_properties_get_data( properties, "producer", NULL );
+	mlt_cache cache = mlt_properties_get_data( properties, "_frame_store", NULL );
+	mlt_frame source = NULL;
+	uint8_t *image = NULL;
+
+	// Seek the producer to the correct place
+	mlt_producer_seek( real_producer, position );
+
+	// Get the frame and its image
+	mlt_service_get_frame( MLT_PRODUCER_SERVICE( real_producer ), &source, index );
+	mlt_properties_set( MLT_FRAME_PROPERTIES( source ), "rescale.interp", interp );
+	if ( mlt_frame_get_image( source, &image, &format, &width, &height, 0 ) || !image )
+	{
+		mlt_frame_close( source );
+		return NULL;
+	}
+	mlt_frame_get_alpha_mask( source );
+
+	// Key the store by the position asked for, even where the producer clamps it
+	mlt_properties_set_position( MLT_FRAME_PROPERTIES( source ), "original_position", position );
+	if ( store )
+		mlt_cache_put_frame( cache, source );
+
+	return source;
+}
+
+/** Get a decoded frame of the wrapped producer, from the frame store if possible.
+
+    When the positions requested go backwards, decoding one frame at a time would
+    make the decoder seek back to a keyframe for every frame. Instead the frames
+    from gop - 1 before the position up to it are decoded forwards in one pass
+    and stored, so the following requests are served from the store.
+*/
+
+static mlt_frame get_source( mlt_producer producer, mlt_position position, int index, const char *interp, mlt_image_format format, int width, int height )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	mlt_cache cache = mlt_properties_get_data( properties, "_frame_store", NULL );
+	int backwards = mlt_properties_get( properties, "_last_source" ) &&
+		position < mlt_properties_get_position( properties, "_last_source" );
+	int gop = mlt_properties_get_int( properties, "gop" );
+	double speed = mlt_properties_get_double( properties, "_speed" );
+	mlt_frame source = mlt_cache_get_frame( cache, position );
+
+	// Frames played forwards at a whole speed without blending are never asked for again
+	int store = backwards || speed < 1.0 || speed != floor( speed ) ||
+		mlt_properties_get_int( properties, "reverse" ) || mlt_properties_get_int( properties, "blend" );
+
+	mlt_properties_set_position( properties, "_last_source", position );
+	if ( source )
+	{
+		mlt_properties source_properties = MLT_FRAME_PROPERTIES( source );
+		if ( mlt_properties_get_int( source_properties, "width" ) == width &&
+		     mlt_properties_get_int( source_properties, "height" ) == height )
+			return source;
+		mlt_frame_close( source );
+	}
+
+	// Keep a whole pass and the frame blended with its first one
+	gop = gop < 1 ? 1 : gop > MAX_GOP ? MAX_GOP : gop;
+	if ( mlt_cache_get_size( cache ) < gop + 2 )
+		mlt_cache_set_size( cache, gop + 2 );
+
+	if ( gop > 1 && backwards )
+	{
+		mlt_position start = position - gop + 1;
+		for ( start = start < 0 ? 0 : start; start < position; start++ )
+			mlt_frame_close( decode_source( producer, start, index, interp, format, width, height, 1 ) );
+	}
+	return decode_source( producer, position, index, interp, format, width, height, store );
+}
+
+/** Mix two images of the same format and size, byte by byte.
+*/
+
+static void blend_bytes( uint8_t *dest, const uint8_t *a, const uint8_t *b, int size, int weight )
+{
+	int i;
+	for ( i = 0; i < size; i++ )
+		dest[ i ] = ( a[ i ] * ( 256 - weight ) + b[ i ] * weight + 128 ) >> 8;
+}
+
 /** Image stack(able) method
 */
 
@@ -45,7 +136,6 @@ static int framebuffer_get_image( mlt_frame frame, uint8_t **image, mlt_image_fo
 
 	// Frame properties objects
 	mlt_properties frame_properties = MLT_FRAME_PROPERTIES( frame );
-	mlt_frame first_frame = mlt_properties_get_data( properties, "first_frame", NULL );
 
 	// Get producer parameters
 	int strobe = mlt_properties_get_int( properties, "strobe" );
@@ -55,20 +145,22 @@ static int framebuffer_get_image( mlt_frame frame, uint8_t **image, mlt_image_fo
 	int in = mlt_properties_get_position( properties, "in" );
 
 	// Determine the position
-	mlt_position first_position = (first_frame != NULL) ? mlt_frame_get_position( first_frame ) : -1;
 	mlt_position need_first = freeze;
+	double fraction = 0.0;
 
 	if ( !freeze || freeze_after || freeze_before )
 	{
 		double prod_speed = mlt_properties_get_double( properties, "_speed" );
 		double actual_position = in + prod_speed * (double) mlt_producer_position( producer );
 
+		// Reverse within the source, whose playtime differs from ours unless the speed is 1
 		if ( mlt_properties_get_int( properties, "reverse" ) )
-			actual_position = mlt_producer_get_playtime( producer ) - actual_position;
+			actual_position = mlt_producer_get_playtime( mlt_properties_get_data( properties, "producer", NULL ) ) - actual_position;
 
 		if ( strobe < 2 )
 		{
 			need_first = floor( actual_position );
+			fraction = actual_position - need_first;
 		}
 		else
 		{
@@ -78,11 +170,16 @@ static int framebuffer_get_image( mlt_frame frame, uint8_t **image, mlt_image_fo
 		}
 		if ( freeze )
 		{
-			if ( freeze_after && need_first > freeze ) need_first = freeze;
-			else if ( freeze_before && need_first < freeze ) need_first = freeze;
+			if ( freeze_after && need_first > freeze ) need_first = freeze, fraction = 0.0;
+			else if ( freeze_before && need_first < freeze ) need_first = freeze, fraction = 0.0;
 		}
 	}
-	
+
+	// Blend with the following frame at fractional positions
+	int weight = mlt_properties_get_int( properties, "blend" ) ? lrint( fraction * 256 ) : 0;
+	if ( need_first + 1 >= mlt_properties_get_position( properties, "_source_length" ) )
+		weight = 0;
+
 	if ( *format == mlt_image_none )
 	{
 		// set format to the original's producer format
@@ -91,114 +188,60 @@ static int framebuffer_get_image( mlt_frame frame, uint8_t **image, mlt_image_fo
 	// Determine output buffer size
 	*width = mlt_properties_get_int( frame_properties, "width" );
 	*height = mlt_properties_get_int( frame_properties, "height" );
-	int size = mlt_image_format_size( *format, *width, *height, NULL );
-
-	// Get output buffer
-	int buffersize = 0;
-        int alphasize = *width * *height;
-	uint8_t *output = mlt_properties_get_data( properties, "output_buffer", &buffersize );
-        uint8_t *output_alpha = mlt_properties_get_data( properties, "output_alpha", NULL );
-	if( buffersize == 0 || buffersize != size )
-	{
-		// invalidate cached frame
-		first_position = -1;
-	}
 
-	if ( need_first != first_position )
-	{
-		// invalidate cached frame
-		first_position = -1;
-		
-		// Bust the cached frame
-		mlt_properties_set_data( properties, "first_frame", NULL, 0, NULL, NULL );
-		first_frame = NULL;
-	}
+	const char *interp = mlt_properties_get( frame_properties, "rescale.interp" );
+	mlt_frame first_frame = get_source( producer, need_first, index, interp, *format, *width, *height );
+	mlt_frame second_frame = first_frame && weight > 0 && weight < 256 ?
+		get_source( producer, need_first + 1, index, interp, *format, *width, *height ) : NULL;
 
-	if ( output && first_position != -1 ) {
-		// Using the cached frame
-	  	uint8_t *image_copy = mlt_pool_alloc( size );
-		memcpy( image_copy, output, size );
-                uint8_t *alpha_copy = mlt_pool_alloc( alphasize );
-                memcpy( alpha_copy, output_alpha, alphasize );
-
-		// Set the output image
-		*image = image_copy;
-		mlt_frame_set_image( frame, image_copy, size, mlt_pool_release );
-                mlt_frame_set_alpha( frame, alpha_copy, alphasize, mlt_pool_release );
-
-		*width = mlt_properties_get_int( properties, "_output_width" );
-		*height = mlt_properties_get_int( properties, "_output_height" );
-		*format = mlt_properties_get_int( properties, "_output_format" );
-
-		mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
-		return 0;
-	}
+	mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
 
-	// Get the cached frame
-	if ( first_frame == NULL )
+	if ( !first_frame )
 	{
-		// Get the frame to cache from the real producer
-		mlt_producer real_producer = mlt_properties_get_data( properties, "producer", NULL );
-
-		// Seek the producer to the correct place
-		mlt_producer_seek( real_producer, need_first );
-
-		// Get the frame
-		mlt_service_get_frame( MLT_PRODUCER_SERVICE( real_producer ), &first_frame, index );
-
-		// Cache the frame
-		mlt_properties_set_data( properties, "first_frame", first_frame, 0, ( mlt_destructor )mlt_frame_close, NULL );
+		mlt_log_warning( MLT_PRODUCER_SERVICE( producer ), "first_image == NULL get image died\n" );
+		return 1;
 	}
-	mlt_properties first_frame_properties = MLT_FRAME_PROPERTIES( first_frame );
 
-
-	// Which frames are buffered?
-	uint8_t *first_image = mlt_properties_get_data( first_frame_properties, "image", NULL );
-        uint8_t *first_alpha = mlt_properties_get_data( first_frame_properties, "alpha", NULL );
-	if ( !first_image )
+	// The frame store hands out copies, so the images can be used in place
+	mlt_properties first_frame_properties = MLT_FRAME_PROPERTIES( first_frame );
+	int size = 0;
+	int alphasize = 0;
+	uint8_t *first_image = mlt_properties_get_data( first_frame_properties, "image", &size );
+	uint8_t *first_alpha = mlt_properties_get_data( first_frame_properties, "alpha", &alphasize );
+	*format = mlt_properties_get_int( first_frame_properties, "format" );
+	*width = mlt_properties_get_int( first_frame_properties, "width" );
+	*height = mlt_properties_get_int( first_frame_properties, "height" );
+	if ( !size )
+		size = mlt_image_format_size( *format, *width, *height, NULL );
+	if ( !alphasize )
+		alphasize = *width * *height;
+
+	if ( second_frame )
 	{
-		mlt_properties_set( first_frame_properties, "rescale.interp", mlt_properties_get( frame_properties, "rescale.interp" ) );
-
-		int error = mlt_frame_get_image( first_frame, &first_image, format, width, height, writable );
-
-		if ( error != 0 ) {
-			mlt_log_warning( MLT_PRODUCER_SERVICE( producer ), "first_image == NULL get image died\n" );
-			mlt_properties_set_data( properties, "first_frame", NULL, 0, NULL, NULL );
-			mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
-			return error;
+		mlt_properties second_frame_properties = MLT_FRAME_PROPERTIES( second_frame );
+		uint8_t *second_image = mlt_properties_get_data( second_frame_properties, "image", NULL );
+		uint8_t *second_alpha = mlt_properties_get_data( second_frame_properties, "alpha", NULL );
+
+		// Every byte of these formats is an 8-bit sample
+		if ( second_image && mlt_properties_get_int( second_frame_properties, "format" ) == *format &&
+		     mlt_properties_get_int( second_frame_properties, "width" ) == *width &&
+		     mlt_properties_get_int( second_frame_properties, "height" ) == *height &&
+		     ( *format == mlt_image_yuv422 || *format == mlt_image_yuv420p ||
+		       *format == mlt_image_rgb24 || *format == mlt_image_rgb24a ) )
+		{
+			blend_bytes( first_image, first_image, second_image, size, weight );
+			if ( first_alpha && second_alpha )
+				blend_bytes( first_alpha, first_alpha, second_alpha, alphasize, weight );
 		}
-		output = mlt_pool_alloc( size );
-		memcpy( output, first_image, size );
-		// Let someone else clean up
-		mlt_properties_set_data( properties, "output_buffer", output, size, mlt_pool_release, NULL ); 
-		mlt_properties_set_int( properties, "_output_width", *width );
-		mlt_properties_set_int( properties, "_output_height", *height );
-		mlt_properties_set_int( properties, "_output_format", *format );
-	
+		mlt_frame_close( second_frame );
 	}
 
-	if ( !first_alpha )
-        {
-                alphasize = *width * *height;
-                first_alpha = mlt_frame_get_alpha_mask( first_frame );
-                output_alpha = mlt_pool_alloc( alphasize );
-                memcpy( output_alpha, first_alpha, alphasize );
-                mlt_properties_set_data( properties, "output_alpha", output_alpha, alphasize, mlt_pool_release, NULL ); 
-        }
-
-	mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
-
-	// Create a copy
-	uint8_t *image_copy = mlt_pool_alloc( size );
-	memcpy( image_copy, first_image, size );
-        uint8_t *alpha_copy = mlt_pool_alloc( alphasize );
-        memcpy( alpha_copy, first_alpha, alphasize );
-
 	// Set the output image
-	*image = image_copy;
-	mlt_frame_set_image( frame, *image, size, mlt_pool_release );
-
-	mlt_frame_set_alpha( frame, alpha_copy, alphasize, mlt_pool_release );
+	*image = first_image;
+	mlt_frame_set_image( frame, first_image, size, NULL );
+	if ( first_alpha )
+		mlt_frame_set_alpha( frame, first_alpha, alphasize, NULL );
+	mlt_properties_set_data( frame_properties, "framebuffer.source", first_frame, 0, ( mlt_destructor )mlt_frame_close, NULL );
 
 	return 0;
 }
@@ -327,6 +370,12 @@ mlt_producer producer_framebuffer_init( mlt_profile profile, mlt_service_type ty
 		// Store the producer and fitler
 		mlt_properties_set_data( properties, "producer", real_producer, 0, ( mlt_destructor )mlt_producer_close, NULL );
 
+		// Store decoded frames for reverse playback and blending, a second of them by default
+		mlt_cache cache = mlt_cache_init();
+		mlt_properties_set_data( properties, "_frame_store", cache, 0, ( mlt_destructor )mlt_cache_close, NULL );
+		mlt_properties_set_int( properties, "gop", lrint( mlt_profile_fps( profile ) ) );
+		mlt_properties_set_position( properties, "_source_length", mlt_producer_get_length( real_producer ) );
+
 		// Grab some stuff from the real_producer
 		mlt_properties_pass_list( properties, MLT_PRODUCER_PROPERTIES( real_producer ), "length, width, height, aspect_ratio" );
 
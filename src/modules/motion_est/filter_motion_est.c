@@ -33,11 +33,18 @@
 #include <string.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #ifdef USE_SSE
 #include "sad_sse.h"
 #endif
 
+// The AVX2 comparison is selected at run time and needs GCC 4.9 for target attributes
+#if defined(__GNUC__) && (__GNUC__ > 4 || __GNUC__ == 4 && __GNUC_MINOR__ >= 9) && defined(ARCH_X86_64)
+#define MOTION_EST_AVX2
+#include <immintrin.h>
+#endif
+
 #define NDEBUG
 #include <assert.h>
 
@@ -50,8 +57,23 @@
 #define FULL_SEARCH 0x1
 #define SHIFT 8
 #define MIN(a,b) ((a) > (b) ? (b) : (a))
+#define MAX(a,b) ((a) < (b) ? (b) : (a))
 #define ABS(a) ((a) >= 0 ? (a) : (-(a)))
 
+#define MAX_PYRAMID_LEVELS 4			// Deepest coarse-to-fine search
+#define PYRAMID_RANGE 4				// Search range in pixels of the coarsest level
+#define VECTOR_CACHE_SIZE 8			// Number of frames whose vectors are remembered
+
+/** The vectors found for a frame, kept so that revisiting it does not search again.
+*/
+
+struct vector_cache_s
+{
+	mlt_position position;
+	int left_mb, right_mb, top_mb, bottom_mb;
+	motion_vector *vectors;			// Vectors before denoising
+};
+
 
 struct motion_est_context_s
 {
@@ -80,6 +102,16 @@ struct motion_est_context_s
 	int show_reconstruction;
 	int toggle_when_paused;
 	int show_residual;
+	int threads;				// Number of threads searching macroblock rows
+	int pyramid_levels;			// Number of reduced images searched before the full one
+
+	/* luma reduced by 2, 4, 8... for the coarse-to-fine search */
+	uint8_t *pyramid_from[MAX_PYRAMID_LEVELS];
+	uint8_t *pyramid_to[MAX_PYRAMID_LEVELS];
+
+	/* recently found vectors by frame position */
+	struct vector_cache_s vector_cache[VECTOR_CACHE_SIZE];
+	int vector_cache_next;
 
 	/* bounds */
 	struct mlt_geometry_item_s bounds;	// Current bounds (from filters crop_detect, autotrack rectangle, or other)
@@ -108,6 +140,7 @@ struct motion_est_context_s
 	/* run-time configurable comparison functions */
 	int (*compare_reference)(uint8_t *, uint8_t *, int, int, int, int);
 	int (*compare_optimized)(uint8_t *, uint8_t *, int, int, int, int);
+	int (*compare_any)(uint8_t *, uint8_t *, int, int, int, int);	// Any block size and an xstride of 1 or 2
 
 };
 
@@ -174,6 +207,58 @@ static int sad_reference( uint8_t *block1, uint8_t *block2, const int xstride, c
 	return score;
 }
 
+#ifdef MOTION_EST_AVX2
+/** /brief AVX2 Sum of Absolute Differences for blocks of any size
+*
+* Handles packed yuv422 (xstride 2), where the chroma bytes are masked out, and
+* planar luma (xstride 1). Rows are taken 16 pixels at a time with narrower
+* SSE2 steps and plain C for whatever remains.
+*/
+__attribute__((target("avx2")))
+static int sad_avx2( uint8_t *block1, uint8_t *block2, const int xstride, const int ystride, const int w, const int h )
+{
+	if ( xstride != 1 && xstride != 2 )
+		return sad_reference( block1, block2, xstride, ystride, w, h );
+
+	const __m256i mask = xstride == 2 ? _mm256_set1_epi16( 0x00ff ) : _mm256_set1_epi8( -1 );
+	const __m128i mask128 = _mm256_castsi256_si128( mask );
+	const int bytes = w * xstride;
+	__m256i sums = _mm256_setzero_si256();
+	__m128i sums128 = _mm_setzero_si128();
+	int i, j, score = 0;
+
+	for ( j = 0; j < h; j++ ){
+		for ( i = 0; i + 32 <= bytes; i += 32 ){
+			__m256i a = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*) ( block1 + i ) ), mask );
+			__m256i b = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*) ( block2 + i ) ), mask );
+			sums = _mm256_add_epi64( sums, _mm256_sad_epu8( a, b ) );
+		}
+		if ( i + 16 <= bytes ){
+			__m128i a = _mm_and_si128( _mm_loadu_si128( (const __m128i*) ( block1 + i ) ), mask128 );
+			__m128i b = _mm_and_si128( _mm_loadu_si128( (const __m128i*) ( block2 + i ) ), mask128 );
+			sums128 = _mm_add_epi64( sums128, _mm_sad_epu8( a, b ) );
+			i += 16;
+		}
+		if ( i + 8 <= bytes ){
+			__m128i a = _mm_and_si128( _mm_loadl_epi64( (const __m128i*) ( block1 + i ) ), mask128 );
+			__m128i b = _mm_and_si128( _mm_loadl_epi64( (const __m128i*) ( block2 + i ) ), mask128 );
+			sums128 = _mm_add_epi64( sums128, _mm_sad_epu8( a, b ) );
+			i += 8;
+		}
+		for ( ; i < bytes; i += xstride )
+			score += ABS( block1[i] - block2[i] );
+		block1 += ystride;
+		block2 += ystride;
+	}
+
+	sums128 = _mm_add_epi64( sums128, _mm256_castsi256_si128( sums ) );
+	sums128 = _mm_add_epi64( sums128, _mm256_extracti128_si256( sums, 1 ) );
+	sums128 = _mm_add_epi64( sums128, _mm_unpackhi_epi64( sums128, sums128 ) );
+
+	return score + (int) _mm_cvtsi128_si64( sums128 );
+}
+#endif
+
 
 /** /brief Abstracted block comparison function
 */
@@ -208,8 +293,8 @@ inline static int block_compare( uint8_t *block1,
 	// Some gotchas
 	if( penalty == 0 )			// Clipped out of existance: Return worst score
 		return MAX_MSAD;
-	else if( penalty != 1<<SHIFT )		// Nonstandard macroblock dimensions: Disable SIMD optimizizations.
-		cmp = c->compare_reference;
+	else if( penalty != 1<<SHIFT )		// Nonstandard macroblock dimensions: Use the comparison for any size.
+		cmp = c->compare_any;
 
 	// Calculate the memory locations of the macroblocks
 	block1 += x	 * c->xstride + y 	* c->ystride;
@@ -492,134 +577,326 @@ static inline int median_predictor(int a, int b, int c) {
 }
 
 
-/** /brief Motion search
+/** /brief Halve the size of a luma plane
 *
-* For each macroblock in the current frame, estimate the block from the last frame that
-* matches best.
+* The source is either the packed yuv422 image (xstride 2) or the previous
+* level of the pyramid (xstride 1). The result is planar.
+*/
+static void reduce_luma( uint8_t *dst, const uint8_t *src, const int xstride, const int width, const int height )
+{
+	int x, y;
+	int w = width / 2;
+	int h = height / 2;
+	int ystride = width * xstride;
+
+	for( y = 0; y < h; y++ ){
+		const uint8_t *a = src + 2 * y * ystride;
+		const uint8_t *b = a + ystride;
+		for( x = 0; x < w; x++ ){
+			*dst++ = ( a[0] + a[xstride] + b[0] + b[xstride] + 2 ) >> 2;
+			a += 2 * xstride;
+			b += 2 * xstride;
+		}
+	}
+}
+
+/** /brief Build the reduced images of both frames for the coarse-to-fine search
+*/
+static void build_pyramid( uint8_t *from, uint8_t *to, struct motion_est_context_s *c )
+{
+	int level;
+
+	for( level = 0; level < c->pyramid_levels; level++ ){
+		int xstride = level == 0 ? c->xstride : 1;
+		int width = c->width >> level;
+		int height = c->height >> level;
+		reduce_luma( c->pyramid_from[level], level == 0 ? from : c->pyramid_from[level - 1], xstride, width, height );
+		reduce_luma( c->pyramid_to[level], level == 0 ? to : c->pyramid_to[level - 1], xstride, width, height );
+	}
+}
+
+/** /brief Coarse-to-fine search
+*
+* Find the motion of a macroblock by a full search of a small range on the
+* smallest image, then refine the vector by one pixel on each larger image.
+* The result is a candidate for the search at full resolution.
+*/
+static void pyramid_search( const int i, const int j, motion_vector *result, struct motion_est_context_s *c )
+{
+	int level, range = PYRAMID_RANGE;
+	int dx = 0, dy = 0;
+
+	for( level = c->pyramid_levels; level > 0; level-- ){
+		int width = c->width >> level;
+		int height = c->height >> level;
+		int w = MAX( c->mb_w >> level, 1 );
+		int h = MAX( c->mb_h >> level, 1 );
+		int x = ( i * c->mb_w ) >> level;
+		int y = ( j * c->mb_h ) >> level;
+		uint8_t *ref = c->pyramid_to[level - 1] + y * width + x;
+		uint8_t *candidate_base = c->pyramid_from[level - 1];
+		int best = MAX_MSAD * 16, best_dx = dx, best_dy = dy;
+		int tx, ty, score;
+
+		if( x + w > width || y + h > height )
+			break;
+
+		for( ty = dy - range; ty <= dy + range; ty++ ){
+			if( y + ty < 0 || y + ty + h > height )
+				continue;
+			for( tx = dx - range; tx <= dx + range; tx++ ){
+				if( x + tx < 0 || x + tx + w > width )
+					continue;
+				score = c->compare_any( ref, candidate_base + ( y + ty ) * width + x + tx, 1, width, w, h );
+				if( score < best ){
+					best = score;
+					best_dx = tx;
+					best_dy = ty;
+				}
+			}
+		}
+
+		// Scale up for the next level
+		dx = best_dx * 2;
+		dy = best_dy * 2;
+		range = 1;
+	}
+
+	result->dx = dx;
+	result->dy = dy;
+}
+
+/** /brief Estimate the motion of one macroblock
 *
 * Vocab: Colocated - the pixel in the previous frame at the current position
 *
 * Based on enhanced predictive zonal search. [Tourapis 2002]
+*
+* Only the left and top neighbours of the current frame are used as predictors
+* so that rows may be searched in parallel one macroblock behind each other.
+* The top right neighbour counts as the zero vector as it always has.
 */
-static void motion_search( uint8_t *from,			//<! Image data.
-		   	   uint8_t *to,				//<! Image data. Rigid grid.
-			   struct motion_est_context_s *c)	//<! The context
+static void search_block( uint8_t *from, uint8_t *to, const int i, const int j, struct motion_est_context_s *c )
 {
-
-#ifdef COUNT_COMPARES
-	compares = 0;
-#endif
-
-	motion_vector candidates[10];
+	motion_vector candidates[11];
 	motion_vector *here;		// This one gets used alot (about 30 times per macroblock)
 	int n = 0;
 
-	int i, j, count=0;
-
-	// For every macroblock, perform motion vector estimation
-	for( i = c->left_mb; i <= c->right_mb; i++ ){
-	 for( j = c->top_mb; j <= c->bottom_mb; j++ ){
-
-		here = CURRENT(i,j);
-		here->valid = 1;
-		here->color = 100;
-		here->msad = MAX_MSAD;
-		count++;
-		n = 0;
-
+	here = CURRENT(i,j);
+	here->valid = 1;
+	here->color = 100;
+	here->msad = MAX_MSAD;
 
-		/* Stack the predictors [i.e. checked in reverse order] */
 
-		/* Adjacent to collocated */
-		if( c->former_vectors_valid )
-		{
-			// Top of colocated
-			if( j > c->prev_top_mb ){// && COL_TOP->valid ){
-				candidates[n  ].dx = FORMER(i,j-1)->dx;
-				candidates[n++].dy = FORMER(i,j-1)->dy;
-			}
+	/* Stack the predictors [i.e. checked in reverse order] */
 
-			// Left of colocated
-			if( i > c->prev_left_mb ){// && COL_LEFT->valid ){
-				candidates[n  ].dx = FORMER(i-1,j)->dx;
-				candidates[n++].dy = FORMER(i-1,j)->dy;
-			}
+	/* Adjacent to collocated */
+	if( c->former_vectors_valid )
+	{
+		// Top of colocated
+		if( j > c->prev_top_mb ){// && COL_TOP->valid ){
+			candidates[n  ].dx = FORMER(i,j-1)->dx;
+			candidates[n++].dy = FORMER(i,j-1)->dy;
+		}
 
-			// Right of colocated
-			if( i < c->prev_right_mb ){// && COL_RIGHT->valid ){
-				candidates[n  ].dx = FORMER(i+1,j)->dx;
-				candidates[n++].dy = FORMER(i+1,j)->dy;
-			}
+		// Left of colocated
+		if( i > c->prev_left_mb ){// && COL_LEFT->valid ){
+			candidates[n  ].dx = FORMER(i-1,j)->dx;
+			candidates[n++].dy = FORMER(i-1,j)->dy;
+		}
 
-			// Bottom of colocated
-			if( j < c->prev_bottom_mb ){// && COL_BOTTOM->valid ){
-				candidates[n  ].dx = FORMER(i,j+1)->dx;
-				candidates[n++].dy = FORMER(i,j+1)->dy;
-			}
+		// Right of colocated
+		if( i < c->prev_right_mb ){// && COL_RIGHT->valid ){
+			candidates[n  ].dx = FORMER(i+1,j)->dx;
+			candidates[n++].dy = FORMER(i+1,j)->dy;
+		}
 
-			// And finally, colocated
-			candidates[n  ].dx = FORMER(i,j)->dx;
-			candidates[n++].dy = FORMER(i,j)->dy;
+		// Bottom of colocated
+		if( j < c->prev_bottom_mb ){// && COL_BOTTOM->valid ){
+			candidates[n  ].dx = FORMER(i,j+1)->dx;
+			candidates[n++].dy = FORMER(i,j+1)->dy;
 		}
 
-		// For macroblocks not in the top row
-		if ( j > c->top_mb) {
+		// And finally, colocated
+		candidates[n  ].dx = FORMER(i,j)->dx;
+		candidates[n++].dy = FORMER(i,j)->dy;
+	}
 
-			// Top if ( TOP->valid ) {
-				candidates[n  ].dx = CURRENT(i,j-1)->dx;
-				candidates[n++].dy = CURRENT(i,j-1)->dy;
-			//}
+	// For macroblocks not in the top row
+	if ( j > c->top_mb) {
 
-			// Top-Right, macroblocks not in the right row
-			if ( i < c->right_mb ){// && TOP_RIGHT->valid ) {
-				candidates[n  ].dx = CURRENT(i+1,j-1)->dx;
-				candidates[n++].dy = CURRENT(i+1,j-1)->dy;
-			}
-		}
+		// Top if ( TOP->valid ) {
+			candidates[n  ].dx = CURRENT(i,j-1)->dx;
+			candidates[n++].dy = CURRENT(i,j-1)->dy;
+		//}
 
-		// Left, Macroblocks not in the left column
-		if ( i > c->left_mb ){// && LEFT->valid ) {
-			candidates[n  ].dx = CURRENT(i-1,j)->dx;
-			candidates[n++].dy = CURRENT(i-1,j)->dy;
+		// Top-Right, macroblocks not in the right row
+		if ( i < c->right_mb ){// && TOP_RIGHT->valid ) {
+			candidates[n  ].dx = 0;
+			candidates[n++].dy = 0;
 		}
+	}
 
-		/* Median predictor vector (median of left, top, and top right adjacent vectors) */
-		if ( i > c->left_mb && j > c->top_mb && i < c->right_mb
-			 )//&& LEFT->valid && TOP->valid && TOP_RIGHT->valid )
-		{
-			candidates[n  ].dx = median_predictor( CURRENT(i-1,j)->dx, CURRENT(i,j-1)->dx, CURRENT(i+1,j-1)->dx);
-			candidates[n++].dy = median_predictor( CURRENT(i-1,j)->dy, CURRENT(i,j-1)->dy, CURRENT(i+1,j-1)->dy);
-		}
+	// Left, Macroblocks not in the left column
+	if ( i > c->left_mb ){// && LEFT->valid ) {
+		candidates[n  ].dx = CURRENT(i-1,j)->dx;
+		candidates[n++].dy = CURRENT(i-1,j)->dy;
+	}
 
-		// Zero vector
-		candidates[n  ].dx = 0;
-		candidates[n++].dy = 0;
+	/* Median predictor vector (median of left, top, and top right adjacent vectors) */
+	if ( i > c->left_mb && j > c->top_mb && i < c->right_mb
+		 )//&& LEFT->valid && TOP->valid && TOP_RIGHT->valid )
+	{
+		candidates[n  ].dx = median_predictor( CURRENT(i-1,j)->dx, CURRENT(i,j-1)->dx, 0 );
+		candidates[n++].dy = median_predictor( CURRENT(i-1,j)->dy, CURRENT(i,j-1)->dy, 0 );
+	}
 
-		int x = i * c->mb_w;
-		int y = j * c->mb_h;
-		check_candidates ( to, from, x, y, candidates, n, 0, here, c );
+	// Coarse-to-fine estimate
+	if ( c->pyramid_levels > 0 )
+		pyramid_search( i, j, &candidates[n++], c );
+
+	// Zero vector
+	candidates[n  ].dx = 0;
+	candidates[n++].dy = 0;
+
+	int x = i * c->mb_w;
+	int y = j * c->mb_h;
+	check_candidates ( to, from, x, y, candidates, n, 0, here, c );
 
 
 #ifndef FULLSEARCH
-		diamond_search( to, from, x, y, here, c);
+	diamond_search( to, from, x, y, here, c);
 #else
-		full_search( to, from, x, y, here, c);
+	full_search( to, from, x, y, here, c);
 #endif
 
-		assert( x + c->mb_w + here->dx > 0 );	// All macroblocks must have area > 0
-		assert( y + c->mb_h + here->dy > 0 );
-		assert( x + here->dx < c->width );
-		assert( y + here->dy < c->height );
+	assert( x + c->mb_w + here->dx > 0 );	// All macroblocks must have area > 0
+	assert( y + c->mb_h + here->dy > 0 );
+	assert( x + here->dx < c->width );
+	assert( y + here->dy < c->height );
+}
 
-	 } /* End column loop */
-	} /* End row loop */
+/** The macroblock rows shared by the threads of a motion search.
+*/
+struct search_job_s
+{
+	struct motion_est_context_s *c;
+	uint8_t *from, *to;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int next_row;				// Next macroblock row to be taken by a thread
+	int *progress;				// Number of macroblocks finished in each row
+};
+
+/** /brief Search rows until there are none left
+*
+* Rows are taken in order and a macroblock waits for the one above it, so
+* the vectors are the same whatever the number of threads.
+*/
+static void *search_rows( void *arg )
+{
+	struct search_job_s *job = arg;
+	struct motion_est_context_s *c = job->c;
+	int i, j;
+
+	while( 1 ){
+		pthread_mutex_lock( &job->mutex );
+		j = job->next_row++;
+		pthread_mutex_unlock( &job->mutex );
+		if( j > c->bottom_mb )
+			break;
+
+		int *above = job->progress + j - c->top_mb - 1;
+		for( i = c->left_mb; i <= c->right_mb; i++ ){
+			pthread_mutex_lock( &job->mutex );
+			while( j > c->top_mb && *above <= i - c->left_mb )
+				pthread_cond_wait( &job->cond, &job->mutex );
+			pthread_mutex_unlock( &job->mutex );
+
+			search_block( job->from, job->to, i, j, c );
+
+			pthread_mutex_lock( &job->mutex );
+			above[1] = i - c->left_mb + 1;
+			pthread_cond_broadcast( &job->cond );
+			pthread_mutex_unlock( &job->mutex );
+		}
+	}
 
 #ifdef USE_SSE
 	asm volatile ( "emms" );
 #endif
+	return NULL;
+}
+
+/** /brief Motion search
+*
+* For each macroblock in the current frame, estimate the block from the last frame that
+* matches best.
+*/
+static void motion_search( uint8_t *from,			//<! Image data.
+		   	   uint8_t *to,				//<! Image data. Rigid grid.
+			   struct motion_est_context_s *c)	//<! The context
+{
+
+#ifdef COUNT_COMPARES
+	compares = 0;
+#endif
+
+	int i, j;
+	int rows = c->bottom_mb - c->top_mb + 1;
+	int threads = MIN( c->threads, rows );
+	pthread_t *ids = NULL;
+	struct search_job_s job;
+
+	if( c->right_mb < c->left_mb || rows <= 0 )
+		return;
+
+	if( threads > 1 )
+		ids = calloc( threads - 1, sizeof( pthread_t ) );
+
+	if( c->pyramid_levels > 0 )
+		build_pyramid( from, to, c );
+
+	if( ids != NULL ){
+		job.c = c;
+		job.from = from;
+		job.to = to;
+		job.next_row = c->top_mb;
+		job.progress = calloc( rows, sizeof( int ) );
+		pthread_mutex_init( &job.mutex, NULL );
+		pthread_cond_init( &job.cond, NULL );
+	}
+
+	if( ids != NULL && job.progress != NULL ){
+		int started = 0;
+
+		// The calling thread takes a share of the rows too
+		while( started < threads - 1 && !pthread_create( &ids[started], NULL, search_rows, &job ) )
+			started++;
+		search_rows( &job );
+		for( i = 0; i < started; i++ )
+			pthread_join( ids[i], NULL );
+	}
+	else {
+		// For every macroblock, perform motion vector estimation
+		for( j = c->top_mb; j <= c->bottom_mb; j++ )
+			for( i = c->left_mb; i <= c->right_mb; i++ )
+				search_block( from, to, i, j, c );
+
+#ifdef USE_SSE
+		asm volatile ( "emms" );
+#endif
+	}
+
+	if( ids != NULL ){
+		pthread_mutex_destroy( &job.mutex );
+		pthread_cond_destroy( &job.cond );
+		free( job.progress );
+		free( ids );
+	}
 
 #ifdef COUNT_COMPARES
-	fprintf(stderr, "%d comparisons per block were made", compares/count);
+	fprintf(stderr, "%d comparisons per block were made", compares/(rows*(c->right_mb-c->left_mb+1)));
 #endif
 	return;
 }
@@ -657,6 +934,18 @@ void collect_post_statistics( struct motion_est_context_s *c ) {
 
 static void init_optimizations( struct motion_est_context_s *c )
 {
+	c->compare_any = c->compare_reference;
+
+#ifdef MOTION_EST_AVX2
+	// Prefer AVX2 for every block size when the processor has it
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) ) {
+		c->compare_optimized = sad_avx2;
+		c->compare_any = sad_avx2;
+		return;
+	}
+#endif
+
 	switch(c->mb_w){
 #ifdef USE_SSE
 		case 4:  if(c->mb_h == 4)	c->compare_optimized = sad_sse_422_luma_4x4;
@@ -776,6 +1065,74 @@ static void show_reconstruction( uint8_t *result, struct motion_est_context_s *c
 	}
 }
 
+/** /brief Find the vectors remembered for the current frame and bounds
+*/
+static motion_vector *vector_cache_find( struct motion_est_context_s *c )
+{
+	int n;
+	for( n = 0; n < VECTOR_CACHE_SIZE; n++ ){
+		struct vector_cache_s *entry = &c->vector_cache[n];
+		if( entry->vectors != NULL && entry->position == c->current_frame_position &&
+		    entry->left_mb == c->left_mb && entry->right_mb == c->right_mb &&
+		    entry->top_mb == c->top_mb && entry->bottom_mb == c->bottom_mb )
+			return entry->vectors;
+	}
+	return NULL;
+}
+
+/** /brief Remember the vectors of the current frame, replacing the oldest
+*/
+static void vector_cache_store( struct motion_est_context_s *c )
+{
+	struct vector_cache_s *entry = &c->vector_cache[c->vector_cache_next];
+	if( entry->vectors == NULL )
+		return;
+	entry->position = c->current_frame_position;
+	entry->left_mb = c->left_mb;
+	entry->right_mb = c->right_mb;
+	entry->top_mb = c->top_mb;
+	entry->bottom_mb = c->bottom_mb;
+	memcpy( entry->vectors, c->current_vectors, c->mv_size );
+	c->vector_cache_next = ( c->vector_cache_next + 1 ) % VECTOR_CACHE_SIZE;
+}
+
+/** /brief Give the frame its own copy of the vectors
+*
+* The copy stays valid for as long as the frame lives, whatever this filter
+* goes on to do, so that the frame may be held by other services.
+*/
+static void attach_vectors( mlt_frame frame, motion_vector *vectors, struct motion_est_context_s *c )
+{
+	motion_vector *copy = mlt_pool_alloc( c->mv_size );
+	if( copy != NULL ) {
+		memcpy( copy, vectors, c->mv_size );
+		mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), "motion_est.vectors",
+				 (void*)copy, c->mv_size, mlt_pool_release, NULL );
+		mlt_properties_set_position( MLT_FRAME_PROPERTIES( frame ), "motion_est.position", c->current_frame_position );
+	}
+}
+
+/** /brief Get vectors of the same layout already found for this frame by another motion_est
+*/
+static motion_vector *shared_vectors( mlt_frame frame, struct motion_est_context_s *c )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	int size = 0;
+	motion_vector *vectors = mlt_properties_get_data( properties, "motion_est.vectors", &size );
+
+	if( vectors != NULL && size == c->mv_size &&
+	    mlt_properties_get( properties, "motion_est.position" ) != NULL &&
+	    mlt_properties_get_position( properties, "motion_est.position" ) == c->current_frame_position &&
+	    mlt_properties_get_int( properties, "motion_est.macroblock_width" ) == c->mb_w &&
+	    mlt_properties_get_int( properties, "motion_est.macroblock_height" ) == c->mb_h &&
+	    mlt_properties_get_int( properties, "motion_est.left_mb" ) == c->left_mb &&
+	    mlt_properties_get_int( properties, "motion_est.right_mb" ) == c->right_mb &&
+	    mlt_properties_get_int( properties, "motion_est.top_mb" ) == c->top_mb &&
+	    mlt_properties_get_int( properties, "motion_est.bottom_mb" ) == c->bottom_mb )
+		return vectors;
+	return NULL;
+}
+
 // Image stack(able) method
 static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
 {
@@ -849,6 +1206,15 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		if( mlt_properties_get( properties, "toggle_when_paused" ) != NULL )
 			c->toggle_when_paused = mlt_properties_get_int( properties, "toggle_when_paused" );
 
+		if( mlt_properties_get( properties, "threads" ) != NULL )
+			c->threads = mlt_properties_get_int( properties, "threads" );
+		else if( getenv( "MLT_MOTION_EST_THREADS" ) != NULL )
+			c->threads = atoi( getenv( "MLT_MOTION_EST_THREADS" ) );
+
+		if( mlt_properties_get( properties, "pyramid_levels" ) != NULL )
+			c->pyramid_levels = mlt_properties_get_int( properties, "pyramid_levels" );
+		c->pyramid_levels = MAX( 0, MIN( c->pyramid_levels, MAX_PYRAMID_LEVELS ) );
+
 		init_optimizations( c );
 
 		// Calculate the dimensions in macroblock units
@@ -881,6 +1247,33 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		// Register for destruction
 		mlt_properties_set_data( properties, "cache_image", (void *)c->cache_image, 0, mlt_pool_release, NULL );
 		mlt_properties_set_data( properties, "former_image", (void *)c->former_image, 0, mlt_pool_release, NULL );
+		memcpy( c->cache_image, *image, *width * *height * c->xstride );
+
+		// Allocate the reduced images of the coarse-to-fine search
+		if( c->pyramid_levels > 0 ) {
+			int level, size = 0;
+			for( level = 1; level <= c->pyramid_levels; level++ )
+				size += ( *width >> level ) * ( *height >> level );
+			uint8_t *pyramid = mlt_pool_alloc( 2 * size );
+			mlt_properties_set_data( properties, "pyramid", (void *)pyramid, 0, mlt_pool_release, NULL );
+			for( level = 0; pyramid != NULL && level < c->pyramid_levels; level++ ) {
+				c->pyramid_from[level] = pyramid;
+				c->pyramid_to[level] = pyramid + size;
+				pyramid += ( *width >> ( level + 1 ) ) * ( *height >> ( level + 1 ) );
+			}
+			if( pyramid == NULL )
+				c->pyramid_levels = 0;
+		}
+
+		// Allocate the cache of vectors by frame position
+		uint8_t *vector_cache = mlt_pool_alloc( VECTOR_CACHE_SIZE * c->mv_size );
+		mlt_properties_set_data( properties, "vector_cache", (void *)vector_cache, 0, mlt_pool_release, NULL );
+		int n;
+		for( n = 0; n < VECTOR_CACHE_SIZE; n++ ) {
+			c->vector_cache[n].position = -1;
+			c->vector_cache[n].vectors = vector_cache ? (motion_vector*) ( vector_cache + n * c->mv_size ) : NULL;
+		}
+		c->vector_cache_next = 0;
 
 		c->former_frame_position = c->current_frame_position;
 		c->previous_msad = 0;
@@ -931,6 +1324,10 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		c->bounds.h = *height;
 	}
 
+	// Vectors found earlier for this frame, by another motion_est or by this one
+	motion_vector *shared = shared_vectors( frame, c );
+	motion_vector *cached = shared ? NULL : vector_cache_find( c );
+
 	// If video is advancing, run motion vector algorithm and etc...
 	if( c->former_frame_position + 1 == c->current_frame_position )
 	{
@@ -943,8 +1340,15 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		// This is done because filter_vismv doesn't pay attention to frame boundry
 		memset( c->current_vectors, 0, c->mv_size );
 
-		// Perform the motion search
-		motion_search( c->cache_image, *image, c );
+		// Perform the motion search unless the vectors are known
+		if( shared )
+			memcpy( c->current_vectors, shared, c->mv_size );
+		else if( cached )
+			memcpy( c->current_vectors, cached, c->mv_size );
+		else {
+			motion_search( c->cache_image, *image, c );
+			vector_cache_store( c );
+		}
 
 		collect_post_statistics( c );
 
@@ -989,12 +1393,12 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		if( c->comparison_average != 0 ) { // If the frame is not a duplicate of the previous frame
 
 			// denoise the vector buffer
-			if( c->denoise )
+			if( c->denoise && !shared )
 				median_denoise( c->current_vectors, c );
 
 			// Pass the new vector data into the frame
-			mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), "motion_est.vectors",
-					 (void*)c->current_vectors, c->mv_size, NULL, NULL );
+			if( !shared )
+				attach_vectors( frame, c->current_vectors, c );
 
 			// Cache the frame's image. Save the old cache. Reuse memory.
 			// After this block, exactly two unique frames will be cached
@@ -1010,8 +1414,8 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 			temp = c->current_vectors;
 			c->current_vectors = c->former_vectors;
 			c->former_vectors = temp;
-			mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), "motion_est.vectors",
-					 (void*)c->former_vectors, c->mv_size, NULL, NULL );
+			if( !shared )
+				attach_vectors( frame, c->former_vectors, c );
 		}
 
 
@@ -1028,8 +1432,8 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 	{
 		// Pass the old vector data into the frame if it's valid
 		if( c->former_vectors_valid == 1 ) {
-			mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), "motion_est.vectors",
-					 (void*)c->current_vectors, c->mv_size, NULL, NULL );
+			if( !shared )
+				attach_vectors( frame, c->current_vectors, c );
 
 			if( c->shot_change == 1)
 				;
@@ -1057,6 +1461,20 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 	else {
 //		fprintf(stderr, "Warning: there was a frame number jumped from %d to %d.\n", c->former_frame_position, c->current_frame_position);
 		c->former_vectors_valid = 0;
+
+		// Seeking back to a frame that was seen before
+		if( shared || cached ) {
+			memcpy( c->current_vectors, shared ? shared : cached, c->mv_size );
+			if( c->denoise && !shared )
+				median_denoise( c->current_vectors, c );
+			if( !shared )
+				attach_vectors( frame, c->current_vectors, c );
+			c->former_vectors_valid = 1;
+			c->shot_change = 0;
+		}
+
+		// The next frame is searched against this one
+		memcpy( c->cache_image, *image, *width * *height * c->xstride );
 	}
 
 
@@ -1135,6 +1553,8 @@ mlt_filter filter_motion_est_init( mlt_profile profile, mlt_service_type type, c
 		context->show_reconstruction = 0;
 		context->show_residual = 0;
 		context->toggle_when_paused = 0;
+		context->threads = 1;
+		context->pyramid_levels = 0;
 
 		/* reference functions that may have optimized versions */
 		context->compare_reference = sad_reference;
@@ -308,6 +308,15 @@ static int slowmotion_get_frame( mlt_producer this, mlt_frame_ptr frame, int ind
 			mlt_frame_close( first_frame );
 			first_position = -1;
 			first_frame = NULL;
+
+			// Playing forward, the second frame becomes the first along with its image and vectors
+			if( need_first == second_position )
+			{
+				first_frame = second_frame;
+				first_position = second_position;
+				second_frame = NULL;
+				second_position = -1;
+			}
 		}
 
 		if( need_second != second_position)
@@ -0,0 +1,56 @@
+/*
+ * audiometer.h -- per frame audio meter readings
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef AUDIOMETER_H
+#define AUDIOMETER_H
+
+#include <framework/mlt_types.h>
+
+/** The name of the frame property holding an audio_meter as data. */
+
+#define AUDIO_METER_PROPERTY "meta.media.audio_meter"
+
+/** Readings of one channel as linear amplitude where 1.0 is full scale. */
+
+typedef struct
+{
+	float rms;       /**< RMS integrated over the filter's rms_window */
+	float peak;      /**< largest absolute sample value of this frame */
+	float peak_hold; /**< highest recent peak, held then falling */
+}
+audio_meter_channel;
+
+/** Readings of all channels of a frame.
+ *
+ * The structure and its channel array are a single allocation owned by the
+ * frame; fetch it with mlt_properties_get_data( frame properties,
+ * AUDIO_METER_PROPERTY, NULL ).
+ */
+
+typedef struct
+{
+	mlt_position position;        /**< frame position the readings belong to */
+	int frequency;                /**< sample rate of the measured audio */
+	int samples;                  /**< number of samples per channel measured */
+	int channels;                 /**< number of entries in channel */
+	audio_meter_channel *channel; /**< readings indexed by channel */
+}
+audio_meter;
+
+#endif
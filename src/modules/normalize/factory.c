@@ -23,6 +23,7 @@
 #include <framework/mlt.h>
 
 extern mlt_filter filter_audiolevel_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg );
+extern mlt_filter filter_audiometer_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg );
 extern mlt_filter filter_volume_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg );
 
 static mlt_properties metadata( mlt_service_type type, const char *id, void *data )
@@ -35,7 +36,9 @@ static mlt_properties metadata( mlt_service_type type, const char *id, void *dat
 MLT_REPOSITORY
 {
 	MLT_REGISTER( filter_type, "audiolevel", filter_audiolevel_init );
+	MLT_REGISTER( filter_type, "audiometer", filter_audiometer_init );
 	MLT_REGISTER( filter_type, "volume", filter_volume_init );
 	MLT_REGISTER_METADATA( filter_type, "audiolevel", metadata, "filter_audiolevel.yml" );
+	MLT_REGISTER_METADATA( filter_type, "audiometer", metadata, "filter_audiometer.yml" );
 	MLT_REGISTER_METADATA( filter_type, "volume", metadata, "filter_volume.yml" );
 }
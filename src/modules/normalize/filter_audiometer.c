@@ -0,0 +1,291 @@
+/*
+ * filter_audiometer.c -- measure RMS, peak and peak hold of each channel
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "audiometer.h"
+
+#include <framework/mlt_filter.h>
+#include <framework/mlt_frame.h>
+#include <framework/mlt_log.h>
+
+#include <stdlib.h>
+#include <math.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/** The meter state carried from one frame to the next.
+*/
+
+typedef struct
+{
+	int channels;
+	mlt_position last_position;
+	double *mean_square; /**< integrated mean square per channel */
+	double *hold;        /**< held peak per channel */
+	double *hold_age;    /**< seconds since the held peak was captured */
+} private_data;
+
+static void reset_state( private_data *pdata, int channels )
+{
+	free( pdata->mean_square );
+	pdata->mean_square = calloc( 3 * channels, sizeof( double ) );
+	pdata->hold = pdata->mean_square + channels;
+	pdata->hold_age = pdata->hold + channels;
+	pdata->channels = pdata->mean_square ? channels : 0;
+}
+
+/** Accumulate the sum of squares and the peak of interleaved samples.
+ *
+ * The channels are the inner loop so that four of them are handled in one
+ * SSE operation.
+*/
+
+static void measure_interleaved( const float *pcm, int channels, int samples, float *sums, float *peaks )
+{
+	int s, c;
+#ifdef __SSE__
+	const __m128 sign = _mm_set1_ps( -0.0f );
+#endif
+
+	for ( s = 0; s < samples; s++, pcm += channels )
+	{
+		c = 0;
+#ifdef __SSE__
+		for ( ; c + 3 < channels; c += 4 )
+		{
+			__m128 x = _mm_loadu_ps( pcm + c );
+			_mm_storeu_ps( sums + c, _mm_add_ps( _mm_loadu_ps( sums + c ), _mm_mul_ps( x, x ) ) );
+			_mm_storeu_ps( peaks + c, _mm_max_ps( _mm_loadu_ps( peaks + c ), _mm_andnot_ps( sign, x ) ) );
+		}
+#endif
+		for ( ; c < channels; c++ )
+		{
+			float x = pcm[c];
+			float a = fabsf( x );
+			sums[c] += x * x;
+			if ( a > peaks[c] )
+				peaks[c] = a;
+		}
+	}
+}
+
+/** Accumulate the sum of squares and the peak of one channel of planar samples.
+*/
+
+static void measure_planar( const float *pcm, int samples, float *sum, float *peak )
+{
+	float total = 0.0f;
+	float max = 0.0f;
+	int s = 0;
+#ifdef __SSE__
+	const __m128 sign = _mm_set1_ps( -0.0f );
+	__m128 sums = _mm_setzero_ps();
+	__m128 peaks = _mm_setzero_ps();
+	float lanes[4];
+
+	for ( ; s + 3 < samples; s += 4 )
+	{
+		__m128 x = _mm_loadu_ps( pcm + s );
+		sums = _mm_add_ps( sums, _mm_mul_ps( x, x ) );
+		peaks = _mm_max_ps( peaks, _mm_andnot_ps( sign, x ) );
+	}
+	_mm_storeu_ps( lanes, sums );
+	total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_ps( lanes, peaks );
+	max = fmaxf( fmaxf( lanes[0], lanes[1] ), fmaxf( lanes[2], lanes[3] ) );
+#endif
+	for ( ; s < samples; s++ )
+	{
+		float a = fabsf( pcm[s] );
+		total += pcm[s] * pcm[s];
+		if ( a > max )
+			max = a;
+	}
+	*sum = total;
+	*peak = max;
+}
+
+/** Fold the readings of a frame into the meter state and fill in the
+ * integrated values.
+*/
+
+static void update_state( mlt_filter filter, audio_meter *meter, const float *sums )
+{
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	private_data *pdata = (private_data*) filter->child;
+	double seconds = (double) meter->samples / meter->frequency;
+	double rms_window = mlt_properties_get_double( properties, "rms_window" ) / 1000.0;
+	double hold_time = mlt_properties_get_double( properties, "peak_hold" ) / 1000.0;
+	double fall = mlt_properties_get_double( properties, "peak_fall" );
+	double k = rms_window > 0.0 ? exp( -seconds / rms_window ) : 0.0;
+	int restart;
+	int c;
+
+	mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
+
+	restart = meter->position != pdata->last_position + 1;
+	if ( pdata->channels != meter->channels )
+	{
+		reset_state( pdata, meter->channels );
+		restart = 1;
+	}
+	if ( pdata->channels != meter->channels )
+	{
+		mlt_service_unlock( MLT_FILTER_SERVICE( filter ) );
+		return;
+	}
+
+	for ( c = 0; c < meter->channels; c++ )
+	{
+		audio_meter_channel *channel = &meter->channel[c];
+		double mean_square = meter->samples > 0 ? sums[c] / meter->samples : 0.0;
+
+		if ( restart )
+		{
+			pdata->mean_square[c] = mean_square;
+			pdata->hold[c] = channel->peak;
+			pdata->hold_age[c] = 0.0;
+		}
+		else
+		{
+			pdata->mean_square[c] = k * pdata->mean_square[c] + ( 1.0 - k ) * mean_square;
+			pdata->hold_age[c] += seconds;
+			if ( pdata->hold_age[c] > hold_time )
+			{
+				// Fall for the part of this frame that is beyond the hold time
+				double falling = pdata->hold_age[c] - hold_time;
+				if ( falling > seconds )
+					falling = seconds;
+				pdata->hold[c] *= pow( 10.0, -fall * falling / 20.0 );
+			}
+			if ( channel->peak >= pdata->hold[c] )
+			{
+				pdata->hold[c] = channel->peak;
+				pdata->hold_age[c] = 0.0;
+			}
+		}
+		channel->rms = sqrt( pdata->mean_square[c] );
+		channel->peak_hold = pdata->hold[c];
+	}
+	pdata->last_position = meter->position;
+
+	mlt_service_unlock( MLT_FILTER_SERVICE( filter ) );
+}
+
+static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	mlt_filter filter = mlt_frame_pop_audio( frame );
+
+	// Measure floating point samples, keeping interleaved if that was asked for
+	if ( *format != mlt_audio_f32le )
+		*format = mlt_audio_float;
+	int error = mlt_frame_get_audio( frame, buffer, format, frequency, channels, samples );
+	if ( error || !*buffer || *channels <= 0 || *frequency <= 0 )
+		return error;
+	if ( *format != mlt_audio_float && *format != mlt_audio_f32le )
+	{
+		mlt_log_warning( MLT_FILTER_SERVICE( filter ), "unsupported audio format %s\n", mlt_audio_format_name( *format ) );
+		return error;
+	}
+
+	// One allocation holds the meter, its channels and the sums of squares
+	audio_meter *meter = calloc( 1, sizeof( audio_meter ) + *channels * ( sizeof( audio_meter_channel ) + 2 * sizeof( float ) ) );
+	if ( !meter )
+		return error;
+	float *sums = (float*) ( (audio_meter_channel*) ( meter + 1 ) + *channels );
+	float *peaks = sums + *channels;
+	int c;
+
+	meter->position = mlt_frame_get_position( frame );
+	meter->frequency = *frequency;
+	meter->samples = *samples;
+	meter->channels = *channels;
+	meter->channel = (audio_meter_channel*) ( meter + 1 );
+
+	if ( *format == mlt_audio_f32le )
+	{
+		measure_interleaved( (float*) *buffer, *channels, *samples, sums, peaks );
+	}
+	else
+	{
+		for ( c = 0; c < *channels; c++ )
+			measure_planar( (float*) *buffer + c * *samples, *samples, &sums[c], &peaks[c] );
+	}
+	for ( c = 0; c < *channels; c++ )
+		meter->channel[c].peak = peaks[c];
+
+	update_state( filter, meter, sums );
+	mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), AUDIO_METER_PROPERTY, meter, 0, free, NULL );
+
+	return error;
+}
+
+/** Filter processing.
+*/
+
+static mlt_frame filter_process( mlt_filter filter, mlt_frame frame )
+{
+	mlt_frame_push_audio( frame, filter );
+	mlt_frame_push_audio( frame, filter_get_audio );
+	return frame;
+}
+
+static void filter_close( mlt_filter filter )
+{
+	private_data *pdata = (private_data*) filter->child;
+
+	if ( pdata )
+	{
+		free( pdata->mean_square );
+		free( pdata );
+	}
+	filter->child = NULL;
+	filter->close = NULL;
+	filter->parent.close = NULL;
+	mlt_service_close( &filter->parent );
+}
+
+/** Constructor for the filter.
+*/
+
+mlt_filter filter_audiometer_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg )
+{
+	mlt_filter filter = mlt_filter_new();
+	private_data *pdata = (private_data*) calloc( 1, sizeof( private_data ) );
+
+	if ( filter && pdata )
+	{
+		mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+		mlt_properties_set_double( properties, "rms_window", 300.0 );
+		mlt_properties_set_double( properties, "peak_hold", 1500.0 );
+		mlt_properties_set_double( properties, "peak_fall", 20.0 );
+		pdata->last_position = -2;
+		filter->child = pdata;
+		filter->close = filter_close;
+		filter->process = filter_process;
+	}
+	else
+	{
+		if ( filter )
+			mlt_filter_close( filter );
+		free( pdata );
+		filter = NULL;
+	}
+	return filter;
+}
@@ -7,6 +7,7 @@
 #include <math.h> /* You may have to define _USE_MATH_DEFINES if you use MSVC */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* This can be replaced by any BSD-like queue implementation. */
 #include "queue.h"
@@ -15,6 +16,13 @@
   #include <speex/speex_resampler.h>
 #endif
 
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+/* Taps per phase of the true peak interpolation filter. */
+#define TRUE_PEAK_TAPS 12
+
 #define CHECK_ERROR(condition, errorcode, goto_point)                          \
   if ((condition)) {                                                           \
     errcode = (errorcode);                                                     \
@@ -46,8 +54,23 @@ struct ebur128_state_internal {
   double b[5];
   /** BS.1770 filter coefficients (denominator). */
   double a[5];
-  /** BS.1770 filter state. */
-  double v[5][5];
+  /** BS.1770 filter state, v[k * channels + j] for the j-th measured channel,
+   *  so that the state of consecutive channels is contiguous. */
+  double* v;
+  /** Indices of the channels that are not EBUR128_UNUSED. */
+  size_t* active;
+  /** Number of entries in active. */
+  size_t active_count;
+  /** Per channel weighting of the measured channels. */
+  double* active_weight;
+  /** Per channel scratch space. */
+  double* channel_sums;
+  /** Input converted to double, up to 400ms. */
+  double* input_buffer;
+  /** Weighted energy of every 100ms segment of audio_data. */
+  double* segment_energy;
+  /** Frame index in audio_data up to which segments have been summed. */
+  size_t segment_index;
   /** Linked list of block energies. */
   struct ebur128_double_queue block_list;
   /** Linked list of 3s-block energies, used to calculate LRA. */
@@ -65,6 +88,13 @@ struct ebur128_state_internal {
   SpeexResamplerState* resampler;
 #endif
   size_t oversample_factor;
+  /** Polyphase interpolation filter used without the Speex resampler,
+   *  TRUE_PEAK_TAPS coefficients per phase. */
+  double* interp_coeff;
+  /** Last TRUE_PEAK_TAPS - 1 input frames of each channel. */
+  double* interp_history;
+  /** One channel of history and input for the interpolator. */
+  double* interp_buffer;
   float* resampler_buffer_input;
   size_t resampler_buffer_input_frames;
   float* resampler_buffer_output;
@@ -127,16 +157,53 @@ static void ebur128_init_filter(ebur128_state* st) {
   st->d->a[4] = pa[2] * ra[2];
 
   for (i = 0; i < 5; ++i) {
-    for (j = 0; j < 5; ++j) {
-      st->d->v[i][j] = 0.0;
+    for (j = 0; j < (int) st->channels; ++j) {
+      st->d->v[i * st->channels + j] = 0.0;
     }
   }
 }
 
+static void ebur128_update_active(ebur128_state* st) {
+  size_t c, j = 0;
+  for (c = 0; c < st->channels; ++c) {
+    if (st->d->channel_map[c] == EBUR128_UNUSED) continue;
+    st->d->active[j] = c;
+    if (st->d->channel_map[c] == EBUR128_LEFT_SURROUND ||
+        st->d->channel_map[c] == EBUR128_RIGHT_SURROUND) {
+      st->d->active_weight[j] = 1.41;
+    } else if (st->d->channel_map[c] == EBUR128_DUAL_MONO) {
+      st->d->active_weight[j] = 2.0;
+    } else {
+      st->d->active_weight[j] = 1.0;
+    }
+    ++j;
+  }
+  st->d->active_count = j;
+  for (c = 0; c < 5 * st->channels; ++c) {
+    st->d->v[c] = 0.0;
+  }
+}
+
+static void ebur128_destroy_channel_map(ebur128_state* st) {
+  free(st->d->channel_map);    st->d->channel_map = NULL;
+  free(st->d->v);              st->d->v = NULL;
+  free(st->d->active);         st->d->active = NULL;
+  free(st->d->active_weight);  st->d->active_weight = NULL;
+  free(st->d->channel_sums);   st->d->channel_sums = NULL;
+}
+
 static int ebur128_init_channel_map(ebur128_state* st) {
   size_t i;
   st->d->channel_map = (int*) malloc(st->channels * sizeof(int));
-  if (!st->d->channel_map) return EBUR128_ERROR_NOMEM;
+  st->d->v = (double*) malloc(5 * st->channels * sizeof(double));
+  st->d->active = (size_t*) malloc(st->channels * sizeof(size_t));
+  st->d->active_weight = (double*) malloc(st->channels * sizeof(double));
+  st->d->channel_sums = (double*) malloc(st->channels * sizeof(double));
+  if (!st->d->channel_map || !st->d->v || !st->d->active ||
+      !st->d->active_weight || !st->d->channel_sums) {
+    ebur128_destroy_channel_map(st);
+    return EBUR128_ERROR_NOMEM;
+  }
   if (st->channels == 4) {
     st->d->channel_map[0] = EBUR128_LEFT;
     st->d->channel_map[1] = EBUR128_RIGHT;
@@ -161,9 +228,121 @@ static int ebur128_init_channel_map(ebur128_state* st) {
       }
     }
   }
+  ebur128_update_active(st);
   return EBUR128_SUCCESS;
 }
 
+/* The interpolator of ITU-R BS.1770-3 Annex 2: a windowed sinc low-pass
+ * filter split into one phase per output sample. The coefficients of each
+ * phase are stored in reverse so that they line up with ascending input. */
+static int ebur128_init_interpolator(ebur128_state* st) {
+  size_t factor, taps, p, k;
+
+  free(st->d->interp_coeff);    st->d->interp_coeff = NULL;
+  free(st->d->interp_history);  st->d->interp_history = NULL;
+  free(st->d->interp_buffer);   st->d->interp_buffer = NULL;
+  if ((st->mode & EBUR128_MODE_TRUE_PEAK) != EBUR128_MODE_TRUE_PEAK) {
+    return EBUR128_SUCCESS;
+  }
+
+  if (st->samplerate < 96000) {
+    factor = 4;
+  } else if (st->samplerate < 192000) {
+    factor = 2;
+  } else {
+    factor = 1;
+  }
+  st->d->oversample_factor = factor;
+  taps = factor * TRUE_PEAK_TAPS;
+
+  st->d->interp_coeff = (double*) calloc(taps, sizeof(double));
+  st->d->interp_history = (double*) calloc((TRUE_PEAK_TAPS - 1) * st->channels,
+                                           sizeof(double));
+  st->d->interp_buffer = (double*) calloc(TRUE_PEAK_TAPS - 1 +
+                                          st->d->samples_in_100ms * 4,
+                                          sizeof(double));
+  if (!st->d->interp_coeff || !st->d->interp_history ||
+      !st->d->interp_buffer) {
+    free(st->d->interp_coeff);    st->d->interp_coeff = NULL;
+    free(st->d->interp_history);  st->d->interp_history = NULL;
+    free(st->d->interp_buffer);   st->d->interp_buffer = NULL;
+    return EBUR128_ERROR_NOMEM;
+  }
+  for (p = 0; p < factor; ++p) {
+    for (k = 0; k < TRUE_PEAK_TAPS; ++k) {
+      double m = (double) (k * factor + p) - (double) (taps - 1) / 2.0;
+      double x = M_PI * m / (double) factor;
+      double window = 0.5 * (1.0 - cos(2.0 * M_PI * (double) (k * factor + p)
+                                       / (double) (taps - 1)));
+      st->d->interp_coeff[p * TRUE_PEAK_TAPS + TRUE_PEAK_TAPS - 1 - k] =
+          (fabs(x) < 1.0e-9 ? 1.0 : sin(x) / x) * window;
+    }
+  }
+  return EBUR128_SUCCESS;
+}
+
+/* Largest absolute value of the phase outputs for the given number of
+ * frames of a single channel. buffer starts TRUE_PEAK_TAPS - 1 frames before
+ * the first new frame. */
+static double ebur128_interpolate_channel(const double* buffer,
+                                          const double* coeffs,
+                                          size_t factor, size_t frames,
+                                          double peak) {
+  size_t i = 0, p, k;
+#ifdef __SSE2__
+  const __m128d sign = _mm_set1_pd(-0.0);
+  __m128d max = _mm_set1_pd(peak);
+  for (; i + 1 < frames; i += 2) {
+    for (p = 0; p < factor; ++p) {
+      const double* coeff = coeffs + p * TRUE_PEAK_TAPS;
+      __m128d sum = _mm_setzero_pd();
+      for (k = 0; k < TRUE_PEAK_TAPS; ++k) {
+        sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(coeff[k]),
+                                         _mm_loadu_pd(buffer + i + k)));
+      }
+      max = _mm_max_pd(max, _mm_andnot_pd(sign, sum));
+    }
+  }
+  {
+    double pair[2];
+    _mm_storeu_pd(pair, max);
+    peak = pair[0] > pair[1] ? pair[0] : pair[1];
+  }
+#endif
+  for (; i < frames; ++i) {
+    for (p = 0; p < factor; ++p) {
+      const double* coeff = coeffs + p * TRUE_PEAK_TAPS;
+      double sum = 0.0;
+      for (k = 0; k < TRUE_PEAK_TAPS; ++k) {
+        sum += coeff[k] * buffer[i + k];
+      }
+      sum = fabs(sum);
+      if (sum > peak) peak = sum;
+    }
+  }
+  return peak;
+}
+
+static void ebur128_interpolate_peaks(ebur128_state* st, const double* src,
+                                      size_t frames) {
+  const size_t channels = st->channels;
+  const size_t history = TRUE_PEAK_TAPS - 1;
+  double* buffer = st->d->interp_buffer;
+  size_t i, c;
+
+  for (c = 0; c < channels; ++c) {
+    double* last = st->d->interp_history + c * history;
+    memcpy(buffer, last, history * sizeof(double));
+    for (i = 0; i < frames; ++i) {
+      buffer[history + i] = src[i * channels + c];
+    }
+    st->d->true_peak[c] = ebur128_interpolate_channel(buffer,
+        st->d->interp_coeff, st->d->oversample_factor, frames,
+        st->d->true_peak[c]);
+    memcpy(last, buffer + frames, history * sizeof(double));
+  }
+}
+
 #ifdef USE_SPEEX_RESAMPLER
 static int ebur128_init_resampler(ebur128_state* st) {
   int errcode = EBUR128_SUCCESS;
@@ -239,7 +418,7 @@ ebur128_state* ebur128_init(unsigned int channels,
   st = (ebur128_state*) malloc(sizeof(ebur128_state));
   CHECK_ERROR(!st, 0, exit)
   st->d = (struct ebur128_state_internal*)
-          malloc(sizeof(struct ebur128_state_internal));
+          calloc(1, sizeof(struct ebur128_state_internal));
   CHECK_ERROR(!st->d, 0, free_state)
   st->channels = channels;
   errcode = ebur128_init_channel_map(st);
@@ -270,6 +449,14 @@ ebur128_state* ebur128_init(unsigned int channels,
                                        st->channels *
                                        sizeof(double));
   CHECK_ERROR(!st->d->audio_data, 0, free_true_peak)
+  st->d->input_buffer = (double*) malloc(st->d->samples_in_100ms * 4 *
+                                         st->channels *
+                                         sizeof(double));
+  CHECK_ERROR(!st->d->input_buffer, 0, free_audio_data)
+  st->d->segment_energy = (double*) calloc(st->d->audio_data_frames /
+                                           st->d->samples_in_100ms,
+                                           sizeof(double));
+  CHECK_ERROR(!st->d->segment_energy, 0, free_audio_data)
   ebur128_init_filter(st);
 
   if (st->d->use_histogram) {
@@ -297,12 +484,16 @@ ebur128_state* ebur128_init(unsigned int channels,
 #ifdef USE_SPEEX_RESAMPLER
   result = ebur128_init_resampler(st);
   CHECK_ERROR(result, 0, free_short_term_block_energy_histogram)
+#else
+  result = ebur128_init_interpolator(st);
+  CHECK_ERROR(result, 0, free_short_term_block_energy_histogram)
 #endif
 
   /* the first block needs 400ms of audio data */
   st->d->needed_frames = st->d->samples_in_100ms * 4;
   /* start at the beginning of the buffer */
   st->d->audio_data_index = 0;
+  st->d->segment_index = 0;
 
   /* initialize static constants */
   relative_gate_factor = pow(10.0, relative_gate / 10.0);
@@ -324,13 +515,15 @@ free_short_term_block_energy_histogram:
 free_block_energy_histogram:
   free(st->d->block_energy_histogram);
 free_audio_data:
+  free(st->d->segment_energy);
+  free(st->d->input_buffer);
   free(st->d->audio_data);
 free_true_peak:
   free(st->d->true_peak);
 free_sample_peak:
   free(st->d->sample_peak);
 free_channel_map:
-  free(st->d->channel_map);
+  ebur128_destroy_channel_map(st);
 free_internal:
   free(st->d);
 free_state:
@@ -344,9 +537,14 @@ void ebur128_destroy(ebur128_state** st) {
   free((*st)->d->block_energy_histogram);
   free((*st)->d->short_term_block_energy_histogram);
   free((*st)->d->audio_data);
-  free((*st)->d->channel_map);
+  free((*st)->d->input_buffer);
+  free((*st)->d->segment_energy);
+  ebur128_destroy_channel_map(*st);
   free((*st)->d->sample_peak);
   free((*st)->d->true_peak);
+  free((*st)->d->interp_coeff);
+  free((*st)->d->interp_history);
+  free((*st)->d->interp_buffer);
   while (!SLIST_EMPTY(&(*st)->d->block_list)) {
     entry = SLIST_FIRST(&(*st)->d->block_list);
     SLIST_REMOVE_HEAD(&(*st)->d->block_list, entries);
@@ -414,11 +612,109 @@ static void ebur128_check_true_peak(ebur128_state* st, size_t frames) {
 #define TURN_ON_FTZ
 #define TURN_OFF_FTZ
 #define FLUSH_MANUALLY \
-    st->d->v[ci][4] = fabs(st->d->v[ci][4]) < DBL_MIN ? 0.0 : st->d->v[ci][4]; \
-    st->d->v[ci][3] = fabs(st->d->v[ci][3]) < DBL_MIN ? 0.0 : st->d->v[ci][3]; \
-    st->d->v[ci][2] = fabs(st->d->v[ci][2]) < DBL_MIN ? 0.0 : st->d->v[ci][2]; \
-    st->d->v[ci][1] = fabs(st->d->v[ci][1]) < DBL_MIN ? 0.0 : st->d->v[ci][1];
+    for (j = 0; j < 4 * st->channels; ++j) { \
+      st->d->v[st->channels + j] = fabs(st->d->v[st->channels + j]) < DBL_MIN \
+                                 ? 0.0 : st->d->v[st->channels + j]; \
+    }
+#endif
+
+/* Apply the K-weighting filter to the measured channels of interleaved
+ * input. The channels are filtered side by side, two at a time with SSE2,
+ * so that the recursion of one channel does not stall the others. */
+static void ebur128_filter_active(ebur128_state* st, const double* src,
+                                  double* dest, size_t frames) {
+  const size_t channels = st->channels;
+  const size_t count = st->d->active_count;
+  const size_t* active = st->d->active;
+  const double* a = st->d->a;
+  const double* b = st->d->b;
+  double* v1 = st->d->v + channels;
+  double* v2 = st->d->v + channels * 2;
+  double* v3 = st->d->v + channels * 3;
+  double* v4 = st->d->v + channels * 4;
+  size_t i, j;
+
+  TURN_ON_FTZ
+
+  for (i = 0; i < frames; ++i) {
+    const double* x = src + i * channels;
+    double* y = dest + i * channels;
+    j = 0;
+#ifdef __SSE2__
+    {
+      const __m128d a1 = _mm_set1_pd(a[1]), a2 = _mm_set1_pd(a[2]),
+                    a3 = _mm_set1_pd(a[3]), a4 = _mm_set1_pd(a[4]);
+      const __m128d b0 = _mm_set1_pd(b[0]), b1 = _mm_set1_pd(b[1]),
+                    b2 = _mm_set1_pd(b[2]), b3 = _mm_set1_pd(b[3]),
+                    b4 = _mm_set1_pd(b[4]);
+      for (; j + 1 < count; j += 2) {
+        __m128d s1 = _mm_loadu_pd(v1 + j);
+        __m128d s2 = _mm_loadu_pd(v2 + j);
+        __m128d s3 = _mm_loadu_pd(v3 + j);
+        __m128d s4 = _mm_loadu_pd(v4 + j);
+        __m128d s0 = _mm_set_pd(x[active[j + 1]], x[active[j]]);
+        __m128d out;
+        s0 = _mm_sub_pd(s0, _mm_mul_pd(a1, s1));
+        s0 = _mm_sub_pd(s0, _mm_mul_pd(a2, s2));
+        s0 = _mm_sub_pd(s0, _mm_mul_pd(a3, s3));
+        s0 = _mm_sub_pd(s0, _mm_mul_pd(a4, s4));
+        out = _mm_mul_pd(b0, s0);
+        out = _mm_add_pd(out, _mm_mul_pd(b1, s1));
+        out = _mm_add_pd(out, _mm_mul_pd(b2, s2));
+        out = _mm_add_pd(out, _mm_mul_pd(b3, s3));
+        out = _mm_add_pd(out, _mm_mul_pd(b4, s4));
+        _mm_storel_pd(y + active[j], out);
+        _mm_storeh_pd(y + active[j + 1], out);
+        _mm_storeu_pd(v4 + j, s3);
+        _mm_storeu_pd(v3 + j, s2);
+        _mm_storeu_pd(v2 + j, s1);
+        _mm_storeu_pd(v1 + j, s0);
+      }
+    }
+#endif
+    for (; j < count; ++j) {
+      double s0 = x[active[j]] - a[1] * v1[j] - a[2] * v2[j]
+                               - a[3] * v3[j] - a[4] * v4[j];
+      y[active[j]] = b[0] * s0 + b[1] * v1[j] + b[2] * v2[j]
+                               + b[3] * v3[j] + b[4] * v4[j];
+      v4[j] = v3[j];
+      v3[j] = v2[j];
+      v2[j] = v1[j];
+      v1[j] = s0;
+    }
+  }
+  FLUSH_MANUALLY
+  TURN_OFF_FTZ
+}
+
+/* Measure the peaks of interleaved input. */
+static void ebur128_filter_peaks(ebur128_state* st, const double* src,
+                                 size_t frames) {
+  const size_t channels = st->channels;
+  size_t i, c;
+  if ((st->mode & EBUR128_MODE_SAMPLE_PEAK) == EBUR128_MODE_SAMPLE_PEAK) {
+    double* max = st->d->channel_sums;
+    for (c = 0; c < channels; ++c) {
+      max[c] = st->d->sample_peak[c];
+    }
+    for (i = 0; i < frames; ++i) {
+      const double* x = src + i * channels;
+      for (c = 0; c < channels; ++c) {
+        double value = fabs(x[c]);
+        max[c] = value > max[c] ? value : max[c];
+      }
+    }
+    for (c = 0; c < channels; ++c) {
+      st->d->sample_peak[c] = max[c];
+    }
+  }
+#ifndef USE_SPEEX_RESAMPLER
+  if ((st->mode & EBUR128_MODE_TRUE_PEAK) == EBUR128_MODE_TRUE_PEAK &&
+      st->d->interp_coeff) {
+    ebur128_interpolate_peaks(st, src, frames);
+  }
 #endif
+}
 
 #define EBUR128_FILTER(type, min_scale, max_scale)                             \
 static void ebur128_filter_##type(ebur128_state* st, const type* src,          \
@@ -426,24 +722,13 @@ static void ebur128_filter_##type(ebur128_state* st, const type* src,          \
   static double scaling_factor = -((double) min_scale) > (double) max_scale ?  \
                                  -((double) min_scale) : (double) max_scale;   \
   double* audio_data = st->d->audio_data + st->d->audio_data_index;            \
+  double* input = st->d->input_buffer;                                         \
   size_t i, c;                                                                 \
                                                                                \
-  TURN_ON_FTZ                                                                  \
-                                                                               \
-  if ((st->mode & EBUR128_MODE_SAMPLE_PEAK) == EBUR128_MODE_SAMPLE_PEAK) {     \
-    for (c = 0; c < st->channels; ++c) {                                       \
-      double max = 0.0;                                                        \
-      for (i = 0; i < frames; ++i) {                                           \
-        if (src[i * st->channels + c] > max) {                                 \
-          max =        src[i * st->channels + c];                              \
-        } else if (-src[i * st->channels + c] > max) {                         \
-          max = -1.0 * src[i * st->channels + c];                              \
-        }                                                                      \
-      }                                                                        \
-      max /= scaling_factor;                                                   \
-      if (max > st->d->sample_peak[c]) st->d->sample_peak[c] = max;            \
-    }                                                                          \
+  for (i = 0; i < frames * st->channels; ++i) {                                \
+    input[i] = (double) src[i] / scaling_factor;                               \
   }                                                                            \
+  ebur128_filter_peaks(st, input, frames);                                     \
   if (ebur128_use_speex_resampler(st)) {                                       \
     for (c = 0; c < st->channels; ++c) {                                       \
       for (i = 0; i < frames; ++i) {                                           \
@@ -453,30 +738,7 @@ static void ebur128_filter_##type(ebur128_state* st, const type* src,          \
     }                                                                          \
     ebur128_check_true_peak(st, frames);                                       \
   }                                                                            \
-  for (c = 0; c < st->channels; ++c) {                                         \
-    int ci = st->d->channel_map[c] - 1;                                        \
-    if (ci < 0) continue;                                                      \
-    else if (ci > 4) ci = 0; /* dual mono */                                   \
-    for (i = 0; i < frames; ++i) {                                             \
-      st->d->v[ci][0] = (double) (src[i * st->channels + c] / scaling_factor)  \
-                   - st->d->a[1] * st->d->v[ci][1]                             \
-                   - st->d->a[2] * st->d->v[ci][2]                             \
-                   - st->d->a[3] * st->d->v[ci][3]                             \
-                   - st->d->a[4] * st->d->v[ci][4];                            \
-      audio_data[i * st->channels + c] =                                       \
-                     st->d->b[0] * st->d->v[ci][0]                             \
-                   + st->d->b[1] * st->d->v[ci][1]                             \
-                   + st->d->b[2] * st->d->v[ci][2]                             \
-                   + st->d->b[3] * st->d->v[ci][3]                             \
-                   + st->d->b[4] * st->d->v[ci][4];                            \
-      st->d->v[ci][4] = st->d->v[ci][3];                                       \
-      st->d->v[ci][3] = st->d->v[ci][2];                                       \
-      st->d->v[ci][2] = st->d->v[ci][1];                                       \
-      st->d->v[ci][1] = st->d->v[ci][0];                                       \
-    }                                                                          \
-    FLUSH_MANUALLY                                                             \
-  }                                                                            \
-  TURN_OFF_FTZ                                                                 \
+  ebur128_filter_active(st, input, audio_data, frames);                        \
 }
 EBUR128_FILTER(short, SHRT_MIN, SHRT_MAX)
 EBUR128_FILTER(int, INT_MIN, INT_MAX)
@@ -504,47 +766,88 @@ static size_t find_histogram_index(double energy) {
   return index_min;
 }
 
+static int ebur128_store_block(ebur128_state* st, double sum);
+
+static void ebur128_sum_squares(ebur128_state* st, size_t from, size_t to,
+                                double* sums) {
+  const size_t channels = st->channels;
+  const size_t count = st->d->active_count;
+  const size_t* active = st->d->active;
+  size_t i, j;
+  for (i = from; i < to; ++i) {
+    const double* y = st->d->audio_data + i * channels;
+    for (j = 0; j < count; ++j) {
+      sums[j] += y[active[j]] * y[active[j]];
+    }
+  }
+}
+
 static int ebur128_calc_gating_block(ebur128_state* st, size_t frames_per_block,
                                      double* optional_output) {
-  size_t i, c;
+  size_t j;
+  size_t current = st->d->audio_data_index / st->channels;
+  double* sums = st->d->channel_sums;
   double sum = 0.0;
-  double channel_sum;
-  for (c = 0; c < st->channels; ++c) {
-    if (st->d->channel_map[c] == EBUR128_UNUSED) continue;
-    channel_sum = 0.0;
-    if (st->d->audio_data_index < frames_per_block * st->channels) {
-      for (i = 0; i < st->d->audio_data_index / st->channels; ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
-      }
-      for (i = st->d->audio_data_frames -
-              (frames_per_block -
-               st->d->audio_data_index / st->channels);
-           i < st->d->audio_data_frames; ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
-      }
-    } else {
-      for (i = st->d->audio_data_index / st->channels - frames_per_block;
-           i < st->d->audio_data_index / st->channels;
-           ++i) {
-        channel_sum += st->d->audio_data[i * st->channels + c] *
-                       st->d->audio_data[i * st->channels + c];
-      }
-    }
-    if (st->d->channel_map[c] == EBUR128_LEFT_SURROUND ||
-        st->d->channel_map[c] == EBUR128_RIGHT_SURROUND) {
-      channel_sum *= 1.41;
-    } else if (st->d->channel_map[c] == EBUR128_DUAL_MONO) {
-      channel_sum *= 2.0;
-    }
-    sum += channel_sum;
+  for (j = 0; j < st->d->active_count; ++j) {
+    sums[j] = 0.0;
+  }
+  if (current < frames_per_block) {
+    ebur128_sum_squares(st, 0, current, sums);
+    ebur128_sum_squares(st, st->d->audio_data_frames -
+                            (frames_per_block - current),
+                        st->d->audio_data_frames, sums);
+  } else {
+    ebur128_sum_squares(st, current - frames_per_block, current, sums);
+  }
+  for (j = 0; j < st->d->active_count; ++j) {
+    sum += sums[j] * st->d->active_weight[j];
   }
   sum /= (double) frames_per_block;
   if (optional_output) {
     *optional_output = sum;
     return EBUR128_SUCCESS;
-  } else if (sum >= histogram_energy_boundaries[0]) {
+  }
+  return ebur128_store_block(st, sum);
+}
+
+/* Compute the weighted energy of the 100ms segments filtered since the last
+ * call, up to the current position which must be on a segment boundary. */
+static void ebur128_calc_segments(ebur128_state* st) {
+  size_t samples_in_100ms = st->d->samples_in_100ms;
+  size_t end = st->d->audio_data_index / st->channels;
+  size_t from;
+  for (from = st->d->segment_index; from < end; from += samples_in_100ms) {
+    double* sums = st->d->channel_sums;
+    double sum = 0.0;
+    size_t j;
+    for (j = 0; j < st->d->active_count; ++j) {
+      sums[j] = 0.0;
+    }
+    ebur128_sum_squares(st, from, from + samples_in_100ms, sums);
+    for (j = 0; j < st->d->active_count; ++j) {
+      sum += sums[j] * st->d->active_weight[j];
+    }
+    st->d->segment_energy[from / samples_in_100ms] = sum;
+  }
+  st->d->segment_index = end % st->d->audio_data_frames;
+}
+
+/* Mean energy of the given number of 100ms segments ending at the current
+ * position, which must be on a segment boundary. */
+static double ebur128_segments_energy(ebur128_state* st, size_t segments) {
+  size_t count = st->d->audio_data_frames / st->d->samples_in_100ms;
+  size_t last = st->d->audio_data_index / st->channels /
+                st->d->samples_in_100ms;
+  double sum = 0.0;
+  size_t i;
+  for (i = 1; i <= segments; ++i) {
+    sum += st->d->segment_energy[(last + count - i) % count];
+  }
+  return sum / (double) (segments * st->d->samples_in_100ms);
+}
+
+static int ebur128_store_block(ebur128_state* st, double sum) {
+  if (sum >= histogram_energy_boundaries[0]) {
     if (st->d->use_histogram) {
       ++st->d->block_energy_histogram[find_histogram_index(sum)];
     } else {
@@ -572,6 +875,7 @@ int ebur128_set_channel(ebur128_state* st,
     return 1;
   }
   st->d->channel_map[channel_number] = value;
+  ebur128_update_active(st);
   return 0;
 }
 
@@ -585,11 +889,15 @@ int ebur128_change_parameters(ebur128_state* st,
   }
   free(st->d->audio_data);
   st->d->audio_data = NULL;
+  free(st->d->input_buffer);
+  st->d->input_buffer = NULL;
+  free(st->d->segment_energy);
+  st->d->segment_energy = NULL;
 
   if (channels != st->channels) {
     unsigned int i;
 
-    free(st->d->channel_map); st->d->channel_map = NULL;
+    ebur128_destroy_channel_map(st);
     free(st->d->sample_peak); st->d->sample_peak = NULL;
     free(st->d->true_peak);   st->d->true_peak = NULL;
     st->channels = channels;
@@ -613,8 +921,13 @@ int ebur128_change_parameters(ebur128_state* st,
   }
   if (samplerate != st->samplerate) {
     st->samplerate = samplerate;
-    ebur128_init_filter(st);
+    st->d->samples_in_100ms = (st->samplerate + 5) / 10;
   }
+  ebur128_init_filter(st);
+#ifndef USE_SPEEX_RESAMPLER
+  errcode = ebur128_init_interpolator(st);
+  CHECK_ERROR(errcode, EBUR128_ERROR_NOMEM, exit)
+#endif
   if ((st->mode & EBUR128_MODE_S) == EBUR128_MODE_S) {
     st->d->audio_data_frames = st->d->samples_in_100ms * 30;
   } else if ((st->mode & EBUR128_MODE_M) == EBUR128_MODE_M) {
@@ -626,11 +939,20 @@ int ebur128_change_parameters(ebur128_state* st,
                                        st->channels *
                                        sizeof(double));
   CHECK_ERROR(!st->d->audio_data, EBUR128_ERROR_NOMEM, exit)
+  st->d->input_buffer = (double*) malloc(st->d->samples_in_100ms * 4 *
+                                         st->channels *
+                                         sizeof(double));
+  CHECK_ERROR(!st->d->input_buffer, EBUR128_ERROR_NOMEM, exit)
+  st->d->segment_energy = (double*) calloc(st->d->audio_data_frames /
+                                           st->d->samples_in_100ms,
+                                           sizeof(double));
+  CHECK_ERROR(!st->d->segment_energy, EBUR128_ERROR_NOMEM, exit)
 
   /* the first block needs 400ms of audio data */
   st->d->needed_frames = st->d->samples_in_100ms * 4;
   /* start at the beginning of the buffer */
   st->d->audio_data_index = 0;
+  st->d->segment_index = 0;
   /* reset short term frame counter */
   st->d->short_term_frame_counter = 0;
 
@@ -652,9 +974,10 @@ int ebur128_add_frames_##type(ebur128_state* st,                               \
       src_index += st->d->needed_frames * st->channels;                        \
       frames -= st->d->needed_frames;                                          \
       st->d->audio_data_index += st->d->needed_frames * st->channels;          \
+      ebur128_calc_segments(st);                                               \
       /* calculate the new gating block */                                     \
       if ((st->mode & EBUR128_MODE_I) == EBUR128_MODE_I) {                     \
-        if (ebur128_calc_gating_block(st, st->d->samples_in_100ms * 4, NULL)) {\
+        if (ebur128_store_block(st, ebur128_segments_energy(st, 4))) {         \
           return EBUR128_ERROR_NOMEM;                                          \
         }                                                                      \
       }                                                                        \
@@ -662,8 +985,7 @@ int ebur128_add_frames_##type(ebur128_state* st,                               \
         st->d->short_term_frame_counter += st->d->needed_frames;               \
         if (st->d->short_term_frame_counter == st->d->samples_in_100ms * 30) { \
           struct ebur128_dq_entry* block;                                      \
-          double st_energy;                                                    \
-          ebur128_energy_shortterm(st, &st_energy);                            \
+          double st_energy = ebur128_segments_energy(st, 30);                  \
           if (st_energy >= histogram_energy_boundaries[0]) {                   \
             if (st->d->use_histogram) {                                        \
               ++st->d->short_term_block_energy_histogram[                      \
@@ -702,6 +1024,27 @@ EBUR128_ADD_FRAMES(int)
 EBUR128_ADD_FRAMES(float)
 EBUR128_ADD_FRAMES(double)
 
+void ebur128_clear_blocks(ebur128_state* st) {
+  struct ebur128_dq_entry* entry;
+  size_t i;
+  if (st->d->use_histogram) {
+    for (i = 0; i < 1000; ++i) {
+      st->d->block_energy_histogram[i] = 0;
+      st->d->short_term_block_energy_histogram[i] = 0;
+    }
+  }
+  while (!SLIST_EMPTY(&st->d->block_list)) {
+    entry = SLIST_FIRST(&st->d->block_list);
+    SLIST_REMOVE_HEAD(&st->d->block_list, entries);
+    free(entry);
+  }
+  while (!SLIST_EMPTY(&st->d->short_term_block_list)) {
+    entry = SLIST_FIRST(&st->d->short_term_block_list);
+    SLIST_REMOVE_HEAD(&st->d->short_term_block_list, entries);
+    free(entry);
+  }
+}
+
 static int ebur128_gated_loudness(ebur128_state** sts, size_t size,
                                   double* out) {
   struct ebur128_dq_entry* it;
@@ -980,7 +1323,6 @@ int ebur128_sample_peak(ebur128_state* st,
   return EBUR128_SUCCESS;
 }
 
-#ifdef USE_SPEEX_RESAMPLER
 int ebur128_true_peak(ebur128_state* st,
                       unsigned int channel_number,
                       double* out) {
@@ -994,4 +1336,3 @@ int ebur128_true_peak(ebur128_state* st,
        : st->d->sample_peak[channel_number];
   return EBUR128_SUCCESS;
 }
-#endif
@@ -167,6 +167,16 @@ int ebur128_add_frames_double(ebur128_state* st,
                              const double* src,
                              size_t frames);
 
+/** \brief Discard the gating blocks measured so far.
+ *
+ *  The filter state and the unfinished blocks are kept, so measurement
+ *  continues seamlessly. This allows a state to be primed with the audio
+ *  preceding the range of interest.
+ *
+ *  @param st library state.
+ */
+void ebur128_clear_blocks(ebur128_state* st);
+
 /** \brief Get global integrated loudness in LUFS.
  *
  *  @param st library state.
@@ -264,9 +274,11 @@ int ebur128_sample_peak(ebur128_state* st,
  *  try to compare resulting values across different versions of the library,
  *  as the algorithm may change.
  *
- *  The current implementation uses the Speex resampler with quality level 8 to
- *  calculate true peak. Will oversample 4x for sample rates < 96000 Hz, 2x for
- *  sample rates < 192000 Hz and leave the signal unchanged for 192000 Hz.
+ *  When built with USE_SPEEX_RESAMPLER, the Speex resampler with quality level
+ *  8 is used to calculate true peak. Otherwise a polyphase windowed sinc
+ *  interpolator with 12 taps per phase, as described in ITU-R BS.1770 Annex 2,
+ *  is used. Both oversample 4x for sample rates < 96000 Hz, 2x for sample
+ *  rates < 192000 Hz and leave the signal unchanged for 192000 Hz.
  *
  *  @param st library state
  *  @param channel_number channel to analyse
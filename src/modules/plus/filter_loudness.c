@@ -22,9 +22,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "ebur128/ebur128.h"
 
 #define MAX_RESULT_SIZE 512
+#define PREROLL_SECONDS 3
 
 typedef struct
 {
@@ -43,6 +45,7 @@ typedef struct
 	analyze_data* analyze;
 	apply_data* apply;
 	mlt_position last_position;
+	int offline_failed;
 } private_data;
 
 static void destroy_analyze_data( mlt_filter filter )
@@ -57,7 +60,7 @@ static void init_analyze_data( mlt_filter filter, int channels, int samplerate )
 {
 	private_data* private = (private_data*)filter->child;
 	private->analyze = (analyze_data*)calloc( 1, sizeof(analyze_data) );
-	private->analyze->state = ebur128_init( (unsigned int)channels, (unsigned long)samplerate, EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_SAMPLE_PEAK );
+	private->analyze->state = ebur128_init( (unsigned int)channels, (unsigned long)samplerate, EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_SAMPLE_PEAK | EBUR128_MODE_TRUE_PEAK );
 	private->last_position = 0;
 }
 
@@ -119,6 +122,7 @@ static void analyze( mlt_filter filter, mlt_frame frame, void **buffer, mlt_audi
 			double range = 0.0;
 			double tmpPeak = 0.0;
 			double peak = 0.0;
+			double true_peak = 0.0;
 			int i = 0;
 			char result[MAX_RESULT_SIZE];
 			ebur128_loudness_global( private->analyze->state, &loudness );
@@ -131,9 +135,14 @@ static void analyze( mlt_filter filter, mlt_frame frame, void **buffer, mlt_audi
 				{
 					peak = tmpPeak;
 				}
+				ebur128_true_peak( private->analyze->state, i, &tmpPeak );
+				if( tmpPeak > true_peak )
+				{
+					true_peak = tmpPeak;
+				}
 			}
 
-			snprintf( result, MAX_RESULT_SIZE, "L: %lf\tR: %lf\tP %lf", loudness, range, peak );
+			snprintf( result, MAX_RESULT_SIZE, "L: %lf\tR: %lf\tP %lf\tTP %lf", loudness, range, peak, true_peak );
 			result[ MAX_RESULT_SIZE - 1 ] = '\0';
 			mlt_log_info( MLT_FILTER_SERVICE( filter ), "Stored results: %s", result );
 			mlt_properties_set( properties, "results", result );
@@ -144,6 +153,226 @@ static void analyze( mlt_filter filter, mlt_frame frame, void **buffer, mlt_audi
 	}
 }
 
+/** One contiguous part of the offline analysis.
+ *
+ * Chunks start on whole seconds so that the gating blocks of every chunk
+ * fall on the same 100ms grid as a single pass over the whole range would.
+ * The preceding PREROLL_SECONDS are fed first to settle the K-weighting filter
+ * and to complete the first short-term block, and their blocks are discarded.
+*/
+
+typedef struct
+{
+	mlt_producer producer;
+	ebur128_state* state;
+	mlt_position origin;   // producer position of sample 0
+	int64_t preroll;       // first sample fed
+	int64_t start;         // first sample measured
+	int64_t end;           // sample after the last one measured
+	double fps;
+	int frequency;
+	int channels;
+	int error;
+	int started;           // running on its own thread
+} analyze_chunk;
+
+static int64_t sample_offset( analyze_chunk* chunk, mlt_position position )
+{
+	return mlt_sample_calculator_to_now( chunk->fps, chunk->frequency, position )
+		- mlt_sample_calculator_to_now( chunk->fps, chunk->frequency, chunk->origin );
+}
+
+static void* analyze_chunk_thread( void* arg )
+{
+	analyze_chunk* chunk = (analyze_chunk*)arg;
+	mlt_position position = chunk->origin + (mlt_position)( chunk->preroll * chunk->fps / chunk->frequency );
+	int cleared = chunk->preroll == chunk->start;
+
+	// Find the frame that contains the first sample
+	while ( position > chunk->origin && sample_offset( chunk, position ) > chunk->preroll )
+		position--;
+	while ( sample_offset( chunk, position + 1 ) <= chunk->preroll )
+		position++;
+
+	while ( !chunk->error && sample_offset( chunk, position ) < chunk->end )
+	{
+		mlt_frame frame = NULL;
+		mlt_audio_format format = mlt_audio_f32le;
+		int frequency = chunk->frequency;
+		int channels = chunk->channels;
+		int samples = mlt_sample_calculator( chunk->fps, frequency, position );
+		float* buffer = NULL;
+		int64_t first = sample_offset( chunk, position );
+
+		mlt_producer_seek( chunk->producer, position );
+		if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( chunk->producer ), &frame, 0 ) || !frame )
+		{
+			chunk->error = 1;
+			break;
+		}
+		// Only the audio is requested, so the video is never decoded.
+		if ( mlt_frame_get_audio( frame, (void**) &buffer, &format, &frequency, &channels, &samples ) ||
+			 format != mlt_audio_f32le || frequency != chunk->frequency || channels != chunk->channels )
+		{
+			chunk->error = 1;
+		}
+		else
+		{
+			int64_t from = first > chunk->preroll ? first : chunk->preroll;
+			int64_t to = first + samples < chunk->end ? first + samples : chunk->end;
+
+			// Feed the preroll up to the start, then forget its blocks
+			if ( !cleared && from < chunk->start )
+			{
+				int64_t preroll_to = to < chunk->start ? to : chunk->start;
+				ebur128_add_frames_float( chunk->state, buffer + ( from - first ) * channels, preroll_to - from );
+				from = preroll_to;
+				if ( from == chunk->start )
+				{
+					ebur128_clear_blocks( chunk->state );
+					cleared = 1;
+				}
+			}
+			if ( from < to )
+				ebur128_add_frames_float( chunk->state, buffer + ( from - first ) * channels, to - from );
+		}
+		mlt_frame_close( frame );
+		position++;
+	}
+	return NULL;
+}
+
+/** Measure the whole range at once by pulling audio from copies of the producer in parallel.
+ *
+ * \return true if the results were stored
+*/
+
+static int analyze_offline( mlt_filter filter, mlt_frame frame, int frequency, int channels, int threads )
+{
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	mlt_profile profile = mlt_service_profile( MLT_FILTER_SERVICE( filter ) );
+	mlt_position length = mlt_filter_get_length2( filter, frame );
+	mlt_position origin = 0;
+	double fps = mlt_profile_fps( profile );
+	analyze_chunk* chunks = NULL;
+	pthread_t* thread_ids = NULL;
+	ebur128_state** states = NULL;
+	mlt_producer first = NULL;
+	int count = 0;
+	int result = 0;
+	int i;
+
+	if ( length <= 0 || frequency <= 0 || channels <= 0 )
+		return 0;
+
+	// Only a filter directly on a media file can be measured out of band
+	first = mlt_filter_open_source( filter, frame, 1, 0, &origin );
+	if ( !first )
+		return 0;
+
+	chunks = (analyze_chunk*)calloc( threads, sizeof(analyze_chunk) );
+	thread_ids = (pthread_t*)calloc( threads, sizeof(pthread_t) );
+	states = (ebur128_state**)calloc( threads, sizeof(ebur128_state*) );
+	if ( !chunks || !thread_ids || !states )
+		goto exit;
+
+	// Split the range into chunks on whole seconds
+	analyze_chunk range = { NULL, NULL, origin, 0, 0, 0, fps, frequency, channels, 0, 0 };
+	int64_t total = sample_offset( &range, origin + length );
+	int64_t seconds = ( total + frequency - 1 ) / frequency;
+	int64_t chunk_seconds = ( seconds + threads - 1 ) / threads;
+	if ( chunk_seconds < PREROLL_SECONDS * 4 )
+		chunk_seconds = PREROLL_SECONDS * 4;
+
+	for ( count = 0; count < threads; count++ )
+	{
+		analyze_chunk* chunk = &chunks[count];
+		if ( count * chunk_seconds * frequency >= total )
+			break;
+		*chunk = range;
+		chunk->start = count * chunk_seconds * frequency;
+		chunk->end = chunk->start + chunk_seconds * frequency;
+		if ( chunk->end > total )
+			chunk->end = total;
+		chunk->preroll = chunk->start > PREROLL_SECONDS * frequency ? chunk->start - PREROLL_SECONDS * frequency : 0;
+		chunk->producer = count ? mlt_filter_open_source( filter, frame, 1, 0, NULL ) : first;
+		first = NULL;
+		chunk->state = ebur128_init( (unsigned int)channels, (unsigned long)frequency,
+			EBUR128_MODE_I | EBUR128_MODE_LRA | EBUR128_MODE_SAMPLE_PEAK | EBUR128_MODE_TRUE_PEAK | EBUR128_MODE_HISTOGRAM );
+		if ( !chunk->producer || !chunk->state )
+		{
+			count++;
+			goto exit;
+		}
+		states[count] = chunk->state;
+	}
+
+	if ( count > 0 )
+	{
+		double loudness = 0.0;
+		double range_lu = 0.0;
+		double peak = 0.0;
+		double true_peak = 0.0;
+		char result_string[MAX_RESULT_SIZE];
+		int c;
+
+		// The first chunk runs on this thread
+		for ( i = 1; i < count; i++ )
+			chunks[i].started = !pthread_create( &thread_ids[i], NULL, analyze_chunk_thread, &chunks[i] );
+		for ( i = 0; i < count; i++ )
+			if ( !chunks[i].started )
+				analyze_chunk_thread( &chunks[i] );
+		for ( i = 1; i < count; i++ )
+			if ( chunks[i].started )
+				pthread_join( thread_ids[i], NULL );
+		for ( i = 0; i < count; i++ )
+			if ( chunks[i].error )
+			{
+				mlt_log_error( MLT_FILTER_SERVICE( filter ), "Analysis Failed: unable to read the source\n" );
+				goto exit;
+			}
+
+		// Merge the chunks
+		ebur128_loudness_global_multiple( states, count, &loudness );
+		ebur128_loudness_range_multiple( states, count, &range_lu );
+		for ( i = 0; i < count; i++ )
+		{
+			for ( c = 0; c < channels; c++ )
+			{
+				double tmpPeak = 0.0;
+				ebur128_sample_peak( states[i], c, &tmpPeak );
+				if ( tmpPeak > peak )
+					peak = tmpPeak;
+				ebur128_true_peak( states[i], c, &tmpPeak );
+				if ( tmpPeak > true_peak )
+					true_peak = tmpPeak;
+			}
+		}
+
+		snprintf( result_string, MAX_RESULT_SIZE, "L: %lf\tR: %lf\tP %lf\tTP %lf", loudness, range_lu, peak, true_peak );
+		result_string[ MAX_RESULT_SIZE - 1 ] = '\0';
+		mlt_log_info( MLT_FILTER_SERVICE( filter ), "Stored results: %s", result_string );
+		mlt_properties_set( properties, "results", result_string );
+		result = 1;
+	}
+
+exit:
+	if ( chunks )
+	{
+		for ( i = 0; i < count; i++ )
+		{
+			mlt_producer_close( chunks[i].producer );
+			if ( chunks[i].state )
+				ebur128_destroy( &chunks[i].state );
+		}
+	}
+	mlt_producer_close( first );
+	free( chunks );
+	free( thread_ids );
+	free( states );
+	return result;
+}
+
 static void apply( mlt_filter filter, mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
 {
 	private_data* private = (private_data*)filter->child;
@@ -185,6 +414,18 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	mlt_frame_get_audio( frame, buffer, format, frequency, channels, samples );
 
 	char* results = mlt_properties_get( properties, "results" );
+	int threads = mlt_properties_get_int( properties, "analysis_threads" );
+	private_data* private = (private_data*)filter->child;
+
+	// Measure the whole range before the first frame is returned
+	if( ( !results || !strcmp( results, "" ) ) && threads > 0 && !private->offline_failed )
+	{
+		if( analyze_offline( filter, frame, *frequency, *channels, threads ) )
+			results = mlt_properties_get( properties, "results" );
+		else
+			private->offline_failed = 1;
+	}
+
 	if( results && strcmp( results, "" ) )
 	{
 		apply( filter, frame, buffer, format, frequency, channels, samples );
@@ -48,13 +48,12 @@ static float alignment_parse( char* align )
 /** Calculate real geometry.
 */
 
-static void geometry_calculate( mlt_transition transition, const char *store, struct mlt_geometry_item_s *output, float position )
+static void geometry_calculate( mlt_transition transition, mlt_geometry_compiled geometry, struct mlt_geometry_item_s *output, float position )
 {
 	mlt_properties properties = MLT_TRANSITION_PROPERTIES( transition );
-	mlt_geometry geometry = mlt_properties_get_data( properties, store, NULL );
 	int mirror_off = mlt_properties_get_int( properties, "mirror_off" );
 	int repeat_off = mlt_properties_get_int( properties, "repeat_off" );
-	int length = mlt_geometry_get_length( geometry );
+	int length = mlt_geometry_compiled_get_length( geometry );
 
 	// Allow wrapping
 	if ( !repeat_off && position >= length && length != 0 )
@@ -66,18 +65,21 @@ static void geometry_calculate( mlt_transition transition, const char *store, st
 	}
 
 	// Fetch the key for the position
-	mlt_geometry_fetch( geometry, output, position );
+	mlt_geometry_compiled_fetch( geometry, output, position );
 }
 
+/** Get the compiled keys of a property.
 
-static mlt_geometry transition_parse_keys( mlt_transition transition, const char *name, const char *store, int normalised_width, int normalised_height )
+    The property keeps the compiled keys until its value, the length or the
+    normalisation changes. The caller must release the result with
+    mlt_geometry_compiled_close.
+*/
+
+static mlt_geometry_compiled transition_parse_keys( mlt_transition transition, const char *name, int normalised_width, int normalised_height )
 {
 	// Get the properties of the transition
 	mlt_properties properties = MLT_TRANSITION_PROPERTIES( transition );
 
-	// Try to fetch it first
-	mlt_geometry geometry = mlt_properties_get_data( properties, store, NULL );
-
 	// Determine length and obtain cycle
 	mlt_position length = mlt_transition_get_length( transition );
 	double cycle = mlt_properties_get_double( properties, "cycle" );
@@ -88,50 +90,30 @@ static mlt_geometry transition_parse_keys( mlt_transition transition, const char
 	else if ( cycle > 0 )
 		length *= cycle;
 
-	if ( geometry == NULL )
-	{
-		// Get the new style geometry string
-		char *property = mlt_properties_get( properties, name );
-
-		// Create an empty geometries object
-		geometry = mlt_geometry_init( );
-
-		// Parse the geometry if we have one
-		mlt_geometry_parse( geometry, property, length, normalised_width, normalised_height );
-
-		// Store it
-		mlt_properties_set_data( properties, store, geometry, 0, ( mlt_destructor )mlt_geometry_close, NULL );
-	}
-	else
-	{
-		// Check for updates and refresh if necessary
-		mlt_geometry_refresh( geometry, mlt_properties_get( properties, name ), length, normalised_width, normalised_height );
-	}
-
-	return geometry;
+	return mlt_properties_get_geometry( properties, name, length, normalised_width, normalised_height );
 }
 
-static mlt_geometry composite_calculate( mlt_transition transition, struct mlt_geometry_item_s *result, int nw, int nh, float position )
+static void composite_calculate( mlt_transition transition, struct mlt_geometry_item_s *result, int nw, int nh, float position )
 {
 	// Structures for geometry
-	mlt_geometry start = transition_parse_keys( transition, "geometry", "geometries", nw, nh );
+	mlt_geometry_compiled geometry = transition_parse_keys( transition, "geometry", nw, nh );
 
 	// Do the calculation
-	geometry_calculate( transition, "geometries", result, position );
-
-	return start;
+	geometry_calculate( transition, geometry, result, position );
+	mlt_geometry_compiled_close( geometry );
 }
 
-static inline float composite_calculate_key( mlt_transition transition, const char *name, const char *store, int norm, float position )
+static inline float composite_calculate_key( mlt_transition transition, const char *name, int norm, float position )
 {
 	// Struct for the result
 	struct mlt_geometry_item_s result;
 
 	// Structures for geometry
-	transition_parse_keys( transition, name, store, norm, 0 );
+	mlt_geometry_compiled geometry = transition_parse_keys( transition, name, norm, 0 );
 
 	// Do the calculation
-	geometry_calculate( transition, store, &result, position );
+	geometry_calculate( transition, geometry, &result, position );
+	mlt_geometry_compiled_close( geometry );
 
 	return result.x;
 }
@@ -351,14 +333,14 @@ static inline void get_affine( affine_t *affine, mlt_transition transition, floa
 	}
 	else
 	{
-		float rotate_x = composite_calculate_key( transition, "rotate_x", "rotate_x_info", 360, position );
-		float rotate_y = composite_calculate_key( transition, "rotate_y", "rotate_y_info", 360, position );
-		float rotate_z = composite_calculate_key( transition, "rotate_z", "rotate_z_info", 360, position );
-		float shear_x = composite_calculate_key( transition, "shear_x", "shear_x_info", 360, position );
-		float shear_y = composite_calculate_key( transition, "shear_y", "shear_y_info", 360, position );
-		float shear_z = composite_calculate_key( transition, "shear_z", "shear_z_info", 360, position );
-		float o_x = composite_calculate_key( transition, "ox", "ox_info", 0, position );
-		float o_y = composite_calculate_key( transition, "oy", "oy_info", 0, position );
+		float rotate_x = composite_calculate_key( transition, "rotate_x", 360, position );
+		float rotate_y = composite_calculate_key( transition, "rotate_y", 360, position );
+		float rotate_z = composite_calculate_key( transition, "rotate_z", 360, position );
+		float shear_x = composite_calculate_key( transition, "shear_x", 360, position );
+		float shear_y = composite_calculate_key( transition, "shear_y", 360, position );
+		float shear_z = composite_calculate_key( transition, "shear_z", 360, position );
+		float o_x = composite_calculate_key( transition, "ox", 0, position );
+		float o_y = composite_calculate_key( transition, "oy", 0, position );
 		
 		affine_rotate_x( affine->matrix, rotate_x );
 		affine_rotate_y( affine->matrix, rotate_y );
@@ -23,6 +23,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#ifdef USE_SSE2
+#include <emmintrin.h>
+#endif
 
 #define MAX_CYCLE 6
 #define BLKSIZE 24
@@ -81,6 +85,7 @@ struct context_s {
 	unsigned int *overrides, *overrides_p;
 	int film, override, inpattern, found;
 	int force;
+	int threads;
 
 	// Used by field matching.
 	unsigned char *fprp, *fcrp, *fcrp_saved, *fnrp;
@@ -389,31 +394,120 @@ static struct PREDICTION *PredictSoftYUY2(context cx, int frame )
 	return cx->pred;
 }
 
-static
-void CalculateMetrics(context cx, int frame, unsigned char *fcrp, unsigned char *fcrpU, unsigned char *fcrpV,
-					unsigned char *fprp, unsigned char *fprpU, unsigned char *fprpV)
+#define T 4
+
+#ifdef USE_SSE2
+/** Test eight 16 bit lanes of a row for combing.
+ *
+ * Adds the differences that exceed nt to diffs as 32 bit sums and returns
+ * the lanes that look like video rather than film.
+*/
+
+static inline __m128i MatchLanes(__m128i bot0, __m128i bot2, __m128i top0, __m128i top2, __m128i top4,
+					__m128i lanes, __m128i nt, __m128i *diffs)
 {
-	int x, y, p, c, tmp1, tmp2, skip;
-	int vc;
-    unsigned char *currbot0, *currbot2, *prevbot0, *prevbot2;
-	unsigned char *prevtop0, *prevtop2, *prevtop4, *currtop0, *currtop2, *currtop4;
-	unsigned char *a0, *a2, *b0, *b2, *b4;
-	unsigned int diff, index;
-#	define T 4
+	const __m128i t = _mm_set1_epi16(T);
+	__m128i tmp1 = _mm_add_epi16(bot0, bot2);
+	__m128i diff = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(top0, top2), top4),
+								 _mm_add_epi16(_mm_srli_epi16(tmp1, 1), tmp1));
+	diff = _mm_max_epi16(diff, _mm_sub_epi16(_mm_setzero_si128(), diff));
+	diff = _mm_and_si128(diff, _mm_and_si128(_mm_cmpgt_epi16(diff, nt), lanes));
+	*diffs = _mm_add_epi32(*diffs, _mm_madd_epi16(diff, _mm_set1_epi16(1)));
 
-	/* Clear the block sums. */
- 	for (y = 0; y < cx->yblocks; y++)
+	__m128i hi = _mm_add_epi16(bot0, t);
+	__m128i lo = _mm_sub_epi16(bot0, t);
+	__m128i vc = _mm_or_si128(_mm_and_si128(_mm_cmplt_epi16(hi, top0), _mm_cmplt_epi16(hi, top2)),
+							  _mm_and_si128(_mm_cmpgt_epi16(lo, top0), _mm_cmpgt_epi16(lo, top2)));
+	return _mm_and_si128(vc, lanes);
+}
+#endif
+
+/** Calculate the field match and film/video metrics of one row.
+ *
+ * Only the bytes whose offset modulo 8 is below 4 (with chroma) or is 0 or 2
+ * (luma only) are tested. Returns the sum of the differences above nt and
+ * counts the combed samples in the block sums of the row.
+*/
+
+static int MatchRow(context cx, const unsigned char *bot0, const unsigned char *bot2,
+					const unsigned char *top0, const unsigned char *top2, const unsigned char *top4,
+					unsigned int *sums)
+{
+	int x = 0, tmp1, tmp2, vc, skip;
+	int total = 0;
+	unsigned int diff;
+
+#ifdef USE_SSE2
+	// nt is compared unsigned, so a negative one never matches
+	const __m128i nt = _mm_set1_epi16(cx->nt < 0 || cx->nt > 0x7fff ? 0x7fff : cx->nt);
+	const __m128i lanes = cx->chroma ? _mm_setr_epi16(-1, -1, -1, -1, 0, 0, 0, 0)
+									 : _mm_setr_epi16(-1, 0, -1, 0, 0, 0, 0, 0);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i diffs = zero;
+	int32_t lane_sums[4];
+
+	// 16 bytes never straddle a block of BLKSIZE_TIMES2 bytes
+	for (; x + 16 <= cx->w; x += 16)
 	{
- 		for (x = 0; x < cx->xblocks; x++)
-		{
-#ifdef WINDOWED_MATCH
-			matchp[y*xblocks+x] = 0;
-			matchc[y*xblocks+x] = 0;
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(bot0 + x));
+		__m128i b2 = _mm_loadu_si128((const __m128i*)(bot2 + x));
+		__m128i t0 = _mm_loadu_si128((const __m128i*)(top0 + x));
+		__m128i t2 = _mm_loadu_si128((const __m128i*)(top2 + x));
+		__m128i t4 = _mm_loadu_si128((const __m128i*)(top4 + x));
+		__m128i vc_lo = MatchLanes(_mm_unpacklo_epi8(b0, zero), _mm_unpacklo_epi8(b2, zero),
+			_mm_unpacklo_epi8(t0, zero), _mm_unpacklo_epi8(t2, zero), _mm_unpacklo_epi8(t4, zero),
+			lanes, nt, &diffs);
+		__m128i vc_hi = MatchLanes(_mm_unpackhi_epi8(b0, zero), _mm_unpackhi_epi8(b2, zero),
+			_mm_unpackhi_epi8(t0, zero), _mm_unpackhi_epi8(t2, zero), _mm_unpackhi_epi8(t4, zero),
+			lanes, nt, &diffs);
+		sums[x / BLKSIZE_TIMES2] += __builtin_popcount(_mm_movemask_epi8(_mm_packs_epi16(vc_lo, vc_hi)));
+	}
+	_mm_storeu_si128((__m128i*)lane_sums, diffs);
+	total = lane_sums[0] + lane_sums[1] + lane_sums[2] + lane_sums[3];
 #endif
-			cx->sump[y * cx->xblocks + x] = 0;
-			cx->sumc[y * cx->xblocks + x] = 0;
-		}
+
+	skip = 1 + ( !cx->chroma );
+	while (x < cx->w)
+	{
+		tmp1 = ((long)bot0[x] + (long)bot2[x]);
+		diff = abs((((long)top0[x] + (long)top2[x] + (long)top4[x])) - (tmp1 >> 1) - tmp1);
+		if (diff > cx->nt)
+			total += diff;
+
+		tmp1 = bot0[x] + T;
+		tmp2 = bot0[x] - T;
+		vc = (tmp1 < top0[x] && tmp1 < top2[x]) ||
+			 (tmp2 > top0[x] && tmp2 > top2[x]);
+		if (vc)
+			sums[x / BLKSIZE_TIMES2]++;
+
+		x += skip;
+		if (!(x&3)) x += 4;
 	}
+	return total;
+}
+
+/** A band of whole block rows for CalculateMetrics.
+*/
+
+typedef struct
+{
+	context cx;
+	unsigned char *fcrp, *fprp;
+	int y_start, y_end;
+	int p, c;
+} metrics_band;
+
+static void *CalculateBand(void *arg)
+{
+	metrics_band *band = arg;
+	context cx = band->cx;
+	int y;
+	unsigned char *currbot0, *currbot2, *prevbot0, *prevbot2;
+	unsigned char *prevtop0, *prevtop2, *prevtop4, *currtop0, *currtop2, *currtop4;
+	unsigned char *a0, *a2, *b0, *b2, *b4;
+	unsigned char *fcrp = band->fcrp + band->y_start * cx->pitch;
+	unsigned char *fprp = band->fprp + band->y_start * cx->pitch;
 
 	/* Find the best field match. Subsample the frames for speed. */
 	currbot0  = fcrp + cx->pitch;
@@ -442,62 +536,21 @@ void CalculateMetrics(context cx, int frame, unsigned char *fcrp, unsigned char
 		b2 = prevtop2;
 		b4 = prevtop4;
 	}
-	p = c = 0;
+	band->p = band->c = 0;
 
 	// Calculate the field match and film/video metrics.
-	skip = 1 + ( !cx->chroma );
-	for (y = 0, index = 0; y < cx->h - 4; y+=4)
+	for (y = band->y_start; y < band->y_end && y < cx->h - 4; y+=4)
 	{
 		/* Exclusion band. Good for ignoring subtitles. */
 		if (cx->y0 == cx->y1 || y < cx->y0 || y > cx->y1)
 		{
-			for (x = 0; x < cx->w;)
-			{
-				index = (y/BLKSIZE) * cx->xblocks + x/BLKSIZE_TIMES2;
-
-				// Test combination with current frame.
-				tmp1 = ((long)currbot0[x] + (long)currbot2[x]);
-				diff = abs((((long)currtop0[x] + (long)currtop2[x] + (long)currtop4[x])) - (tmp1 >> 1) - tmp1);
-				if (diff > cx->nt)
-				{
-					c += diff;
-#ifdef WINDOWED_MATCH
-					matchc[index] += diff;
-#endif
-				}
+			int row = (y/BLKSIZE) * cx->xblocks;
 
-				tmp1 = currbot0[x] + T;
-				tmp2 = currbot0[x] - T;
-				vc = (tmp1 < currtop0[x] && tmp1 < currtop2[x]) ||
-					 (tmp2 > currtop0[x] && tmp2 > currtop2[x]);
-				if (vc)
-				{
-					cx->sumc[index]++;
-				}
+			// Test combination with current frame.
+			band->c += MatchRow(cx, currbot0, currbot2, currtop0, currtop2, currtop4, cx->sumc + row);
 
-				// Test combination with previous frame.
-				tmp1 = ((long)a0[x] + (long)a2[x]);
-				diff = abs((((long)b0[x] + (long)b2[x] + (long)b4[x])) - (tmp1 >> 1) - tmp1);
-				if (diff > cx->nt)
-				{
-					p += diff;
-#ifdef WINDOWED_MATCH
-					matchp[index] += diff;
-#endif
-				}
-
-				tmp1 = a0[x] + T;
-				tmp2 = a0[x] - T;
-				vc = (tmp1 < b0[x] && tmp1 < b2[x]) ||
-					 (tmp2 > b0[x] && tmp2 > b2[x]);
-				if (vc)
-				{
-					cx->sump[index]++;
-				}
-
-				x += skip;
-				if (!(x&3)) x += 4;
-			}
+			// Test combination with previous frame.
+			band->p += MatchRow(cx, a0, a2, b0, b2, b4, cx->sump + row);
 		}
 		currbot0 += cx->pitchtimes4;
 		currbot2 += cx->pitchtimes4;
@@ -510,7 +563,76 @@ void CalculateMetrics(context cx, int frame, unsigned char *fcrp, unsigned char
 		b2		 += cx->pitchtimes4;
 		b4		 += cx->pitchtimes4;
 	}
+	return NULL;
+}
 
+static
+void CalculateMetrics(context cx, int frame, unsigned char *fcrp, unsigned char *fcrpU, unsigned char *fcrpV,
+					unsigned char *fprp, unsigned char *fprpU, unsigned char *fprpV)
+{
+	int x, y, p, c, i;
+	int threads = cx->threads < cx->yblocks ? cx->threads : cx->yblocks;
+	metrics_band *bands;
+	pthread_t *ids;
+	int *started;
+
+	/* Clear the block sums. */
+ 	for (y = 0; y < cx->yblocks; y++)
+	{
+ 		for (x = 0; x < cx->xblocks; x++)
+		{
+#ifdef WINDOWED_MATCH
+			matchp[y*xblocks+x] = 0;
+			matchc[y*xblocks+x] = 0;
+#endif
+			cx->sump[y * cx->xblocks + x] = 0;
+			cx->sumc[y * cx->xblocks + x] = 0;
+		}
+	}
+
+	// Split the rows into bands of whole blocks, so that each band has its own block sums
+	if (threads < 1)
+		threads = 1;
+	bands = calloc(threads, sizeof(metrics_band));
+	ids = calloc(threads, sizeof(pthread_t));
+	started = calloc(threads, sizeof(int));
+	if (!bands || !ids || !started)
+	{
+		free(bands);
+		free(ids);
+		free(started);
+		threads = 1;
+		bands = calloc(1, sizeof(metrics_band));
+		ids = NULL;
+		started = NULL;
+		if (!bands)
+			return;
+	}
+	for (i = 0; i < threads; i++)
+	{
+		bands[i].cx = cx;
+		bands[i].fcrp = fcrp;
+		bands[i].fprp = fprp;
+		bands[i].y_start = cx->yblocks * i / threads * BLKSIZE;
+		bands[i].y_end = cx->yblocks * (i + 1) / threads * BLKSIZE;
+	}
+	// The first band runs on this thread
+	for (i = 1; i < threads; i++)
+		started[i] = !pthread_create(&ids[i], NULL, CalculateBand, &bands[i]);
+	for (i = 0; i < threads; i++)
+		if (!started || !started[i])
+			CalculateBand(&bands[i]);
+	p = c = 0;
+	for (i = 0; i < threads; i++)
+	{
+		if (started && started[i])
+			pthread_join(ids[i], NULL);
+		p += bands[i].p;
+		c += bands[i].c;
+	}
+	free(bands);
+	free(ids);
+	free(started);
 
 	if ( cx->post )
 	{
@@ -574,6 +696,11 @@ static int get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format
 		cx->hints = mlt_properties_get_int( properties, "hints" );
 		cx->debug = mlt_properties_get_int( properties, "debug" );
 		cx->show = mlt_properties_get_int( properties, "show" );
+		cx->threads = 1;
+		if ( mlt_properties_get( properties, "threads" ) != NULL )
+			cx->threads = mlt_properties_get_int( properties, "threads" );
+		else if ( getenv( "MLT_TELECIDE_THREADS" ) != NULL )
+			cx->threads = atoi( getenv( "MLT_TELECIDE_THREADS" ) );
 	}
 
 	// Get the image
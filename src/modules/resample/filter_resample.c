@@ -27,10 +27,83 @@
 #include <samplerate.h>
 #include <string.h>
 
-// BUFFER_LEN is based on a maximum of 96KHz, 5 fps, 8 channels
-// TODO: dynamically allocate larger buffer size
-#define BUFFER_LEN ((96000/5) * 8 * sizeof(float))
-#define RESAMPLE_TYPE SRC_SINC_FASTEST
+// Extra output frames allowed for beyond the rate ratio
+#define OUTPUT_SLACK (64)
+
+/** The converter state kept across the frames of a source.
+
+    libsamplerate keeps the filter history between calls, so the frames of
+    a source resampled in order join without discontinuities. Planar float
+    audio uses a mono converter per plane and is resampled as it is, without
+    interleaving. Any other format is converted to interleaved float and
+    uses one converter for all channels.
+*/
+
+typedef struct
+{
+	SRC_STATE **states;
+	int count;
+	int channels;
+	int planar;
+	int quality;
+	mlt_position next;
+} resampler;
+
+static void resampler_close( resampler *self )
+{
+	int i;
+	for ( i = 0; i < self->count; i++ )
+		if ( self->states[ i ] )
+			src_delete( self->states[ i ] );
+	free( self->states );
+	free( self );
+}
+
+static resampler *resampler_init( int quality, int channels, int planar, int *error )
+{
+	resampler *self = calloc( 1, sizeof( resampler ) );
+	int i;
+
+	self->count = planar ? channels : 1;
+	self->states = calloc( self->count, sizeof( SRC_STATE* ) );
+	self->channels = channels;
+	self->planar = planar;
+	self->quality = quality;
+	self->next = -1;
+	for ( i = 0; i < self->count && !*error; i++ )
+		self->states[ i ] = src_new( quality, planar ? 1 : channels, error );
+	if ( *error )
+	{
+		resampler_close( self );
+		self = NULL;
+	}
+	return self;
+}
+
+/** Map the quality property to a libsamplerate converter.
+
+    The tiers trade speed for quality: hold, linear, fastest (the default),
+    medium and best. The quality property overrides MLT_RESAMPLE_QUALITY.
+*/
+
+static int resample_quality( mlt_properties properties )
+{
+	const char *quality = mlt_properties_get( properties, "quality" );
+
+	if ( !quality )
+		quality = getenv( "MLT_RESAMPLE_QUALITY" );
+	if ( !quality )
+		return SRC_SINC_FASTEST;
+	if ( !strcmp( quality, "best" ) )
+		return SRC_SINC_BEST_QUALITY;
+	if ( !strcmp( quality, "medium" ) )
+		return SRC_SINC_MEDIUM_QUALITY;
+	if ( !strcmp( quality, "linear" ) )
+		return SRC_LINEAR;
+	if ( !strcmp( quality, "hold" ) )
+		return SRC_ZERO_ORDER_HOLD;
+	return SRC_SINC_FASTEST;
+}
 
 /** Get the audio.
 */
@@ -61,42 +134,68 @@ static int resample_get_audio( mlt_frame frame, void **buffer, mlt_audio_format
 			*channels, *samples, *frequency, output_rate );
 
 		// Do not convert to float unless we need to change the rate
-		if ( *format != mlt_audio_f32le )
+		int planar = *format == mlt_audio_float;
+		if ( !planar && *format != mlt_audio_f32le )
 			frame->convert_audio( frame, buffer, format, mlt_audio_f32le );
 
+		// Allocate the output for the frame
+		double ratio = ( double ) output_rate / ( double ) *frequency;
+		int output_frames = *samples * ratio + OUTPUT_SLACK;
+		int size = output_frames * *channels * sizeof( float );
+		float *output = mlt_pool_alloc( size );
+
 		mlt_service_lock( MLT_FILTER_SERVICE(filter) );
 
+		int quality = resample_quality( filter_properties );
+		resampler *state = mlt_properties_get_data( filter_properties, "state", NULL );
+		if ( !state || state->channels != *channels || state->planar != planar || state->quality != quality )
+		{
+			// Recreate the resampler if the layout or quality changed
+			state = resampler_init( quality, *channels, planar, &error );
+			mlt_properties_set_data( filter_properties, "state", state, 0, (mlt_destructor) resampler_close, NULL );
+		}
+		else if ( mlt_frame_get_position( frame ) != state->next )
+		{
+			// Do not carry the history of another position across a seek
+			int i;
+			for ( i = 0; i < state->count; i++ )
+				src_reset( state->states[ i ] );
+		}
+
+		// Resample the audio
 		SRC_DATA data;
-		data.data_in = *buffer;
-		data.data_out = mlt_properties_get_data( filter_properties, "output_buffer", NULL );
-		data.src_ratio = ( float ) output_rate / ( float ) *frequency;
-		data.input_frames = *samples;
-		data.output_frames = BUFFER_LEN / *channels;
+		int i;
+		data.src_ratio = ratio;
 		data.end_of_input = 0;
-
-		SRC_STATE *state = mlt_properties_get_data( filter_properties, "state", NULL );
-		if ( !state || mlt_properties_get_int( filter_properties, "channels" ) != *channels )
+		for ( i = 0; state && !error && i < state->count; i++ )
 		{
-			// Recreate the resampler if the number of channels changed
-			state = src_new( RESAMPLE_TYPE, *channels, &error );
-			mlt_properties_set_data( filter_properties, "state", state, 0, (mlt_destructor) src_delete, NULL );
-			mlt_properties_set_int( filter_properties, "channels", *channels );
+			data.data_in = ( float* ) *buffer + i * *samples;
+			data.data_out = output + i * output_frames;
+			data.input_frames = *samples;
+			data.output_frames = output_frames;
+			error = src_process( state->states[ i ], &data );
 		}
+		if ( state )
+			state->next = mlt_frame_get_position( frame ) + 1;
+		mlt_service_unlock( MLT_FILTER_SERVICE(filter) );
 
-		// Resample the audio
-		error = src_process( state, &data );
-		if ( !error )
+		if ( state && !error )
 		{
+			// The planes were written at the allocated stride
+			for ( i = 1; planar && i < *channels; i++ )
+				memmove( output + i * data.output_frames_gen, output + i * output_frames, data.output_frames_gen * sizeof( float ) );
+
 			// Update output variables
+			mlt_frame_set_audio( frame, output, *format, size, mlt_pool_release );
 			*samples = data.output_frames_gen;
 			*frequency = output_rate;
-			*buffer = data.data_out;
+			*buffer = output;
 		}
 		else
 		{
+			mlt_pool_release( output );
 			mlt_log_error( MLT_FILTER_SERVICE( filter ), "%s %d,%d,%d\n", src_strerror( error ), *frequency, *samples, output_rate );
 		}
-		mlt_service_unlock( MLT_FILTER_SERVICE(filter) );
 	}
 
 	return error;
@@ -124,22 +223,9 @@ mlt_filter filter_resample_init( mlt_profile profile, mlt_service_type type, con
 	mlt_filter this = mlt_filter_new( );
 	if ( this != NULL )
 	{
-		int error;
-		SRC_STATE *state = src_new( RESAMPLE_TYPE, 2 /* channels */, &error );
-		if ( error == 0 )
-		{
-			void *output_buffer = mlt_pool_alloc( BUFFER_LEN );
-			this->process = filter_process;
-			if ( arg != NULL )
-				mlt_properties_set_int( MLT_FILTER_PROPERTIES( this ), "frequency", atoi( arg ) );
-			mlt_properties_set_int( MLT_FILTER_PROPERTIES( this ), "channels", 2 );
-			mlt_properties_set_data( MLT_FILTER_PROPERTIES( this ), "state", state, 0, (mlt_destructor)src_delete, NULL );
-			mlt_properties_set_data( MLT_FILTER_PROPERTIES( this ), "output_buffer", output_buffer, BUFFER_LEN, mlt_pool_release, NULL );
-		}
-		else
-		{
-			fprintf( stderr, "filter_resample_init: %s\n", src_strerror( error ) );
-		}
+		this->process = filter_process;
+		if ( arg != NULL )
+			mlt_properties_set_int( MLT_FILTER_PROPERTIES( this ), "frequency", atoi( arg ) );
 	}
 	return this;
 }
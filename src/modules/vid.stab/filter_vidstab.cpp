@@ -30,6 +30,7 @@ extern "C"
 #include <sstream>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 typedef struct
 {
@@ -49,8 +50,33 @@ typedef struct
 {
 	vs_analyze* analyze_data;
 	vs_apply* apply_data;
+	int offline_failed;
 } vs_data;
 
+/** One contiguous part of the offline analysis.
+ *
+ * Every chunk but the first starts one frame early; that frame only becomes
+ * the previous image of the motion detection, so the motions join up exactly
+ * at the boundaries.
+*/
+
+typedef struct
+{
+	mlt_producer producer;
+	VSMotionDetectConfig conf;
+	VSMotionDetect md;
+	FILE* results;         // temporary file receiving the motions of this chunk
+	mlt_position origin;   // producer position of the filter's first frame
+	mlt_position start;    // first frame measured, relative to the filter
+	mlt_position end;      // frame after the last one measured
+	mlt_image_format format;
+	int width;
+	int height;
+	int initialized;
+	int error;
+	int started;           // running on its own thread
+} analyze_chunk;
+
 static void get_transform_config( VSTransformConfig* conf, mlt_filter filter, mlt_frame frame )
 {
 	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
@@ -186,6 +212,20 @@ void destory_analyze_data( vs_analyze* analyze_data )
 	}
 }
 
+static void get_motion_detect_config( VSMotionDetectConfig* conf, mlt_filter filter )
+{
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	const char* filterName = mlt_properties_get( properties, "mlt_service" );
+
+	*conf = vsMotionDetectGetDefaultConfig( filterName );
+	conf->shakiness = mlt_properties_get_int( properties, "shakiness" );
+	conf->accuracy = mlt_properties_get_int( properties, "accuracy" );
+	conf->stepSize = mlt_properties_get_int( properties, "stepsize" );
+	conf->contrastThreshold = mlt_properties_get_double( properties, "mincontrast" );
+	conf->show = mlt_properties_get_int( properties, "show" );
+	conf->virtualTripod = mlt_properties_get_int( properties, "tripod" );
+}
+
 static void init_analyze_data( mlt_filter filter, mlt_frame frame, VSPixelFormat vs_format, int width, int height )
 {
 	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
@@ -194,14 +234,8 @@ static void init_analyze_data( mlt_filter filter, mlt_frame frame, VSPixelFormat
 	memset( analyze_data, 0, sizeof(vs_analyze) );
 
 	// Initialize a VSMotionDetectConfig
-	const char* filterName = mlt_properties_get( properties, "mlt_service" );
-	VSMotionDetectConfig conf = vsMotionDetectGetDefaultConfig( filterName );
-	conf.shakiness = mlt_properties_get_int( properties, "shakiness" );
-	conf.accuracy = mlt_properties_get_int( properties, "accuracy" );
-	conf.stepSize = mlt_properties_get_int( properties, "stepsize" );
-	conf.contrastThreshold = mlt_properties_get_double( properties, "mincontrast" );
-	conf.show = mlt_properties_get_int( properties, "show" );
-	conf.virtualTripod = mlt_properties_get_int( properties, "tripod" );
+	VSMotionDetectConfig conf;
+	get_motion_detect_config( &conf, filter );
 
 	// Initialize a VSFrameInfo
 	VSFrameInfo fi;
@@ -318,6 +352,205 @@ static void analyze_image( mlt_filter filter, mlt_frame frame, uint8_t* vs_image
 	}
 }
 
+static void* analyze_chunk_thread( void* arg )
+{
+	analyze_chunk* chunk = (analyze_chunk*)arg;
+	mlt_position position = chunk->start > 0 ? chunk->start - 1 : 0;
+
+	for ( ; !chunk->error && position < chunk->end; position++ )
+	{
+		mlt_frame frame = NULL;
+		mlt_image_format format = chunk->format;
+		int width = chunk->width;
+		int height = chunk->height;
+		uint8_t* image = NULL;
+		uint8_t* vs_image = NULL;
+		VSPixelFormat vs_format = PF_NONE;
+
+		mlt_producer_seek( chunk->producer, chunk->origin + position );
+		if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( chunk->producer ), &frame, 0 ) || !frame )
+		{
+			chunk->error = 1;
+			break;
+		}
+		mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "consumer_deinterlace", 1 );
+		if ( mlt_frame_get_image( frame, &image, &format, &width, &height, 1 ) || !image ||
+			format != chunk->format || width != chunk->width || height != chunk->height )
+		{
+			chunk->error = 1;
+		}
+		else
+		{
+			vs_format = mltimage_to_vsimage( format, width, height, image, &vs_image );
+		}
+
+		if ( vs_image )
+		{
+			VSMotionDetect* md = &chunk->md;
+			LocalMotions localmotions;
+			VSFrame vsFrame;
+
+			if ( !chunk->initialized )
+			{
+				VSFrameInfo fi;
+				vsFrameInfoInit( &fi, width, height, vs_format );
+				vsMotionDetectInit( md, &chunk->conf, &fi );
+				// The motions are numbered from 1 and the early frame takes the number before
+				md->frameNum = position;
+				chunk->initialized = 1;
+			}
+
+			vsFrameFillFromBuffer( &vsFrame, vs_image, &md->fi );
+			if( vsMotionDetection( md, &localmotions, &vsFrame ) == VS_OK )
+			{
+				if ( position >= chunk->start )
+					vsWriteToFile( md, chunk->results, &localmotions );
+				vs_vector_del( &localmotions );
+			}
+			else
+			{
+				chunk->error = 1;
+			}
+			free_vsimage( vs_image, vs_format );
+		}
+		else
+		{
+			chunk->error = 1;
+		}
+		mlt_frame_close( frame );
+	}
+	return NULL;
+}
+
+/** Analyze the whole range at once by pulling frames from copies of the producer in parallel.
+ *
+ * The motions of every chunk go to a temporary file and are then joined in
+ * order into the results file, which keeps the format read by vid.stab.
+ * \return true if the results file was written
+*/
+
+static int analyze_offline( mlt_filter filter, mlt_frame frame, mlt_image_format format, int width, int height, int threads )
+{
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	char* filename = mlt_properties_get( properties, "filename" );
+	mlt_position length = mlt_filter_get_length2( filter, frame );
+	mlt_position origin = 0;
+	analyze_chunk* chunks = NULL;
+	pthread_t* thread_ids = NULL;
+	FILE* results = NULL;
+	mlt_producer first = NULL;
+	int count = 0;
+	int result = 0;
+	int i;
+
+	// A virtual tripod compares every frame with the first one
+	if ( mlt_properties_get_int( properties, "tripod" ) )
+		return 0;
+	if ( !filename || !strcmp( filename, "" ) || length <= 0 )
+		return 0;
+
+	// Only a filter directly on a media file can be analyzed out of band
+	first = mlt_filter_open_source( filter, frame, 0, 1, &origin );
+	if ( !first )
+		return 0;
+
+	if ( threads > length )
+		threads = length;
+	chunks = (analyze_chunk*)calloc( threads, sizeof(analyze_chunk) );
+	thread_ids = (pthread_t*)calloc( threads, sizeof(pthread_t) );
+	if ( !chunks || !thread_ids )
+		goto exit;
+
+	for ( count = 0; count < threads; count++ )
+	{
+		analyze_chunk* chunk = &chunks[count];
+		chunk->origin = origin;
+		chunk->start = length * count / threads;
+		chunk->end = length * ( count + 1 ) / threads;
+		chunk->format = format;
+		chunk->width = width;
+		chunk->height = height;
+		get_motion_detect_config( &chunk->conf, filter );
+		chunk->results = tmpfile();
+		chunk->producer = count ? mlt_filter_open_source( filter, frame, 0, 1, NULL ) : first;
+		first = NULL;
+		if ( !chunk->producer || !chunk->results )
+		{
+			if ( !chunk->results )
+				mlt_log_error( MLT_FILTER_SERVICE(filter), "Unable to create a temporary file for analysis\n" );
+			count++;
+			goto exit;
+		}
+	}
+
+	// The first chunk runs on this thread
+	for ( i = 1; i < count; i++ )
+		chunks[i].started = !pthread_create( &thread_ids[i], NULL, analyze_chunk_thread, &chunks[i] );
+	for ( i = 0; i < count; i++ )
+		if ( !chunks[i].started )
+			analyze_chunk_thread( &chunks[i] );
+	for ( i = 1; i < count; i++ )
+		if ( chunks[i].started )
+			pthread_join( thread_ids[i], NULL );
+
+	for ( i = 0; i < count; i++ )
+	{
+		if ( chunks[i].error || !chunks[i].initialized )
+		{
+			mlt_log_error( MLT_FILTER_SERVICE(filter), "Motion detection failed\n" );
+			goto exit;
+		}
+	}
+
+	// Join the motions of the chunks in order
+	results = fopen( filename, "w" );
+	if ( !results || vsPrepareFile( &chunks[0].md, results ) != VS_OK )
+	{
+		mlt_log_error( MLT_FILTER_SERVICE(filter), "Can not write to results file: %s\n", filename );
+		goto exit;
+	}
+	for ( i = 0; i < count; i++ )
+	{
+		char buffer[4096];
+		size_t n;
+		rewind( chunks[i].results );
+		while ( ( n = fread( buffer, 1, sizeof(buffer), chunks[i].results ) ) > 0 )
+		{
+			if ( fwrite( buffer, 1, n, results ) != n )
+			{
+				mlt_log_error( MLT_FILTER_SERVICE(filter), "Can not write to results file: %s\n", filename );
+				goto exit;
+			}
+		}
+	}
+	if ( fclose( results ) == 0 )
+	{
+		mlt_log_info( MLT_FILTER_SERVICE(filter), "Analysis complete\n" );
+		mlt_properties_set( properties, "results", filename );
+		result = 1;
+	}
+	results = NULL;
+
+exit:
+	if ( results )
+		fclose( results );
+	if ( chunks )
+	{
+		for ( i = 0; i < count; i++ )
+		{
+			if ( chunks[i].initialized )
+				vsMotionDetectionCleanup( &chunks[i].md );
+			if ( chunks[i].results )
+				fclose( chunks[i].results );
+			mlt_producer_close( chunks[i].producer );
+		}
+	}
+	mlt_producer_close( first );
+	free( chunks );
+	free( thread_ids );
+	return result;
+}
+
 static int get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
 {
 	mlt_filter filter = (mlt_filter)mlt_frame_pop_service( frame );
@@ -330,6 +563,27 @@ static int get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format
 
 	*format = validate_format( *format );
 
+	// Analyze the whole range before the first frame is returned
+	vs_data* data = (vs_data*)filter->child;
+	int threads = mlt_properties_get_int( properties, "analysis_threads" );
+	if ( threads > 0 && !data->offline_failed && !data->analyze_data )
+	{
+		mlt_service_lock( MLT_FILTER_SERVICE(filter) );
+		char* results = mlt_properties_get( properties, "results" );
+		if ( ( !results || !strcmp( results, "" ) ) && !data->offline_failed && !data->analyze_data )
+		{
+			mlt_profile profile = mlt_service_profile( MLT_FILTER_SERVICE( filter ) );
+			int w = *width > 0 ? *width : profile->width;
+			int h = *height > 0 ? *height : profile->height;
+			if ( !analyze_offline( filter, frame, *format, w, h, threads ) )
+			{
+				mlt_log_warning( MLT_FILTER_SERVICE(filter), "falling back to analysis during playback\n" );
+				data->offline_failed = 1;
+			}
+		}
+		mlt_service_unlock( MLT_FILTER_SERVICE(filter) );
+	}
+
 	int error = mlt_frame_get_image( frame, image, format, width, height, 1 );
 
 	// Convert the received image to a format vid.stab can handle
@@ -21,13 +21,16 @@
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
 #include <framework/mlt_producer.h>
+#include <framework/mlt_factory.h>
 #include <framework/mlt_geometry.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "stabilize.h"
 #include "transform_image.h"
@@ -36,10 +39,68 @@ typedef struct {
 	StabData* stab;
 	TransformData* trans;
 	int initialized;
+	int offline_failed;
 	void* parent;
 } videostab2_data;
 
-static void serialize_vectors( videostab2_data* self, mlt_position length )
+/** Header of the binary results file.
+ *
+ * It is followed by count records of four doubles each: x, y, alpha and zoom
+ * of the transform of every frame, in the byte order given by byte_order.
+ */
+typedef struct {
+	char magic[8];
+	int32_t byte_order;
+	int32_t count;
+	int32_t width;
+	int32_t height;
+} results_header;
+
+#define RESULTS_MAGIC "MLTVSTB2"
+#define RESULTS_BYTE_ORDER 0x01020304
+
+/** One contiguous part of the offline analysis.
+ *
+ * Every chunk but the first starts one frame early; that frame only becomes
+ * the previous image, so the transforms join up exactly at the boundaries.
+*/
+
+typedef struct {
+	mlt_producer producer;
+	StabData stab;
+	mlt_position origin; // producer position of the filter's first frame
+	mlt_position start;  // first frame measured, relative to the filter
+	mlt_position end;    // frame after the last one measured
+	int width, height;
+	int error;
+	int started;         // running on its own thread
+} analyze_chunk;
+
+static void configure_stab( StabData* stab, mlt_properties properties, mlt_image_format format, int w, int h )
+{
+	stab->width=w;
+	stab->height=h;
+	if (format==mlt_image_yuv420p) stab->framesize=w*h* 3/2;//( mlt_image_format_size ( *format, w,h , 0) ; // 3/2 =1 too small
+	if (format==mlt_image_yuv422) stab->framesize=w*h;
+	stab->shakiness = mlt_properties_get_int( properties , "shakiness" );
+	stab->accuracy = mlt_properties_get_int( properties , "accuracy" );
+	stab->stepsize = mlt_properties_get_int( properties , "stepsize" );
+	stab->algo = mlt_properties_get_int( properties , "algo" );
+	stab->show = mlt_properties_get_int( properties , "show" );
+	stab->contrast_threshold = mlt_properties_get_double( properties , "mincontrast" );
+	stab->threads = 1;
+	if ( mlt_properties_get( properties, "threads" ) != NULL )
+		stab->threads = mlt_properties_get_int( properties, "threads" );
+	else if ( getenv( "MLT_VIDEOSTAB_THREADS" ) != NULL )
+		stab->threads = atoi( getenv( "MLT_VIDEOSTAB_THREADS" ) );
+	// The image comparisons may be limited to plainer code to check them
+	stab->simd = 2;
+	if ( getenv( "MLT_VIDEOSTAB_SIMD" ) != NULL )
+		stab->simd = atoi( getenv( "MLT_VIDEOSTAB_SIMD" ) );
+	stabilize_configure(stab);
+}
+
+static void serialize_vectors( videostab2_data* self, tlist* transform_data, mlt_position length )
 {
 	mlt_geometry g = mlt_geometry_init();
 	if ( g )
@@ -50,8 +111,8 @@ static void serialize_vectors( videostab2_data* self, mlt_position length )
 		// Initialize geometry item
 		item.key = item.f[0] = item.f[1] = item.f[2] = item.f[3] = 1;
 		item.f[4] = 0;
+		item.mix = 0;
 
-		tlist* transform_data =self->stab->transs;
 		for ( i = 0; i < length; i++ )
 		{
 			// Set the geometry item
@@ -111,19 +172,286 @@ Transform* deserialize_vectors( char *vectors, mlt_position length ,float scale_
 	return tx;
 }
 
+/** Write the transforms to a binary results file.
+ *
+ * \return true on success
+*/
+
+static int write_results( const char* filename, tlist* transform_data, mlt_position length, int width, int height )
+{
+	FILE* f = fopen( filename, "wb" );
+	results_header header;
+	mlt_position i;
+	int error = !f;
+
+	memcpy( header.magic, RESULTS_MAGIC, sizeof(header.magic) );
+	header.byte_order = RESULTS_BYTE_ORDER;
+	header.count = length;
+	header.width = width;
+	header.height = height;
+	if ( !error )
+		error = fwrite( &header, sizeof(header), 1, f ) != 1;
+
+	for ( i = 0; !error && i < length; i++ )
+	{
+		double record[4] = { 0, 0, 0, 0 };
+		if ( transform_data && transform_data->data )
+		{
+			Transform* t = transform_data->data;
+			record[0] = t->x;
+			record[1] = t->y;
+			record[2] = t->alpha;
+			record[3] = t->zoom;
+			transform_data = transform_data->next;
+		}
+		error = fwrite( record, sizeof(record), 1, f ) != 1;
+	}
+
+	if ( f && fclose( f ) )
+		error = 1;
+	return !error;
+}
+
+/** Read the transforms from a binary results file, scaled to the current width.
+ *
+ * \return an array of length transforms or NULL on failure
+*/
+
+static Transform* read_results( const char* filename, mlt_position length, int width )
+{
+	FILE* f = fopen( filename, "rb" );
+	results_header header;
+	Transform* tx = NULL;
+	mlt_position i;
+
+	if ( f && fread( &header, sizeof(header), 1, f ) == 1 &&
+		 !memcmp( header.magic, RESULTS_MAGIC, sizeof(header.magic) ) &&
+		 header.byte_order == RESULTS_BYTE_ORDER && header.width > 0 &&
+		 ( tx = calloc( length, sizeof(Transform) ) ) )
+	{
+		// The vectors were calculated at the analysis width
+		float scale_zoom = (float) width / (float) header.width;
+		for ( i = 0; i < length && i < header.count; i++ )
+		{
+			double record[4];
+			if ( fread( record, sizeof(record), 1, f ) != 1 )
+			{
+				free( tx );
+				tx = NULL;
+				break;
+			}
+			tx[i].x = scale_zoom * record[0];
+			tx[i].y = scale_zoom * record[1];
+			tx[i].alpha = record[2];
+			tx[i].zoom = scale_zoom * record[3];
+			tx[i].extra = 0;
+		}
+	}
+	if ( f )
+		fclose( f );
+	return tx;
+}
+
+static void* analyze_chunk_thread( void* arg )
+{
+	analyze_chunk* chunk = arg;
+	mlt_position position = chunk->start > 0 ? chunk->start - 1 : 0;
+
+	for ( ; !chunk->error && position < chunk->end; position++ )
+	{
+		mlt_frame frame = NULL;
+		mlt_image_format format = mlt_image_yuv422;
+		int width = chunk->width;
+		int height = chunk->height;
+		uint8_t* image = NULL;
+
+		mlt_producer_seek( chunk->producer, chunk->origin + position );
+		if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( chunk->producer ), &frame, 0 ) || !frame )
+		{
+			chunk->error = 1;
+			break;
+		}
+		mlt_properties_set_int( MLT_FRAME_PROPERTIES(frame), "consumer_deinterlace", 1 );
+		if ( mlt_frame_get_image( frame, &image, &format, &width, &height, 1 ) || !image ||
+			 format != mlt_image_yuv422 || width != chunk->width || height != chunk->height )
+			chunk->error = 1;
+		else
+			stabilize_filter_video( &chunk->stab, image, format );
+		mlt_frame_close( frame );
+	}
+	return NULL;
+}
+
+/** Analyze the whole range at once by pulling frames from copies of the producer in parallel.
+ *
+ * \return true if the results were stored
+*/
+
+static int analyze_offline( mlt_filter filter, mlt_frame frame, int width, int height, int threads )
+{
+	videostab2_data* data = filter->child;
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	const char* filename = mlt_properties_get( properties, "filename" );
+	mlt_position length = mlt_filter_get_length2( filter, frame );
+	mlt_position origin = 0;
+	analyze_chunk* chunks = NULL;
+	pthread_t* thread_ids = NULL;
+	tlist* transs = NULL;
+	tlist* transs_end = NULL;
+	mlt_producer first = NULL;
+	int count = 0;
+	int result = 0;
+	int i;
+
+	if ( length <= 0 )
+		return 0;
+
+	// Only a filter directly on a media file can be analyzed out of band
+	first = mlt_filter_open_source( filter, frame, 0, 1, &origin );
+	if ( !first )
+		return 0;
+
+	if ( threads > length )
+		threads = length;
+	chunks = calloc( threads, sizeof(analyze_chunk) );
+	thread_ids = calloc( threads, sizeof(pthread_t) );
+	if ( !chunks || !thread_ids )
+		goto exit;
+
+	for ( count = 0; count < threads; count++ )
+	{
+		analyze_chunk* chunk = &chunks[count];
+		chunk->origin = origin;
+		chunk->start = length * count / threads;
+		chunk->end = length * ( count + 1 ) / threads;
+		chunk->width = width;
+		chunk->height = height;
+		chunk->producer = count ? mlt_filter_open_source( filter, frame, 0, 1, NULL ) : first;
+		first = NULL;
+		if ( !chunk->producer )
+		{
+			count++;
+			goto exit;
+		}
+		configure_stab( &chunk->stab, properties, mlt_image_yuv422, width, height );
+	}
+
+	// The first chunk runs on this thread
+	for ( i = 1; i < count; i++ )
+		chunks[i].started = !pthread_create( &thread_ids[i], NULL, analyze_chunk_thread, &chunks[i] );
+	for ( i = 0; i < count; i++ )
+		if ( !chunks[i].started )
+			analyze_chunk_thread( &chunks[i] );
+	for ( i = 1; i < count; i++ )
+		if ( chunks[i].started )
+			pthread_join( thread_ids[i], NULL );
+
+	// Join the transforms, dropping the null transform of each early frame
+	transs = tlist_new( 0 );
+	transs_end = transs;
+	for ( i = 0; i < count; i++ )
+	{
+		tlist* t = chunks[i].stab.transs;
+		if ( chunks[i].error )
+		{
+			mlt_log_error( MLT_FILTER_SERVICE( filter ), "Analysis Failed: unable to read the source\n" );
+			goto exit;
+		}
+		if ( i > 0 && t )
+			t = t->next;
+		for ( ; t && t->data; t = t->next )
+		{
+			tlist_append( transs_end, t->data, sizeof(Transform) );
+			transs_end = transs_end->next;
+		}
+	}
+
+	if ( filename && strcmp( filename, "" ) )
+	{
+		if ( write_results( filename, transs, length, width, height ) )
+		{
+			mlt_properties_set( properties, "results", filename );
+			result = 1;
+		}
+		else
+		{
+			mlt_log_error( MLT_FILTER_SERVICE( filter ), "Can not write to results file: %s\n", filename );
+		}
+	}
+	else
+	{
+		serialize_vectors( data, transs, length );
+		result = 1;
+	}
+
+exit:
+	if ( chunks )
+	{
+		for ( i = 0; i < count; i++ )
+		{
+			mlt_producer_close( chunks[i].producer );
+			stabilize_stop( &chunks[i].stab );
+			free( chunks[i].stab.fields );
+			free( chunks[i].stab.currcopy );
+			if ( chunks[i].stab.transs )
+				tlist_fini( chunks[i].stab.transs );
+		}
+	}
+	if ( transs )
+		tlist_fini( transs );
+	mlt_producer_close( first );
+	free( chunks );
+	free( thread_ids );
+	return result;
+}
+
 static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
 {
 	mlt_filter filter = mlt_frame_pop_service( frame );
-	char *vectors = mlt_properties_get( MLT_FILTER_PROPERTIES(filter), "vectors" );
+	mlt_properties properties = MLT_FILTER_PROPERTIES(filter);
+	videostab2_data* data = filter->child;
+	char *vectors = mlt_properties_get( properties, "vectors" );
+	char *results = mlt_properties_get( properties, "results" );
+	int threads = mlt_properties_get_int( properties, "analysis_threads" );
+
+	if ( results && !strcmp( results, "" ) )
+		results = NULL;
+
+	// Analyze the whole range before the first frame is returned
+	if ( data && !vectors && !results && threads > 0 && !data->offline_failed )
+	{
+		mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
+		vectors = mlt_properties_get( properties, "vectors" );
+		results = mlt_properties_get( properties, "results" );
+		if ( results && !strcmp( results, "" ) )
+			results = NULL;
+		if ( !vectors && !results && !data->offline_failed )
+		{
+			mlt_profile profile = mlt_service_profile( MLT_FILTER_SERVICE( filter ) );
+			int w = *width > 0 ? *width : profile->width;
+			int h = *height > 0 ? *height : profile->height;
+			if ( analyze_offline( filter, frame, w, h, threads ) )
+			{
+				vectors = mlt_properties_get( properties, "vectors" );
+				results = mlt_properties_get( properties, "results" );
+			}
+			else
+			{
+				mlt_log_warning( MLT_FILTER_SERVICE( filter ), "falling back to analysis during playback\n" );
+				data->offline_failed = 1;
+			}
+		}
+		mlt_service_unlock( MLT_FILTER_SERVICE( filter ) );
+	}
+
 	*format = mlt_image_yuv422;
-	if (vectors)
+	if (vectors || results)
 		*format= mlt_image_rgb24;
 	mlt_properties_set_int( MLT_FRAME_PROPERTIES(frame), "consumer_deinterlace", 1 );
 	int error = mlt_frame_get_image( frame, image, format, width, height, 1 );
 
 	if ( !error && *image )
 	{
-		videostab2_data* data = filter->child;
 		if ( data==NULL ) { // big error, abort
 			return 1;
 		}
@@ -135,28 +463,19 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
 
 		// Handle signal from app to re-init data
-		if ( mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter) , "refresh" ) )
+		if ( mlt_properties_get_int( properties , "refresh" ) )
 		{
-			mlt_properties_set( MLT_FILTER_PROPERTIES(filter) , "refresh", NULL );
+			mlt_properties_set( properties , "refresh", NULL );
 			data->initialized = 0;
+			data->offline_failed = 0;
 		}
 
-		if ( !vectors) {
+		if ( !vectors && !results ) {
 			if ( !data->initialized )
 			{
 				// Initialize our context
 				data->initialized = 1;
-				data->stab->width=w;
-				data->stab->height=h;
-				if (*format==mlt_image_yuv420p) data->stab->framesize=w*h* 3/2;//( mlt_image_format_size ( *format, w,h , 0) ; // 3/2 =1 too small
-				if (*format==mlt_image_yuv422) data->stab->framesize=w*h;
-				data->stab->shakiness = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter) , "shakiness" );
-				data->stab->accuracy = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter) , "accuracy" );
-				data->stab->stepsize = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter) , "stepsize" );
-				data->stab->algo = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter) , "algo" );
-				data->stab->show = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter) , "show" );
-				data->stab->contrast_threshold = mlt_properties_get_double( MLT_FILTER_PROPERTIES(filter) , "mincontrast" );
-				stabilize_configure(data->stab);
+				configure_stab( data->stab, properties, *format, w, h );
 			}
 				// Analyse
 				mlt_position pos = mlt_filter_get_position( filter, frame );
@@ -165,7 +484,18 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 				// On last frame
 				if ( pos == length - 1 )
 				{
-					serialize_vectors( data , length );
+					const char* filename = mlt_properties_get( properties, "filename" );
+					if ( filename && strcmp( filename, "" ) )
+					{
+						if ( write_results( filename, data->stab->transs, length, w, h ) )
+							mlt_properties_set( properties, "results", filename );
+						else
+							mlt_log_error( MLT_FILTER_SERVICE( filter ), "Can not write to results file: %s\n", filename );
+					}
+					else
+					{
+						serialize_vectors( data , data->stab->transs, length );
+					}
 				}
 		}
 		else
@@ -181,25 +511,37 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 
 					int interp = 2; // default to bilinear
 					float scale_zoom=1.0;
-					if ( *width != mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "meta.media.width" ) )
-						scale_zoom = (float) *width / (float) mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "meta.media.width" );
-					if ( strcmp( interps, "nearest" ) == 0 || strcmp( interps, "neighbor" ) == 0 )
+					Transform* tx = NULL;
+					int media_width = mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "meta.media.width" );
+					if ( media_width > 0 && *width != media_width )
+						scale_zoom = (float) *width / (float) media_width;
+					if ( !interps )
+						interp = 2;
+					else if ( strcmp( interps, "nearest" ) == 0 || strcmp( interps, "neighbor" ) == 0 )
 						interp = 0;
 					else if ( strcmp( interps, "tiles" ) == 0 || strcmp( interps, "fast_bilinear" ) == 0 )
 						interp = 1;
 
 					data->trans->interpoltype = interp;
-					data->trans->smoothing = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter), "smoothing" );
-					data->trans->maxshift = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter), "maxshift" );
-					data->trans->maxangle = mlt_properties_get_double( MLT_FILTER_PROPERTIES(filter), "maxangle" );
-					data->trans->crop = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter), "crop" );
-					data->trans->invert = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter), "invert" );
-					data->trans->relative = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter), "relative" );
-					data->trans->zoom = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter), "zoom" );
-					data->trans->optzoom = mlt_properties_get_int( MLT_FILTER_PROPERTIES(filter), "optzoom" );
-					data->trans->sharpen = mlt_properties_get_double( MLT_FILTER_PROPERTIES(filter), "sharpen" );
-
-					transform_configure(data->trans,w,h,*format ,*image, deserialize_vectors(  vectors, length , scale_zoom ),length);
+					data->trans->smoothing = mlt_properties_get_int( properties, "smoothing" );
+					data->trans->maxshift = mlt_properties_get_int( properties, "maxshift" );
+					data->trans->maxangle = mlt_properties_get_double( properties, "maxangle" );
+					data->trans->crop = mlt_properties_get_int( properties, "crop" );
+					data->trans->invert = mlt_properties_get_int( properties, "invert" );
+					data->trans->relative = mlt_properties_get_int( properties, "relative" );
+					data->trans->zoom = mlt_properties_get_int( properties, "zoom" );
+					data->trans->optzoom = mlt_properties_get_int( properties, "optzoom" );
+					data->trans->sharpen = mlt_properties_get_double( properties, "sharpen" );
+
+					if ( results )
+					{
+						tx = read_results( results, length, *width );
+						if ( !tx )
+							mlt_log_error( MLT_FILTER_SERVICE( filter ), "Can not read results file: %s\n", results );
+					}
+					if ( !tx && vectors )
+						tx = deserialize_vectors( vectors, length, scale_zoom );
+					transform_configure(data->trans,w,h,*format ,*image, tx,length);
 
 				}
 				if ( data->initialized == 2 )
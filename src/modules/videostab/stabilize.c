@@ -54,16 +54,26 @@
 #include <string.h>
 #include <framework/mlt_types.h>
 #include <framework/mlt_log.h>
+#include <stdint.h>
+#include <pthread.h>
 #ifdef USE_SSE2
 #include <emmintrin.h>
 #endif
 
+// The AVX2 comparison is selected at run time and needs GCC 4.9 for target attributes
+#if defined(USE_SSE2) && defined(__GNUC__) && (__GNUC__ > 4 || __GNUC__ == 4 && __GNUC_MINOR__ >= 9) && defined(ARCH_X86_64)
+#define STABILIZE_AVX2
+#include <immintrin.h>
+#endif
+
 void addTrans(StabData* sd, Transform sl)
 {
     if (!sd->transs) {
        sd->transs = tlist_new(0);
+       sd->transs_end = sd->transs;
     }
-    tlist_append(sd->transs, &sl,sizeof(Transform) );
+    tlist_append(sd->transs_end, &sl,sizeof(Transform) );
+    sd->transs_end = sd->transs_end->next;
 }
 
 
@@ -108,75 +118,150 @@ int initFields(StabData* sd)
 
 
 /**
-   compares the two given images and returns the average absolute difference
-   \param d_x shift in x direction
-   \param d_y shift in y direction
+   number of bytes compared in a row of the given length.
+   The SSE2 comparison takes whole blocks of 16 bytes as long as
+   at least one more byte follows, the detected transforms depend on that.
 */
-double compareImg(unsigned char* I1, unsigned char* I2,
-                  int width, int height,  int bytesPerPixel, int d_x, int d_y)
+static int compared_bytes(int bytes)
 {
+#ifdef USE_SSE2
+    return bytes > 0 ? (bytes - 1) / 16 * 16 : 0;
+#else
+    return bytes;
+#endif
+}
+
+/**
+   smallest sum of absolute differences whose average over count values
+   is not below limit, so that a comparison can stop once it is reached
+*/
+static uint64_t sad_limit(double limit, double count)
+{
+    double b = ceil(limit * count);
+    uint64_t s;
+    if (!(b < 1e18))
+        return UINT64_MAX;
+    if (b <= 0)
+        return 0;
+    s = (uint64_t) b;
+    while (s > 0 && (s - 1) / count >= limit)
+        s--;
+    while (s / count < limit)
+        s++;
+    return s;
+}
+
+#ifdef USE_SSE2
+static uint64_t rows_sad_sse2(const unsigned char* p1, const unsigned char* p2,
+                              int rows, int bytes, int pitch, uint64_t limit)
+{
+    uint64_t sum = 0;
     int i, j;
-    unsigned char* p1 = NULL;
-    unsigned char* p2 = NULL;
-    long int sum = 0;
-    int effectWidth = width - abs(d_x);
-    int effectHeight = height - abs(d_y);
+    for (j = 0; j < rows && sum < limit; j++, p1 += pitch, p2 += pitch) {
+        __m128i acc = _mm_setzero_si128();
+        for (i = 0; i < bytes; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (p1 + i));
+            __m128i b = _mm_loadu_si128((const __m128i*) (p2 + i));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+        }
+        acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+        sum += (unsigned int) _mm_cvtsi128_si32(acc);
+    }
+    return sum;
+}
+#endif
 
-/*   DEBUGGING code to export single frames */
-/*   char buffer[100]; */
-/*   sprintf(buffer, "pic_%02ix%02i_1.ppm", d_x, d_y); */
-/*   FILE *pic1 = fopen(buffer, "w"); */
-/*   sprintf(buffer, "pic_%02ix%02i_2.ppm", d_x, d_y); */
-/*   FILE *pic2 = fopen(buffer, "w"); */
-/*   fprintf(pic1, "P6\n%i %i\n255\n", effectWidth, effectHeight); */
-/*   fprintf(pic2, "P6\n%i %i\n255\n", effectWidth, effectHeight); */
-
-    for (i = 0; i < effectHeight; i++) {
-        p1 = I1;
-        p2 = I2;
-        if (d_y > 0 ){
-            p1 += (i + d_y) * width * bytesPerPixel;
-            p2 += i * width * bytesPerPixel;
-        } else {
-            p1 += i * width * bytesPerPixel;
-            p2 += (i - d_y) * width * bytesPerPixel;
+static uint64_t rows_sad_c(const unsigned char* p1, const unsigned char* p2,
+                           int rows, int bytes, int pitch, uint64_t limit)
+{
+    uint64_t sum = 0;
+    int i, j;
+    for (j = 0; j < rows && sum < limit; j++, p1 += pitch, p2 += pitch) {
+        for (i = 0; i < bytes; i++)
+            sum += abs((int)p1[i] - (int)p2[i]);
+    }
+    return sum;
+}
+
+#ifdef STABILIZE_AVX2
+__attribute__((target("avx2")))
+static uint64_t rows_sad_avx2(const unsigned char* p1, const unsigned char* p2,
+                              int rows, int bytes, int pitch, uint64_t limit)
+{
+    uint64_t sum = 0;
+    int i, j;
+    for (j = 0; j < rows && sum < limit; j++, p1 += pitch, p2 += pitch) {
+        __m256i acc = _mm256_setzero_si256();
+        __m128i acc128;
+        for (i = 0; i + 32 <= bytes; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (p1 + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*) (p2 + i));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(a, b));
         }
-        if (d_x > 0) {
-            p1 += d_x * bytesPerPixel;
-        } else {
-            p2 -= d_x * bytesPerPixel;
+        acc128 = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                               _mm256_extracti128_si256(acc, 1));
+        if (i < bytes) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (p1 + i));
+            __m128i b = _mm_loadu_si128((const __m128i*) (p2 + i));
+            acc128 = _mm_add_epi64(acc128, _mm_sad_epu8(a, b));
         }
-#ifdef USE_SSE2
-		__m128i A,B,C,D,E;
-		for (j = 0; j < effectWidth * bytesPerPixel - 16; j++) {
-#else
-		for (j = 0; j < effectWidth * bytesPerPixel; j++) {
+        acc128 = _mm_add_epi64(acc128, _mm_srli_si128(acc128, 8));
+        sum += (unsigned int) _mm_cvtsi128_si32(acc128);
+    }
+    return sum;
+}
+#endif
+
+/**
+   sums the absolute differences of the first bytes of rows rows,
+   which are pitch bytes apart. Stops early once the sum reaches limit.
+   simd is the highest instruction set to use, all of them give the same sum.
+*/
+static uint64_t rows_sad(const unsigned char* p1, const unsigned char* p2,
+                         int rows, int bytes, int pitch, uint64_t limit, int simd)
+{
+#ifdef STABILIZE_AVX2
+    if (simd >= 2 && __builtin_cpu_supports("avx2"))
+        return rows_sad_avx2(p1, p2, rows, bytes, pitch, limit);
 #endif
-            /* fwrite(p1,1,1,pic1);fwrite(p1,1,1,pic1);fwrite(p1,1,1,pic1);
-               fwrite(p2,1,1,pic2);fwrite(p2,1,1,pic2);fwrite(p2,1,1,pic2);
-             */
 #ifdef USE_SSE2
-			A= _mm_loadu_si128((__m128i*)p1); //load unaligned data
-			B= _mm_loadu_si128((__m128i*)p2);
-			C= _mm_sad_epu8(A, B);//diff per 8 bit pixel stored in 2 64 byte values
-			D = _mm_srli_si128(C, 8); // shift first 64 byte value to align at the same as C
-			E = _mm_add_epi32(C, D); // add the 2 values (sum of all diffs)
-			sum+= _mm_cvtsi128_si32(E); //convert _m128i to int
-
-            p1+=16;
-            p2+=16;
-			j+=15;
-#else
-            sum += abs((int)*p1 - (int)*p2);
-            p1++;
-            p2++;
+    if (simd >= 1)
+        return rows_sad_sse2(p1, p2, rows, bytes, pitch, limit);
 #endif
-        }
+    return rows_sad_c(p1, p2, rows, bytes, pitch, limit);
+}
+
+/**
+   compares the two given images and returns the average absolute difference
+   \param d_x shift in x direction
+   \param d_y shift in y direction
+   \param limit the comparison may stop once the result is known to be
+   at least limit, the returned value is then not below limit
+   \param simd the highest instruction set to use (see StabData)
+*/
+double compareImg(unsigned char* I1, unsigned char* I2,
+                  int width, int height,  int bytesPerPixel, int d_x, int d_y,
+                  double limit, int simd)
+{
+    unsigned char* p1 = I1;
+    unsigned char* p2 = I2;
+    int effectWidth = width - abs(d_x);
+    int effectHeight = height - abs(d_y);
+    double count = (double) effectWidth * effectHeight * bytesPerPixel;
+
+    if (d_y > 0 ){
+        p1 += d_y * width * bytesPerPixel;
+    } else {
+        p2 -= d_y * width * bytesPerPixel;
+    }
+    if (d_x > 0) {
+        p1 += d_x * bytesPerPixel;
+    } else {
+        p2 -= d_x * bytesPerPixel;
     }
-    /*  fclose(pic1);
-        fclose(pic2);
-     */
-    return sum/((double) effectWidth * effectHeight * bytesPerPixel);
+    return rows_sad(p1, p2, effectHeight,
+                    compared_bytes(effectWidth * bytesPerPixel),
+                    width * bytesPerPixel, sad_limit(limit, count), simd) / count;
 }
 
 /**
@@ -188,48 +273,25 @@ double compareImg(unsigned char* I1, unsigned char* I2,
    \param field Field specifies position(center) and size of subimage
    \param d_x shift in x direction
    \param d_y shift in y direction
+   \param limit the comparison may stop once the result is known to be
+   at least limit, the returned value is then not below limit
+   \param simd the highest instruction set to use (see StabData)
 */
 double compareSubImg(unsigned char* const I1, unsigned char* const I2,
                      const Field* field,
-                     int width, int height, int bytesPerPixel, int d_x, int d_y)
+                     int width, int height, int bytesPerPixel, int d_x, int d_y,
+                     double limit, int simd)
 {
-    int k, j;
-    unsigned char* p1 = NULL;
-    unsigned char* p2 = NULL;
     int s2 = field->size / 2;
-    double sum=0.0;
-
-    p1=I1 + ((field->x - s2) + (field->y - s2)*width)*bytesPerPixel;
-
-    p2=I2 + ((field->x - s2 + d_x) + (field->y - s2 + d_y)*width)*bytesPerPixel;
-    // TODO: use some mmx or sse stuff here
-#ifdef USE_SSE2
-	__m128i A,B,C,D,E;
-#endif
-    for (j = 0; j < field->size; j++){
-#ifdef USE_SSE2
-			for (k = 0; k < (field->size * bytesPerPixel) - 16 ; k++) {
-				A= _mm_loadu_si128((__m128i*)p1); //load unaligned data
-				B= _mm_loadu_si128((__m128i*)p2);
-				C= _mm_sad_epu8(A, B);//abd diff stored in 2 64 byte values
-				D = _mm_srli_si128(C, 8); // shift value 8 byte right
-				E = _mm_add_epi32(C, D); // add the 2 values (sum of all diffs)
-				sum+= _mm_cvtsi128_si32(E); //convert _m128i to int
-
-            p1+=16;
-            p2+=16;
-			k+=15;
-#else
-			for (k = 0; k < (field->size * bytesPerPixel); k++) {
-            sum += abs((int)*p1 - (int)*p2);
-            p1++;
-            p2++;
-#endif
-        }
-        p1 += ((width - field->size) * bytesPerPixel);
-        p2 += ((width - field->size) * bytesPerPixel);
-    }
-    return sum/((double) field->size *field->size* bytesPerPixel);
+    int bytes = compared_bytes(field->size * bytesPerPixel);
+    double count = (double) field->size * field->size * bytesPerPixel;
+    unsigned char* p1 = I1 + ((field->x - s2) + (field->y - s2)*width)*bytesPerPixel;
+    unsigned char* p2 = I2 + ((field->x - s2 + d_x) + (field->y - s2 + d_y)*width)*bytesPerPixel;
+
+    // The rows advance by the bytes compared, not by the field size
+    return rows_sad(p1, p2, field->size, bytes,
+                    bytes + (width - field->size) * bytesPerPixel,
+                    sad_limit(limit, count), simd) / count;
 }
 
 /** \see contrastSubImg called with bytesPerPixel=1*/
@@ -331,7 +393,7 @@ Transform calcShiftRGBSimple(StabData* sd)
     for (i = -sd->maxshift; i <= sd->maxshift; i++) {
         for (j = -sd->maxshift; j <= sd->maxshift; j++) {
             double error = compareImg(sd->curr, sd->prev,
-                                      sd->width, sd->height, 3, i, j);
+                                      sd->width, sd->height, 3, i, j, minerror, sd->simd);
             if (error < minerror) {
                 minerror = error;
                 x = i;
@@ -374,7 +436,7 @@ Transform calcShiftYUVSimple(StabData* sd)
     for (i = -sd->maxshift; i <= sd->maxshift; i++) {
         for (j = -sd->maxshift; j <= sd->maxshift; j++) {
             double error = compareImg(Y_c, Y_p,
-                                      sd->width, sd->height, 1, i, j);
+                                      sd->width, sd->height, 1, i, j, minerror, sd->simd);
 #ifdef STABVERBOSE
             fprintf(f, "%i %i %f\n", i, j, error);
 #endif
@@ -445,7 +507,7 @@ Transform calcFieldTransYUV(StabData* sd, const Field* field, int fieldnum)
     for (i = -sd->maxshift; i <= sd->maxshift; i += sd->stepsize) {
         for (j = -sd->maxshift; j <= sd->maxshift; j += sd->stepsize) {
             error = compareSubImg(Y_c, Y_p, field,
-                                         sd->width, sd->height, 1, i, j);
+                                         sd->width, sd->height, 1, i, j, minerror, sd->simd);
 #ifdef STABVERBOSE
             fprintf(f, "%i %i %f\n", i, j, error);
 #endif
@@ -464,7 +526,7 @@ Transform calcFieldTransYUV(StabData* sd, const Field* field, int fieldnum)
                 if (i == t.x && j == t.y)
                     continue; //no need to check this since already done
                 error = compareSubImg(Y_c, Y_p, field,
-                                      sd->width, sd->height, 1, i, j);
+                                      sd->width, sd->height, 1, i, j, minerror, sd->simd);
 #ifdef STABVERBOSE
                 fprintf(f, "%i %i %f\n", i, j, error);
 #endif
@@ -509,7 +571,7 @@ Transform calcFieldTransRGB(StabData* sd, const Field* field, int fieldnum)
     for (i = -sd->maxshift; i <= sd->maxshift; i += 2) {
         for (j=-sd->maxshift; j <= sd->maxshift; j += 2) {
             double error = compareSubImg(I_c, I_p, field,
-                                         sd->width, sd->height, 3, i, j);
+                                         sd->width, sd->height, 3, i, j, minerror, sd->simd);
             if (error < minerror) {
                 minerror = error;
                 t.x = i;
@@ -520,7 +582,7 @@ Transform calcFieldTransRGB(StabData* sd, const Field* field, int fieldnum)
     for (i = t.x - 1; i <= t.x + 1; i += 2) {
         for (j = -t.y - 1; j <= t.y + 1; j += 2) {
             double error = compareSubImg(I_c, I_p, field,
-                                         sd->width, sd->height, 3, i, j);
+                                         sd->width, sd->height, 3, i, j, minerror, sd->simd);
             if (error < minerror) {
                 minerror = error;
                 t.x = i;
@@ -537,6 +599,77 @@ Transform calcFieldTransRGB(StabData* sd, const Field* field, int fieldnum)
     return t;
 }
 
+/* one share of the fields measured for a frame, see measure_fields */
+typedef struct _field_job {
+    StabData* sd;
+    calcFieldTransFunc fieldfunc; // fills ts for the fields in indices
+    contrastSubImgFunc contrastfunc; // or fills ci for all fields
+    const int* indices;
+    Transform* ts;
+    contrast_idx* ci;
+    int count;
+    int first;
+    int step;
+} field_job;
+
+static void* measure_fields_thread(void* arg)
+{
+    field_job* job = arg;
+    int k;
+    for (k = job->first; k < job->count; k += job->step) {
+        if (job->fieldfunc) {
+            int i = job->indices[k];
+            job->ts[k] = job->fieldfunc(job->sd, &job->sd->fields[i], i);
+        } else {
+            job->ci[k].contrast = job->contrastfunc(job->sd, &job->sd->fields[k]);
+        }
+    }
+    return NULL;
+}
+
+/* measures the fields of a job on up to sd->threads threads.
+   Every field is measured independently, so the results do not depend
+   on the number of threads.
+*/
+static void measure_fields(StabData* sd, const field_job* job)
+{
+    int threads = MIN(sd->threads, job->count);
+    field_job* jobs = NULL;
+    pthread_t* ids = NULL;
+    int* started = NULL;
+    int i;
+
+    if (threads > 1) {
+        jobs = malloc(sizeof(field_job) * threads);
+        ids = malloc(sizeof(pthread_t) * threads);
+        started = calloc(threads, sizeof(int));
+    }
+    if (!jobs || !ids || !started) {
+        field_job single = *job;
+        single.first = 0;
+        single.step = 1;
+        measure_fields_thread(&single);
+    } else {
+        for (i = 0; i < threads; i++) {
+            jobs[i] = *job;
+            jobs[i].first = i;
+            jobs[i].step = threads;
+        }
+        // The first share runs on this thread
+        for (i = 1; i < threads; i++)
+            started[i] = !pthread_create(&ids[i], NULL, measure_fields_thread, &jobs[i]);
+        for (i = 0; i < threads; i++)
+            if (!started[i])
+                measure_fields_thread(&jobs[i]);
+        for (i = 1; i < threads; i++)
+            if (started[i])
+                pthread_join(ids[i], NULL);
+    }
+    free(jobs);
+    free(ids);
+    free(started);
+}
+
 /* compares contrast_idx structures respect to the contrast
    (for sort function)
 */
@@ -565,8 +698,14 @@ tlist* selectfields(StabData* sd, contrastSubImgFunc contrastfunc)
     contrast_idx *ci_segms = malloc(sizeof(contrast_idx) * sd->field_num);
     int remaining   = 0;
     // calculate contrast for each field
+    field_job job;
+    memset(&job, 0, sizeof(job));
+    job.sd = sd;
+    job.contrastfunc = contrastfunc;
+    job.ci = ci;
+    job.count = sd->field_num;
+    measure_fields(sd, &job);
     for (i = 0; i < sd->field_num; i++) {
-        ci[i].contrast = contrastfunc(sd, &sd->fields[i]);
         ci[i].index=i;
         if(ci[i].contrast < sd->contrast_threshold) ci[i].contrast = 0;
         // else printf("%i %lf\n", ci[i].index, ci[i].contrast);
@@ -646,12 +785,28 @@ Transform calcTransFields(StabData* sd, calcFieldTransFunc fieldfunc,
 
 
     tlist* goodflds = selectfields(sd, contrastfunc);
+    Transform* fts = malloc(sizeof(Transform) * sd->field_num);
+    int* fis = malloc(sizeof(int) * sd->field_num);
+    int num_good = 0;
 
     // use all "good" fields and calculate optimal match to previous frame
     contrast_idx* f;
     while((f = (contrast_idx*)tlist_pop(goodflds,0) ) != 0){
-        int i = f->index;
-        t =  fieldfunc(sd, &sd->fields[i], i); // e.g. calcFieldTransYUV
+        fis[num_good++] = f->index;
+    }
+    field_job job;
+    memset(&job, 0, sizeof(job));
+    job.sd = sd;
+    job.fieldfunc = fieldfunc; // e.g. calcFieldTransYUV
+    job.indices = fis;
+    job.ts = fts;
+    job.count = num_good;
+    measure_fields(sd, &job);
+
+    int k;
+    for (k = 0; k < num_good; k++) {
+        int i = fis[k];
+        t = fts[k];
 #ifdef STABVERBOSE
         fprintf(f, "%i %i\n%f %f %i\n \n\n", sd->fields[i].x, sd->fields[i].y,
                 sd->fields[i].x + t.x, sd->fields[i].y + t.y, t.extra);
@@ -663,6 +818,8 @@ Transform calcTransFields(StabData* sd, calcFieldTransFunc fieldfunc,
         }
     }
     tlist_fini(goodflds);
+    free(fts);
+    free(fis);
 
     t = null_transform();
     num_trans = index; // amount of transforms we actually have
@@ -825,6 +982,12 @@ int stabilize_configure(StabData* instance
     sd->currcopy = 0;
     sd->hasSeenOneFrame = 0;
     sd->transs = 0;
+    sd->transs_end = 0;
+    if (sd->threads < 1)
+        sd->threads = 1;
+#ifdef STABILIZE_AVX2
+    __builtin_cpu_init();
+#endif
     sd->allowmax   = 0;
     sd->field_size  = MIN(sd->width, sd->height)/12;
     sd->maxanglevariation = 1;
@@ -88,6 +88,7 @@ typedef struct _stab_data {
     /* list of transforms*/
     //TCList* transs;
     tlist* transs;
+    tlist* transs_end; // empty last element of transs, so appending does not walk the list
 
     Field* fields;
 
@@ -111,6 +112,8 @@ typedef struct _stab_data {
     /* meta parameter for maxshift and fieldsize between 1 and 10 */
     int shakiness;   
     int accuracy;   // meta parameter for number of fields between 1 and 10
+    int threads;    // number of threads measuring the fields of a frame
+    int simd;       // instruction set comparing the images: 0 C, 1 SSE2, 2 AVX2
   
     int t;
 
@@ -148,10 +151,12 @@ static const char stabilize_help[] = ""
 
 int initFields(StabData* sd);
 double compareImg(unsigned char* I1, unsigned char* I2, 
-		  int width, int height,  int bytesPerPixel, int d_x, int d_y);
+		  int width, int height,  int bytesPerPixel, int d_x, int d_y,
+		  double limit, int simd);
 double compareSubImg(unsigned char* const I1, unsigned char* const I2, 
 		     const Field* field, 
-		     int width, int height, int bytesPerPixel,int d_x,int d_y);
+		     int width, int height, int bytesPerPixel,int d_x,int d_y,
+		     double limit, int simd);
 double contrastSubImgYUV(StabData* sd, const Field* field);
 double contrastSubImgRGB(StabData* sd, const Field* field);
 double contrastSubImg(unsigned char* const I, const Field* field, 
@@ -29,36 +29,25 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #define YADIF_MODE_TEMPORAL_SPATIAL (0)
 #define YADIF_MODE_TEMPORAL (2)
 
+#define FIELD_CACHE_SIZE 4
+#define MIN_SLICE_ROWS 32
+
 static yadif_filter *init_yadif( int width, int height )
 {
 	yadif_filter *yadif = mlt_pool_alloc( sizeof( *yadif ) );
 
-	yadif->cpu = 0; // Pure C
-#ifdef USE_SSE
-	yadif->cpu |= AVS_CPU_INTEGER_SSE;
-#endif
-#ifdef USE_SSE2
-	yadif->cpu |= AVS_CPU_SSE2;
-#endif
-	// Create intermediate planar planes
+	yadif->cpu = yadif_cpu_flags();
+	// Create intermediate planar planes for the result; the sources are yadif_planes
 	yadif->yheight = height;
 	yadif->ywidth  = width;
 	yadif->uvwidth = yadif->ywidth / 2;
 	yadif->ypitch  = ( yadif->ywidth +  15 ) / 16 * 16;
 	yadif->uvpitch = ( yadif->uvwidth + 15 ) / 16 * 16;
-	yadif->ysrc  = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->ypitch );
-	yadif->usrc  = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->uvpitch);
-	yadif->vsrc  = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->uvpitch );
-	yadif->yprev = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->ypitch );
-	yadif->uprev = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->uvpitch );
-	yadif->vprev = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->uvpitch );
-	yadif->ynext = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->ypitch );
-	yadif->unext = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->uvpitch );
-	yadif->vnext = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->uvpitch );
 	yadif->ydest = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->ypitch );
 	yadif->udest = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->uvpitch );
 	yadif->vdest = (unsigned char *) mlt_pool_alloc( yadif->yheight * yadif->uvpitch );
@@ -68,48 +57,457 @@ static yadif_filter *init_yadif( int width, int height )
 
 static void close_yadif(yadif_filter *yadif)
 {
-	mlt_pool_release( yadif->ysrc );
-	mlt_pool_release( yadif->usrc );
-	mlt_pool_release( yadif->vsrc );
-	mlt_pool_release( yadif->yprev );
-	mlt_pool_release( yadif->uprev );
-	mlt_pool_release( yadif->vprev );
-	mlt_pool_release( yadif->ynext );
-	mlt_pool_release( yadif->unext );
-	mlt_pool_release( yadif->vnext );
 	mlt_pool_release( yadif->ydest );
 	mlt_pool_release( yadif->udest );
 	mlt_pool_release( yadif->vdest );
 	mlt_pool_release( yadif );
+}
+
+/** An unfiltered neighbouring image converted to planes for yadif.
+*/
+
+typedef struct
+{
+	mlt_producer producer;    /**< the producer and position identify the image */
+	mlt_position position;
+	int width;
+	int height;
+	int progressive;
+	int refcount;             /**< one for each user, the cache does not count */
+	int cached;
+	unsigned int used;        /**< cache clock value of the last use */
+	uint8_t *y, *u, *v;
+} yadif_planes;
+
+/** The planes of the previous and next frames, shared by consecutive frames.
+
+    The next frame of position N is the previous frame of position N + 2, so
+    keeping them here saves fetching and converting the previous image.
+*/
+
+typedef struct
+{
+	yadif_planes *entries[ FIELD_CACHE_SIZE ];
+	unsigned int clock;
+} field_cache;
+
+static int plane_pitch( int width )
+{
+	return ( width + 15 ) / 16 * 16;
+}
+
+static yadif_planes *planes_new( mlt_producer producer, mlt_position position, int width, int height )
+{
+	yadif_planes *planes = calloc( 1, sizeof( *planes ) );
+	if ( planes )
+	{
+		int ypitch = plane_pitch( width );
+		int uvpitch = plane_pitch( width / 2 );
+		planes->producer = producer;
+		planes->position = position;
+		planes->width = width;
+		planes->height = height;
+		planes->refcount = 1;
+		planes->y = mlt_pool_alloc( height * ( ypitch + 2 * uvpitch ) );
+		planes->u = planes->y + height * ypitch;
+		planes->v = planes->u + height * uvpitch;
+		if ( !planes->y )
+		{
+			free( planes );
+			planes = NULL;
+		}
+	}
+	return planes;
+}
+
+static void planes_close( yadif_planes *planes )
+{
+	if ( planes )
+	{
+		mlt_pool_release( planes->y );
+		free( planes );
+	}
+}
+
+static void field_cache_close( field_cache *cache )
+{
+	int i;
+	for ( i = 0; i < FIELD_CACHE_SIZE; i++ )
+		planes_close( cache->entries[i] );
+	free( cache );
+}
 
-#if defined(__GNUC__) && !defined(PIC)
-	// Set SSSE3 bit to cpu
-	asm (\
-	"mov $1, %%eax \n\t"\
-	"push %%ebx \n\t"\
-	"cpuid \n\t"\
-	"pop %%ebx \n\t"\
-	"mov %%ecx, %%edx \n\t"\
-	"shr $9, %%edx \n\t"\
-	"and $1, %%edx \n\t"\
-	"shl $9, %%edx \n\t"\
-	"and $511, %%ebx \n\t"\
-	"or %%edx, %%ebx \n\t"\
-	: "=b"(yadif->cpu) : "p"(yadif->cpu) : "%eax", "%ecx", "%edx");
-#endif
+/** Find converted planes and take a reference to them.
+*/
+
+static yadif_planes *field_cache_get( mlt_filter filter, mlt_producer producer, mlt_position position, int width, int height )
+{
+	field_cache *cache = mlt_properties_get_data( MLT_FILTER_PROPERTIES( filter ), "_field_cache", NULL );
+	yadif_planes *result = NULL;
+	int i;
+
+	mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
+	for ( i = 0; cache && i < FIELD_CACHE_SIZE; i++ )
+	{
+		yadif_planes *planes = cache->entries[i];
+		if ( planes && planes->producer == producer && planes->position == position &&
+			 planes->width == width && planes->height == height )
+		{
+			planes->refcount++;
+			planes->used = ++cache->clock;
+			result = planes;
+			break;
+		}
+	}
+	mlt_service_unlock( MLT_FILTER_SERVICE( filter ) );
+	return result;
+}
+
+/** Offer newly converted planes to the cache, replacing the least recently
+    used entry that is not in use.
+*/
+
+static void field_cache_put( mlt_filter filter, yadif_planes *planes )
+{
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	field_cache *cache;
+	int i, slot = -1;
+
+	mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
+	cache = mlt_properties_get_data( properties, "_field_cache", NULL );
+	if ( !cache )
+	{
+		cache = calloc( 1, sizeof( *cache ) );
+		mlt_properties_set_data( properties, "_field_cache", cache, 0, (mlt_destructor) field_cache_close, NULL );
+	}
+	for ( i = 0; cache && i < FIELD_CACHE_SIZE; i++ )
+	{
+		yadif_planes *entry = cache->entries[i];
+		if ( entry && entry->producer == planes->producer && entry->position == planes->position &&
+			 entry->width == planes->width && entry->height == planes->height )
+		{
+			// Another thread got here first
+			slot = -1;
+			break;
+		}
+		if ( !entry )
+			slot = i;
+		else if ( entry->refcount == 0 && ( slot < 0 || ( cache->entries[slot] && entry->used < cache->entries[slot]->used ) ) )
+			slot = i;
+	}
+	if ( slot >= 0 )
+	{
+		planes_close( cache->entries[slot] );
+		cache->entries[slot] = planes;
+		planes->cached = 1;
+		planes->used = ++cache->clock;
+	}
+	mlt_service_unlock( MLT_FILTER_SERVICE( filter ) );
+}
+
+static void field_cache_release( mlt_filter filter, yadif_planes *planes )
+{
+	if ( planes )
+	{
+		mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
+		int unused = --planes->refcount == 0 && !planes->cached;
+		mlt_service_unlock( MLT_FILTER_SERVICE( filter ) );
+		if ( unused )
+			planes_close( planes );
+	}
+}
+
+/** One horizontal band of the image processed by a thread.
+*/
+
+typedef struct
+{
+	int stage;
+	int mode;
+	int order;
+	int width;
+	int height;
+	int start;
+	int end;
+	int ypitch;
+	int uvpitch;
+	int cpu;
+	uint8_t *image;
+	yadif_planes *current;
+	yadif_planes *previous;
+	yadif_planes *next;
+	uint8_t *previous_image;  /**< packed image still to be converted or NULL */
+	uint8_t *next_image;      /**< packed image still to be converted or NULL */
+	uint8_t *ydest, *udest, *vdest;
+} yadif_slice;
+
+static void convert_rows( yadif_slice *slice, uint8_t *image, yadif_planes *planes )
+{
+	int pitch = slice->width << 1;
+	int rows = slice->end - slice->start;
+	YUY2ToPlanes( image + slice->start * pitch, pitch, slice->width, rows,
+		planes->y + slice->start * slice->ypitch, slice->ypitch,
+		planes->u + slice->start * slice->uvpitch, planes->v + slice->start * slice->uvpitch,
+		slice->uvpitch, slice->cpu );
+}
+
+static void *yadif_slice_run( void *arg )
+{
+	yadif_slice *slice = arg;
+	const int parity = 0;
+
+	if ( slice->stage == 0 )
+	{
+		// Convert packed to planar
+		convert_rows( slice, slice->image, slice->current );
+		if ( slice->previous_image )
+			convert_rows( slice, slice->previous_image, slice->previous );
+		if ( slice->next_image )
+			convert_rows( slice, slice->next_image, slice->next );
+	}
+	else
+	{
+		// Deinterlace each plane
+		filter_plane_slice( slice->mode, slice->ydest, slice->ypitch, slice->previous->y, slice->current->y,
+			slice->next->y, slice->ypitch, slice->width, slice->height, parity, slice->order, slice->cpu,
+			slice->start, slice->end );
+		filter_plane_slice( slice->mode, slice->udest, slice->uvpitch, slice->previous->u, slice->current->u,
+			slice->next->u, slice->uvpitch, slice->width >> 1, slice->height, parity, slice->order, slice->cpu,
+			slice->start, slice->end );
+		filter_plane_slice( slice->mode, slice->vdest, slice->uvpitch, slice->previous->v, slice->current->v,
+			slice->next->v, slice->uvpitch, slice->width >> 1, slice->height, parity, slice->order, slice->cpu,
+			slice->start, slice->end );
+
+		// Convert planar to packed
+		YUY2FromPlanes( slice->image + slice->start * ( slice->width << 1 ), slice->width << 1,
+			slice->width, slice->end - slice->start,
+			slice->ydest + slice->start * slice->ypitch, slice->ypitch,
+			slice->udest + slice->start * slice->uvpitch, slice->vdest + slice->start * slice->uvpitch,
+			slice->uvpitch, slice->cpu );
+	}
+	return NULL;
+}
+
+/** The threads that run the slices, kept for the lifetime of the filter.
+
+    Starting threads for every stage of every frame is a large share of the
+    work at SD and HD sizes, so the workers wait here for the next stage.
+*/
+
+typedef struct
+{
+	pthread_mutex_t busy;     /**< held by the frame using the workers */
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	int count;                /**< the number of threads started */
+	int stop;
+	yadif_slice *slices;      /**< the stage being run */
+	int slice_count;
+	int next;                 /**< the next slice to take */
+	int pending;              /**< the slices not finished */
+} slice_pool;
+
+/** Take the next slice of the stage and run it.
+    \return false if there was none left
+    The caller must hold the pool mutex, which is released while running.
+*/
+
+static int slice_pool_run_next( slice_pool *pool )
+{
+	yadif_slice *slice;
+
+	if ( pool->next >= pool->slice_count )
+		return 0;
+	slice = &pool->slices[ pool->next++ ];
+	pthread_mutex_unlock( &pool->mutex );
+	yadif_slice_run( slice );
+	pthread_mutex_lock( &pool->mutex );
+	if ( --pool->pending == 0 )
+		pthread_cond_signal( &pool->done_cond );
+	return 1;
+}
+
+static void *slice_pool_worker( void *arg )
+{
+	slice_pool *pool = arg;
+
+	pthread_mutex_lock( &pool->mutex );
+	while ( !pool->stop )
+	{
+		if ( !slice_pool_run_next( pool ) )
+			pthread_cond_wait( &pool->work_cond, &pool->mutex );
+	}
+	pthread_mutex_unlock( &pool->mutex );
+	return NULL;
+}
+
+static void slice_pool_close( slice_pool *pool )
+{
+	int i;
+
+	pthread_mutex_lock( &pool->mutex );
+	pool->stop = 1;
+	pthread_cond_broadcast( &pool->work_cond );
+	pthread_mutex_unlock( &pool->mutex );
+	for ( i = 0; i < pool->count; i++ )
+		pthread_join( pool->threads[i], NULL );
+	pthread_mutex_destroy( &pool->busy );
+	pthread_mutex_destroy( &pool->mutex );
+	pthread_cond_destroy( &pool->work_cond );
+	pthread_cond_destroy( &pool->done_cond );
+	free( pool->threads );
+	free( pool );
+}
+
+/** Get the filter's workers, starting more of them if needed.
+    \return the pool, reserved for the caller, or NULL if it is in use
+*/
+
+static slice_pool *slice_pool_acquire( mlt_filter filter, int threads )
+{
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	slice_pool *pool;
+
+	mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
+	pool = mlt_properties_get_data( properties, "_slice_pool", NULL );
+	if ( !pool )
+	{
+		pool = calloc( 1, sizeof( *pool ) );
+		if ( pool )
+		{
+			pthread_mutex_init( &pool->busy, NULL );
+			pthread_mutex_init( &pool->mutex, NULL );
+			pthread_cond_init( &pool->work_cond, NULL );
+			pthread_cond_init( &pool->done_cond, NULL );
+			mlt_properties_set_data( properties, "_slice_pool", pool, 0, (mlt_destructor) slice_pool_close, NULL );
+		}
+	}
+	mlt_service_unlock( MLT_FILTER_SERVICE( filter ) );
+
+	// Frames filtered at the same time by other threads run on their own thread
+	if ( !pool || pthread_mutex_trylock( &pool->busy ) )
+		return NULL;
+	if ( pool->count < threads )
+	{
+		pthread_t *grown = realloc( pool->threads, threads * sizeof( *grown ) );
+		if ( grown )
+		{
+			pool->threads = grown;
+			while ( pool->count < threads && !pthread_create( &pool->threads[ pool->count ], NULL, slice_pool_worker, pool ) )
+				pool->count++;
+		}
+	}
+	return pool;
+}
+
+static void slice_pool_release( slice_pool *pool )
+{
+	if ( pool )
+		pthread_mutex_unlock( &pool->busy );
+}
+
+/** Run a stage over all slices, on the workers and the calling thread.
+*/
+
+static void run_slices( slice_pool *pool, yadif_slice *slices, int count, int stage )
+{
+	int i;
+
+	for ( i = 0; i < count; i++ )
+		slices[i].stage = stage;
+	if ( !pool || !pool->count )
+	{
+		for ( i = 0; i < count; i++ )
+			yadif_slice_run( &slices[i] );
+		return;
+	}
+	pthread_mutex_lock( &pool->mutex );
+	pool->slices = slices;
+	pool->slice_count = count;
+	pool->next = 0;
+	pool->pending = count;
+	pthread_cond_broadcast( &pool->work_cond );
+	while ( slice_pool_run_next( pool ) )
+		;
+	while ( pool->pending > 0 )
+		pthread_cond_wait( &pool->done_cond, &pool->mutex );
+	pool->slices = NULL;
+	pool->slice_count = 0;
+	pool->next = 0;
+	pthread_mutex_unlock( &pool->mutex );
+}
+
+static int yadif_threads( mlt_filter filter, int height )
+{
+	mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+	int threads = mlt_properties_get_int( properties, "threads" );
+	if ( !mlt_properties_get( properties, "threads" ) && getenv( "MLT_DEINTERLACE_THREADS" ) )
+		threads = atoi( getenv( "MLT_DEINTERLACE_THREADS" ) );
+	if ( threads > height / MIN_SLICE_ROWS )
+		threads = height / MIN_SLICE_ROWS;
+	return threads < 1 ? 1 : threads;
+}
+
+/** Get an unfiltered neighbouring frame's planes from the cache or convert its image.
+ *
+ * The neighbour is shared with the frames around this one and must stay as it
+ * is, so an image that is not yuv422 yet is converted on a private frame,
+ * returned in \p converted for closing once the planes are filled.
+*/
+
+static yadif_planes *neighbour_planes( mlt_filter filter, mlt_frame frame, mlt_frame neighbour, int width, int height, uint8_t **image, mlt_frame *converted, int *error )
+{
+	mlt_producer producer = mlt_frame_get_original_producer( neighbour );
+	mlt_position position = mlt_frame_original_position( neighbour );
+	yadif_planes *planes = field_cache_get( filter, producer, position, width, height );
+
+	*image = NULL;
+	*converted = NULL;
+	if ( !planes )
+	{
+		mlt_image_format format = mlt_image_yuv422;
+		int neighbour_width = width;
+		int neighbour_height = height;
+		*error = mlt_frame_get_image( neighbour, image, &format, &neighbour_width, &neighbour_height, 0 );
+		if ( !*error && *image )
+		{
+			planes = planes_new( producer, position, neighbour_width, neighbour_height );
+			if ( planes )
+				planes->progressive = mlt_properties_get_int( MLT_FRAME_PROPERTIES( neighbour ), "progressive" );
+			if ( planes && !planes->progressive && format != mlt_image_yuv422 && frame->convert_image )
+			{
+				*converted = mlt_frame_init( NULL );
+				if ( *converted )
+				{
+					mlt_properties converted_properties = MLT_FRAME_PROPERTIES( *converted );
+					mlt_properties_set_int( converted_properties, "format", format );
+					mlt_properties_set_int( converted_properties, "width", neighbour_width );
+					mlt_properties_set_int( converted_properties, "height", neighbour_height );
+					mlt_frame_set_image( *converted, *image, 0, NULL );
+					frame->convert_image( *converted, image, &format, mlt_image_yuv422 );
+				}
+			}
+			if ( planes && !planes->progressive && format != mlt_image_yuv422 )
+				*error = 1;
+		}
+	}
+	return planes;
 }
 
 static int deinterlace_yadif( mlt_frame frame, mlt_filter filter, uint8_t **image, mlt_image_format *format, int *width, int *height, int mode )
 {
 	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
-	mlt_frame previous_frame = mlt_properties_get_data( properties, "previous frame", NULL );
+	mlt_frame previous_frame = mlt_frame_get_neighbour( frame, -1 );
 	uint8_t* previous_image = NULL;
-	int previous_width = *width;
-	int previous_height = *height;
-	mlt_frame next_frame = mlt_properties_get_data( properties, "next frame", NULL );
+	mlt_frame next_frame = mlt_frame_get_neighbour( frame, 1 );
 	uint8_t* next_image = NULL;
-	int next_width = *width;
-	int next_height = *height;
+	mlt_frame previous_converted = NULL;
+	mlt_frame next_converted = NULL;
+	yadif_planes *previous = NULL;
+	yadif_planes *next = NULL;
+	int error = 0;
 	
 	mlt_log_debug( MLT_FILTER_SERVICE(filter), "previous " MLT_POSITION_FMT " current " MLT_POSITION_FMT " next " MLT_POSITION_FMT "\n",
 		previous_frame? mlt_frame_original_position(previous_frame) : -1,
@@ -119,56 +517,84 @@ static int deinterlace_yadif( mlt_frame frame, mlt_filter filter, uint8_t **imag
 	if ( !previous_frame || !next_frame )
 		return 1;
 
-	// Get the preceding frame's image
-	int error = mlt_frame_get_image( previous_frame, &previous_image, format, &previous_width, &previous_height, 0 );
-	int progressive = mlt_properties_get_int( MLT_FRAME_PROPERTIES( previous_frame ), "progressive" );
+	// The neighbours are shared with the frames around this one, so hold them
+	// until their images have been copied into planes
+	mlt_frame_neighbour_lock( previous_frame );
+	mlt_frame_neighbour_lock( next_frame );
+
+	// Get the preceding frame's image unless its planes are still around
+	previous = neighbour_planes( filter, frame, previous_frame, *width, *height, &previous_image, &previous_converted, &error );
 
 	// Check that we aren't already progressive
-	if ( !error && previous_image && !progressive )
+	if ( !error && previous && !previous->progressive )
 	{
-		// OK, now we know we have work to do and can request the image in our format
-		frame->convert_image( previous_frame, &previous_image, format, mlt_image_yuv422 );
-
-		// Get the current frame's image
+		// OK, now we know we have work to do and can request the image in our
+		// format, writable as the result goes into it
 		*format = mlt_image_yuv422;
-		error = mlt_frame_get_image( frame, image, format, width, height, 0 );
+		error = mlt_frame_get_image( frame, image, format, width, height, 1 );
 
-		if ( !error && *image && *format == mlt_image_yuv422 )
+		if ( !error && *image && *format == mlt_image_yuv422 &&
+			 previous->width == *width && previous->height == *height )
 		{
-			// Get the following frame's image
-			error = mlt_frame_get_image( next_frame, &next_image, format, &next_width, &next_height, 0 );
+			// Get the following frame's image unless its planes are still around
+			next = neighbour_planes( filter, frame, next_frame, *width, *height, &next_image, &next_converted, &error );
 		
-			if ( !error && next_image && *format == mlt_image_yuv422 )
+			if ( !error && next && next->width == *width && next->height == *height )
 			{
-				yadif_filter *yadif = init_yadif( *width, *height );
+				yadif_planes *current = planes_new( NULL, 0, *width, *height );
+				yadif_filter *yadif = current ? init_yadif( *width, *height ) : NULL;
 				if ( yadif )
 				{
-					const int order = mlt_properties_get_int( properties, "top_field_first" );
-					const int pitch = *width << 1;
-					const int parity = 0;
-
-					// Convert packed to planar
-					YUY2ToPlanes( *image, pitch, *width, *height, yadif->ysrc,
-						yadif->ypitch, yadif->usrc, yadif->vsrc, yadif->uvpitch, yadif->cpu );
-					YUY2ToPlanes( previous_image, pitch, *width, *height, yadif->yprev,
-						yadif->ypitch, yadif->uprev, yadif->vprev, yadif->uvpitch, yadif->cpu );
-					YUY2ToPlanes( next_image, pitch, *width, *height, yadif->ynext,
-						yadif->ypitch, yadif->unext, yadif->vnext, yadif->uvpitch, yadif->cpu );
-
-					// Deinterlace each plane
-					filter_plane( mode, yadif->ydest, yadif->ypitch, yadif->yprev, yadif->ysrc,
-						yadif->ynext, yadif->ypitch, *width, *height, parity, order, yadif->cpu);
-					filter_plane( mode, yadif->udest, yadif->uvpitch,yadif->uprev, yadif->usrc,
-						yadif->unext, yadif->uvpitch, *width >> 1, *height, parity, order, yadif->cpu);
-					filter_plane( mode, yadif->vdest, yadif->uvpitch, yadif->vprev, yadif->vsrc,
-						yadif->vnext, yadif->uvpitch, *width >> 1, *height, parity, order, yadif->cpu);
-
-					// Convert planar to packed
-					YUY2FromPlanes( *image, pitch, *width, *height, yadif->ydest,
-						yadif->ypitch, yadif->udest, yadif->vdest, yadif->uvpitch, yadif->cpu);
-
+					int count = yadif_threads( filter, *height );
+					yadif_slice *slices = calloc( count, sizeof( *slices ) );
+					slice_pool *pool = count > 1 ? slice_pool_acquire( filter, count - 1 ) : NULL;
+					int i;
+
+					for ( i = 0; slices && i < count; i++ )
+					{
+						yadif_slice *slice = &slices[i];
+						slice->mode = mode;
+						slice->order = mlt_properties_get_int( properties, "top_field_first" );
+						slice->width = *width;
+						slice->height = *height;
+						slice->start = *height * i / count;
+						slice->end = *height * ( i + 1 ) / count;
+						slice->ypitch = yadif->ypitch;
+						slice->uvpitch = yadif->uvpitch;
+						slice->cpu = yadif->cpu;
+						slice->image = *image;
+						slice->current = current;
+						slice->previous = previous;
+						slice->next = next;
+						slice->previous_image = previous_image;
+						slice->next_image = next_image;
+						slice->ydest = yadif->ydest;
+						slice->udest = yadif->udest;
+						slice->vdest = yadif->vdest;
+					}
+					if ( slices )
+					{
+						// All rows must be planar before any are filtered
+						run_slices( pool, slices, count, 0 );
+						mlt_frame_close( next_converted );
+						mlt_frame_close( previous_converted );
+						next_converted = previous_converted = NULL;
+						mlt_frame_neighbour_unlock( next_frame );
+						mlt_frame_neighbour_unlock( previous_frame );
+						next_frame = previous_frame = NULL;
+						run_slices( pool, slices, count, 1 );
+
+						// The neighbours are unfiltered, so they can serve the next frames
+						if ( previous_image )
+							field_cache_put( filter, previous );
+						if ( next_image )
+							field_cache_put( filter, next );
+					}
+					slice_pool_release( pool );
+					free( slices );
 					close_yadif( yadif );
 				}
+				planes_close( current );
 			}
 		}
 	}
@@ -177,6 +603,14 @@ static int deinterlace_yadif( mlt_frame frame, mlt_filter filter, uint8_t **imag
 		// Get the current frame's image
 		error = mlt_frame_get_image( frame, image, format, width, height, 0 );
 	}
+	if ( next_frame )
+		mlt_frame_neighbour_unlock( next_frame );
+	if ( previous_frame )
+		mlt_frame_neighbour_unlock( previous_frame );
+	mlt_frame_close( next_converted );
+	mlt_frame_close( previous_converted );
+	field_cache_release( filter, previous );
+	field_cache_release( filter, next );
 	return error;
 }
 
@@ -240,8 +674,6 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 		}
 		if ( error || ( method > DEINTERLACE_NONE && method < DEINTERLACE_YADIF ) )
 		{
-			mlt_service service = mlt_properties_get_data( MLT_FILTER_PROPERTIES(filter), "service", NULL );
-
 			// Get the current frame's image
 			int error2 = mlt_frame_get_image( frame, image, format, width, height, writable );
 			progressive = mlt_properties_get_int( properties, "progressive" );
@@ -252,12 +684,12 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 				// If YADIF requested, prev/next cancelled because some previous frames were progressive,
 				// but new frames are interlaced, then turn prev/next frames back on.
 				if ( !progressive )
-					mlt_properties_set_int( MLT_SERVICE_PROPERTIES(service), "_need_previous_next", 1 );
+					mlt_properties_set_int( MLT_FILTER_PROPERTIES(filter), "_temporal_radius", 1 );
 			}
 			else
 			{
 				// Signal that we no longer need previous and next frames
-				mlt_properties_set_int( MLT_SERVICE_PROPERTIES(service), "_need_previous_next", 0 );
+				mlt_properties_set_int( MLT_FILTER_PROPERTIES(filter), "_temporal_radius", 0 );
 			}
 			error = error2;
 			
@@ -305,9 +737,7 @@ static int filter_get_image( mlt_frame frame, uint8_t **image, mlt_image_format
 	if ( !deinterlace || progressive )
 	{
 		// Signal that we no longer need previous and next frames
-		mlt_service service = mlt_properties_get_data( MLT_FILTER_PROPERTIES(filter), "service", NULL );
-		if ( service )
-			mlt_properties_set_int( MLT_SERVICE_PROPERTIES(service), "_need_previous_next", 0 );
+		mlt_properties_set_int( MLT_FILTER_PROPERTIES(filter), "_temporal_radius", 0 );
 	}
 
 	return error;
@@ -327,12 +757,6 @@ static mlt_frame deinterlace_process( mlt_filter filter, mlt_frame frame )
 	return frame;
 }
 
-static void on_service_changed( mlt_service owner, mlt_service filter )
-{
-	mlt_service service = mlt_properties_get_data( MLT_SERVICE_PROPERTIES(filter), "service", NULL );
-	mlt_properties_set_int( MLT_SERVICE_PROPERTIES(service), "_need_previous_next", 1 );
-}
-
 /** Constructor for the filter.
 */
 
@@ -343,7 +767,8 @@ mlt_filter filter_deinterlace_init( mlt_profile profile, mlt_service_type type,
 	{
 		filter->process = deinterlace_process;
 		mlt_properties_set( MLT_FILTER_PROPERTIES( filter ), "method", arg );
-		mlt_events_listen( MLT_FILTER_PROPERTIES( filter ), filter, "service-changed", (mlt_listener) on_service_changed );
+		// Ask the producer for the previous and next frames
+		mlt_properties_set_int( MLT_FILTER_PROPERTIES( filter ), "_temporal_radius", 1 );
 	}
 	return filter;
 }
@@ -32,7 +32,7 @@
 #define MIN3(a,b,c) MIN(MIN(a,b),c)
 #define MAX3(a,b,c) MAX(MAX(a,b),c)
 
-static void (*filter_line)(int mode, uint8_t *dst, const uint8_t *prev, const uint8_t *cur, const uint8_t *next, int w, int refs, int parity);
+typedef void (*filter_line_func)(int mode, uint8_t *dst, const uint8_t *prev, const uint8_t *cur, const uint8_t *next, int w, int refs, int parity);
 
 #if defined(__GNUC__) && defined(USE_SSE)
 
@@ -346,6 +346,92 @@ static void filter_line_c(int mode, uint8_t *dst, const uint8_t *prev, const uin
     }
 }
 
+// ================= AVX2 =================
+#ifdef YADIF_AVX2
+#include <immintrin.h>
+
+// 16 pixels widened to 16 bit words
+#define LOAD16(p) _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (p)))
+#define ABSDIFF(a,b) _mm256_abs_epi16(_mm256_sub_epi16(a, b))
+#define AVG(a,b) _mm256_srli_epi16(_mm256_add_epi16(a, b), 1)
+#define SCORE(j) _mm256_add_epi16(_mm256_add_epi16(\
+            ABSDIFF(LOAD16(cur - refs - 1 + (j)), LOAD16(cur + refs - 1 - (j))),\
+            ABSDIFF(LOAD16(cur - refs + (j)), LOAD16(cur + refs - (j)))),\
+            ABSDIFF(LOAD16(cur - refs + 1 + (j)), LOAD16(cur + refs + 1 - (j))))
+// Same as the nested CHECK of the C version: dir 2 is only tested when dir 1 won
+#define CHECK_DIRS(j1,j2)\
+        {   __m256i score = SCORE(j1);\
+            __m256i better = _mm256_cmpgt_epi16(spatial_score, score);\
+            spatial_score = _mm256_blendv_epi8(spatial_score, score, better);\
+            spatial_pred = _mm256_blendv_epi8(spatial_pred, AVG(LOAD16(cur - refs + (j1)), LOAD16(cur + refs - (j1))), better);\
+            score = SCORE(j2);\
+            better = _mm256_and_si256(better, _mm256_cmpgt_epi16(spatial_score, score));\
+            spatial_score = _mm256_blendv_epi8(spatial_score, score, better);\
+            spatial_pred = _mm256_blendv_epi8(spatial_pred, AVG(LOAD16(cur - refs + (j2)), LOAD16(cur + refs - (j2))), better);\
+        }
+
+__attribute__((target("avx2")))
+static void filter_line_avx2(int mode, uint8_t *dst, const uint8_t *prev, const uint8_t *cur, const uint8_t *next, int w, int refs, int parity){
+    int x;
+    const uint8_t *prev2= parity ? prev : cur ;
+    const uint8_t *next2= parity ? cur  : next;
+    const __m256i one = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for(x=0; x+16<=w; x+=16){
+        __m256i c = LOAD16(cur - refs);
+        __m256i e = LOAD16(cur + refs);
+        __m256i p2 = LOAD16(prev2);
+        __m256i n2 = LOAD16(next2);
+        __m256i d = AVG(p2, n2);
+        __m256i temporal_diff0 = ABSDIFF(p2, n2);
+        __m256i temporal_diff1 = AVG(ABSDIFF(LOAD16(prev - refs), c), ABSDIFF(LOAD16(prev + refs), e));
+        __m256i temporal_diff2 = AVG(ABSDIFF(LOAD16(next - refs), c), ABSDIFF(LOAD16(next + refs), e));
+        __m256i diff = _mm256_max_epi16(_mm256_max_epi16(_mm256_srli_epi16(temporal_diff0, 1), temporal_diff1), temporal_diff2);
+        __m256i spatial_pred = AVG(c, e);
+        __m256i spatial_score = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(
+                                    ABSDIFF(LOAD16(cur - refs - 1), LOAD16(cur + refs - 1)), ABSDIFF(c, e)),
+                                    ABSDIFF(LOAD16(cur - refs + 1), LOAD16(cur + refs + 1))), one);
+
+        CHECK_DIRS(-1, -2)
+        CHECK_DIRS( 1,  2)
+
+        if(mode<2){
+            __m256i b = AVG(LOAD16(prev2 - 2*refs), LOAD16(next2 - 2*refs));
+            __m256i f = AVG(LOAD16(prev2 + 2*refs), LOAD16(next2 + 2*refs));
+            __m256i dc = _mm256_sub_epi16(d, c);
+            __m256i de = _mm256_sub_epi16(d, e);
+            __m256i bc = _mm256_sub_epi16(b, c);
+            __m256i fe = _mm256_sub_epi16(f, e);
+            __m256i max = _mm256_max_epi16(_mm256_max_epi16(de, dc), _mm256_min_epi16(bc, fe));
+            __m256i min = _mm256_min_epi16(_mm256_min_epi16(de, dc), _mm256_max_epi16(bc, fe));
+
+            diff = _mm256_max_epi16(_mm256_max_epi16(diff, min), _mm256_sub_epi16(zero, max));
+        }
+
+        spatial_pred = _mm256_max_epi16(spatial_pred, _mm256_sub_epi16(d, diff));
+        spatial_pred = _mm256_min_epi16(spatial_pred, _mm256_add_epi16(d, diff));
+        // packus works within 128 bit lanes; gather the two low quadwords
+        spatial_pred = _mm256_permute4x64_epi64(_mm256_packus_epi16(spatial_pred, spatial_pred), 0xd8);
+        _mm_storeu_si128((__m128i*) dst, _mm256_castsi256_si128(spatial_pred));
+
+        dst += 16;
+        cur += 16;
+        prev += 16;
+        next += 16;
+        prev2 += 16;
+        next2 += 16;
+    }
+    if(x<w)
+        filter_line_c(mode, dst, prev, cur, next, w - x, refs, parity);
+}
+#undef LOAD16
+#undef ABSDIFF
+#undef AVG
+#undef SCORE
+#undef CHECK_DIRS
+#endif // YADIF_AVX2
+
 static void interpolate(uint8_t *dst, const uint8_t *cur0,  const uint8_t *cur2, int w)
 {
     int x;
@@ -354,10 +440,15 @@ static void interpolate(uint8_t *dst, const uint8_t *cur0,  const uint8_t *cur2,
     }
 }
 
-void filter_plane(int mode, uint8_t *dst, int dst_stride, const uint8_t *prev0, const uint8_t *cur0, const uint8_t *next0, int refs, int w, int h, int parity, int tff, int cpu){
+void filter_plane_slice(int mode, uint8_t *dst, int dst_stride, const uint8_t *prev0, const uint8_t *cur0, const uint8_t *next0, int refs, int w, int h, int parity, int tff, int cpu, int start, int end){
 
 	int y;
-	filter_line = filter_line_c;
+	filter_line_func filter_line = filter_line_c;
+#ifdef YADIF_AVX2
+	if (cpu & AVS_CPU_AVX2)
+		filter_line = filter_line_avx2;
+	else
+#endif
 #ifdef __GNUC__
 #if (__GNUC__ > 4 || __GNUC__ == 4 && __GNUC_MINOR__>1)
 #ifdef USE_SSE3
@@ -376,48 +467,69 @@ void filter_plane(int mode, uint8_t *dst, int dst_stride, const uint8_t *prev0,
 		filter_line = filter_line_mmx2;
 #endif
 #endif // GNUC
-        y=0;
-        if(((y ^ parity) & 1)){
-            memcpy(dst, cur0 + refs, w);// duplicate 1
-        }else{
-            memcpy(dst, cur0, w);
-        }
-        y=1;
-        if(((y ^ parity) & 1)){
-            interpolate(dst + dst_stride, cur0, cur0 + refs*2, w);   // interpolate 0 and 2
-        }else{
-            memcpy(dst + dst_stride, cur0 + refs, w); // copy original
-        }
-        for(y=2; y<h-2; y++){
-            if(((y ^ parity) & 1)){
+        for(y=start; y<end; y++){
+            uint8_t *dst2= dst + y*dst_stride;
+            if(y == h-1){
+                if(((y ^ parity) & 1)){
+                    memcpy(dst2, cur0 + (h-2)*refs, w); // duplicate h-2
+                }else{
+                    memcpy(dst2, cur0 + (h-1)*refs, w); // copy original
+                }
+            }else if(y == h-2){
+                if(((y ^ parity) & 1)){
+                    interpolate(dst2, cur0 + (h-3)*refs, cur0 + (h-1)*refs, w);   // interpolate h-3 and h-1
+                }else{
+                    memcpy(dst2, cur0 + (h-2)*refs, w); // copy original
+                }
+            }else if(y == 1){
+                if(((y ^ parity) & 1)){
+                    interpolate(dst2, cur0, cur0 + refs*2, w);   // interpolate 0 and 2
+                }else{
+                    memcpy(dst2, cur0 + refs, w); // copy original
+                }
+            }else if(y == 0){
+                if(((y ^ parity) & 1)){
+                    memcpy(dst2, cur0 + refs, w);// duplicate 1
+                }else{
+                    memcpy(dst2, cur0, w);
+                }
+            }else if(((y ^ parity) & 1)){
                 const uint8_t *prev= prev0 + y*refs;
                 const uint8_t *cur = cur0 + y*refs;
                 const uint8_t *next= next0 + y*refs;
-                uint8_t *dst2= dst + y*dst_stride;
                 filter_line(mode, dst2, prev, cur, next, w, refs, (parity ^ tff));
             }else{
-                memcpy(dst + y*dst_stride, cur0 + y*refs, w); // copy original
+                memcpy(dst2, cur0 + y*refs, w); // copy original
             }
         }
-       y=h-2;
-        if(((y ^ parity) & 1)){
-            interpolate(dst + (h-2)*dst_stride, cur0 + (h-3)*refs, cur0 + (h-1)*refs, w);   // interpolate h-3 and h-1
-        }else{
-            memcpy(dst + (h-2)*dst_stride, cur0 + (h-2)*refs, w); // copy original
-        }
-        y=h-1;
-        if(((y ^ parity) & 1)){
-            memcpy(dst + (h-1)*dst_stride, cur0 + (h-2)*refs, w); // duplicate h-2
-        }else{
-            memcpy(dst + (h-1)*dst_stride, cur0 + (h-1)*refs, w); // copy original
-        }
 
 #if defined(__GNUC__) && defined(USE_SSE)
-	if (cpu >= AVS_CPU_INTEGER_SSE)
+	if (cpu >= AVS_CPU_INTEGER_SSE && !(cpu & AVS_CPU_AVX2))
 		asm volatile("emms");
 #endif
 }
 
+void filter_plane(int mode, uint8_t *dst, int dst_stride, const uint8_t *prev0, const uint8_t *cur0, const uint8_t *next0, int refs, int w, int h, int parity, int tff, int cpu){
+	filter_plane_slice(mode, dst, dst_stride, prev0, cur0, next0, refs, w, h, parity, tff, cpu, 0, h);
+}
+
+int yadif_cpu_flags(void)
+{
+	int cpu = 0; // Pure C
+#ifdef USE_SSE
+	cpu |= AVS_CPU_INTEGER_SSE;
+#endif
+#ifdef USE_SSE2
+	cpu |= AVS_CPU_SSE2;
+#endif
+#ifdef YADIF_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		cpu |= AVS_CPU_AVX2;
+#endif
+	return cpu;
+}
+
 #if defined(__GNUC__) && defined(USE_SSE) && !defined(PIC)
 static attribute_align_arg void  YUY2ToPlanes_mmx(const unsigned char *srcYUY2, int pitch_yuy2, int width, int height,
                     unsigned char *py, int pitch_y,
@@ -30,6 +30,12 @@
 #define AVS_CPU_INTEGER_SSE 0x1
 #define AVS_CPU_SSE2 0x2
 #define AVS_CPU_SSSE3 0x4
+#define AVS_CPU_AVX2 0x8
+
+// The AVX2 line filter is selected at run time and needs GCC 4.9 for target attributes
+#if defined(__GNUC__) && (__GNUC__ > 4 || __GNUC__ == 4 && __GNUC_MINOR__ >= 9) && defined(ARCH_X86_64)
+#define YADIF_AVX2
+#endif
 
 typedef struct yadif_filter  {
 	int cpu; // optimization
@@ -52,7 +58,9 @@ typedef struct yadif_filter  {
 	unsigned char *vdest;
 } yadif_filter;
 
+int yadif_cpu_flags(void);
 void filter_plane(int mode, uint8_t *dst, int dst_stride, const uint8_t *prev0, const uint8_t *cur0, const uint8_t *next0, int refs, int w, int h, int parity, int tff, int cpu);
+void filter_plane_slice(int mode, uint8_t *dst, int dst_stride, const uint8_t *prev0, const uint8_t *cur0, const uint8_t *next0, int refs, int w, int h, int parity, int tff, int cpu, int start, int end);
 void YUY2ToPlanes(const unsigned char *pSrcYUY2, int nSrcPitchYUY2, int nWidth, int nHeight,
 							   unsigned char * pSrcY, int srcPitchY,
 							   unsigned char * pSrcU,  unsigned char * pSrcV, int srcPitchUV, int cpu);
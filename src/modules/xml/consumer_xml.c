@@ -28,6 +28,8 @@
 #include <pthread.h>
 #include <wchar.h>
 
+#include "xml_binary.h"
+
 #define ID_SIZE 128
 #define TIME_PROPERTY "_consumer_xml"
 
@@ -812,6 +814,47 @@ xmlDocPtr xml_make_doc( mlt_consumer consumer, mlt_service service )
 	return doc;
 }
 
+/** Write the document in the compact binary form read by the mltb producer.
+*/
+
+static void output_binary( mlt_consumer this, xmlDocPtr doc, char *resource )
+{
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( this );
+	uint8_t *buffer = NULL;
+	size_t size = 0;
+
+	if ( mltb_encode( doc, &buffer, &size ) )
+	{
+		mlt_log_error( MLT_CONSUMER_SERVICE( this ), "failed to encode the binary document\n" );
+		return;
+	}
+
+	if ( resource == NULL || !strcmp( resource, "" ) )
+	{
+		fwrite( buffer, 1, size, stdout );
+		free( buffer );
+	}
+	else if ( strchr( resource, '.' ) == NULL )
+	{
+		// Binary data is not a string, so it is stored as a sized data property.
+		mlt_properties_set_data( properties, resource, buffer, size, free, NULL );
+	}
+	else
+	{
+		FILE *file;
+
+		// Convert file name string encoding.
+		mlt_properties_from_utf8( properties, "resource", "_resource" );
+		resource = mlt_properties_get( properties, "_resource" );
+
+		file = fopen( resource, "wb" );
+		if ( file == NULL || fwrite( buffer, 1, size, file ) != size )
+			mlt_log_error( MLT_CONSUMER_SERVICE( this ), "failed to write %s\n", resource );
+		if ( file )
+			fclose( file );
+		free( buffer );
+	}
+}
 
 static void output_xml( mlt_consumer this )
 {
@@ -819,6 +862,8 @@ static void output_xml( mlt_consumer this )
 	mlt_service service = mlt_service_producer( MLT_CONSUMER_SERVICE( this ) );
 	mlt_properties properties = MLT_CONSUMER_PROPERTIES( this );
 	char *resource =  mlt_properties_get( properties, "resource" );
+	const char *service_name = mlt_properties_get( properties, "mlt_service" );
+	int is_binary = service_name && !strcmp( service_name, "mltb" );
 	xmlDocPtr doc = NULL;
 
 	if ( !service ) return;
@@ -852,7 +897,11 @@ static void output_xml( mlt_consumer this )
 	doc = xml_make_doc( this, service );
 
 	// Handle the output
-	if ( resource == NULL || !strcmp( resource, "" ) )
+	if ( is_binary )
+	{
+		output_binary( this, doc, resource );
+	}
+	else if ( resource == NULL || !strcmp( resource, "" ) )
 	{
 		xmlDocFormatDump( stdout, doc, 1 );
 	}
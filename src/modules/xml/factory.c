@@ -35,12 +35,16 @@ static mlt_properties metadata( mlt_service_type type, const char *id, void *dat
 MLT_REPOSITORY
 {
 	MLT_REGISTER( consumer_type, "xml", consumer_xml_init );
+	MLT_REGISTER( consumer_type, "mltb", consumer_xml_init );
 	MLT_REGISTER( producer_type, "xml", producer_xml_init );
 	MLT_REGISTER( producer_type, "xml-string", producer_xml_init );
     MLT_REGISTER( producer_type, "xml-nogl", producer_xml_init );
+	MLT_REGISTER( producer_type, "mltb", producer_xml_init );
 
 	MLT_REGISTER_METADATA( consumer_type, "xml", metadata, "consumer_xml.yml" );
+	MLT_REGISTER_METADATA( consumer_type, "mltb", metadata, "consumer_mltb.yml" );
 	MLT_REGISTER_METADATA( producer_type, "xml", metadata, "producer_xml.yml" );
 	MLT_REGISTER_METADATA( producer_type, "xml-string", metadata, "producer_xml-string.yml" );
     MLT_REGISTER_METADATA( producer_type, "xml-nogl", metadata, "producer_xml-nogl.yml" );
+	MLT_REGISTER_METADATA( producer_type, "mltb", metadata, "producer_mltb.yml" );
 }
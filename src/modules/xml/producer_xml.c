@@ -32,6 +32,8 @@
 #include <libxml/parserInternals.h> // for xmlCreateFileParserCtxt
 #include <libxml/tree.h>
 
+#include "xml_binary.h"
+
 #define STACK_SIZE 1000
 #define BRANCH_SIG_LEN 4000
 
@@ -1218,11 +1220,8 @@ static void on_end_property( deserialise_context context, const xmlChar *name )
 	}
 }
 
-static void on_start_element( void *ctx, const xmlChar *name, const xmlChar **atts)
+static void start_element( deserialise_context context, const xmlChar *name, const xmlChar **atts)
 {
-	struct _xmlParserCtxt *xmlcontext = ( struct _xmlParserCtxt* )ctx;
-	deserialise_context context = ( deserialise_context )( xmlcontext->_private );
-	
 	if ( context->pass == 0 )
 	{
 		if ( xmlStrcmp( name, _x("mlt") ) == 0 ||
@@ -1300,11 +1299,8 @@ static void on_start_element( void *ctx, const xmlChar *name, const xmlChar **at
 	}
 }
 
-static void on_end_element( void *ctx, const xmlChar *name )
+static void end_element( deserialise_context context, const xmlChar *name )
 {
-	struct _xmlParserCtxt *xmlcontext = ( struct _xmlParserCtxt* )ctx;
-	deserialise_context context = ( deserialise_context )( xmlcontext->_private );
-	
 	if ( context->is_value == 1 && context->pass == 1 && xmlStrcmp( name, _x("property") ) != 0 )
 		context_pop_node( context );
 	else if ( xmlStrcmp( name, _x("multitrack") ) == 0 )
@@ -1332,10 +1328,8 @@ static void on_end_element( void *ctx, const xmlChar *name )
 	context->depth --;
 }
 
-static void on_characters( void *ctx, const xmlChar *ch, int len )
+static void characters( deserialise_context context, const xmlChar *ch, int len )
 {
-	struct _xmlParserCtxt *xmlcontext = ( struct _xmlParserCtxt* )ctx;
-	deserialise_context context = ( deserialise_context )( xmlcontext->_private );
 	char *value = calloc( 1, len + 1 );
 	enum service_type type;
 	mlt_service service = context_pop_service( context, &type );
@@ -1377,6 +1371,66 @@ static void on_characters( void *ctx, const xmlChar *ch, int len )
 	free( value);
 }
 
+static void on_start_element( void *ctx, const xmlChar *name, const xmlChar **atts)
+{
+	struct _xmlParserCtxt *xmlcontext = ( struct _xmlParserCtxt* )ctx;
+	start_element( ( deserialise_context )( xmlcontext->_private ), name, atts );
+}
+
+static void on_end_element( void *ctx, const xmlChar *name )
+{
+	struct _xmlParserCtxt *xmlcontext = ( struct _xmlParserCtxt* )ctx;
+	end_element( ( deserialise_context )( xmlcontext->_private ), name );
+}
+
+static void on_characters( void *ctx, const xmlChar *ch, int len )
+{
+	struct _xmlParserCtxt *xmlcontext = ( struct _xmlParserCtxt* )ctx;
+	characters( ( deserialise_context )( xmlcontext->_private ), ch, len );
+}
+
+// The following 4 receive the node stream of a binary (mltb) document.
+static void on_binary_start_element( void *ctx, const xmlChar *name, const xmlChar **atts )
+{
+	start_element( ( deserialise_context )ctx, name, atts );
+}
+
+static void on_binary_end_element( void *ctx, const xmlChar *name )
+{
+	deserialise_context context = ( deserialise_context )ctx;
+	if ( context->pass == 1 )
+		end_element( context, name );
+}
+
+static void on_binary_characters( void *ctx, const xmlChar *ch, int len )
+{
+	characters( ( deserialise_context )ctx, ch, len );
+}
+
+static void on_binary_integer( void *ctx, int value )
+{
+	deserialise_context context = ( deserialise_context )ctx;
+	enum service_type type;
+	mlt_service service = context_pop_service( context, &type );
+
+	if ( service != NULL )
+		context_push_service( context, service, type );
+
+	// Store a property value typed to avoid a later string to number conversion.
+	const char *current = service && context->property ?
+		mlt_properties_get( MLT_SERVICE_PROPERTIES( service ), context->property ) : NULL;
+	if ( current != NULL && current[0] == '\0' && context->stack_node_size == 0 )
+	{
+		mlt_properties_set_int( MLT_SERVICE_PROPERTIES( service ), context->property, value );
+	}
+	else
+	{
+		char temp[ 16 ];
+		int len = snprintf( temp, sizeof( temp ), "%d", value );
+		characters( context, _x(temp), len );
+	}
+}
+
 /** Convert parameters parsed from resource into entity declarations.
 */
 static void params_to_entities( deserialise_context context )
@@ -1610,78 +1664,30 @@ static void retain_services( struct deserialise_context_s *context, mlt_service
 	}
 }
 
-mlt_producer producer_xml_init( mlt_profile profile, mlt_service_type servtype, const char *id, char *data )
+/** Create the qglsl consumer now, if requested, so that glsl.manager
+ *  may exist when trying to load glsl. or movit. services.
+ *  The "if requested" part can come from query string qglsl=1 or when
+ *  a service beginning with glsl. or movit. appears in the XML.
+ */
+
+static void create_qglsl( deserialise_context context, mlt_profile profile, const char *id )
+{
+	if ( mlt_properties_get_int( context->params, "qglsl" ) && strcmp( id, "xml-nogl" )
+		// Only if glslManager does not yet exist.
+		&& !mlt_properties_get_data( mlt_global_properties(), "glslManager", NULL ) )
+		context->qglsl = mlt_factory_consumer( profile, "qglsl", NULL );
+}
+
+/** Run both passes of the SAX parser over a file or string.
+ *
+ * \return true if the document is well formed
+ */
+
+static int parse_xml( deserialise_context context, mlt_profile profile, const char *id, char *data, int is_filename )
 {
 	xmlSAXHandler *sax, *sax_orig;
-	struct deserialise_context_s *context;
-	mlt_properties properties = NULL;
-	int i = 0;
 	struct _xmlParserCtxt *xmlcontext;
 	int well_formed = 0;
-	char *filename = NULL;
-	int is_filename = strcmp( id, "xml-string" );
-
-	// Strip file:// prefix
-	if ( data && strlen( data ) >= 7 && strncmp( data, "file://", 7 ) == 0 )
-		data += 7;
-
-	if ( data == NULL || !strcmp( data, "" ) )
-		return NULL;
-
-	context = calloc( 1, sizeof( struct deserialise_context_s ) );
-	if ( context == NULL )
-		return NULL;
-
-	context->producer_map = mlt_properties_new();
-	context->destructors = mlt_properties_new();
-	context->params = mlt_properties_new();
-	context->profile = profile;
-	context->seekable = 1;
-
-	// Decode URL and parse parameters
-	mlt_properties_set( context->producer_map, "root", "" );
-	if ( is_filename )
-	{
-		mlt_properties_set( context->params, "_mlt_xml_resource", data );
-		filename = mlt_properties_get( context->params, "_mlt_xml_resource" );
-		parse_url( context->params, url_decode( filename, data ) );
-
-		// We need the directory prefix which was used for the xml
-		if ( strchr( filename, '/' ) )
-		{
-			char *root = NULL;
-			mlt_properties_set( context->producer_map, "root", filename );
-			root = mlt_properties_get( context->producer_map, "root" );
-			*( strrchr( root, '/' ) ) = '\0';
-
-			// If we don't have an absolute path here, we're heading for disaster...
-			if ( root[ 0 ] != '/' )
-			{
-				char *cwd = getcwd( NULL, 0 );
-				char *real = malloc( strlen( cwd ) + strlen( root ) + 2 );
-				sprintf( real, "%s/%s", cwd, root );
-				mlt_properties_set( context->producer_map, "root", real );
-				free( real );
-				free( cwd );
-			}
-		}
-
-		// Convert file name string encoding.
-		mlt_properties_from_utf8( context->params, "_mlt_xml_resource", "__mlt_xml_resource" );
-		filename = mlt_properties_get( context->params, "__mlt_xml_resource" );
-
-		if ( !file_exists( filename ) )
-		{
-			mlt_properties_close( context->producer_map );
-			mlt_properties_close( context->destructors );
-			mlt_properties_close( context->params );
-			free( context );
-			return NULL;
-		}
-	}
-
-	// We need to track the number of registered filters
-	mlt_properties_set_int( context->destructors, "registered", 0 );
 
 	// Setup SAX callbacks for first pass
 	sax = calloc( 1, sizeof( xmlSAXHandler ) );
@@ -1697,19 +1703,16 @@ mlt_producer producer_xml_init( mlt_profile profile, mlt_service_type servtype,
 	// This is used to facilitate entity substitution in the SAX parser
 	context->entity_doc = xmlNewDoc( _x("1.0") );
 	if ( is_filename )
-		xmlcontext = xmlCreateFileParserCtxt( filename );
+		xmlcontext = xmlCreateFileParserCtxt( data );
 	else
 		xmlcontext = xmlCreateMemoryParserCtxt( data, strlen( data ) );
 
-	// Invalid context - clean up and return NULL
+	// Invalid context - clean up and return
 	if ( xmlcontext == NULL )
 	{
-		mlt_properties_close( context->producer_map );
-		mlt_properties_close( context->destructors );
-		mlt_properties_close( context->params );
-		free( context );
+		xmlFreeDoc( context->entity_doc );
 		free( sax );
-		return NULL;
+		return 0;
 	}
 
 	// Parse
@@ -1728,45 +1731,30 @@ mlt_producer producer_xml_init( mlt_profile profile, mlt_service_type servtype,
 	context->stack_node_size = 0;
 	context->stack_service_size = 0;
 
-	// Bad xml - clean up and return NULL
+	// Bad xml - clean up and return
 	if ( !well_formed )
 	{
-		mlt_properties_close( context->producer_map );
-		mlt_properties_close( context->destructors );
-		mlt_properties_close( context->params );
 		xmlFreeDoc( context->entity_doc );
-		free( context );
 		free( sax );
-		return NULL;
+		return 0;
 	}
 
 	// Setup the second pass
 	context->pass ++;
 	if ( is_filename )
-		xmlcontext = xmlCreateFileParserCtxt( filename );
+		xmlcontext = xmlCreateFileParserCtxt( data );
 	else
 		xmlcontext = xmlCreateMemoryParserCtxt( data, strlen( data ) );
 
-	// Invalid context - clean up and return NULL
+	// Invalid context - clean up and return
 	if ( xmlcontext == NULL )
 	{
-		mlt_properties_close( context->producer_map );
-		mlt_properties_close( context->destructors );
-		mlt_properties_close( context->params );
 		xmlFreeDoc( context->entity_doc );
-		free( context );
 		free( sax );
-		return NULL;
+		return 0;
 	}
 
-	// Create the qglsl consumer now, if requested, so that glsl.manager
-	// may exist when trying to load glsl. or movit. services.
-	// The "if requested" part can come from query string qglsl=1 or when
-	// a service beginning with glsl. or movit. appears in the XML.
-	if ( mlt_properties_get_int( context->params, "qglsl" ) && strcmp( id, "xml-nogl" )
-		// Only if glslManager does not yet exist.
-		&& !mlt_properties_get_data( mlt_global_properties(), "glslManager", NULL ) )
-		context->qglsl = mlt_factory_consumer( profile, "qglsl", NULL );
+	create_qglsl( context, profile, id );
 
 	// Setup SAX callbacks for second pass
 	sax->endElement = on_end_element;
@@ -1792,6 +1780,125 @@ mlt_producer producer_xml_init( mlt_profile profile, mlt_service_type servtype,
 		xmlFreeDoc( xmlcontext->myDoc );
 	xmlFreeParserCtxt( xmlcontext );
 
+	return well_formed;
+}
+
+/** Run both passes over a memory mapped binary document.
+ *
+ * The node stream carries the same elements as the XML, so the same handlers
+ * build the service network, but there is no text parsing, escaping or
+ * entity substitution involved.
+ *
+ * \return true if the document is well formed
+ */
+
+static int parse_binary( deserialise_context context, mlt_profile profile, const char *id, const char *filename )
+{
+	mltb_handler handler = {
+		on_binary_start_element,
+		on_binary_end_element,
+		on_binary_characters,
+		on_binary_integer
+	};
+	mltb_reader reader = mltb_reader_open( filename );
+	int well_formed = 0;
+
+	if ( reader == NULL )
+	{
+		mlt_log_error( NULL, "[producer_xml] not a binary MLT document: %s\n", filename );
+		return 0;
+	}
+
+	if ( !mltb_reader_parse( reader, &handler, context ) )
+	{
+		context->stack_node_size = 0;
+		context->stack_service_size = 0;
+		context->pass ++;
+		create_qglsl( context, profile, id );
+		well_formed = !mltb_reader_parse( reader, &handler, context );
+	}
+	mltb_reader_close( reader );
+
+	return well_formed;
+}
+
+mlt_producer producer_xml_init( mlt_profile profile, mlt_service_type servtype, const char *id, char *data )
+{
+	struct deserialise_context_s *context;
+	mlt_properties properties = NULL;
+	int i = 0;
+	int well_formed = 0;
+	char *filename = NULL;
+	int is_filename = strcmp( id, "xml-string" );
+	int is_binary = !strcmp( id, "mltb" );
+
+	// Strip file:// prefix
+	if ( data && strlen( data ) >= 7 && strncmp( data, "file://", 7 ) == 0 )
+		data += 7;
+
+	if ( data == NULL || !strcmp( data, "" ) )
+		return NULL;
+
+	context = calloc( 1, sizeof( struct deserialise_context_s ) );
+	if ( context == NULL )
+		return NULL;
+
+	context->producer_map = mlt_properties_new();
+	context->destructors = mlt_properties_new();
+	context->params = mlt_properties_new();
+	context->profile = profile;
+	context->seekable = 1;
+
+	// Decode URL and parse parameters
+	mlt_properties_set( context->producer_map, "root", "" );
+	if ( is_filename )
+	{
+		mlt_properties_set( context->params, "_mlt_xml_resource", data );
+		filename = mlt_properties_get( context->params, "_mlt_xml_resource" );
+		parse_url( context->params, url_decode( filename, data ) );
+
+		// We need the directory prefix which was used for the xml
+		if ( strchr( filename, '/' ) )
+		{
+			char *root = NULL;
+			mlt_properties_set( context->producer_map, "root", filename );
+			root = mlt_properties_get( context->producer_map, "root" );
+			*( strrchr( root, '/' ) ) = '\0';
+
+			// If we don't have an absolute path here, we're heading for disaster...
+			if ( root[ 0 ] != '/' )
+			{
+				char *cwd = getcwd( NULL, 0 );
+				char *real = malloc( strlen( cwd ) + strlen( root ) + 2 );
+				sprintf( real, "%s/%s", cwd, root );
+				mlt_properties_set( context->producer_map, "root", real );
+				free( real );
+				free( cwd );
+			}
+		}
+
+		// Convert file name string encoding.
+		mlt_properties_from_utf8( context->params, "_mlt_xml_resource", "__mlt_xml_resource" );
+		filename = mlt_properties_get( context->params, "__mlt_xml_resource" );
+
+		if ( !file_exists( filename ) )
+		{
+			mlt_properties_close( context->producer_map );
+			mlt_properties_close( context->destructors );
+			mlt_properties_close( context->params );
+			free( context );
+			return NULL;
+		}
+	}
+
+	// We need to track the number of registered filters
+	mlt_properties_set_int( context->destructors, "registered", 0 );
+
+	if ( is_binary )
+		well_formed = parse_binary( context, profile, id, filename );
+	else
+		well_formed = parse_xml( context, profile, id, is_filename ? filename : data, is_filename );
+
 	// Get the last producer on the stack
 	enum service_type type;
 	mlt_service service = context_pop_service( context, &type );
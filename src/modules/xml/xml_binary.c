@@ -0,0 +1,562 @@
+/*
+ * xml_binary.c -- compact binary encoding of the MLT XML document model
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "xml_binary.h"
+
+#include <framework/mlt_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+/** A growable byte buffer.
+*/
+
+typedef struct
+{
+	uint8_t *data;
+	size_t size;
+	size_t alloc;
+}
+buffer_s;
+
+static int buffer_reserve( buffer_s *buffer, size_t extra )
+{
+	if ( buffer->size + extra > buffer->alloc )
+	{
+		size_t alloc = buffer->alloc ? buffer->alloc * 2 : 4096;
+		uint8_t *data;
+		while ( alloc < buffer->size + extra )
+			alloc *= 2;
+		data = realloc( buffer->data, alloc );
+		if ( data == NULL )
+			return 1;
+		buffer->data = data;
+		buffer->alloc = alloc;
+	}
+	return 0;
+}
+
+static int buffer_append( buffer_s *buffer, const void *data, size_t size )
+{
+	if ( buffer_reserve( buffer, size ) )
+		return 1;
+	memcpy( buffer->data + buffer->size, data, size );
+	buffer->size += size;
+	return 0;
+}
+
+static int buffer_put_u32( buffer_s *buffer, uint32_t value )
+{
+	uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+	return buffer_append( buffer, bytes, 4 );
+}
+
+static int buffer_put_varint( buffer_s *buffer, uint32_t value )
+{
+	uint8_t bytes[5];
+	int n = 0;
+	while ( value >= 0x80 )
+	{
+		bytes[ n++ ] = ( value & 0x7f ) | 0x80;
+		value >>= 7;
+	}
+	bytes[ n++ ] = value;
+	return buffer_append( buffer, bytes, n );
+}
+
+static inline uint32_t read_u32( const uint8_t *p )
+{
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t) p[3] << 24 );
+}
+
+/** The string table is an open addressing hash of string to index.
+*/
+
+typedef struct
+{
+	buffer_s blob;
+	buffer_s offsets;
+	uint32_t *slots;
+	uint32_t slot_count;
+	uint32_t count;
+}
+string_table_s;
+
+static uint32_t hash_string( const char *s )
+{
+	uint32_t hash = 2166136261u;
+	while ( *s )
+		hash = ( hash ^ (uint8_t) *s++ ) * 16777619u;
+	return hash;
+}
+
+static int string_table_grow( string_table_s *table )
+{
+	uint32_t slot_count = table->slot_count ? table->slot_count * 2 : 1024;
+	uint32_t *slots = malloc( slot_count * sizeof( uint32_t ) );
+	uint32_t i;
+
+	if ( slots == NULL )
+		return 1;
+	memset( slots, 0xff, slot_count * sizeof( uint32_t ) );
+	for ( i = 0; i < table->count; i++ )
+	{
+		const char *s = (const char*) table->blob.data + read_u32( table->offsets.data + i * 4 );
+		uint32_t slot = hash_string( s ) & ( slot_count - 1 );
+		while ( slots[ slot ] != UINT32_MAX )
+			slot = ( slot + 1 ) & ( slot_count - 1 );
+		slots[ slot ] = i;
+	}
+	free( table->slots );
+	table->slots = slots;
+	table->slot_count = slot_count;
+	return 0;
+}
+
+/** Get the index of a string, adding it to the table when first seen.
+*/
+
+static int string_table_index( string_table_s *table, const char *s, uint32_t *index )
+{
+	uint32_t slot;
+
+	if ( s == NULL )
+		s = "";
+	if ( table->count * 2 >= table->slot_count && string_table_grow( table ) )
+		return 1;
+
+	slot = hash_string( s ) & ( table->slot_count - 1 );
+	while ( table->slots[ slot ] != UINT32_MAX )
+	{
+		uint32_t i = table->slots[ slot ];
+		if ( !strcmp( s, (const char*) table->blob.data + read_u32( table->offsets.data + i * 4 ) ) )
+		{
+			*index = i;
+			return 0;
+		}
+		slot = ( slot + 1 ) & ( table->slot_count - 1 );
+	}
+
+	if ( buffer_put_u32( &table->offsets, table->blob.size ) ||
+	     buffer_append( &table->blob, s, strlen( s ) + 1 ) )
+		return 1;
+	*index = table->slots[ slot ] = table->count++;
+	return 0;
+}
+
+static int put_string( buffer_s *nodes, string_table_s *table, const char *s )
+{
+	uint32_t index;
+	return string_table_index( table, s, &index ) || buffer_put_varint( nodes, index );
+}
+
+/** Determine if text is exactly how "%d" would print an int.
+*/
+
+static int is_canonical_int( const char *s, int *value )
+{
+	char temp[ 16 ];
+	char *end = NULL;
+	long n;
+
+	if ( s == NULL || *s == '\0' || strlen( s ) >= sizeof( temp ) )
+		return 0;
+	errno = 0;
+	n = strtol( s, &end, 10 );
+	if ( errno || *end || n < INT_MIN || n > INT_MAX )
+		return 0;
+	snprintf( temp, sizeof( temp ), "%d", (int) n );
+	if ( strcmp( temp, s ) )
+		return 0;
+	*value = n;
+	return 1;
+}
+
+static int encode_node( xmlNodePtr node, buffer_s *nodes, string_table_s *table )
+{
+	for ( ; node != NULL; node = node->next )
+	{
+		if ( node->type == XML_ELEMENT_NODE )
+		{
+			xmlAttrPtr attr;
+			uint32_t count = 0;
+			uint8_t op = mltb_op_start;
+
+			for ( attr = node->properties; attr != NULL; attr = attr->next )
+				count++;
+			if ( buffer_append( nodes, &op, 1 ) ||
+			     put_string( nodes, table, (const char*) node->name ) ||
+			     buffer_put_varint( nodes, count ) )
+				return 1;
+			for ( attr = node->properties; attr != NULL; attr = attr->next )
+			{
+				const xmlChar *value = attr->children ? attr->children->content : NULL;
+				if ( put_string( nodes, table, (const char*) attr->name ) ||
+				     put_string( nodes, table, (const char*) value ) )
+					return 1;
+			}
+			if ( encode_node( node->children, nodes, table ) )
+				return 1;
+			op = mltb_op_end;
+			if ( buffer_append( nodes, &op, 1 ) )
+				return 1;
+		}
+		else if ( ( node->type == XML_TEXT_NODE || node->type == XML_CDATA_SECTION_NODE ) && node->content )
+		{
+			const char *text = (const char*) node->content;
+			int value;
+			uint8_t op;
+
+			if ( is_canonical_int( text, &value ) )
+			{
+				op = mltb_op_int;
+				if ( buffer_append( nodes, &op, 1 ) ||
+				     buffer_put_varint( nodes, ( (uint32_t) value << 1 ) ^ (uint32_t) ( value >> 31 ) ) )
+					return 1;
+			}
+			else
+			{
+				op = mltb_op_text;
+				if ( buffer_append( nodes, &op, 1 ) || put_string( nodes, table, text ) )
+					return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/** Encode a document to a newly allocated buffer.
+ *
+ * \param doc the document to encode, as made by xml_make_doc()
+ * \param buffer receives the encoded bytes, which the caller must free
+ * \param size receives the number of bytes
+ * \return true if there was an error
+ */
+
+int mltb_encode( xmlDocPtr doc, uint8_t **buffer, size_t *size )
+{
+	string_table_s table;
+	buffer_s nodes;
+	buffer_s out;
+	int error;
+
+	memset( &table, 0, sizeof( table ) );
+	memset( &nodes, 0, sizeof( nodes ) );
+	memset( &out, 0, sizeof( out ) );
+
+	error = encode_node( xmlDocGetRootElement( doc ), &nodes, &table );
+	if ( !error )
+	{
+		uint32_t offsets_offset = MLTB_HEADER_SIZE;
+		uint32_t strings_offset = offsets_offset + table.offsets.size;
+		uint32_t nodes_offset = strings_offset + table.blob.size;
+
+		error = buffer_reserve( &out, nodes_offset + nodes.size ) ||
+			buffer_append( &out, MLTB_MAGIC, 4 ) ||
+			buffer_put_u32( &out, MLTB_VERSION ) ||
+			buffer_put_u32( &out, table.count ) ||
+			buffer_put_u32( &out, offsets_offset ) ||
+			buffer_put_u32( &out, strings_offset ) ||
+			buffer_put_u32( &out, table.blob.size ) ||
+			buffer_put_u32( &out, nodes_offset ) ||
+			buffer_put_u32( &out, nodes.size ) ||
+			buffer_append( &out, table.offsets.data, table.offsets.size ) ||
+			buffer_append( &out, table.blob.data, table.blob.size ) ||
+			buffer_append( &out, nodes.data, nodes.size );
+	}
+
+	free( table.blob.data );
+	free( table.offsets.data );
+	free( table.slots );
+	free( nodes.data );
+
+	if ( error )
+	{
+		free( out.data );
+		return 1;
+	}
+	*buffer = out.data;
+	*size = out.size;
+	return 0;
+}
+
+struct mltb_reader_s
+{
+	uint8_t *data;
+	size_t size;
+	int is_mapped;
+	const xmlChar **strings;
+	uint32_t count;
+	const uint8_t *nodes;
+	size_t nodes_size;
+};
+
+static int reader_validate( mltb_reader self )
+{
+	const uint8_t *p = self->data;
+	uint32_t offsets_offset, strings_offset, strings_size, nodes_offset, nodes_size, i;
+
+	if ( self->size < MLTB_HEADER_SIZE || memcmp( p, MLTB_MAGIC, 4 ) )
+		return 1;
+	if ( read_u32( p + 4 ) != MLTB_VERSION )
+	{
+		mlt_log_error( NULL, "[producer_xml] unsupported binary version %u\n", read_u32( p + 4 ) );
+		return 1;
+	}
+	self->count = read_u32( p + 8 );
+	offsets_offset = read_u32( p + 12 );
+	strings_offset = read_u32( p + 16 );
+	strings_size = read_u32( p + 20 );
+	nodes_offset = read_u32( p + 24 );
+	nodes_size = read_u32( p + 28 );
+
+	if ( (uint64_t) offsets_offset + (uint64_t) self->count * 4 > self->size ||
+	     (uint64_t) strings_offset + strings_size > self->size ||
+	     (uint64_t) nodes_offset + nodes_size > self->size ||
+	     ( strings_size > 0 && p[ strings_offset + strings_size - 1 ] != '\0' ) )
+		return 1;
+
+	// Strings are used in place: only their addresses are computed here.
+	self->strings = malloc( ( self->count + 1 ) * sizeof( xmlChar* ) );
+	if ( self->strings == NULL )
+		return 1;
+	for ( i = 0; i < self->count; i++ )
+	{
+		uint32_t offset = read_u32( p + offsets_offset + i * 4 );
+		if ( offset >= strings_size )
+			return 1;
+		self->strings[ i ] = (const xmlChar*) p + strings_offset + offset;
+	}
+	self->nodes = p + nodes_offset;
+	self->nodes_size = nodes_size;
+	return 0;
+}
+
+/** Open a binary document, mapping it into memory.
+ *
+ * \param filename the file to open
+ * \return a reader or NULL if the file is not a valid binary document
+ */
+
+mltb_reader mltb_reader_open( const char *filename )
+{
+	mltb_reader self = calloc( 1, sizeof( struct mltb_reader_s ) );
+	struct stat st;
+	int fd;
+
+	if ( self == NULL )
+		return NULL;
+	fd = open( filename, O_RDONLY );
+	if ( fd < 0 || fstat( fd, &st ) || st.st_size < MLTB_HEADER_SIZE )
+	{
+		if ( fd >= 0 )
+			close( fd );
+		free( self );
+		return NULL;
+	}
+	self->size = st.st_size;
+#ifndef WIN32
+	self->data = mmap( NULL, self->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( self->data == MAP_FAILED )
+		self->data = NULL;
+	else
+		self->is_mapped = 1;
+#endif
+	if ( self->data == NULL )
+	{
+		size_t n = 0;
+		ssize_t r = 0;
+		self->data = malloc( self->size );
+		while ( self->data && n < self->size && ( r = read( fd, self->data + n, self->size - n ) ) > 0 )
+			n += r;
+		if ( n < self->size )
+		{
+			free( self->data );
+			self->data = NULL;
+		}
+	}
+	close( fd );
+
+	if ( self->data == NULL || reader_validate( self ) )
+	{
+		mltb_reader_close( self );
+		return NULL;
+	}
+	return self;
+}
+
+static int read_varint( const uint8_t **p, const uint8_t *end, uint32_t *value )
+{
+	uint32_t result = 0;
+	int shift = 0;
+	while ( *p < end && shift < 35 )
+	{
+		uint8_t byte = *( *p )++;
+		result |= (uint32_t) ( byte & 0x7f ) << shift;
+		if ( !( byte & 0x80 ) )
+		{
+			*value = result;
+			return 0;
+		}
+		shift += 7;
+	}
+	return 1;
+}
+
+static int read_string( mltb_reader self, const uint8_t **p, const uint8_t *end, const xmlChar **s )
+{
+	uint32_t index;
+	if ( read_varint( p, end, &index ) || index >= self->count )
+		return 1;
+	*s = self->strings[ index ];
+	return 0;
+}
+
+/** Walk the node stream, calling the handler for each item.
+ *
+ * \param self a reader
+ * \param handler the callbacks
+ * \param context passed to the callbacks
+ * \return true if the document is malformed
+ */
+
+int mltb_reader_parse( mltb_reader self, mltb_handler *handler, void *context )
+{
+	const uint8_t *p = self->nodes;
+	const uint8_t *end = self->nodes + self->nodes_size;
+	const xmlChar **stack = NULL;
+	const xmlChar **atts = NULL;
+	int stack_size = 0, stack_alloc = 0, atts_alloc = 0;
+	int error = 0;
+
+	while ( !error && p < end )
+	{
+		uint8_t op = *p++;
+		switch ( op )
+		{
+		case mltb_op_start:
+		{
+			const xmlChar *name;
+			uint32_t count, i;
+			if ( read_string( self, &p, end, &name ) || read_varint( &p, end, &count ) || count > ( end - p ) / 2 )
+			{
+				error = 1;
+				break;
+			}
+			if ( (int) count * 2 + 1 > atts_alloc )
+			{
+				const xmlChar **grown = realloc( atts, ( count * 2 + 1 ) * sizeof( xmlChar* ) );
+				if ( !grown )
+				{
+					error = 1;
+					break;
+				}
+				atts = grown;
+				atts_alloc = count * 2 + 1;
+			}
+			if ( stack_size == stack_alloc )
+			{
+				int size = stack_alloc ? stack_alloc * 2 : 64;
+				const xmlChar **grown = realloc( stack, size * sizeof( xmlChar* ) );
+				if ( !grown )
+				{
+					error = 1;
+					break;
+				}
+				stack = grown;
+				stack_alloc = size;
+			}
+			for ( i = 0; !error && i < count * 2; i++ )
+				error = read_string( self, &p, end, &atts[ i ] );
+			if ( !error )
+			{
+				atts[ count * 2 ] = NULL;
+				stack[ stack_size++ ] = name;
+				if ( handler->start_element )
+					handler->start_element( context, name, count ? atts : NULL );
+			}
+			break;
+		}
+		case mltb_op_text:
+		{
+			const xmlChar *s;
+			error = read_string( self, &p, end, &s );
+			if ( !error && handler->characters )
+				handler->characters( context, s, strlen( (const char*) s ) );
+			break;
+		}
+		case mltb_op_int:
+		{
+			uint32_t value;
+			error = read_varint( &p, end, &value );
+			if ( !error && handler->integer )
+				handler->integer( context, (int) ( ( value >> 1 ) ^ -( value & 1 ) ) );
+			break;
+		}
+		case mltb_op_end:
+			if ( stack_size == 0 )
+				error = 1;
+			else if ( handler->end_element )
+				handler->end_element( context, stack[ --stack_size ] );
+			else
+				--stack_size;
+			break;
+		default:
+			error = 1;
+			break;
+		}
+	}
+	if ( stack_size != 0 )
+		error = 1;
+	if ( error )
+		mlt_log_error( NULL, "[producer_xml] malformed binary document\n" );
+
+	free( stack );
+	free( atts );
+	return error;
+}
+
+/** Release a reader and unmap its document.
+ *
+ * \param self a reader
+ */
+
+void mltb_reader_close( mltb_reader self )
+{
+	if ( self )
+	{
+#ifndef WIN32
+		if ( self->is_mapped )
+			munmap( self->data, self->size );
+		else
+#endif
+		free( self->data );
+		free( self->strings );
+		free( self );
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * xml_binary.h -- compact binary encoding of the MLT XML document model
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef XML_BINARY_H
+#define XML_BINARY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libxml/tree.h>
+
+/* File layout (all fixed width fields are little endian):
+
+   header      "MLTB", version, string count, string table offset,
+               string data offset, string data size, node offset, node size
+   offsets     uint32 offset of every string within the string data
+   strings     NUL terminated UTF-8 strings, each stored once
+   nodes       a stream of opcodes; indices and integers are varints
+
+   The node stream mirrors the element tree produced by consumer_xml so that
+   producer_xml can build the service network with its existing handlers.
+*/
+
+#define MLTB_MAGIC "MLTB"
+#define MLTB_VERSION 1
+#define MLTB_HEADER_SIZE 32
+
+typedef enum
+{
+	mltb_op_start = 1,  /**< element: name, attribute count, name/value pairs */
+	mltb_op_text,       /**< character data: string index */
+	mltb_op_int,        /**< character data stored as a zigzag varint */
+	mltb_op_end         /**< close the current element */
+}
+mltb_opcode;
+
+/** Callbacks invoked while walking a binary document. */
+
+typedef struct
+{
+	void ( *start_element )( void *context, const xmlChar *name, const xmlChar **atts );
+	void ( *end_element )( void *context, const xmlChar *name );
+	void ( *characters )( void *context, const xmlChar *ch, int len );
+	void ( *integer )( void *context, int value );
+}
+mltb_handler;
+
+typedef struct mltb_reader_s *mltb_reader;
+
+extern int mltb_encode( xmlDocPtr doc, uint8_t **buffer, size_t *size );
+extern mltb_reader mltb_reader_open( const char *filename );
+extern int mltb_reader_parse( mltb_reader self, mltb_handler *handler, void *context );
+extern void mltb_reader_close( mltb_reader self );
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with consumer library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <QString>
+#include <QtTest>
+
+#include <mlt++/Mlt.h>
+using namespace Mlt;
+
+extern "C" {
+#include <framework/mlt.h>
+}
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// The clip is clock16pal.pgm shaken by these offsets, one per frame.
+static const int shake[][2] = {
+    { 0, 0 }, { 3, -2 }, { -4, 1 }, { 2, 5 }, { -1, -3 },
+    { 5, 2 }, { -3, -4 }, { 1, 3 }, { 4, -1 }, { -2, 2 }
+};
+static const int clip_length = sizeof( shake ) / sizeof( shake[0] );
+
+static QByteArray luma;
+static int luma_width = 0;
+static int luma_height = 0;
+
+/** Load the 16 bit PGM as 8 bit luma.
+*/
+
+static bool load_luma( const char *filename )
+{
+    FILE *file = fopen( filename, "rb" );
+    int maxval = 0;
+    bool ok = file && fscanf( file, "P5 %d %d %d", &luma_width, &luma_height, &maxval ) == 3
+        && fgetc( file ) != EOF && maxval > 255;
+    if ( ok )
+    {
+        luma.resize( luma_width * luma_height );
+        for ( int i = 0; ok && i < luma.size(); i++ )
+        {
+            int high = fgetc( file );
+            int low = fgetc( file );
+            ok = low != EOF;
+            luma[i] = char( ( high << 8 | low ) * 255 / maxval );
+        }
+    }
+    if ( file )
+        fclose( file );
+    return ok;
+}
+
+static int clip_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int )
+{
+    int position = mlt_frame_original_position( frame ) % clip_length;
+    int size = luma_width * luma_height * 2;
+    uint8_t *p = (uint8_t*) mlt_pool_alloc( size );
+
+    *buffer = p;
+    *format = mlt_image_yuv422;
+    *width = luma_width;
+    *height = luma_height;
+    for ( int y = 0; y < luma_height; y++ )
+    {
+        int sy = qBound( 0, y + shake[position][1], luma_height - 1 );
+        for ( int x = 0; x < luma_width; x++ )
+        {
+            int sx = qBound( 0, x + shake[position][0], luma_width - 1 );
+            // The clock wipe is smooth, so add a texture that moves with it
+            int texture = ( sx * 7 ^ sy * 13 ) & 31;
+            *p++ = uint8_t( 16 + ( uchar( luma[ sy * luma_width + sx ] ) * 192 >> 8 ) + texture );
+            *p++ = 128;
+        }
+    }
+    mlt_frame_set_image( frame, *buffer, size, mlt_pool_release );
+    return 0;
+}
+
+static int clip_get_frame( mlt_producer producer, mlt_frame_ptr frame, int )
+{
+    *frame = mlt_frame_init( MLT_PRODUCER_SERVICE( producer ) );
+    mlt_frame_set_position( *frame, mlt_producer_position( producer ) );
+    mlt_properties_set_int( MLT_FRAME_PROPERTIES( *frame ), "progressive", 1 );
+    mlt_frame_push_get_image( *frame, clip_get_image );
+    mlt_producer_prepare_next( producer );
+    return 0;
+}
+
+static void clip_close( mlt_producer producer )
+{
+    producer->close = NULL;
+    mlt_producer_close( producer );
+    free( producer );
+}
+
+class TestVideostab: public QObject
+{
+    Q_OBJECT
+
+public:
+    TestVideostab()
+    {
+        Factory::init();
+    }
+
+private:
+    /** Analyze the clip and return the serialised transforms.
+    */
+
+    QString analyze( const char *simd, int threads )
+    {
+        Profile profile( "dv_pal" );
+        mlt_producer producer = (mlt_producer) calloc( 1, sizeof( struct mlt_producer_s ) );
+        mlt_producer_init( producer, NULL );
+        producer->get_frame = clip_get_frame;
+        producer->close = (mlt_destructor) clip_close;
+        producer->close_object = producer;
+        mlt_properties_set_data( MLT_PRODUCER_PROPERTIES( producer ), "_profile", profile.get_profile(), 0, NULL, NULL );
+        mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "length", clip_length );
+        mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "out", clip_length - 1 );
+
+        qputenv( "MLT_VIDEOSTAB_SIMD", simd );
+        Filter filter( profile, "videostab2" );
+        filter.set( "threads", threads );
+        filter.set( "in", 0 );
+        filter.set( "out", clip_length - 1 );
+        mlt_producer_attach( producer, filter.get_filter() );
+
+        for ( int i = 0; i < clip_length; i++ )
+        {
+            mlt_frame frame = NULL;
+            mlt_image_format format = mlt_image_yuv422;
+            int width = luma_width;
+            int height = luma_height;
+            uint8_t *image = NULL;
+
+            mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), &frame, 0 );
+            mlt_frame_get_image( frame, &image, &format, &width, &height, 0 );
+            mlt_frame_close( frame );
+        }
+        QString vectors = QString::fromLatin1( filter.get( "vectors" ) );
+
+        mlt_producer_close( producer );
+        qunsetenv( "MLT_VIDEOSTAB_SIMD" );
+        return vectors;
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QVERIFY( load_luma( SRCDIR "clock16pal.pgm" ) );
+    }
+
+    void TransformsDoNotDependOnThreadsOrInstructionSet()
+    {
+        Profile profile( "dv_pal" );
+        Filter probe( profile, "videostab2" );
+        if ( !probe.is_valid() )
+#if QT_VERSION >= 0x050000
+            QSKIP( "videostab2 is not available" );
+#else
+            QSKIP( "videostab2 is not available", SkipAll );
+#endif
+
+        QString expected = analyze( "2", 1 );
+        QVERIFY( !expected.isEmpty() );
+        // The clip is shaken, so some transform must not be zero
+        QVERIFY( expected.contains( QRegExp( "[1-9]" ) ) );
+
+        QCOMPARE( analyze( "2", 3 ), expected );
+        QCOMPARE( analyze( "1", 1 ), expected );
+        QCOMPARE( analyze( "1", 3 ), expected );
+        QCOMPARE( analyze( "0", 1 ), expected );
+        QCOMPARE( analyze( "0", 3 ), expected );
+    }
+};
+
+QTEST_APPLESS_MAIN(TestVideostab)
+
+#include "test_videostab.moc"
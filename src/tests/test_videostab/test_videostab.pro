@@ -0,0 +1,3 @@
+include(../common.pri)
+TARGET = test_videostab
+SOURCES += test_videostab.cpp
@@ -1,3 +1,4 @@
 TEMPLATE = subdirs
 SUBDIRS = test_properties \
-    test_repository
+    test_repository \
+    test_videostab